@@ -2,12 +2,34 @@
 #define EXTERNAL_SORT_H
 
 #include <stdint.h>
+#include <string.h>
 #include "file/ion_file.h"
 
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
+/* Key types for key_type in external_sort_t. Used by MinSort which orders keys without compare_fcn. */
+#define SORT_KEY_TYPE_NONE      -1      /* Keys are ordered only by compare_fcn */
+#define SORT_KEY_TYPE_INT       0       /* Signed integer of key_size 1, 2, 4 or 8 bytes */
+#define SORT_KEY_TYPE_UINT      1       /* Unsigned integer of key_size 1, 2, 4 or 8 bytes */
+#define SORT_KEY_TYPE_FLOAT     2       /* float (key_size 4) or double (key_size 8) */
+
+/* Aggregates for aggregate in external_sort_t. Records with equal keys are combined into one record (see sort_aggregate.h). */
+#define SORT_AGGREGATE_NONE     0
+#define SORT_AGGREGATE_DISTINCT 1       /* First record of each key */
+#define SORT_AGGREGATE_COUNT    2       /* Number of records of each key */
+#define SORT_AGGREGATE_SUM      3
+#define SORT_AGGREGATE_MIN      4
+#define SORT_AGGREGATE_MAX      5
+
+/* Page codecs for codec in external_sort_t. Keys of temporary run and merge pages are encoded (see sort_codec.h). */
+#define SORT_CODEC_NONE         0
+#define SORT_CODEC_DELTA        1       /* Difference from previous normalized key as a varint */
+#define SORT_CODEC_RLE          2       /* Key stored once for each run of equal keys */
+#define SORT_CODEC_DICT         3       /* One byte code of each key into a dictionary of up to 256 keys at end of page */
+#define SORT_CODEC_SLOTTED      4       /* Variable length records (see length_fcn) packed at end of page with an offset array */
+
 typedef struct {
     uint16_t	key_size;
     uint16_t	value_size;
@@ -17,8 +39,36 @@ typedef struct {
     uint16_t    num_values_last_page;
     int8_t      headerSize;
     int8_t      (*compare_fcn)(void *a, void *b);
+    int8_t      key_type;               /* One of SORT_KEY_TYPE_* */
+    uint16_t    key_offset;             /* Offset of key from start of record */
+    int8_t      aggregate;              /* One of SORT_AGGREGATE_* */
+    uint16_t    aggregate_offset;       /* Offset of int32_t value field of COUNT, SUM, MIN and MAX. Must not overlap key. */
+    int8_t      codec;                  /* One of SORT_CODEC_*. Output of the sort is not encoded unless it is SORT_CODEC_SLOTTED. */
+    uint16_t    (*length_fcn)(void *record);    /* Bytes used by a variable length record (at most record_size) for SORT_CODEC_SLOTTED */
 } external_sort_t;
 
+/* Sort phases tracked in metrics_phase_t */
+#define METRICS_PHASE_RUN_GENERATION        0
+#define METRICS_PHASE_MERGE_PASS            1
+#define METRICS_PHASE_MINSORT_INIT          2
+#define METRICS_PHASE_MINSORT_OUTPUT        3
+#define METRICS_PHASE_MINSORT_SUBLIST_INIT  4
+#define METRICS_PHASE_MINSORT_SUBLIST_OUTPUT 5
+#define METRICS_PHASE_TAG_GATHER            6
+
+typedef struct {
+    int8_t   type;                  /* One of METRICS_PHASE_* */
+    int16_t  number;                /* Pass number for merge passes, otherwise 0 */
+    uint32_t num_reads;
+    uint32_t num_writes;
+    uint32_t num_memcpys;
+    uint32_t num_compar;
+    uint32_t bytes_read;            /* Derived as num_reads * page_size, not measured */
+    uint32_t bytes_written;         /* Derived as num_writes * page_size, not measured */
+    uint32_t bytes_copied;          /* Derived as num_memcpys * record_size, not measured. Some copies move more than one record. */
+    uint32_t time_us;
+} metrics_phase_t;
+
 typedef struct {
     uint32_t num_reads;
     uint32_t num_writes;
@@ -49,6 +99,19 @@ typedef struct {
 #define    BLOCK_ID_OFFSET      0
 #define    BLOCK_COUNT_OFFSET   sizeof(uint32_t)
 
+/**
+@brief      Initializes sort settings to defaults. Must be called before the other fields are set, as later fields of
+                external_sort_t are not set by every caller. All fields are zeroed, except key_type is SORT_KEY_TYPE_NONE,
+                aggregate is SORT_AGGREGATE_NONE, codec is SORT_CODEC_NONE and headerSize is BLOCK_HEADER_SIZE.
+*/
+static inline void external_sort_init(external_sort_t *es)
+{
+    memset(es, 0, sizeof(external_sort_t));
+    es->key_type    = SORT_KEY_TYPE_NONE;
+    es->aggregate   = SORT_AGGREGATE_NONE;
+    es->codec       = SORT_CODEC_NONE;
+    es->headerSize  = BLOCK_HEADER_SIZE;
+}
 
 #if defined(__cplusplus)
 }
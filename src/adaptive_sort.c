@@ -49,6 +49,17 @@
 #include "flash_minsort_sublist.h"
 #include "in_memory_sort.h"
 #include "no_output_heap.h"
+#include "device_profile.h"
+#include "sort_metrics.h"
+#include "run_directory.h"
+#include "sort_key.h"
+#include "sort_aggregate.h"
+#include "sort_codec.h"
+#include "sort_estimate.h"
+#include "run_pipeline.h"
+#include "sort_parallel.h"
+#include "file/ion_file_async.h"
+#include "file/ion_file_map.h"
 
 /*
   #define     DEBUG         1
@@ -57,6 +68,12 @@
   #define     DEBUG_HEAP    0
 */
 
+/* Output blocks of a merge that may be written by I/O threads while merging continues (see ion_file_async.h) */
+#define MERGE_WRITE_BEHIND_PAGES    4
+
+/* Input pages sampled to estimate the distinct keys of the input before run generation (see optimisticMinSort()) */
+#define OPTIMISTIC_SAMPLE_PAGES     16
+
 /**
  * Prints the contents of the heap. Used for debugging.
  */
@@ -87,1195 +104,3252 @@ void print_heap(char* buffer,  int32_t heap_start_offset, int heap_size, int lis
 }
 
 /**
-@brief      Adaptive sort combining no output buffer sort and MinSort that dynamically determines best sorting
-                algorithm based on input distribution. Uses replacement selection.
-@param      iterator
-                Row iterator for reading input rows
-@param      iteratorState
-                Structure stores state of iterator (file info etc.)
-@param      tupleBuffer
-                Pre-allocated space to store one tuple (row) of input being sorted
-@param      outputFile
-                Already opened file to store sorting output (and in-progress temporary results)
-@param      buffer
-                Pre-allocated space used by algorithm during sorting
-@param      bufferSizeInBlocks
-                Size of buffer in blocks
-@param      es
-                Sorting state info (block size, record size, etc.)
-@param      resultFilePtr
-                Offset within output file of first output record
-@param      metric
-                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
-@param      compareFn
-                Record comparison function for record ordering
-@param      runGenOnly
-                True if generate sorted runs but not whole merge process
-@param      writeToReadRatio
-                Write time divided by read time multiplied by 10. If ratio is 2.5 
-                (writes over twice as expensive) then value is 25.
-*/
-int adaptive_sort(
-    int     (*iterator)(void *state, void* buffer, external_sort_t *es),
-    void    *iteratorState,
-	void    *tupleBuffer,
-    ION_FILE *outputFile,		
-	char    *buffer,        
-	int     bufferSizeInBlocks,
-	external_sort_t *es,
-	long    *resultFilePtr,
-	metrics_t *metric,
-    int8_t  (*compareFn)(void *a, void *b),
-    int8_t  runGenOnly,
-    int8_t  writeToReadRatio
-)
+ * Tournament (winner) tree over the current records of a merge run. Leaf 2*i is the current input record (record1) of block i.
+ * Leaf 2*i+1 is the top of the heap of output block records (record2) stored in block i. Each node stores its winning leaf or -1.
+ * Ties are won by the lower leaf, so the output block's own input record is preferred.
+ */
+typedef struct {
+    int32_t         *node;          /* Nodes 1 to size-1 are internal. Leaves are stored at size to 2*size-1. */
+    int32_t         size;           /* Number of leaves (power of 2). Two per block, so exceeds int16_t for large buffers. */
+    int16_t         numBlocks;      /* Number of sublists in the run */
+    char            *buffer;
+    int32_t         *record1;
+    int32_t         *record2;
+    external_sort_t *es;
+    metrics_t       *metric;
+} merge_tree_t;
+
+/**
+ * Returns buffer offset of the record of a merge tree leaf or -1 if the leaf has no record.
+ */
+static int32_t mergeTreeRecord(merge_tree_t *tree, int32_t leaf)
 {
-    printf("Adaptive sort with Replacement Selection for Run Generation\n");
-	unsigned long startMillis = millis();
-    
-    int16_t     tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;	
-	long        lastWritePos = 0;	
-	int16_t     i, status;
-	int32_t     numSublist=0;
-	void        *addr;
-    int32_t     numShiftOutOutput = 0, numShiftIntoOutput = 0, numShiftOtherBlock = 0;     
+    int32_t blk = leaf / 2;
+
+    if (blk >= tree->numBlocks)
+        return -1;
+    if ((leaf & 1) == 0)
+        return tree->record1[blk];
+    if (blk == OUTPUT_BLOCK_ID || tree->record2[blk] == -1)
+        return -1;                  /* record2 of the output block is the output position not a list */
+    return blk * tree->es->page_size + tree->es->headerSize;
+}
 
-    /* Distribution estimation variables */
-    int16_t avgDistinct = 0;                /* Average # of distinct values per run. Multiplied by 10 so can do integer rather than float operations. */
-                                            /* Note: Could be int8_t as larger than 255 is above cutoff for using MinSort. */
-    uint8_t  numDistinctInRun = 0;          /* Number of distinct values in current run */
+/**
+ * Returns the winning leaf of two leaves.
+ */
+static int32_t mergeTreeMatch(merge_tree_t *tree, int32_t a, int32_t b)
+{
+    if (a == -1)
+        return b;
+    if (b == -1)
+        return a;
+
+    tree->metric->num_compar++;
+    if (0 < tree->es->compare_fcn(tree->buffer + mergeTreeRecord(tree, a), tree->buffer + mergeTreeRecord(tree, b)))
+        return b;
+    return a;
+}
 
- 
-    int optimistic = 0;
-    if (optimistic)
-    {   // Do FLASH MinSort init first
-        printf("*Optimistic*\n");    
-  
-        MinSortState ms;
-        ms.buffer = buffer;
-        ms.iteratorState = iteratorState;
-        ms.memoryAvailable = bufferSizeInBlocks*es->page_size;
-        ms.num_records = ((file_iterator_state_t*) iteratorState)->totalRecords;
-    
-        init_MinSort(&ms, es, metric);
-        avgDistinct = 16;        
-
-        printf("Adaptive calculation.\n");
-        int16_t numPasses = (int) ceil(log(es->num_pages/bufferSizeInBlocks)/log(bufferSizeInBlocks));
-        int32_t nobSortCost = numPasses *(10 + writeToReadRatio)/10;    
-        printf("NOB sort cost. # runs: %d", numSublist);
-        printf(" # passes: %d cost: %d\n", numPasses, nobSortCost);
-        printf("MinSort cost. Num sublists: %d ", numSublist);
-        printf(" Avg. distinct/sublist: %d\n", avgDistinct/10);
-
-        if (avgDistinct < nobSortCost)
-        // if (0)
-        {
-            printf("Performing MinSort Optimistic\n");            
-            int16_t count = 0;  
-            int32_t blockIndex = 0;
-            int16_t values_per_page = (es->page_size - es->headerSize) / es->record_size;
-            char* outputBuffer = buffer+es->page_size;    
-
-            // Write 
-            while (next_MinSort(&ms, es, (char*) (outputBuffer+count*es->record_size+es->headerSize), metric) != NULL)
-            {         
-                // Store record in block (already done during call to next)        
-                // buf = (void *)(outputBuffer+count*es->record_size+es->headerSize);        
-                count++;
-
-                if (count == values_per_page)
-                {   // Write block
-                    *((int32_t *) outputBuffer) = blockIndex;                             /* Block index */
-                    *((int16_t *) (outputBuffer + BLOCK_COUNT_OFFSET)) = count;            /* Block record count */
-                    count=0;
-                    // Force seek to end of file as outputFile is also inputFile and have been reading it
-                    fseek(outputFile, 0, SEEK_END);
-                    if (0 == fwrite(outputBuffer, es->page_size, 1, outputFile))
-                        return 9;
-
-                #ifdef DEBUG_OUTPUT
-                    printf("Wrote output block. Block index: %d\n", blockIndex);
-                    for (int k = 0; k < values_per_page; k++)
-                    {
-                        test_record_t *buf = (void *)(outputBuffer + es->headerSize + k * es->record_size);
-                        printf("%d: Output Record: %d\n", k, buf->key);
-                    }
-                #endif
-                    blockIndex++;
-                }       
-            }
+/**
+ * Initializes all leaves and plays all matches.
+ */
+static void mergeTreeBuild(merge_tree_t *tree)
+{
+    int32_t n;
 
-            if (count > 0)
-            {
-                // Write last block   
-                fseek(outputFile, 0, SEEK_END);     
-                *((int32_t *) buffer) = blockIndex;                             /* Block index */
-                *((int16_t *)(buffer + BLOCK_COUNT_OFFSET)) = count;            /* Block record count */
-                count=0;
-                blockIndex++;                 
-                if (0 == fwrite(buffer, es->page_size, 1, outputFile))
-                    return 9;
-            }
-             
-            close_MinSort(&ms, es);  
+    for (n = 0; n < tree->size; n++)
+        tree->node[tree->size + n] = mergeTreeRecord(tree, n) == -1 ? -1 : n;
 
-            resultFilePtr = 0;
-            return 0;
-        }
-        else
-        {
-            optimistic = 0;
-            /* Position at start of file */
-            fseek(((file_iterator_state_t*) iteratorState)->file, 0, SEEK_SET);
-        }        
+    for (n = tree->size - 1; n >= 1; n--)
+        tree->node[n] = mergeTreeMatch(tree, tree->node[2*n], tree->node[2*n+1]);
+}
+
+/**
+ * Updates the leaves of two blocks after their records change and replays the matches on their paths to the root.
+ * Paths are replayed one level at a time as they may share matches.
+ */
+static void mergeTreeUpdate(merge_tree_t *tree, int16_t blkA, int16_t blkB)
+{
+    int32_t a = (tree->size + 2*blkA) / 2;
+    int32_t b = (tree->size + 2*blkB) / 2;
+
+    tree->node[2*a]   = mergeTreeRecord(tree, 2*blkA) == -1 ? -1 : 2*(int32_t) blkA;
+    tree->node[2*a+1] = mergeTreeRecord(tree, 2*blkA+1) == -1 ? -1 : 2*(int32_t) blkA+1;
+    tree->node[2*b]   = mergeTreeRecord(tree, 2*blkB) == -1 ? -1 : 2*(int32_t) blkB;
+    tree->node[2*b+1] = mergeTreeRecord(tree, 2*blkB+1) == -1 ? -1 : 2*(int32_t) blkB+1;
+
+    for ( ; a >= 1; a /= 2, b /= 2)
+    {
+        tree->node[a] = mergeTreeMatch(tree, tree->node[2*a], tree->node[2*a+1]);
+        if (b != a)
+            tree->node[b] = mergeTreeMatch(tree, tree->node[2*b], tree->node[2*b+1]);
     }
-    
-    if (!optimistic)
-    {                                                    
-        /* Replacement selection variables */
-        int32_t recordsRead     = 0;    
-        int32_t heapSize        = 0;
-        int32_t heapStartOffset = bufferSizeInBlocks*es->page_size - es->record_size;
-        int32_t listSize        = 0; 
-
-        /* -----Replacement Selection----- */	
-        /* Fill all blocks other than first (input block) with tuples */
-        /* TODO: This algorithm may be improved for M=2 case by using merging and alternating output block rather than using a heap.
-                Unclear if any optimization for M=3 and above that is worth the added complexity.
-                Idea: Sort each block and then perform merge like merge code. Advanced the output block every output which would work great for sorted input.
-        */
-        /* Current algorithm sorts output block every time new input block is read. Merges with heap in the remaining blocks.
-        Uses a list for any records that would be in next sublist (since they are less than the maximum record key output so far).
-        This list starts in block 1. Output/input block is block 0. Heap is reverse heap with top of heap being end of buffer.
-        */ 
-        addr = buffer+es->page_size;
-        for (i = 0; i < (bufferSizeInBlocks-1)*tuplesPerPage; i++)
-        {
-            status=iterator(iteratorState, addr, es);
-            if (status == 0)
-                break;
-            recordsRead++;
-            addr += es->record_size;
-        }
+}
+
+/**
+ * State of one merge of up to bufferSizeInBlocks sublists into one output sublist (a run of a merge pass).
+ * Merges of a pass are independent, so each worker of a parallel pass has its own state and buffer.
+ */
+typedef struct {
+    char            *buffer;            /* bufferSizeInBlocks pages */
+    void            *tupleBuffer;       /* One record */
+    int16_t         bufferSizeInBlocks;
+    int8_t          ownsBuffer;         /* 1 if buffer and tupleBuffer were allocated by mergeRunInit() */
+    int8_t          positional;         /* 1 if file is shared with other workers (see sort_parallel_read()) */
+    ION_FILE        *file;
+    external_sort_t *es;
+    metrics_t       *metric;
+    long            *sublsFilePtr;      /* location of current block of each sublist in file */
+    int32_t         *sublsBlkPos;       /* current block of sublist being read */
+    int32_t         *blocksInSublist;
+    int32_t         *record1;           /* current record of each buffered block. (byte offset from start of buffer) */
+    int32_t         *record2;           /* current output block record stored in each buffered block (byte offset from start of buffer) */
+    merge_tree_t    tree;               /* selects smallest record of all sublists */
+    int32_t         numSublists;        /* Sublists merged by this run */
+    long            writePos;           /* File offset of next output block */
+    int32_t         blocksOut;          /* Blocks written by this run */
+    int32_t         recordsOut;         /* Records written by this run */
+    int32_t         limit;              /* Run stops after writing this many records. 0 merges all records. */
+    char            *firstKey;          /* Key prefix (key_offset+key_size bytes) of first record written */
+    uint32_t        numShiftIntoOutput;
+    uint32_t        numShiftOutOutput;
+    uint32_t        numShiftOtherBlock;
+    ion_file_async_t    *io;            /* I/O threads (see ion_file_async.h). NULL for synchronous I/O. */
+    ion_file_request_t  *readRequests;  /* First block read of each sublist */
+    ion_file_request_t  writeRequests[MERGE_WRITE_BEHIND_PAGES];
+    char            *writePages;        /* Copies of output blocks being written */
+    int16_t         writeNext;          /* Write page used by next output block */
+    ion_file_map_t  *map;               /* Mapped file (see ion_file_map.h). Blocks are copied from the mapping if mapped. */
+    char            *aggPage;           /* With an aggregate, output records are combined into this page before it is written. Otherwise NULL. */
+    int16_t         aggCount;           /* Records in aggPage */
+    sort_codec_writer_t writer;         /* With a page codec, output records are encoded into the writer page (see sort_codec.h) */
+    sort_codec_cursor_t *cursors;       /* With a page codec, decoding position in the buffered block of each sublist. Otherwise NULL. */
+    char            *codecRecords;      /* With a page codec, current record of each sublist. Merge tree records are in this array. */
+} merge_run_t;
 
-        metric->num_reads += bufferSizeInBlocks-1;
-        metric->num_runs++;
+/**
+ * Waits for all output blocks being written. Returns 0 if success, 9 if write error.
+ */
+static int8_t mergeWriteWait(merge_run_t *mr)
+{
+    int8_t  err = 0;
+    int16_t i;
 
-        /* Build heap from tuples in filled blocks */    
-        for(i = 0; i < recordsRead; i++)
-        {        
-            addr -= es->record_size;
-            memcpy(tupleBuffer, addr, es->record_size);
-            metric->num_memcpys++;
-            shiftUp_rev(buffer + heapStartOffset, tupleBuffer, heapSize, es, metric);
-            heapSize++;
-        }
+    if (mr->io == NULL)
+        return 0;
+    for (i = 0; i < MERGE_WRITE_BEHIND_PAGES; i++)
+    {
+        if (ion_file_async_wait(mr->io, &mr->writeRequests[i]) != 0)
+            err = 9;
+        mr->writeRequests[i].status = 0;
+    }
+    return err;
+}
 
-        void *lastOutputKey;                            /* Pointer to memory storing value of last key output */
-        int8_t haveOutputKey       = 0;
-        int32_t sublistSize        = 0;                 /* size in blocks */
-        int32_t outputCount        = 0;                 /* number of values in output block */
-        int32_t recordsLeft        = recordsRead;       /* number of records in buffer */
-        void *heapVal, *inputVal;
+/**
+ * Frees memory allocated by mergeRunInit().
+ */
+static void mergeRunFree(merge_run_t *mr)
+{
+    mergeWriteWait(mr);
+    free(mr->readRequests); free(mr->writePages);
+    free(mr->sublsFilePtr); free(mr->sublsBlkPos); free(mr->blocksInSublist); free(mr->record1); free(mr->record2); free(mr->tree.node); free(mr->firstKey); free(mr->aggPage);
+    free(mr->cursors); free(mr->codecRecords); sort_codec_writer_free(&mr->writer);
+    if (mr->ownsBuffer)
+    {
+        free(mr->buffer);
+        free(mr->tupleBuffer);
+    }
+}
 
-        while (recordsLeft != 0)
-        {
-            /* Read next block and sort it */
-            recordsRead = 0;
-            addr = buffer+es->headerSize;
-            for(i = 0; i < tuplesPerPage; i++)
-            {
-                status=iterator(iteratorState, addr, es);
-                if (status == 0)
-                    break;
-                recordsRead++;
-                addr += es->record_size;
-            }
-            recordsLeft += recordsRead;
+/**
+ * Allocates merge state. If buffer is NULL, a buffer and tuple buffer are allocated for the worker. Returns 0 if success, 8 if out of memory.
+ */
+static int8_t mergeRunInit(merge_run_t *mr, char *buffer, void *tupleBuffer, int16_t bufferSizeInBlocks, ION_FILE *file, external_sort_t *es, metrics_t *metric)
+{
+    mr->ownsBuffer          = buffer == NULL;
+    mr->buffer              = buffer == NULL ? (char*) malloc((size_t) bufferSizeInBlocks * es->page_size) : buffer;
+    mr->tupleBuffer         = buffer == NULL ? malloc(es->record_size) : tupleBuffer;
+    mr->bufferSizeInBlocks  = bufferSizeInBlocks;
+    mr->positional          = 0;
+    mr->file                = file;
+    mr->es                  = es;
+    mr->metric              = metric;
+    mr->sublsFilePtr        = (long*) malloc(sizeof(long) * bufferSizeInBlocks);
+    mr->sublsBlkPos         = (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);
+    mr->blocksInSublist     = (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);
+    mr->record1             = (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);
+    mr->record2             = (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);
+    mr->firstKey            = (char*) malloc(es->key_offset + es->key_size);
+    mr->tree.size = 1;
+    while (mr->tree.size < 2 * bufferSizeInBlocks)
+        mr->tree.size *= 2;
+    mr->tree.node           = (int32_t*) malloc(sizeof(int32_t) * 2 * mr->tree.size);
+    mr->tree.buffer         = mr->buffer;
+    mr->tree.record1        = mr->record1;
+    mr->tree.record2        = mr->record2;
+    mr->tree.es             = es;
+    mr->numShiftIntoOutput = mr->numShiftOutOutput = mr->numShiftOtherBlock = 0;
+    mr->limit               = 0;
+    mr->io                  = NULL;
+    mr->map                 = NULL;
+    mr->readRequests        = NULL;
+    mr->writePages          = NULL;
+    mr->aggPage             = es->aggregate == SORT_AGGREGATE_NONE ? NULL : (char*) malloc(es->page_size);
+    mr->aggCount            = 0;
+    mr->cursors             = NULL;
+    mr->codecRecords        = NULL;
+    mr->writer.page         = NULL;
+    mr->writer.first        = NULL;
+    if (es->codec != SORT_CODEC_NONE)
+    {   /* Encoded blocks are decoded a record at a time, so the current record of each sublist is merged from its own array */
+        mr->cursors         = (sort_codec_cursor_t*) malloc(sizeof(sort_codec_cursor_t) * bufferSizeInBlocks);
+        mr->codecRecords    = (char*) malloc((size_t) bufferSizeInBlocks * es->record_size);
+        mr->tree.buffer     = mr->codecRecords;
+        sort_codec_writer_init(&mr->writer, es);
+    }
 
-            #ifdef DEBUG_HEAP 
-                print_heap(buffer, heapStartOffset, heapSize, listSize, es); 
-            #endif
-            if (recordsRead > 1)
-            {
-                metric->num_reads += 1;        
-                in_memory_sort(buffer + es->headerSize, (uint32_t)recordsRead, es->record_size, es->compare_fcn, 1);
-            }       
-            else if (heapSize < tuplesPerPage)  /* May have enough records currently in heap to continue last block. TODO: Does this make sense? It will add to last run before starting new one.*/
-            {   /* Move everything in list in to heap */
-                for (listSize = listSize; listSize > 0; listSize--)
-                {
-                    shiftUp_rev(buffer + heapStartOffset, buffer + es->page_size + (listSize-1)*es->record_size, heapSize, es, metric);
-                    heapSize++;
-                }
+    if (mr->buffer == NULL || mr->tupleBuffer == NULL || mr->sublsFilePtr == NULL || mr->sublsBlkPos == NULL || mr->blocksInSublist == NULL
+        || mr->record1 == NULL || mr->record2 == NULL || mr->firstKey == NULL || mr->tree.node == NULL
+        || (es->aggregate != SORT_AGGREGATE_NONE && mr->aggPage == NULL)
+        || (es->codec != SORT_CODEC_NONE && (mr->cursors == NULL || mr->codecRecords == NULL || mr->writer.page == NULL)))
+    {
+        mergeRunFree(mr);
+        return 8;
+    }
+    return 0;
+}
 
-                /* If first value in heap is smaller than lastOutputValue then start new sublist, otherwise continue with previous one. */
-                heapVal = buffer+heapStartOffset;
-                if (es->compare_fcn(heapVal, lastOutputKey) < 0 )
-                {   /* Start new sublist */
-                    numSublist++;
+/**
+ * Uses I/O threads for the first block reads and write-behind of output blocks of a merge.
+ * Allocates MERGE_WRITE_BEHIND_PAGES pages in addition to the merge buffer. Returns 0 if success, 8 if out of memory.
+ */
+static int8_t mergeRunInitAsync(merge_run_t *mr, ion_file_async_t *io)
+{
+    int16_t i;
+
+    mr->readRequests    = (ion_file_request_t*) malloc(sizeof(ion_file_request_t) * mr->bufferSizeInBlocks);
+    mr->writePages      = (char*) malloc((size_t) MERGE_WRITE_BEHIND_PAGES * mr->es->page_size);
+    if (mr->readRequests == NULL || mr->writePages == NULL)
+    {
+        free(mr->readRequests); free(mr->writePages);
+        mr->readRequests = NULL; mr->writePages = NULL;
+        return 8;
+    }
+    for (i = 0; i < MERGE_WRITE_BEHIND_PAGES; i++)
+        mr->writeRequests[i].status = 0;
+    mr->writeNext   = 0;
+    mr->io          = io;
+    return 0;
+}
 
-                    /* Track number of distinct values per sublist */                
-                    avgDistinct = avgDistinct + (numDistinctInRun - avgDistinct/10)*10/numSublist;
-                    #ifdef DEBUG
-                        printf("Number of distinct values in sublist: %d Running average: %d\n",  numDistinctInRun, avgDistinct/10);
-                    #endif
-                    numDistinctInRun = 1;
+/**
+ * Reads a block of a sublist. Returns 0 if success, 10 if read error.
+ */
+static int8_t mergeReadBlock(merge_run_t *mr, long pos, char *dest)
+{
+    char *mapped = mr->map == NULL ? NULL : ion_file_map_page(mr->map, pos, mr->es->page_size);
 
-                    /* Restart building the sublist */
-                    outputCount = 0;
-                    haveOutputKey = 0;
-                    sublistSize = 0;                
-                    metric->num_runs++;
-                }
-            }
-            
-            /* Input/output block is block 0. Swap output records into it from heap if smaller than records currently there. */
-            for(i = 0; i < tuplesPerPage; i++)
-            {
-                if (recordsRead == 0)
-                {                   
-                    // Just copy over from heap
-                    memcpy(buffer + es->headerSize + i*es->record_size, buffer+heapStartOffset, es->record_size);   /* Heap into input/output block */                
-                    outputCount++;
-                    recordsLeft--;
+    if (mapped != NULL)
+    {   /* Merge changes blocks in place so a mapped block is copied rather than borrowed */
+        memcpy(dest, mapped, mr->es->page_size);
+        return 0;
+    }
+    if (mr->io != NULL)
+        return ion_file_async_read(mr->io, mr->file, pos, dest, mr->es->page_size);
+    if (mr->positional)
+        return sort_parallel_read(mr->file, pos, dest, mr->es->page_size);
+
+    fseek(mr->file, pos, SEEK_SET);
+    if (0 == fread(dest, (size_t)mr->es->page_size, 1, mr->file))
+        return 10;
+    return 0;
+}
 
-                    /* Restore heap */
-                    heapSize--;
-                    if(heapSize > 0)
-                        heapify_rev(buffer+heapStartOffset, buffer + heapStartOffset - heapSize*es->record_size, heapSize, es, metric);
-                    continue;
-                }            
+/**
+ * Writes a block holding numRecords records as the next block of the output sublist. first is the first record of the block.
+ * Returns 0 if success, 9 if write error.
+ */
+static int8_t mergeWritePage(merge_run_t *mr, char *block, int16_t numRecords, char *first)
+{
+    external_sort_t *es = mr->es;
 
-                heapVal = buffer+heapStartOffset;
-                inputVal = buffer+es->headerSize + i*es->record_size;          
+    /* Setup block header */
+    *((int32_t *) block) = mr->blocksOut;
+    *((int16_t *) (block + BLOCK_COUNT_OFFSET)) = numRecords;
 
-                if (haveOutputKey && (es->compare_fcn(heapVal, lastOutputKey) < 0 || 0 >= heapSize) && es->compare_fcn(inputVal, lastOutputKey) < 0)
-                {
-                    /* Start a new sublist (as cannot use heap value or input value) */
-                    numSublist++;
+    if (mr->io != NULL)
+    {   /* Write-behind: copy block to a free write page and keep merging while it is written */
+        ion_file_request_t *request = &mr->writeRequests[mr->writeNext];
+
+        if (ion_file_async_wait(mr->io, request) != 0)
+            return 9;
+        request->file       = mr->file;
+        request->offset     = mr->writePos;
+        request->buffer     = mr->writePages + mr->writeNext * es->page_size;
+        request->size       = es->page_size;
+        request->write      = 1;
+        request->callback   = NULL;
+        memcpy(request->buffer, block, es->page_size);
+        ion_file_async_submit(mr->io, request, 1);
+        mr->writeNext = (mr->writeNext + 1) % MERGE_WRITE_BEHIND_PAGES;
+    }
+    else if (mr->positional)
+    {
+        if (sort_parallel_write(mr->file, mr->writePos, block, es->page_size) != 0)
+            return 9;
+    }
+    else
+    {
+        fseek(mr->file, mr->writePos, SEEK_SET);
+        if (0 == fwrite(block, (size_t)es->page_size, 1, mr->file))
+            return 9;       /* Arduino prints 1st value nmemb times if nmemb != 1 */
+    }
+
+    if (mr->blocksOut == 0)
+        memcpy(mr->firstKey, first, es->key_offset + es->key_size);
+    mr->blocksOut++;
+    mr->recordsOut  += numRecords;
+    mr->writePos    += es->page_size;
+    mr->metric->num_writes++;
+
+    #ifdef DEBUG_OUTPUT
+    printf("Wrote output block: %d  # records: %d\n", *((int32_t *) block), numRecords);
+    for (int k=0; k < numRecords; k++)
+    {
+        test_record_t *buf = (void*) (block+es->headerSize+k*es->record_size);
+        printf("%d: Output Record: %d  Address: %p\n", k, buf->key, (void*) buf);
+    }
+    #endif
+    return 0;
+}
+
+/**
+ * Writes the output block (block 0) holding numRecords records. With an aggregate, its records are combined into the
+ * aggregate page, which is written each time it is full. Returns 0 if success, 9 if write error.
+ */
+static int8_t mergeWriteBlock(merge_run_t *mr, int16_t numRecords)
+{
+    external_sort_t *es = mr->es;
+    char            *block = mr->buffer + OUTPUT_BLOCK_ID * es->page_size;
+    int16_t         i;
+
+    if (mr->aggPage == NULL)
+        return mergeWritePage(mr, block, numRecords, block + es->headerSize);
+
+    for (i = 0; i < numRecords; i++)
+    {
+        char *record = block + es->headerSize + i * es->record_size;
+
+        mr->metric->num_compar++;
+        if (sort_aggregate_add(es, mr->aggPage, &mr->aggCount, record))
+            continue;
+        if (mergeWritePage(mr, mr->aggPage, mr->aggCount, mr->aggPage + es->headerSize) != 0)
+            return 9;
+        mr->aggCount = 0;
+        sort_aggregate_add(es, mr->aggPage, &mr->aggCount, record);
+    }
+    return 0;
+}
+
+/**
+ * Assigns the next mr->numSublists sublists of the previous pass output to a merge run.
+ * Sublists are taken from the back: ptrLastBlock is the end of the last unassigned sublist and dirRun its run directory index plus one.
+ * Both are updated. Returns 0 if success, 10 if read error.
+ */
+static int8_t mergeFindSublists(merge_run_t *mr, run_directory_t *inDir, int8_t useDir, int32_t *dirRun, long *ptrLastBlock, long lastMergeStart)
+{
+    char            *buffer = mr->buffer;
+    external_sort_t *es = mr->es;
+    metrics_t       *metric = mr->metric;
+    long            *sublsFilePtr = mr->sublsFilePtr;
+    int32_t         *sublsBlkPos = mr->sublsBlkPos;
+    int32_t         *blocksInSublist = mr->blocksInSublist;
+    int32_t         sublistsInRun = mr->numSublists;
+    char            *firstKey, *smallestKey = NULL;
+    int32_t         i;
+
+    /* 
+    Find first block of each sublist in the run.
+    The run directory recorded by run generation or the previous pass has the length and first key of every sublist,
+    so no I/O is needed. If it is not available (more sublists than the directory holds), the last block of each sublist 
+    is read to get its block id (the count of blocks in the sublist) and the walk continues backwards from its first block.
+    This code also makes sure the "smallest" sublist (by first key) is in output block (0) as this results in fewest swaps (especially for sorted input).
+    Without the directory the check is not perfect. It is comparing first record in last block of each sublist as that is the block that is read
+    when determining the starting point of the sublist. The first block is not read at this point. That happens later in the code.
+    */            
+    for (i = 0; i < sublistsInRun; i++) 
+    {
+        if (useDir)
+        {
+            (*dirRun)--;
+            blocksInSublist[i] = run_directory_blocks(inDir, *dirRun);
+            firstKey = run_directory_key(inDir, *dirRun);
+        }
+        else
+        {   /* Read last block of sublist into buffer */
+            if (mergeReadBlock(mr, *ptrLastBlock - es->page_size, &buffer[i * es->page_size]) != 0) 
+                return 10;     /* File read error */
+            metric->num_reads += 1;
+            blocksInSublist[i] = *(int32_t*) &buffer[i * es->page_size] + 1;       /* Retrieve block id (indexed from 0 - hence +1) to compute count of blocks in sublist */
+            firstKey = buffer + i * es->page_size + es->headerSize;
+        }
+        *ptrLastBlock = *ptrLastBlock - blocksInSublist[i]*es->page_size;
 
-                    /* Track number of distinct values per sublist */                
-                    avgDistinct = avgDistinct + (numDistinctInRun - avgDistinct/10)*10/numSublist;
+        if (*ptrLastBlock < lastMergeStart) 
+        {   /* Invalid block offset */
+            sublsFilePtr[i] = -1;
+            sublsBlkPos[i] = -1;
+        }
+        else 
+        {
+            sublsFilePtr[i] = *ptrLastBlock;
+            sublsBlkPos[i] = 0;
+
+            if (i == 0)
+                smallestKey = firstKey;
+            else if (useDir || es->codec == SORT_CODEC_NONE)
+            {   /* Records of an encoded block are not in place, so only keys of the directory are compared */
+                /* Always keep the smallest entry in index 0 */                       
+                metric->num_compar++;
+
+                if (es->compare_fcn(smallestKey, firstKey) > 0)
+                {                            
                     #ifdef DEBUG
-                        printf("Number of distinct values in sublist: %d Running average: %d\n",  numDistinctInRun, avgDistinct/10);
+                    printf("Swapping in buffer 0. Current key: %d  New key: %d\n", *(int32_t*) smallestKey, *(int32_t*) firstKey);
                     #endif
-                    numDistinctInRun = 1;
+                    smallestKey = firstKey;
+                    sublsBlkPos[i] = sublsFilePtr[0];           /* Note: Using subls_blk_pos[i] as a temp variable during swap */
+                    sublsFilePtr[0] = sublsFilePtr[i];
+                    sublsFilePtr[i] = sublsBlkPos[i];
+                    sublsBlkPos[i] = blocksInSublist[i];
+                    blocksInSublist[i] = blocksInSublist[0];
+                    blocksInSublist[0] = sublsBlkPos[i];
+                    sublsBlkPos[i] = 0;                         /* Reset variable back to 0 */                                                   
+                }
+            }
+        }
+    }
+    return 0;
+}
 
-                    /* Convert unsorted list into heap */
-                    for (listSize = listSize; listSize > 0; listSize--)
-                    {
-                        shiftUp_rev(buffer + heapStartOffset, buffer + es->page_size + (listSize-1)*es->record_size, heapSize, es, metric);
-                        heapSize++;
-                    }
+/**
+ * Reads the first block of each sublist assigned by mergeFindSublists() into the buffer. Returns 0 if success, 10 if read error.
+ */
+static int8_t mergeReadFirstBlocks(merge_run_t *mr)
+{
+    char            *buffer = mr->buffer;
+    external_sort_t *es = mr->es;
+    metrics_t       *metric = mr->metric;
+    long            *sublsFilePtr = mr->sublsFilePtr;
+    int32_t         sublistsInRun = mr->numSublists;
+    int32_t         i;
+
+    if (mr->io != NULL)
+    {   /* Read all first blocks as one batch so the reads are in flight together */
+        int8_t err = 0;
+
+        for (i = 0; i < sublistsInRun; i++)
+        {
+            mr->readRequests[i].file        = mr->file;
+            mr->readRequests[i].offset      = sublsFilePtr[i];
+            mr->readRequests[i].buffer      = &buffer[i * es->page_size];
+            mr->readRequests[i].size        = es->page_size;
+            mr->readRequests[i].write       = 0;
+            mr->readRequests[i].callback    = NULL;
+        }
+        ion_file_async_submit(mr->io, mr->readRequests, (int16_t) sublistsInRun);
+        for (i = 0; i < sublistsInRun; i++)
+        {
+            if (ion_file_async_wait(mr->io, &mr->readRequests[i]) != 0)
+                err = 10;
+        }
+        if (err != 0)
+            return err;
+    }
+    for (i = 0; i < sublistsInRun; i++) 
+    {
+        if (mr->io == NULL && mergeReadBlock(mr, sublsFilePtr[i], &buffer[i * es->page_size]) != 0) 
+            return 10;
+        metric->num_reads += 1;                
+
+        #ifdef DEBUG_READ
+        test_record_t *firstRec = (void*) buffer + i * es->page_size + es->headerSize;
+        test_record_t *lastRec = (void*) buffer + i * es->page_size + es->headerSize + (*((int16_t *) (buffer + i * es->page_size + BLOCK_COUNT_OFFSET))-1) * es->record_size;               
+        printf("Read Sublist: %d Block: %d NumRec: %d First key: %d Last key: %d\n", i, (int32_t) *(buffer + i * es->page_size), 
+                        *((int16_t *) (buffer + i * es->page_size + BLOCK_COUNT_OFFSET)), firstRec->key, lastRec->key);
+        #endif
+    }
+    return 0;
+}
 
-                    /* Restart building the sublist */
-                    outputCount = 0;
-                    haveOutputKey = 0;
-                    sublistSize = 0;
-                    recordsLeft += i;
-                    i=-1;
-                    metric->num_runs++;
-                    continue;
+/**
+ * Returns the number of records in a list of block blk that starts after the block header and ends with the record at
+ * offset last from the start of the buffer. The header is subtracted as it may be larger than a record.
+ */
+static inline int16_t listRecords(int32_t last, int32_t blk, external_sort_t *es)
+{
+    return (int16_t) ((last - blk * es->page_size - es->headerSize) / es->record_size + 1);
+}
+
+/**
+ * Merges the sublists assigned by mergeFindSublists() into one sublist written starting at mr->writePos.
+ * Returns 0 if success, 8 if no block has space for a moved record, 9 if write error, 10 if read error.
+ */
+static int8_t mergeRun(merge_run_t *mr)
+{
+    char            *buffer = mr->buffer;
+    void            *tupleBuffer = mr->tupleBuffer;
+    external_sort_t *es = mr->es;
+    metrics_t       *metric = mr->metric;
+    long            *sublsFilePtr = mr->sublsFilePtr;
+    int32_t         *sublsBlkPos = mr->sublsBlkPos;
+    int32_t         *blocksInSublist = mr->blocksInSublist;
+    int32_t         *record1 = mr->record1;
+    int32_t         *record2 = mr->record2;
+    merge_tree_t    *tree = &mr->tree;
+    int32_t         sublistsInRun = mr->numSublists;
+    int16_t         tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+    int8_t  rebuildTree             = 1;    /* 1 if records of blocks other than result and output block have changed */
+    /* Output block uses record2 to store position of last to-output record inserted */    
+    int32_t resultRecOffset         = -1;   /* Number of records from start of buffer to the next record to output */
+    int32_t resultBlock	            = -1;   /* Block containing next record to output */
+    char	isRecord2			    = 0;    /* 1 if result record is from the output block but stored in a non outputblock */
+    int32_t offset                  = 0;    /* Offset of current record being compared with current smallest record */
+    int16_t heapSizeRecords;                /* Number of records in heap */      
+    char    outputIsEmpty           = 0;    /* Flag indicating if there are still more input records in sublist in output block */    
+    int16_t numTransferThisPass;
+    int32_t blk                     = -1;
+    int16_t space                   = 0;
+    int32_t outputCursor;
+    int32_t destBlk;
+    int32_t i;
+
+    mr->blocksOut   = 0;
+    mr->recordsOut  = 0;
+    mr->aggCount    = 0;
+    tree->metric    = metric;
+
+    /* Load in first blocks into buffer */            
+    if (mergeReadFirstBlocks(mr) != 0)
+        return 10;      /* Read error */
+    for (i = 0; i < sublistsInRun; i++) 
+    {   /* Initialize record1 to start of each block and record2 to empty */
+        record1[i] = i * es->page_size + es->headerSize;
+        record2[i] = -1;
+    }          
+    tree->numBlocks = sublistsInRun;
+    rebuildTree = 1;
+
+    /* Perform the run */
+    while (1) 
+    {
+        /* Later records cannot be among the smallest limit records */
+        if (mr->limit > 0 && mr->recordsOut + (record2[OUTPUT_BLOCK_ID] == -1 ? 0 : (record2[OUTPUT_BLOCK_ID] - es->headerSize) / es->record_size + 1) >= mr->limit)
+            break;
+
+        /* Find next smallest tuple by replaying matches of blocks changed by last output record */
+        if (rebuildTree)
+            mergeTreeBuild(tree);
+        else
+            mergeTreeUpdate(tree, resultBlock, OUTPUT_BLOCK_ID);
+        rebuildTree = 0;
+
+        resultBlock = -1;
+        if (tree->node[1] != -1)
+        {
+            resultRecOffset = mergeTreeRecord(tree, tree->node[1]);
+            resultBlock     = tree->node[1] / 2;
+            isRecord2       = tree->node[1] & 1;
+        }
+
+        if (resultBlock == -1) break; /* No records left to merge */
+
+        /* increment record2 to next position of output block. record2 is where the next record to output will be placed */
+        if (record2[OUTPUT_BLOCK_ID] == -1) 
+            record2[OUTPUT_BLOCK_ID] = BUFFER_OUTPUT_BLOCK_START_RECORD_OFFSET;                
+        else 
+            record2[OUTPUT_BLOCK_ID] += es->record_size;                
+                                                
+        #ifdef DEBUG
+        test_record_t *buf = (void*) buffer + resultRecOffset;
+        printf("Smallest Record: %d  From list: %d\n", buf->key, resultBlock);                        
+        printf("List status: 0: (%d, %d) 1: (%d, %d) 2: (%d, %d) ResultList: %d\n", record1[0],record2[0],
+                                        record1[1],record2[1],record1[2],record2[2], resultBlock);
+
+        if (buf->key == 27391)
+        {
+            /* Output all block contents */
+            for (int l=0; l < 2; l++)
+            {   
+                printf("Current  block: %d  # records: %d\n", l, tuplesPerPage);
+                for (int k=0; k < tuplesPerPage; k++)
+                {
+                    test_record_t *buf = (void*) (buffer+es->headerSize+k*es->record_size+l*es->page_size);
+                    printf("%d: Record: %d  Address: %p\n", k, buf->key, (void*) (buffer+es->headerSize+k*es->record_size+l*es->page_size));                     
+                }
+            }
+            printf("HERE\n");
+        }
+        #endif
+        
+        /* Add smallest tuple to output position in buffer (may already be in output buffer) */
+        if (resultBlock != OUTPUT_BLOCK_ID) 
+        {
+            if ((record1[OUTPUT_BLOCK_ID] == record2[OUTPUT_BLOCK_ID]) && (record1[OUTPUT_BLOCK_ID] != -1)) 
+            {   /* Output block does not have space for the result record */
+                /* Optimization (removed):  
+                Determine if space in block holding smallest record to store output block.
+                If so, can directly insert into the heap in that block rather than using a temporary tuple.
+                Note: Can extend this to check if space in other blocks not just the one with smallest record.
+                This would be more comparisons but would save record copies.
+                Savings on memory copies between 1 and 2% was determined not to be worth extra calculations.
+                This is for records of 16 bytes. May be different for larger records.                           
+                */                       
+
+                /* Move output block's record into temporary buffer */
+                metric->num_memcpys++;
+                memcpy(tupleBuffer, buffer + record1[OUTPUT_BLOCK_ID], (size_t)es->record_size);
+                mr->numShiftOutOutput++;                                                                                                                                           
+                #ifdef DEBUG
+                test_record_t *buf = (void*) (buffer + record1[OUTPUT_BLOCK_ID]);
+                printf("Output record moved to list %d Key: %d\n", resultBlock, buf->key);
+                #endif                                
+                /* Move result record into output block (record1[output_block]==record2[output_block]) */
+                metric->num_memcpys++;
+                memcpy(buffer + record2[OUTPUT_BLOCK_ID], buffer + resultRecOffset, (size_t)es->record_size);
+                                        
+                /* Move displaced output block record out of the temp buffer and into the output list (list2) of the result record's block */
+                if (isRecord2 == 0) 
+                {   /* Smallest record is not originally from output block */
+                    /* Result is from record1 list. Insert into heap of output records for block. */                                                      
+                    if (record2[resultBlock] == -1) 
+                        record2[resultBlock] = resultBlock * es->page_size + es->headerSize;						
+                    else 
+                        record2[resultBlock] += es->record_size;							
+                    heapSizeRecords = listRecords(record2[resultBlock], resultBlock, es);                            
+                    /* Buffered output record is in tuple_buffer */
+                    shiftUp(buffer + resultBlock*es->page_size + es->headerSize, tupleBuffer, heapSizeRecords -1, es, metric);                            
                 }
+                else 
+                {
+                    /* Result is from record2 list. Insert the displaced output value into record2 list */
+                    heapSizeRecords = listRecords(record2[resultBlock], resultBlock, es);
 
-                if ((es->compare_fcn(heapVal, inputVal) < 0 && (haveOutputKey==0 || es->compare_fcn(heapVal, lastOutputKey) >= 0))
-                || (haveOutputKey && es->compare_fcn(inputVal, lastOutputKey) < 0))
+                    /* Output record to be inserted is already stored in the tuple_buffer */
+                    heapify(buffer + resultBlock*es->page_size + es->headerSize, tupleBuffer, heapSizeRecords, es, metric);
+                }                      
+                
+                /* Displaced the output block's current record. Increment to next output block record. */
+                record1[OUTPUT_BLOCK_ID] += es->record_size;
+                if (record1[OUTPUT_BLOCK_ID] >= OUTPUT_BLOCK_ID * es->page_size + (*((int16_t *) (buffer + OUTPUT_BLOCK_ID * es->page_size + BLOCK_COUNT_OFFSET))) * es->record_size + es->headerSize) 
+                // if (record1[OUTPUT_BLOCK_ID] >= OUTPUT_BLOCK_ID * es->page_size + tuplesPerPage*es->record_size + es->headerSize)                        
+                    record1[OUTPUT_BLOCK_ID] = -1;      						
+            }
+            else 
+            {   /* Output block already has an empty slot for the result value. Only need to move result value into result list of output block. */
+                /* Move result record into output block */
+                metric->num_memcpys++;
+                memcpy(buffer + record2[OUTPUT_BLOCK_ID], buffer + resultRecOffset, (size_t)es->record_size);
+
+                if (isRecord2 == 1) 
                 {
-                    /* Use the heap value if heap value is less than input value AND heap value is not larger than last output key OR input value is invalid */
-                    memcpy(tupleBuffer, buffer + es->headerSize + i*es->record_size, es->record_size);              /* Input tuple into buffer */
-                    memcpy(buffer + es->headerSize + i*es->record_size, buffer+heapStartOffset, es->record_size);   /* Heap into input/output block */                
-                    /* Determine if the value is different than the last one to estimate num. distinct values */
-                    if (numDistinctInRun < 255 && haveOutputKey)
-                    {   metric->num_compar++;
-                        if (es->compare_fcn(lastOutputKey, inputVal) < 0)
-                            numDistinctInRun++;
-                    }
-                    lastOutputKey = inputVal;             
+                    /* is_record2: result value came from list2 of result block */
+                    record2[resultBlock] -= es->record_size;
 
-                    /* Find somewhere to put the input value */
-                    if(es->compare_fcn(tupleBuffer, lastOutputKey) < 0)
-                    {
-                        /* Restore heap */
-                        heapSize--;
-                        if(heapSize > 0)
-                            heapify_rev(buffer+heapStartOffset, buffer + heapStartOffset - heapSize*es->record_size, heapSize, es, metric);
-
-                        /* val into list (unsorted) */
-                        memcpy(buffer+es->page_size + listSize*es->record_size, tupleBuffer, es->record_size);
-                        listSize++;
-                    }
+                    if (record2[resultBlock] < resultBlock * es->page_size + es->headerSize) 
+                        record2[resultBlock] = -1;                            
                     else
                     {
-                        /* val into heap */
-                        heapify_rev(buffer + heapStartOffset, tupleBuffer, heapSize, es, metric);
-                    }
-                }
-                else
-                {
-                    /* Determine if the value is different than the last one to estimate num. distinct values */
-                    metric->num_compar++;
-                    if (numDistinctInRun < 255 && haveOutputKey)
-                    {   metric->num_compar++;
-                        if (es->compare_fcn(lastOutputKey, inputVal) < 0)
-                            numDistinctInRun++;
-                    }              
-
-                    /* Use the newly read value. don't move it, it's in proper place. */                
-                    lastOutputKey = inputVal;       /* Update the last key output */                 
+                        /* Move last value to front of heap */
+                        heapSizeRecords = listRecords(record2[resultBlock], resultBlock, es);
+                        heapify(buffer + resultBlock*es->page_size + es->headerSize, buffer + record2[resultBlock]+es->record_size, heapSizeRecords, es, metric);
+                    }                           
                 }
-                haveOutputKey = 1;
-                outputCount++;
-                recordsLeft--;
-                #ifdef DEBUG_HEAP 
-                    print_heap(buffer, heapStartOffset, heapSize, listSize, es); 
-                #endif
-                if(recordsLeft == 0) break;
             }
 
-            /* Setup header */
-            *((int32_t *) buffer) = sublistSize;
-            *((int16_t *) (buffer + BLOCK_COUNT_OFFSET)) = (int8_t)outputCount;        
-            memcpy(tupleBuffer, buffer+(outputCount-1)*es->record_size+es->headerSize, es->key_size);
-            lastOutputKey = tupleBuffer;
-            /* Store the last key output temporarily in tuple buffer as once write out then read new block it would be gone */
-
-            /* Write the output block */
-            if (0 == fwrite(buffer, es->page_size, 1, outputFile)) 
+            /* increment to next position of block that smallest value was read from */
+            if (isRecord2 == 0) 
+                record1[resultBlock] += es->record_size;                    
+        } /* end if smallestblock != output block */
+        else 
+        {
+            /* The smallest value is already in output block, move it from record1 to record2 */
+            if (record2[resultBlock] != record1[resultBlock]) 
             {
-                free(lastOutputKey);
-                return 9;
+                metric->num_memcpys++;
+                memcpy(buffer + record2[resultBlock], buffer + record1[resultBlock], (size_t)es->record_size);
             }
+
+            record1[resultBlock] += es->record_size;
+        }	/* end of adding smallest tuple to appropriate block */
+
+        /* Determine if block with smallest value has any more records in it */                
+        if (record1[resultBlock] >= resultBlock * es->page_size + (*((int16_t *) (buffer + resultBlock * es->page_size + BLOCK_COUNT_OFFSET))) * es->record_size + es->headerSize) 
+            record1[resultBlock] = -1;				
+
+        /* Output block is full, write it out */
+        if (record2[OUTPUT_BLOCK_ID] >= OUTPUT_BLOCK_ID * es->page_size + es->headerSize + (tuplesPerPage-1)*es->record_size) 
+        {                
+            if (mergeWriteBlock(mr, tuplesPerPage) != 0) 
+                return 9;   /* File write error */
+            record2[OUTPUT_BLOCK_ID]	= -1;
             #ifdef DEBUG_OUTPUT
-            printf("Wrote block. Sublist: %d ", numSublist);
-            printf(" Idx: %d\n", sublistSize);
-            printf("Offset: %lu\n",  ftell(outputFile)-es->page_size);
+            printf("Wrote output block: %d  # records: %d\n", *((int32_t *) buffer), tuplesPerPage);
             for (int k=0; k < tuplesPerPage; k++)
             {
                 test_record_t *buf = (void*) (buffer+es->headerSize+k*es->record_size);
-                printf("%d: Output Record: %d\n", k, buf->key);
+                printf("%d: Output Record: %d  Address: %p\n", k, buf->key, (void*) (buffer+es->headerSize+k*es->record_size));                     
             }
-            #endif         
-            
-            metric->num_writes +=1;
-            sublistSize++;
-            outputCount = 0;       
-        } /* while records left */
-    
-        // free(lastOutputKey);
-        numSublist = metric->num_runs;
-        unsigned long endMillis = millis();
-        metric->genTime = ((double) (endMillis - startMillis));
-        printf("Gen time: %d\n", metric->genTime);
-
-        /* Track number of distinct values per sublist */       
-        avgDistinct = avgDistinct + (numDistinctInRun - avgDistinct/10)*10/numSublist;  
-        printf("Final number of distinct values in sublist: %d Average: %d\n",  numDistinctInRun, avgDistinct);
-        numDistinctInRun = 0;
-    } // end pessmistic   
-
-    if (numSublist == 1)
-	{	/* No merge phase necessary */
-		*resultFilePtr = 0;
-		return 0;
-	}
-    if (runGenOnly)
-        return 0;
-
-    lastWritePos = ftell(outputFile);
+            #endif                    
+        }                
 
-    /* Make decision to use either no output buffer sort or MinSort */
-   // if (avgDistinct/10 < nobSortCost)    
-    int bufferSizeBytes = (bufferSizeInBlocks-1) * es->page_size;   /* One of the buffers is used for a read buffer */
-    int8_t sublistVersionPossible =  (numSublist <= bufferSizeBytes / (SORT_KEY_SIZE+4));  /* +4 is size of file offset pointer. Each record has a key and file offset. */
-
-    if (sublistVersionPossible && avgDistinct > tuplesPerPage)
-        avgDistinct  = tuplesPerPage * 10;
-
-    printf("Adaptive calculation.\n");
-    int16_t numPasses = (int) ceil(log(numSublist)/log(bufferSizeInBlocks));
-    int32_t nobSortCost = numPasses *(10 + writeToReadRatio)/10;    
-    printf("NOB sort cost. # runs: %d", numSublist);
-    printf(" # passes: %d cost: %d\n", numPasses, nobSortCost);
-    printf("MinSort cost. Num sublists: %d ", numSublist);
-    printf(" Avg. distinct/sublist: %d\n", avgDistinct/10);
-
-    if (avgDistinct/10 < nobSortCost)        
-    // if (0)
-    {   /* MinSort */             
-        if (sublistVersionPossible)         
-        {   /* If can buffer smallest value per sublist, can use a better performing version */
-            printf("Performing MinSort with sorted sublists\n");
-            ((file_iterator_state_t*) iteratorState)->file = outputFile;
-            *resultFilePtr = 0;
-            flash_minsort_sublist(iteratorState, tupleBuffer, outputFile, buffer, bufferSizeBytes, es, resultFilePtr, metric, compareFn, numSublist);
-            *resultFilePtr = lastWritePos;
-        }
-        else
-        {   /* Do not have enough space to index a value per sublist, so use regular version (assumes data is not sorted in each region) */
-            printf("Performing MinSort\n");
-            ((file_iterator_state_t*) iteratorState)->file = outputFile;
-            flash_minsort(iteratorState, tupleBuffer, outputFile, buffer, bufferSizeBytes, es, resultFilePtr, metric, compareFn);
-            *resultFilePtr = lastWritePos;
-        }                    
-    }
-    else
-    {   /* No output buffer sort merge */        
-        printf("Performing NOBSort\n");
-        /* ----- Merge phase: recursively combine M sublists ----- */
-        long	mergeSOW;                                                                           /* start of write */
-        int32_t currentBlockId          = 0;
-        long	lastMergeStart		    = 0;	                                                    /* start of read */
-        long	lastMergeEnd            = lastWritePos;
-
-        long	*sublsFilePtr		    = (long*) malloc(sizeof(long) * bufferSizeInBlocks);        /* location of current record in file */
-        int32_t *sublsBlkPos		    = (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);  /* current block of sublist being read */
-        int32_t *blocksInSublist		= (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);
-
-        int32_t *record1				= (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);  /* current record of each buffered block. (byte offset from start of buffer) */
-        int32_t *record2				= (int32_t*) malloc(sizeof(int32_t) * bufferSizeInBlocks);  /* current output block record stored in each buffered block (byte offset from start of buffer) */
-        /* Output block uses record2 to store position of last to-output record inserted */    
-        int16_t run                     = 0;
-        int8_t  passNumber              = 1;
-        int32_t numRuns;
-        int32_t resultRecOffset         = -1;   /* Number of records from start of buffer to the next record to output */
-        int32_t resultBlock	            = -1;   /* Block containing next record to output */
-        char	isRecord2			    = 0;    /* 1 if result record is from the output block but stored in a non outputblock */
-        int32_t offset                  = 0;    /* Offset of current record being compared with current smallest record */
-        int16_t heapSizeRecords;                /* Number of records in heap */      
-        char    outputIsEmpty           = 0;    /* Flag indicating if there are still more input records in sublist in output block */    
-        int16_t numTransferThisPass;
-        int32_t blk                     = -1;
-        int16_t space                   = 0;
-        int16_t outputCursor;
-        int8_t  destBlk;
-
-        if (record2 == NULL) 
+        /* Read in the next block of a sublist if buffered block is depleted (non-output block) */
+        if ((record1[resultBlock] == -1) && (sublsBlkPos[resultBlock] != -1) && (resultBlock != OUTPUT_BLOCK_ID)) 
         {
-            /* Verify all memory has been allocated successfully */
-            free(record1); free(sublsBlkPos); free(sublsFilePtr); free(blocksInSublist);
-            return 9;
-        }
-        int32_t other = 0;
-        while (numSublist > 1) 
-        {         
-                         
-            if (numSublist >= 32 && numSublist <= 64)// && avgDistinct/10 < 32)
-            {   // Switch to MinSort to finish off
-                printf("Finishing sort with MinSort with sorted sublists\n");
-                printf("Elapsed time: %lu\n", millis()-startMillis);
-                ((file_iterator_state_t*) iteratorState)->file = outputFile;    
-                // *resultFilePtr = lastMergeStart;   
-                fflush(outputFile);
-                *resultFilePtr = lastMergeStart;           
-                flash_minsort_sublist(iteratorState, tupleBuffer, outputFile, buffer, bufferSizeBytes, es, resultFilePtr, metric, compareFn, numSublist);
-                lastMergeStart = lastMergeEnd;
-                *resultFilePtr = lastMergeStart;               
-                printf("Elapsed time: %lu\n", millis()-startMillis);
-                break;
-            }
-
-            if (passNumber % 3 == 0)
-            { 
-                lastWritePos = 0;          /* Wrap-around in memory space/file after every 3rd pass */                
+            /* check if we are finished with that sublist */
+            if (sublsBlkPos[resultBlock] >= blocksInSublist[resultBlock] - 1) 
+            {
+                sublsBlkPos[resultBlock]	 = -1;	/* sublist is spent */
+                record1[resultBlock]	     = -1;
             }
+            else 
+            {
+                /* not finished with sublist read in next block of sublist */
+                rebuildTree = 1;        /* Output records are moved to other blocks */
+                sublsBlkPos[resultBlock]++;
+                sublsFilePtr[resultBlock] += es->page_size;
+
+                /* put any output records in this block into other blocks */
+                int32_t originPtr	= resultBlock * es->page_size + es->headerSize;
+                int32_t destBlk	= OUTPUT_BLOCK_ID;
+                int16_t numTransfer = (record2[resultBlock]-originPtr) / es->record_size + 1;
+
+                /* while there are still records left to move */
+                while (record2[resultBlock] != -1 && originPtr <= record2[resultBlock]) 
+                {
+                    /* Find a block with space to store the record. Space is free slots between the record2 and record1 lists. */
+                    blk         = -1;
+                    while (blk == -1 && destBlk < sublistsInRun) 
+                    {                                                               
+                        if (record1[destBlk] != -1) 
+                            space = record1[destBlk] - (destBlk * es->page_size + es->headerSize);                       
+                        else 
+                            space = es->page_size - es->headerSize;                                
 
-            printf("Pass number: %u  Comparisons: %lu  MemCopies: %lu  TransferIn: %lu  TransferOut: %lu TransferOther: %lu Other: %lu\n", passNumber, metric->num_compar, metric->num_memcpys, numShiftIntoOutput, numShiftOutOutput, numShiftOtherBlock, other);
-            printf("Elapsed time: %lu\n", millis()-startMillis);
-            passNumber++;
+                        if (record2[destBlk] != -1) 
+                            space -= (record2[destBlk] - destBlk * es->page_size + es->record_size - es->headerSize);                                
 
-            /* perform a merge */
-            mergeSOW = lastWritePos;
+                        space = space / es->record_size;
 
-            numRuns	= (numSublist + bufferSizeInBlocks -1)/bufferSizeInBlocks; /* Equivalent to CEIL(numSublist/bufferSizeInBlocks) */
+                        if (space >= 1)
+                            blk = destBlk;
+                        else 
+                            destBlk++;
 
-            /* perform runs */
-            long ptrLastBlock = lastMergeEnd;
-            for (run = 0; run < numRuns; run++) 
-            {            
-                /* Set up the run */
-                int32_t sublistsInRun = bufferSizeInBlocks;
-                if (numSublist < bufferSizeInBlocks) 
-                    sublistsInRun = numSublist;
-                numSublist -= sublistsInRun;        
-
-                currentBlockId = 0;
-                /* 
-                Find first block of each run.
-                Note: Reading from file to find block offsets of each sublist is ONLY required as not storing these offsets in memory.
-                This code also makes sure the "smallest" sublist is in output block (0) as this results in fewest swaps (especially for sorted input).
-                Since sublists are scanned from back of previous run, it alternates on each pass what sublist read will be smaller. 
-                On first pass, the last sublist read will be smaller. On second pass, first sublist read will be smaller.
-                Considered doing for loop like this instead: for (i = sublists_in_run-1; i >=0 ; i--) 
-                However due to alternating nature of when smallest sublist will be, stuck with current implementation and checked every sublist read.
-                Note that check is not perfect. It is actually comparing first record in last block of each sublist as that is the block that is read
-                when determining the starting point of the sublist. The first block is not read at this point. That happens later in the code.
-                TODO: Consider checking last record instead as they may be better for the random case when sublists are not the same size in blocks.
-                */            
-                for (i = 0; i < sublistsInRun; i++) 
-                {
-                    /* Read last block of sublist into buffer */
-                    fseek(outputFile, ptrLastBlock - es->page_size, SEEK_SET);
-                    if (0 == fread(&buffer[i * es->page_size], (size_t)es->page_size, 1, outputFile)) 
-                    {   /* File read error */
-                        free(record1); free(record2); free(sublsBlkPos); free(sublsFilePtr);
-                        return 10;
+                        if (resultBlock == destBlk) 
+                            destBlk++;                     /* Go to next destination block if currently at the original block that had smallest value */
                     }
-                    metric->num_reads += 1;
-                    ptrLastBlock = ptrLastBlock - (*(int32_t*) &buffer[i * es->page_size])*es->page_size - es->page_size;
-                    blocksInSublist[i] = *(int32_t*) &buffer[i * es->page_size] + 1;       /* Retrieve block id (indexed from 0 - hence +1) to compute count of blocks in sublist */
-
-                    if (ptrLastBlock < lastMergeStart) 
-                    {   /* Invalid block offset */
-                        sublsFilePtr[i] = -1;
-                        sublsBlkPos[i] = -1;
-                    }
-                    else 
-                    {
-                        sublsFilePtr[i] = ptrLastBlock;
-                        sublsBlkPos[i] = 0;
-
-                        if (i != 0)
-                        {
-                            /* Always keep the smallest entry in index 0 */                       
-                            metric->num_compar++;
-
-                            if (es->compare_fcn(buffer + es->headerSize, buffer + i * es->page_size + es->headerSize) > 0)
-                            {                            
+                    if (blk == -1)
+                        return 8;       /* No block has space for the record */
+
+                    numTransferThisPass = space;
+                    if (space > numTransfer)
+                        numTransferThisPass = numTransfer;
+                    numTransfer -= numTransferThisPass;
+
+                    if (destBlk == OUTPUT_BLOCK_ID) 
+                    {   /* Returning tuples back to output block */                         
+                        /* Position record1 input pointer at first space for record to be inserted */                               
+                        if (record1[destBlk] == -1)
+                        {   /* There are no input records in sublist 0 currently in the block */
+                            record1[destBlk] = destBlk * es->page_size + (tuplesPerPage - numTransferThisPass) * es->record_size + es->headerSize;
+                            /* Records are placed at end of block so block count must cover whole block (last block of sublist may be partial) */
+                            *((int16_t *) (buffer + destBlk * es->page_size + BLOCK_COUNT_OFFSET)) = tuplesPerPage;
+                            offset = record1[destBlk];                                  /* Remember first insert location */
+                            for (i=0; i <  numTransferThisPass; i++)
+                            {
                                 #ifdef DEBUG
-                                test_record_t *buffer0Rec = (void*) buffer + es->headerSize;
-                                test_record_t *currentRec = (void*) buffer + i * es->page_size + es->headerSize;
-                                printf("Swapping in buffer 0. Current key: %d  New key: %d\n", buffer0Rec->key, currentRec->key);
+                                test_record_t *buf = (void*) (buffer + originPtr);
+                                printf("Empty output block case. Moved output record back from list %d Key: %d\n", resultBlock, buf->key);
                                 #endif
-                                sublsBlkPos[i] = sublsFilePtr[0];           /* Note: Using subls_blk_pos[i] as a temp variable during swap */
-                                sublsFilePtr[0] = sublsFilePtr[i];
-                                sublsFilePtr[i] = sublsBlkPos[i];
-                                sublsBlkPos[i] = blocksInSublist[i];
-                                blocksInSublist[i] = blocksInSublist[0];
-                                blocksInSublist[0] = sublsBlkPos[i];
-                                sublsBlkPos[i] = 0;                         /* Reset variable back to 0 */                                                   
-                            }
+                                mr->numShiftIntoOutput++;
+                                /* Get top value from heap */
+                                metric->num_memcpys++;
+                                memcpy(buffer + record1[destBlk], buffer + originPtr, (size_t)es->record_size);
+
+                                /* Fix heap */
+                                heapSizeRecords = listRecords(record2[resultBlock], resultBlock, es);
+                                heapSizeRecords--;              /* Subtract 1 as going to use last record in heap as insert record */
+                    
+                                heapify(buffer + resultBlock*es->page_size + es->headerSize, (void*) (buffer+record2[resultBlock]), heapSizeRecords, es, metric);                                    
+                                record1[destBlk] += es->record_size;
+                                record2[resultBlock] -= es->record_size;
+                            }   
+                            record1[destBlk] = offset;         /* Set pointer to first insert location */                                                                                                     
                         }
-                    }
-                }
+                        else
+                        {
+                            for (i=0; i <  numTransferThisPass; i++)
+                            {
+                                record1[destBlk] = record1[destBlk] - es->record_size;
+                                #ifdef DEBUG
+                                test_record_t *buf = (void*) (buffer + originPtr);
+                                printf("Moved output record back from list %d Key: %d\n", resultBlock, buf->key);
+                                #endif
+                                mr->numShiftIntoOutput++;
 
-                /* Load in first blocks into buffer */            
-                for (i = 0; i < sublistsInRun; i++) 
-                {
-                    fseek(outputFile, sublsFilePtr[i], SEEK_SET);
-                    if (0 == fread(&buffer[i * es->page_size], (size_t)es->page_size, 1, outputFile)) 
-                    {   /* Read error */
-                        free(record1); free(record2); free(sublsBlkPos); free(sublsFilePtr);
-                        return 10;
-                    }
-                    metric->num_reads += 1;                
+                                /* insertion sort type insert */
+                                int32_t insert_ptr = record1[destBlk];
+                                int16_t blockCount = *((int16_t *) (buffer + destBlk * es->page_size + BLOCK_COUNT_OFFSET));
+                                while (insert_ptr < destBlk * es->page_size + es->headerSize + (blockCount-1)*es->record_size) 
+                                {
+                                    metric->num_compar++;
+                                    #ifdef DEBUG
+                                    test_record_t *buf = (void*) (buffer + insert_ptr + es->record_size);
+                                    printf("Compare with list %d Key: %d\n", resultBlock, buf->key);
+                                    #endif
+                                    if ( 0 < es->compare_fcn(buffer + originPtr, buffer + insert_ptr + es->record_size)) 
+                                    {
+                                        /* shift next_val down */
+                                        metric->num_memcpys++;
+                                        memcpy(buffer + insert_ptr, buffer + insert_ptr + es->record_size, (size_t)es->record_size);
+                                    }
+                                    else 
+                                        break;                                    
 
-                    #ifdef DEBUG_READ
-                    test_record_t *firstRec = (void*) buffer + i * es->page_size + es->headerSize;
-                    test_record_t *lastRec = (void*) buffer + i * es->page_size + es->headerSize + (*((int16_t *) (buffer + i * es->page_size + BLOCK_COUNT_OFFSET))-1) * es->record_size;               
-                    printf("Read Sublist: %d Block: %d NumRec: %d First key: %d Last key: %d\n", i, (int32_t) *(buffer + i * es->page_size), 
-                                    *((int16_t *) (buffer + i * es->page_size + BLOCK_COUNT_OFFSET)), firstRec->key, lastRec->key);
-                    #endif
-                    /* Initialize record1 to start of each block and record2 to empty */
-                    record1[i] = i * es->page_size + es->headerSize;
-                    record2[i] = -1;
-                }          
+                                    insert_ptr += es->record_size;
+                                }
 
-                /* Perform the run */
-                while (1) 
-                {
-                    /* Find next smallest tuple */                
-                    resultBlock	                    = -1;   
-                    isRecord2			            = 0;                  
-                
-                    /* Find first sublist with valid data record */
-                    i = 0;
-                    while (record1[i] == -1 && i < sublistsInRun)
-                        i++;
-
-                    if (i < sublistsInRun)
-                    {   /* Found a sublist with a valid data record */
-                        resultRecOffset = record1[i];
-                        resultBlock = i;
-                        i++;
+                                metric->num_memcpys++;
+                                memcpy(buffer + insert_ptr, buffer + originPtr, (size_t)es->record_size); 
+                                originPtr += es->record_size;  
+                            }                            
+                        }
                     }
-
-                    /* Go through rest of sublists looking for a smaller record */
-                    for ( ; i < sublistsInRun; i++) 
+                    else 
                     {
-                        if (record1[i] == -1) 
-                            continue;                       /* Sublist has no more records */
-
-                        offset = record1[i];
+                        for (i=0; i <  numTransferThisPass; i++)
+                        {
+                            /* insert into a non output block, put into the record2 list of the block */
+                            if (record2[destBlk] == -1) 
+                                record2[destBlk] = destBlk * es->page_size + es->headerSize;	/* no other record2 values */
+                            else 
+                                record2[destBlk] += es->record_size;	                        /* other record2 values */
+                        
+                            #ifdef DEBUG
+                            test_record_t *buf = (void*) (buffer + originPtr);
+                            printf("Moved output record to list %d Key: %d\n", destBlk, buf->key);                              
+                            #endif
+                            mr->numShiftOtherBlock++;
+                        
+                            /* Insert at end of heap */
+                            int32_t heapSizeRecords = listRecords(record2[destBlk], destBlk, es); 
+                            shiftUp(buffer + destBlk*es->page_size + es->headerSize, buffer + originPtr, heapSizeRecords -1, es, metric);    
 
-                        metric->num_compar++;
-                        if (0 < es->compare_fcn(buffer + resultRecOffset, buffer + offset)) 
-                        {   /* Record is smaller than current smallest record */
-                            resultRecOffset = offset;
-                            resultBlock = i;
+                            originPtr += es->record_size;                              
                         }
-                    }
+                    }                          
+                }
 
-                    /* Find smallest value of last block, it might be scattered amongst other blocks 
-                    Note: For loop code is assuming OUTPUT_BLOCK_ID is 0. Otherwise, i should start at 0 not 1 and must check if i == OUTPUT_BLOCK_ID.
-                    */
-                    for (i = 1; i < sublistsInRun; i++) 
-                    {                
-                        if (record2[i] == -1) 
-                            continue;       /* This block has no records from the output block */
-
-                        /* Current value is at start of block in list 2 */
-                        offset = i * es->page_size + es->headerSize;
-
-                        if (resultBlock != -1)
-                            metric->num_compar++;
-
-                        if ((resultBlock == -1) || 0 < es->compare_fcn(buffer + resultRecOffset, buffer + offset)) 
-                        {   /* Record is smaller than current smallest record */
-                            resultRecOffset     = offset;
-                            resultBlock	        = i;
-                            isRecord2			= 1;
-                        }
-                    }
+                /* read in next block */
+                if (mergeReadBlock(mr, sublsFilePtr[resultBlock], buffer + resultBlock * es->page_size) != 0) 
+                    return 10;     /* Read error */
+                metric->num_reads		+= 1;                                             
+                record2[resultBlock]	= -1;
+                record1[resultBlock]	= resultBlock * es->page_size + es->headerSize;
+                #ifdef DEBUG_READ
+                printf("Read block sublist: %d\n", resultBlock);
+                test_record_t *firstRec = (void*) buffer + resultBlock * es->page_size + es->headerSize;
+                test_record_t *lastRec = (void*) buffer + resultBlock * es->page_size + es->headerSize + (*((int16_t *) (buffer + resultBlock * es->page_size + BLOCK_COUNT_OFFSET))-1) * es->record_size;               
+                printf("Read Sublist: %d Block: %d NumRec: %d First key: %d Last key: %d\n", resultBlock, (int32_t) *(buffer + resultBlock * es->page_size), 
+                        *((int16_t *) (buffer + resultBlock * es->page_size + BLOCK_COUNT_OFFSET)), firstRec->key, lastRec->key);
+                #endif
+            }
+        }	/* end if is the non output block empty */
 
-                    if (resultBlock == -1) break; /* No records left to merge */
+        /* Determine if there are no records from the output block left */
+        outputIsEmpty = 1;
+        if (record1[OUTPUT_BLOCK_ID] != -1) 
+        {
+            outputIsEmpty = 0;
+        }
+        else 
+        {
+            for (i = 0; i < sublistsInRun; i++) 
+            {
+                if (i == OUTPUT_BLOCK_ID) 
+                    continue;                        
 
-                    /* increment record2 to next position of output block. record2 is where the next record to output will be placed */
-                    if (record2[OUTPUT_BLOCK_ID] == -1) 
-                        record2[OUTPUT_BLOCK_ID] = BUFFER_OUTPUT_BLOCK_START_RECORD_OFFSET;                
-                    else 
-                        record2[OUTPUT_BLOCK_ID] += es->record_size;                
-                                                            
-                    #ifdef DEBUG
-                    test_record_t *buf = (void*) buffer + resultRecOffset;
-                    printf("Smallest Record: %d  From list: %d\n", buf->key, resultBlock);                        
-                    printf("List status: 0: (%d, %d) 1: (%d, %d) 2: (%d, %d) ResultList: %d\n", record1[0],record2[0],
-                                                    record1[1],record2[1],record1[2],record2[2], resultBlock);
+                if (record2[i] != -1) 
+                {
+                    outputIsEmpty = 0;
+                    break;
+                }
+            }
+        }
 
-                    if (buf->key == 27391)
-                    {
-                        /* Output all block contents */
-                        for (int l=0; l < 2; l++)
-                        {   
-                            printf("Current  block: %d  # records: %d\n", l, tuplesPerPage);
-                            for (int k=0; k < tuplesPerPage; k++)
-                            {
-                                test_record_t *buf = (void*) (buffer+es->headerSize+k*es->record_size+l*es->page_size);
-                                printf("%d: Record: %d  Address: %p\n", k, buf->key, (void*) (buffer+es->headerSize+k*es->record_size+l*es->page_size));                     
-                            }
-                        }
-                        printf("HERE\n");
-                    }
-                    #endif
-                    
-                    /* Add smallest tuple to output position in buffer (may already be in output buffer) */
-                    if (resultBlock != OUTPUT_BLOCK_ID) 
+        /* read in next block of sublist (output block) */
+        if (outputIsEmpty && (-1 != sublsBlkPos[OUTPUT_BLOCK_ID])) 
+        {
+            /* check if we are finished with output blocks associated sublist */
+            if (sublsBlkPos[OUTPUT_BLOCK_ID] >= blocksInSublist[OUTPUT_BLOCK_ID] - 1) 
+            {
+                sublsBlkPos[OUTPUT_BLOCK_ID]        = -1;	/* sublist is spent */
+                record1[OUTPUT_BLOCK_ID]		    = -1;
+            }
+            else 
+            {                        
+                /* sublist isn't empty read in next block of sublist */
+                rebuildTree = 1;        /* Output records are moved through other blocks */
+                sublsBlkPos[OUTPUT_BLOCK_ID]++;
+                sublsFilePtr[OUTPUT_BLOCK_ID] += es->page_size;
+
+                /* if the output block contains results they have to be temporarily stored in other blocks. */
+                if (record2[OUTPUT_BLOCK_ID] != -1) 
+                {
+                    outputCursor	= OUTPUT_BLOCK_ID * es->page_size + es->headerSize;
+                    destBlk		    = 1;
+
+                    /* While there are still output tuples to move */
+                    while (outputCursor <= record2[OUTPUT_BLOCK_ID]) 
                     {
-                        if ((record1[OUTPUT_BLOCK_ID] == record2[OUTPUT_BLOCK_ID]) && (record1[OUTPUT_BLOCK_ID] != -1)) 
-                        {   /* Output block does not have space for the result record */
-                            /* Optimization (removed):  
-                            Determine if space in block holding smallest record to store output block.
-                            If so, can directly insert into the heap in that block rather than using a temporary tuple.
-                            Note: Can extend this to check if space in other blocks not just the one with smallest record.
-                            This would be more comparisons but would save record copies.
-                            Savings on memory copies between 1 and 2% was determined not to be worth extra calculations.
-                            This is for records of 16 bytes. May be different for larger records.                           
-                            */                       
-
-                            /* Move output block's record into temporary buffer */
-                            metric->num_memcpys++;
-                            memcpy(tupleBuffer, buffer + record1[OUTPUT_BLOCK_ID], (size_t)es->record_size);
-                            numShiftOutOutput++;                                                                                                                                           
-                            #ifdef DEBUG
-                            test_record_t *buf = (void*) (buffer + record1[OUTPUT_BLOCK_ID]);
-                            printf("Output record moved to list %d Key: %d\n", resultBlock, buf->key);
-                            #endif                                
-                            /* Move result record into output block (record1[output_block]==record2[output_block]) */
-                            metric->num_memcpys++;
-                            memcpy(buffer + record2[OUTPUT_BLOCK_ID], buffer + resultRecOffset, (size_t)es->record_size);
-                                                    
-                            /* Move displaced output block record out of the temp buffer and into the output list (list2) of the result record's block */
-                            if (isRecord2 == 0) 
-                            {   /* Smallest record is not originally from output block */
-                                /* Result is from record1 list. Insert into heap of output records for block. */                                                      
-                                if (record2[resultBlock] == -1) 
-                                    record2[resultBlock] = resultBlock * es->page_size + es->headerSize;						
-                                else 
-                                    record2[resultBlock] += es->record_size;							
-                                heapSizeRecords = (record2[resultBlock]+es->record_size-resultBlock*es->page_size)/es->record_size;                            
-                                /* Buffered output record is in tuple_buffer */
-                                shiftUp(buffer + resultBlock*es->page_size + es->headerSize, tupleBuffer, heapSizeRecords -1, es, metric);                            
-                            }
+                        /* find next block with space to store a tuple. Start at block 1 continue to block N where N>1 */
+                        blk = -1;
+                        while (-1 == blk && destBlk < sublistsInRun) 
+                        {                                    
+                            if (record1[destBlk] != -1) 
+                                space = record1[destBlk] - (destBlk * es->page_size + es->headerSize);                                    
                             else 
-                            {
-                                /* Result is from record2 list. Insert the displaced output value into record2 list */
-                                heapSizeRecords = (record2[resultBlock]+es->record_size-resultBlock*es->page_size)/es->record_size;
-
-                                /* Output record to be inserted is already stored in the tuple_buffer */
-                                heapify(buffer + resultBlock*es->page_size + es->headerSize, tupleBuffer, heapSizeRecords, es, metric);
-                            }                      
-                            
-                            /* Displaced the output block's current record. Increment to next output block record. */
-                            record1[OUTPUT_BLOCK_ID] += es->record_size;
-                            if (record1[OUTPUT_BLOCK_ID] >= OUTPUT_BLOCK_ID * es->page_size + (*((int16_t *) (buffer + OUTPUT_BLOCK_ID * es->page_size + BLOCK_COUNT_OFFSET))) * es->record_size + es->headerSize) 
-                            // if (record1[OUTPUT_BLOCK_ID] >= OUTPUT_BLOCK_ID * es->page_size + tuplesPerPage*es->record_size + es->headerSize)                        
-                                record1[OUTPUT_BLOCK_ID] = -1;      						
-                        }
-                        else 
-                        {   /* Output block already has an empty slot for the result value. Only need to move result value into result list of output block. */
-                            /* Move result record into output block */
-                            metric->num_memcpys++;
-                            memcpy(buffer + record2[OUTPUT_BLOCK_ID], buffer + resultRecOffset, (size_t)es->record_size);
+                                space = es->page_size - es->headerSize;
 
-                            if (isRecord2 == 1) 
-                            {
-                                /* is_record2: result value came from list2 of result block */
-                                record2[resultBlock] -= es->record_size;
-
-                                if (record2[resultBlock] < resultBlock * es->page_size + es->headerSize) 
-                                    record2[resultBlock] = -1;                            
-                                else
-                                {
-                                    /* Move last value to front of heap */
-                                    heapSizeRecords = (record2[resultBlock] + es->record_size - resultBlock * es->page_size) / es->record_size;
-                                    heapify(buffer + resultBlock*es->page_size + es->headerSize, buffer + record2[resultBlock]+es->record_size, heapSizeRecords, es, metric);
-                                }                           
-                            }
-                        }
+                            if (record2[destBlk] != -1) 
+                                space -= (record2[destBlk] - destBlk * es->page_size + es->record_size - es->headerSize);                                    
 
-                        /* increment to next position of block that smallest value was read from */
-                        if (isRecord2 == 0) 
-                            record1[resultBlock] += es->record_size;                    
-                    } /* end if smallestblock != output block */
-                    else 
-                    {
-                        /* The smallest value is already in output block, move it from record1 to record2 */
-                        if (record2[resultBlock] != record1[resultBlock]) 
-                        {
-                            metric->num_memcpys++;
-                            memcpy(buffer + record2[resultBlock], buffer + record1[resultBlock], (size_t)es->record_size);
-                        }
+                            space = space / es->record_size;
 
-                        record1[resultBlock] += es->record_size;
-                    }	/* end of adding smallest tuple to appropriate block */
-
-                    /* Determine if block with smallest value has any more records in it */                
-                    if (record1[resultBlock] >= resultBlock * es->page_size + (*((int16_t *) (buffer + resultBlock * es->page_size + BLOCK_COUNT_OFFSET))) * es->record_size + es->headerSize) 
-                        record1[resultBlock] = -1;				
-
-                    /* Output block is full, write it out */
-                    if (record2[OUTPUT_BLOCK_ID] >= OUTPUT_BLOCK_ID * es->page_size + tuplesPerPage*es->record_size - es->record_size) 
-                    {                
-                        fseek(outputFile, lastWritePos, SEEK_SET);
-
-                        /* Setup block header */
-                        *((int32_t *) buffer) = currentBlockId;
-                        *((int16_t *) (buffer + BLOCK_COUNT_OFFSET)) = (int16_t)tuplesPerPage;
-                        currentBlockId++;
-
-                        if (0 == fwrite(buffer + OUTPUT_BLOCK_ID * es->page_size, (size_t)es->page_size, 1, outputFile)) 
-                        {   /* File write error - Arduino prints 1st value nmemb times if nmemb != 1  */
-                            free(record1); free(record2); free(sublsBlkPos); free(sublsFilePtr);
-                            return 9;
-                        }                                        
-
-                        lastWritePos		        = ftell(outputFile);
-                        record2[OUTPUT_BLOCK_ID]	= -1;
-                        metric->num_writes++;
-                        #ifdef DEBUG_OUTPUT
-                        printf("Wrote output block: %d  # records: %d\n", *((int32_t *) buffer), tuplesPerPage);
-                        for (int k=0; k < tuplesPerPage; k++)
-                        {
-                            test_record_t *buf = (void*) (buffer+es->headerSize+k*es->record_size);
-                            printf("%d: Output Record: %d  Address: %p\n", k, buf->key, (void*) (buffer+es->headerSize+k*es->record_size));                     
+                            if (space >= 1) 
+                                blk = destBlk;                                    
+                            else 
+                                destBlk++;                                                                   
                         }
-                        #endif                    
-                    }                
+                        if (blk == -1)
+                            return 8;   /* No block has space for the record */
 
-                    /* Read in the next block of a sublist if buffered block is depleted (non-output block) */
-                    if ((record1[resultBlock] == -1) && (sublsBlkPos[resultBlock] != -1) && (resultBlock != OUTPUT_BLOCK_ID)) 
-                    {
-                        /* check if we are finished with that sublist */
-                        if (sublsBlkPos[resultBlock] >= blocksInSublist[resultBlock] - 1) 
-                        {
-                            sublsBlkPos[resultBlock]	 = -1;	/* sublist is spent */
-                            record1[resultBlock]	     = -1;
-                        }
+                        if (record2[destBlk] == -1) 
+                            record2[destBlk] = destBlk * es->page_size + es->headerSize;                                
                         else 
-                        {
-                            /* not finished with sublist read in next block of sublist */
-                            sublsBlkPos[resultBlock]++;
-                            sublsFilePtr[resultBlock] += es->page_size;
-
-                            /* put any output records in this block into other blocks */
-                            int32_t originPtr	= resultBlock * es->page_size + es->headerSize;
-                            int32_t destBlk	= OUTPUT_BLOCK_ID;
-                            int16_t numTransfer = (record2[resultBlock]-originPtr) / es->record_size + 1;
-
-                            /* while there are still records left to move */
-                            while (record2[resultBlock] != -1 && originPtr <= record2[resultBlock]) 
-                            {
-                                /* Find a block with space to store the record */
-                                blk         = -1;
-                                space		= 0;
-                                while (blk == -1 && space == 0) 
-                                {                                                               
-                                    if (record1[destBlk] != -1) 
-                                        space += record1[destBlk] - (destBlk * es->page_size + es->headerSize);                       
-                                    else 
-                                        space += es->page_size - es->headerSize;                                
+                            record2[destBlk] += es->record_size;                                
+
+                        /* move the record */
+                        #ifdef DEBUG
+                        test_record_t *buf = (void*) (buffer + outputCursor);
+                        printf("Output list empty so moved record in output to list %d Key: %d\n", destBlk, buf->key);
+                        #endif
+                        mr->numShiftOutOutput++;
+                        metric->num_memcpys++;
+                        memcpy(buffer + record2[destBlk], buffer + outputCursor, (size_t)es->record_size);
+                        outputCursor += es->record_size;
+                    }
+                }
 
-                                    if (record2[destBlk] != -1) 
-                                        space -= (record2[destBlk] - destBlk * es->page_size + es->record_size - es->headerSize);                                
+                /* Perform the the read into the now empty output block */
+                if (mergeReadBlock(mr, sublsFilePtr[OUTPUT_BLOCK_ID], buffer + OUTPUT_BLOCK_ID * es->page_size) != 0) 
+                    return 10;     /* Read error */
+                
+                int16_t numRecords = *((int16_t*) (buffer + BLOCK_COUNT_OFFSET));
+                #ifdef DEBUG_READ
+                printf("Read block sublist: 0\n");
+                test_record_t *firstRec = (void*) buffer + es->headerSize;
+                test_record_t *lastRec = (void*) buffer + es->headerSize + (*((int16_t *) (buffer +  BLOCK_COUNT_OFFSET))-1) * es->record_size;               
+                printf("Read Sublist: %d Block: %d NumRec: %d First key: %d Last key: %d\n", 0, (int32_t) *(buffer + 0 * es->page_size), 
+                        *((int16_t *) (buffer + BLOCK_COUNT_OFFSET)), firstRec->key, lastRec->key);
+                #endif
 
-                                    space = space / es->record_size;
+                metric->num_reads	+= 1;
+                record1[OUTPUT_BLOCK_ID]	= OUTPUT_BLOCK_ID * es->page_size + es->headerSize;
 
-                                    if (space >= 1)
-                                        blk = destBlk;
-                                    else 
-                                        destBlk++;
+                /* put the results back into the output block, re-add them in reverse order from when we removed them (blocks N to 1)
+                * This will keep the blocks in sorted order.  */
+                if (record2[OUTPUT_BLOCK_ID] != -1) 
+                {
+                    outputCursor = OUTPUT_BLOCK_ID * es->page_size + es->headerSize;						
 
-                                    if (resultBlock == destBlk) 
-                                        destBlk++;                     /* Go to next destination block if currently at the original block that had smallest value */
+                    /* Output block read may not be full of input records. Only swap the input records (counted over all blocks). */
+                    i = 0;
+                    for (blk = 0; blk < sublistsInRun; blk++) 
+                    {
+                        if (record2[blk] == -1) 
+                            continue;								
 
-                                    if (destBlk > bufferSizeInBlocks)
-                                    {
-                                        printf("Incorrect destination block. List 1: (%d, %d) List 2: (%d, %d) List 3: (%d, %d) ResultList: %d\n", record1[0],record2[0],
-                                                record1[1],record2[1],record1[2],record2[2], resultBlock);
-
-                                        /* Output all block contents */
-                                        for (int l=0; l < 3; l++)
-                                        {   
-                                            printf("Current  block: %d  # records: %d\n", l, tuplesPerPage);
-                                            for (int k=0; k < tuplesPerPage; k++)
-                                            {
-                                                test_record_t *buf = (void*) (buffer+es->headerSize+k*es->record_size+l*es->page_size);
-                                                printf("%d: Record: %d  Address: %p\n", k, buf->key, (void*) (buffer+es->headerSize+k*es->record_size+l*es->page_size));                     
-                                            }
-                                        }
-                                    }
-                                }
+                        if (blk == OUTPUT_BLOCK_ID) 
+                            continue;								
 
-                                numTransferThisPass = space;
-                                if (space > numTransfer)
-                                    numTransferThisPass = numTransfer;
-                                numTransfer -= numTransferThisPass;
-
-                                if (destBlk == OUTPUT_BLOCK_ID) 
-                                {   /* Returning tuples back to output block */                         
-                                    /* Position record1 input pointer at first space for record to be inserted */                               
-                                    if (record1[destBlk] == -1)
-                                    {   /* There are no input records in sublist 0 currently in the block */
-                                        record1[destBlk] = destBlk * es->page_size + (tuplesPerPage - numTransferThisPass) * es->record_size + es->headerSize;
-                                        offset = record1[destBlk];                                  /* Remember first insert location */
-                                        for (i=0; i <  numTransferThisPass; i++)
-                                        {
-                                            #ifdef DEBUG
-                                            test_record_t *buf = (void*) (buffer + originPtr);
-                                            printf("Empty output block case. Moved output record back from list %d Key: %d\n", resultBlock, buf->key);
-                                            #endif
-                                            numShiftIntoOutput++;
-                                            /* Get top value from heap */
-                                            metric->num_memcpys++;
-                                            memcpy(buffer + record1[destBlk], buffer + originPtr, (size_t)es->record_size);
-
-                                            /* Fix heap */
-                                            heapSizeRecords = (record2[resultBlock]+es->record_size-resultBlock*es->page_size)/es->record_size;
-                                            heapSizeRecords--;              /* Subtract 1 as going to use last record in heap as insert record */
-                                
-                                            heapify(buffer + resultBlock*es->page_size + es->headerSize, (void*) (buffer+record2[resultBlock]), heapSizeRecords, es, metric);                                    
-                                            record1[destBlk] += es->record_size;
-                                            record2[resultBlock] -= es->record_size;
-                                        }   
-                                        record1[destBlk] = offset;         /* Set pointer to first insert location */                                                                                                     
-                                    }
-                                    else
-                                    {
-                                        for (i=0; i <  numTransferThisPass; i++)
-                                        {
-                                            record1[destBlk] = record1[destBlk] - es->record_size;
-                                            #ifdef DEBUG
-                                            test_record_t *buf = (void*) (buffer + originPtr);
-                                            printf("Moved output record back from list %d Key: %d\n", resultBlock, buf->key);
-                                            #endif
-                                            numShiftIntoOutput++;
-
-                                            /* insertion sort type insert */
-                                            int32_t insert_ptr = record1[destBlk];
-                                            while (insert_ptr < destBlk * es->page_size + (tuplesPerPage-1)*es->record_size) 
-                                            {
-                                                metric->num_compar++;
-                                                #ifdef DEBUG
-                                                test_record_t *buf = (void*) (buffer + insert_ptr + es->record_size);
-                                                printf("Compare with list %d Key: %d\n", resultBlock, buf->key);
-                                                #endif
-                                                if ( 0 < es->compare_fcn(buffer + originPtr, buffer + insert_ptr + es->record_size)) 
-                                                {
-                                                    /* shift next_val down */
-                                                    metric->num_memcpys++;
-                                                    memcpy(buffer + insert_ptr, buffer + insert_ptr + es->record_size, (size_t)es->record_size);
-                                                }
-                                                else 
-                                                    break;                                    
-
-                                                insert_ptr += es->record_size;
-                                            }
-
-                                            metric->num_memcpys++;
-                                            memcpy(buffer + insert_ptr, buffer + originPtr, (size_t)es->record_size); 
-                                            originPtr += es->record_size;  
-                                        }                            
-                                    }
-                                }
-                                else 
-                                {
-                                    for (i=0; i <  numTransferThisPass; i++)
-                                    {
-                                        /* insert into a non output block, put into the record2 list of the block */
-                                        if (record2[destBlk] == -1) 
-                                            record2[destBlk] = destBlk * es->page_size + es->headerSize;	/* no other record2 values */
-                                        else 
-                                            record2[destBlk] += es->record_size;	                        /* other record2 values */
-                                    
-                                        #ifdef DEBUG
-                                        test_record_t *buf = (void*) (buffer + originPtr);
-                                        printf("Moved output record to list %d Key: %d\n", destBlk, buf->key);                              
-                                        #endif
-                                        numShiftOtherBlock++;
-                                    
-                                        /* Insert at end of heap */
-                                        int32_t heapSizeRecords = (record2[destBlk]+es->record_size - es->page_size*destBlk)/es->record_size; 
-                                        shiftUp(buffer + destBlk*es->page_size + es->headerSize, buffer + originPtr, heapSizeRecords -1, es, metric);    
-
-                                        originPtr += es->record_size;                              
-                                    }
-                                }                          
-                            }
-
-                            /* read in next block */
-                            fseek(outputFile, sublsFilePtr[resultBlock], SEEK_SET);
-
-                            if (0 == fread(buffer + resultBlock * es->page_size, (size_t)es->page_size, 1, outputFile)) 
-                            {   /* Read error */
-                                free(record1); free(record2); free(sublsBlkPos); free(sublsFilePtr);
-                                return 10;
-                            }
-                            metric->num_reads		+= 1;                                             
-                            record2[resultBlock]	= -1;
-                            record1[resultBlock]	= resultBlock * es->page_size + es->headerSize;
-                            #ifdef DEBUG_READ
-                            printf("Read block sublist: %d\n", resultBlock);
-                            test_record_t *firstRec = (void*) buffer + resultBlock * es->page_size + es->headerSize;
-                            test_record_t *lastRec = (void*) buffer + resultBlock * es->page_size + es->headerSize + (*((int16_t *) (buffer + resultBlock * es->page_size + BLOCK_COUNT_OFFSET))-1) * es->record_size;               
-                            printf("Read Sublist: %d Block: %d NumRec: %d First key: %d Last key: %d\n", resultBlock, (int32_t) *(buffer + resultBlock * es->page_size), 
-                                    *((int16_t *) (buffer + resultBlock * es->page_size + BLOCK_COUNT_OFFSET)), firstRec->key, lastRec->key);
-                            #endif
-                        }
-                    }	/* end if is the non output block empty */
+                        int32_t blkCursor = blk * es->page_size + es->headerSize;
+                        int32_t limit = record2[blk];
 
-                    /* Determine if there are no records from the output block left */
-                    outputIsEmpty = 1;
-                    if (record1[OUTPUT_BLOCK_ID] != -1) 
-                    {
-                        outputIsEmpty = 0;
-                    }
-                    else 
-                    {
-                        for (i = 0; i < sublistsInRun; i++) 
+                        while (blkCursor <= limit && i < numRecords)
                         {
-                            if (i == OUTPUT_BLOCK_ID) 
-                                continue;                        
-
-                            if (record2[i] != -1) 
-                            {
-                                outputIsEmpty = 0;
-                                break;
-                            }
+                            i++;
+                            metric->num_memcpys += 3;
+                            /* swap record */
+                            memcpy(tupleBuffer, buffer + blkCursor, (size_t)es->record_size);                                  
+                            memcpy(buffer + blkCursor, buffer + outputCursor, (size_t)es->record_size);                                    
+                            memcpy(buffer + outputCursor, tupleBuffer, (size_t)es->record_size);                                    
+                            outputCursor	+= es->record_size;
+                            blkCursor		+= es->record_size;
+                            mr->numShiftIntoOutput++;
+                        }
+                        /* Copy back to output block all remaining records into the free space in the output block */
+                        while (blkCursor <= limit)
+                        {           
+                            metric->num_memcpys += 1;                         
+                            memcpy(buffer + outputCursor, buffer + blkCursor, (size_t)es->record_size);                                                                     
+                            outputCursor	+= es->record_size;
+                            blkCursor		+= es->record_size;
+                            mr->numShiftIntoOutput++;
+                            record2[blk] -= es->record_size;
                         }
+                        if (record2[blk] < blk * es->page_size + es->headerSize)
+                            record2[blk] = -1;      /* No input records were swapped into this block */
                     }
 
-                    /* read in next block of sublist (output block) */
-                    if (outputIsEmpty && (-1 != sublsBlkPos[OUTPUT_BLOCK_ID])) 
-                    {
-                        /* check if we are finished with output blocks associated sublist */
-                        if (sublsBlkPos[OUTPUT_BLOCK_ID] >= blocksInSublist[OUTPUT_BLOCK_ID] - 1) 
-                        {
-                            sublsBlkPos[OUTPUT_BLOCK_ID]        = -1;	/* sublist is spent */
-                            record1[OUTPUT_BLOCK_ID]		    = -1;
-                        }
-                        else 
-                        {                        
-                            /* sublist isn't empty read in next block of sublist */
-                            sublsBlkPos[OUTPUT_BLOCK_ID]++;
-                            sublsFilePtr[OUTPUT_BLOCK_ID] += es->page_size;
+                    record1[OUTPUT_BLOCK_ID] = record2[OUTPUT_BLOCK_ID] + es->record_size;
 
-                            /* if the output block contains results they have to be temporarily stored in other blocks. */
-                            if (record2[OUTPUT_BLOCK_ID] != -1) 
-                            {
-                                outputCursor	= OUTPUT_BLOCK_ID * es->page_size + es->headerSize;
-                                destBlk		    = 1;
+                    if (record1[OUTPUT_BLOCK_ID] >=  OUTPUT_BLOCK_ID * es->page_size + es->headerSize + numRecords*es->record_size) 
+                        record1[OUTPUT_BLOCK_ID] = -1;							
+                }
+            }                       
+        } /*end of reading in next output block */
+    }	/* end of run */
+
+    if (record2[0] > 0)
+    {   /* Tuples in output block to write out */
+        if (mergeWriteBlock(mr, (int16_t) ((record2[0]-es->headerSize)/es->record_size + 1)) != 0) 
+            return 9;   /* File write error */
+        record2[OUTPUT_BLOCK_ID]	= -1;
+
+        #ifdef DEBUG_OUTPUT
+        printf("Wrote output block here.\n");
+        for (int k=0; k < tuplesPerPage; k++)
+        {
+            test_record_t *buf = (void*) (buffer+es->headerSize+k*es->record_size);
+            printf("%d: Output Record: %d  Address: %p\n", k, buf->key, (void*) (buffer+es->headerSize+k*es->record_size));
+        }
+        #endif
+    }
+    if (mr->aggCount > 0 && mergeWritePage(mr, mr->aggPage, mr->aggCount, mr->aggPage + es->headerSize) != 0)
+        return 9;   /* File write error */
+    return mergeWriteWait(mr);
+}
 
-                                /* While there are still output tuples to move */
-                                while (outputCursor <= record2[OUTPUT_BLOCK_ID]) 
-                                {
-                                    /* find next block with space to store a tuple. Start at block 1 continue to block N where N>1 */
-                                    blk = -1;
-                                    space = 0;
-                                    while (-1 == blk) 
-                                    {                                    
-                                        if (record1[destBlk] != -1) 
-                                            space += record1[destBlk] - (destBlk * es->page_size + es->headerSize);                                    
-                                        else 
-                                            space += es->page_size - es->headerSize;
-
-                                        if (record2[destBlk] != -1) 
-                                            space -= (record2[destBlk] - destBlk * es->page_size + es->record_size - es->headerSize);                                    
-
-                                        space = space / es->record_size;
-
-                                        if (space >= 1) 
-                                            blk = destBlk;                                    
-                                        else 
-                                            destBlk++;                                                                   
-                                    }
+/**
+ * Decodes the next record of sublist i of a merge of encoded blocks into its entry of codecRecords. The next block of the
+ * sublist is read when its block is exhausted. record1[i] is -1 once the sublist is exhausted. Returns 0 if success, 10 if read error.
+ */
+static int8_t mergeCodecNext(merge_run_t *mr, int32_t i)
+{
+    external_sort_t *es = mr->es;
+    char            *block = mr->buffer + i * es->page_size;
 
-                                    if (record2[destBlk] == -1) 
-                                        record2[destBlk] = destBlk * es->page_size + es->headerSize;                                
-                                    else 
-                                        record2[destBlk] += es->record_size;                                
+    while (!sort_codec_read(es, block, &mr->cursors[i], mr->codecRecords + i * es->record_size))
+    {
+        if (mr->sublsBlkPos[i] == -1 || mr->sublsBlkPos[i] >= mr->blocksInSublist[i] - 1)
+        {
+            mr->record1[i] = -1;
+            return 0;
+        }
+        mr->sublsBlkPos[i]++;
+        mr->sublsFilePtr[i] += es->page_size;
+        if (mergeReadBlock(mr, mr->sublsFilePtr[i], block) != 0)
+            return 10;
+        mr->metric->num_reads++;
+        sort_codec_rewind(&mr->cursors[i]);
+    }
+    mr->metric->num_memcpys++;
+    mr->record1[i] = i * es->record_size;
+    return 0;
+}
 
-                                    /* move the record */
-                                    #ifdef DEBUG
-                                    test_record_t *buf = (void*) (buffer + outputCursor);
-                                    printf("Output list empty so moved record in output to list %d Key: %d\n", destBlk, buf->key);
-                                    #endif
-                                    numShiftOutOutput++;
-                                    metric->num_memcpys++;
-                                    memcpy(buffer + record2[destBlk], buffer + outputCursor, (size_t)es->record_size);
-                                    outputCursor += es->record_size;
-                                }
-                            }
-
-                            /* Perform the the read into the now empty output block */
-                            fseek(outputFile, sublsFilePtr[OUTPUT_BLOCK_ID], SEEK_SET);
-
-                            if (0 == fread(buffer + OUTPUT_BLOCK_ID * es->page_size, (size_t)es->page_size, 1, outputFile)) 
-                            {   // Read error
-                                free(record1); free(record2); free(sublsBlkPos); free(sublsFilePtr);
-                                return 10;
-                            }
-                            
-                            int16_t numRecords = *((int16_t*) (buffer + BLOCK_COUNT_OFFSET));
-                            #ifdef DEBUG_READ
-                            printf("Read block sublist: 0\n");
-                            test_record_t *firstRec = (void*) buffer + es->headerSize;
-                            test_record_t *lastRec = (void*) buffer + es->headerSize + (*((int16_t *) (buffer +  BLOCK_COUNT_OFFSET))-1) * es->record_size;               
-                            printf("Read Sublist: %d Block: %d NumRec: %d First key: %d Last key: %d\n", 0, (int32_t) *(buffer + 0 * es->page_size), 
-                                    *((int16_t *) (buffer + BLOCK_COUNT_OFFSET)), firstRec->key, lastRec->key);
-                            #endif
+/**
+ * Adds a record to the output page of a merge of encoded blocks. The page is written first if it is full.
+ * Returns 0 if success, 9 if write error.
+ */
+static int8_t mergeCodecAdd(merge_run_t *mr, void *record)
+{
+    sort_codec_writer_t *w = &mr->writer;
 
-                            metric->num_reads	+= 1;
-                            record1[OUTPUT_BLOCK_ID]	= OUTPUT_BLOCK_ID * es->page_size + es->headerSize;
+    mr->metric->num_memcpys++;
+    if (sort_codec_add(w, mr->es, record))
+        return 0;
+    if (mergeWritePage(mr, w->page, w->count, w->first) != 0)
+        return 9;
+    sort_codec_reset(w, mr->es, w->codec);
+    sort_codec_add(w, mr->es, record);
+    return 0;
+}
 
-                            /* put the results back into the output block, re-add them in reverse order from when we removed them (blocks N to 1)
-                            * This will keep the blocks in sorted order.  */
-                            if (record2[OUTPUT_BLOCK_ID] != -1) 
-                            {
-                                outputCursor = OUTPUT_BLOCK_ID * es->page_size + es->headerSize;						
+/**
+ * Merges the sublists assigned by mergeFindSublists() when their blocks are encoded with es->codec (see sort_codec.h).
+ * Encoded records cannot be moved in place, so the current record of each sublist is decoded into codecRecords and the
+ * smallest is encoded into the output page. Output blocks are encoded with codec. The last pass uses sort_codec_output()
+ * so the sorted output is in the standard block format, or slotted pages for variable length records. Returns 0 if success,
+ * 9 if write error, 10 if read error.
+ */
+static int8_t mergeRunCodec(merge_run_t *mr, int8_t codec)
+{
+    external_sort_t *es = mr->es;
+    merge_tree_t    *tree = &mr->tree;
+    char            *pending = mr->aggPage;     /* With an aggregate, record combining the records of the last key */
+    char            *record;
+    int32_t         blk, i;
+
+    mr->blocksOut   = 0;
+    mr->recordsOut  = 0;
+    mr->aggCount    = 0;
+    tree->metric    = mr->metric;
+    sort_codec_reset(&mr->writer, es, codec);
+
+    if (mergeReadFirstBlocks(mr) != 0)
+        return 10;
+    for (i = 0; i < mr->numSublists; i++)
+    {
+        mr->record2[i] = -1;            /* Output is not stored in the buffer */
+        sort_codec_rewind(&mr->cursors[i]);
+        if (mergeCodecNext(mr, i) != 0)
+            return 10;
+    }
+    tree->numBlocks = (int16_t) mr->numSublists;
+    mergeTreeBuild(tree);
+
+    while (tree->node[1] != -1)
+    {
+        /* Later records cannot be among the smallest limit records */
+        if (mr->limit > 0 && mr->recordsOut + mr->writer.count >= mr->limit)
+            break;
+
+        blk = tree->node[1] / 2;
+        record = mr->codecRecords + mr->record1[blk];
+        if (pending == NULL)
+        {
+            if (mergeCodecAdd(mr, record) != 0)
+                return 9;
+        }
+        else
+        {   /* Records are combined until a record with a larger key is found */
+            mr->metric->num_compar++;
+            if (mr->aggCount > 0 && es->compare_fcn(pending, record) == 0)
+                sort_aggregate_combine(es, pending, record);
+            else
+            {
+                if (mr->aggCount > 0 && mergeCodecAdd(mr, pending) != 0)
+                    return 9;
+                memcpy(pending, record, es->record_size);
+                mr->aggCount = 1;
+            }
+        }
 
-                                for (blk = 0; blk < sublistsInRun; blk++) 
-                                {
-                                    if (record2[blk] == -1) 
-                                        continue;								
+        if (mergeCodecNext(mr, blk) != 0)
+            return 10;
+        mergeTreeUpdate(tree, (int16_t) blk, (int16_t) blk);
+    }
 
-                                    if (blk == OUTPUT_BLOCK_ID) 
-                                        continue;								
+    if (mr->aggCount > 0 && mergeCodecAdd(mr, pending) != 0)
+        return 9;
+    if (mr->writer.count > 0 && mergeWritePage(mr, mr->writer.page, mr->writer.count, mr->writer.first) != 0)
+        return 9;
+    return mergeWriteWait(mr);
+}
 
-                                    int16_t blkCursor = blk * es->page_size + es->headerSize;
-                                    int16_t limit = record2[blk];
+/**
+ * Runs of one merge pass merged in parallel. Each run has its own region of the output file computed from the
+ * number of records of its sublists, so runs can be written in any order.
+ */
+typedef struct {
+    long    ptrLastBlock;           /* End of last sublist of run */
+    long    writePos;               /* File offset of first output block of run */
+    int32_t dirRun;                 /* Run directory index of last sublist of run plus one */
+    int32_t numSublists;
+    int32_t numBlocks;              /* Output blocks and records. Set when run is merged. */
+    int32_t numRecords;
+} merge_pass_run_t;
+
+typedef struct {
+    merge_run_t         *workers;
+    merge_pass_run_t    *runs;
+    char                *keys;      /* First key of output of each run */
+    run_directory_t     *inDir;
+    long                lastMergeStart;
+} merge_pass_t;
 
-                                    /* Output block read may not be full of input records. Only swap the input records. */
-                                    i = 0;
-                                    while (blkCursor <= limit && i < numRecords)
-                                    {
-                                        i++;
-                                        metric->num_memcpys += 3;
-                                        /* swap record */
-                                        memcpy(tupleBuffer, buffer + blkCursor, (size_t)es->record_size);                                  
-                                        memcpy(buffer + blkCursor, buffer + outputCursor, (size_t)es->record_size);                                    
-                                        memcpy(buffer + outputCursor, tupleBuffer, (size_t)es->record_size);                                    
-                                        outputCursor	+= es->record_size;
-                                        blkCursor		+= es->record_size;
-                                        numShiftIntoOutput++;
-                                    }
-                                    /* Copy back to output block all remaining records into the free space in the output block */
-                                    while (blkCursor <= limit)
-                                    {           
-                                        metric->num_memcpys += 1;                         
-                                        memcpy(buffer + outputCursor, buffer + blkCursor, (size_t)es->record_size);                                                                     
-                                        outputCursor	+= es->record_size;
-                                        blkCursor		+= es->record_size;
-                                        numShiftIntoOutput++;
-                                        record2[blk] -= es->record_size;
-                                    }
-                                }
+/**
+ * Merges one run of a parallel merge pass (sort_parallel_run() task).
+ */
+static int8_t mergePassTask(void *arg, int16_t worker, int32_t run)
+{
+    merge_pass_t        *pass = (merge_pass_t*) arg;
+    merge_run_t         *mr = &pass->workers[worker];
+    merge_pass_run_t    *r = &pass->runs[run];
+    int16_t             keySize = mr->es->key_offset + mr->es->key_size;
+    int32_t             dirRun = r->dirRun;
+    long                ptrLastBlock = r->ptrLastBlock;
+    int8_t              err;
+
+    mr->numSublists = r->numSublists;
+    mr->writePos    = r->writePos;
+    err = mergeFindSublists(mr, pass->inDir, 1, &dirRun, &ptrLastBlock, pass->lastMergeStart);
+    if (err == 0)
+        err = mergeRun(mr);
+    r->numBlocks    = mr->blocksOut;
+    r->numRecords   = mr->recordsOut;
+    memcpy(pass->keys + run * keySize, mr->firstKey, keySize);
+    return err;
+}
 
-                                record1[OUTPUT_BLOCK_ID] = record2[OUTPUT_BLOCK_ID] + es->record_size;
-
-                                if (record1[OUTPUT_BLOCK_ID] >=  OUTPUT_BLOCK_ID * es->page_size + es->headerSize + numRecords*es->record_size) 
-                                    record1[OUTPUT_BLOCK_ID] = -1;							
-                            }
-                        }                       
-                    } /*end of reading in next output block */
-                }	/* end of run */
-
-                if (record2[0] > 0)
-                {   /* Tuples in output block to write out */
-                    fseek(outputFile, lastWritePos, SEEK_SET);
-
-                    /* setup header */
-                    *((int32_t *) buffer) = currentBlockId;
-                    *((int16_t *) (buffer + BLOCK_COUNT_OFFSET)) = (int16_t) (record2[0]-es->headerSize)/es->record_size + 1; 
-                    currentBlockId++;
-
-                    if (0 == fwrite(buffer + OUTPUT_BLOCK_ID * es->page_size, (size_t)es->page_size, 1, outputFile)) 
-                    {   /* File write error - arduino prints 1st value nmemb times if nmemb != 1 */
-                        free(record1); free(record2); free(sublsBlkPos); free(sublsFilePtr);
-                        return 9;
-                    }                    
-
-                    lastWritePos		        = ftell(outputFile);
-                    record2[OUTPUT_BLOCK_ID]	= -1;
-                    metric->num_writes          += 1;
-
-                    #ifdef DEBUG_OUTPUT
-                    printf("Wrote output block here.\n");
-                    for (int k=0; k < tuplesPerPage; k++)
-                    {
-                        test_record_t *buf = (void*) (buffer+es->headerSize+k*es->record_size);
-                        printf("%d: Output Record: %d  Address: %p\n", k, buf->key, (void*) (buffer+es->headerSize+k*es->record_size));
-                    }
-                    #endif
-                }
+/* Source of the records of a sorted stream */
+#define SORT_STREAM_NONE            0
+#define SORT_STREAM_RUN             1       /* Single run written by run generation */
+#define SORT_STREAM_MERGE           2       /* Final merge of the sublists of the last pass */
+#define SORT_STREAM_MINSORT         3
+#define SORT_STREAM_MINSORT_SUBLIST 4
 
-            }	/* end of runs */
+/**
+ * Sorted stream (see adaptive_sort_open()). Holds the state of the final merge or MinSort between calls.
+ */
+struct adaptive_sort_stream {
+    int8_t              source;
+    int8_t              err;            /* Read error of adaptive_sort_next() */
+    external_sort_t     es;             /* For MinSort, num_pages is the pages of the sorted runs */
+    metrics_t           *metric;
+    ION_FILE            *file;
+    char                *buffer;
+    void                *tupleBuffer;
+    int32_t             pagesOut;       /* Pages returned by adaptive_sort_next_page() */
+    int32_t             page;           /* Single run: next page and number of pages */
+    int32_t             numPages;
+    int16_t             recordIdx;      /* Single run: next record of current page and records in page */
+    int16_t             numRecords;
+    sort_codec_cursor_t cursor;         /* Single run: decoding position in current page if encoded */
+    merge_run_t         merge;          /* Final merge. One block of each sublist. */
+    int16_t             lastBlock;      /* Final merge: block of record returned by last call or -1 */
+    MinSortState        ms;
+    MinSortStateSublist mss;
+    char                *aggRecords;    /* With an aggregate, record returned and first record of next key. Allocated by first call. */
+    int8_t              havePending;    /* 1 if first record of next key has been read */
+};
 
-            numSublist                  = numRuns;      /* each run produces 1 sublist */
-            lastMergeStart			    = mergeSOW;     /* next merge reads where this one started writing */
-            lastMergeEnd                = lastWritePos;            
-        }	/* end of merge */
+/**
+ * Initializes a stream that has not been opened.
+ */
+static void streamInit(adaptive_sort_stream_t *stream, external_sort_t *es, metrics_t *metric, ION_FILE *file, char *buffer, void *tupleBuffer)
+{
+    memset(stream, 0, sizeof(adaptive_sort_stream_t));
+    stream->source      = SORT_STREAM_NONE;
+    stream->es          = *es;
+    stream->metric      = metric;
+    stream->file        = file;
+    stream->buffer      = buffer;
+    stream->tupleBuffer = tupleBuffer;
+}
+
+/**
+ * Frees the state of the final merge or MinSort of a stream.
+ */
+static void streamClose(adaptive_sort_stream_t *stream)
+{
+    switch (stream->source)
+    {
+        case SORT_STREAM_MERGE:
+            mergeRunFree(&stream->merge);
+            break;
+        case SORT_STREAM_MINSORT:
+            close_MinSort(&stream->ms, &stream->es);
+            break;
+        case SORT_STREAM_MINSORT_SUBLIST:
+            free(stream->mss.index.min); free(stream->mss.index.exhausted); free(stream->mss.offset); free(stream->mss.index.heap);
+            close_MinSort_sublist(&stream->mss, &stream->es);
+            break;
+    }
+    free(stream->aggRecords);
+    stream->aggRecords  = NULL;
+    stream->source      = SORT_STREAM_NONE;
+    metrics_phase_end(stream->metric, &stream->es);
+}
+
+/**
+ * Streams the single run written by run generation starting at the start of the output file.
+ */
+static void streamOpenRun(adaptive_sort_stream_t *stream, int32_t numPages)
+{
+    stream->source      = SORT_STREAM_RUN;
+    stream->page        = 0;
+    stream->numPages    = numPages;
+    stream->recordIdx   = 0;
+    stream->numRecords  = 0;
+}
+
+/**
+ * Takes over the state of worker 0 of the merge phase to merge the numSublist sublists of the last pass as records are requested.
+ * Blocks are read with stdio as I/O threads and the file mapping are closed when the sort returns. Returns 0 if success, 10 if read error.
+ */
+static int8_t streamOpenMerge(adaptive_sort_stream_t *stream, merge_run_t *mr, run_directory_t *inDir, long lastMergeStart, long lastMergeEnd, int32_t numSublist)
+{
+    merge_run_t     *sm = &stream->merge;
+    external_sort_t *es = &stream->es;
+    long            ptrLastBlock = lastMergeEnd;
+    int32_t         dirRun = numSublist;
+    int32_t         i;
+
+    mergeWriteWait(mr);
+    *sm = *mr;
+    free(sm->readRequests); free(sm->writePages);
+    sm->readRequests    = NULL;
+    sm->writePages      = NULL;
+    sm->io              = NULL;
+    sm->map             = NULL;
+    sm->positional      = 0;
+    sm->es              = es;
+    sm->tree.es         = es;
+    sm->tree.metric     = stream->metric;
+    sm->numSublists     = numSublist;
+    stream->source      = SORT_STREAM_MERGE;
+    stream->lastBlock   = -1;
+    fflush(stream->file);
+
+    if (mergeFindSublists(sm, inDir, run_directory_matches(inDir, numSublist, lastMergeStart), &dirRun, &ptrLastBlock, lastMergeStart) != 0)
+        return 10;
+    for (i = 0; i < numSublist; i++)
+    {
+        if (mergeReadBlock(sm, sm->sublsFilePtr[i], sm->buffer + i * es->page_size) != 0)
+            return 10;
+        stream->metric->num_reads++;
+        sm->record1[i] = i * es->page_size + es->headerSize;
+        sm->record2[i] = -1;            /* Nothing is output into the buffer, so no block holds output records */
+        if (es->codec != SORT_CODEC_NONE)
+        {
+            sort_codec_rewind(&sm->cursors[i]);
+            if (mergeCodecNext(sm, i) != 0)
+                return 10;
+        }
+    }
+    sm->tree.numBlocks = (int16_t) numSublist;
+    mergeTreeBuild(&sm->tree);
+    return 0;
+}
+
+/**
+ * Initializes regular MinSort over the sorted runs to produce records as they are requested. Returns 0 if success, 8 if out of memory.
+ */
+static int8_t streamOpenMinSort(adaptive_sort_stream_t *stream, void *iteratorState, char *buffer, int bufferSizeInBytes, external_sort_t *esRuns)
+{
+    MinSortState *ms = &stream->ms;
+
+    stream->es          = *esRuns;
+    ms->buffer          = buffer;
+    ms->iteratorState   = iteratorState;
+    ms->memoryAvailable = bufferSizeInBytes;
+    ms->num_records     = ((file_iterator_state_t*) iteratorState)->totalRecords;
+
+    metrics_phase_begin(stream->metric, METRICS_PHASE_MINSORT_INIT, 0);
+    init_MinSort(ms, &stream->es, stream->metric);
+    metrics_phase_end(stream->metric, &stream->es);
+    stream->source = SORT_STREAM_MINSORT;
+    if (stream->es.codec != SORT_CODEC_NONE && ms->record == NULL)
+        return 8;
+    metrics_phase_begin(stream->metric, METRICS_PHASE_MINSORT_OUTPUT, 0);
+    return 0;
+}
+
+/**
+ * Initializes MinSort over numSublist sorted sublists starting at fileOffset to produce records as they are requested.
+ * Returns 0 if success, 8 if out of memory.
+ */
+static int8_t streamOpenMinSortSublist(adaptive_sort_stream_t *stream, void *iteratorState, char *buffer, int bufferSizeInBytes, external_sort_t *esRuns,
+                long fileOffset, int32_t numSublist, run_directory_t *runDir)
+{
+    MinSortStateSublist *ms = &stream->mss;
+
+    stream->es          = *esRuns;
+    ms->buffer          = buffer;
+    ms->iteratorState   = iteratorState;
+    ms->memoryAvailable = bufferSizeInBytes;
+    ms->num_records     = ((file_iterator_state_t*) iteratorState)->totalRecords;
+    ms->numRegions      = numSublist;
+    ms->fileOffset      = fileOffset;
+    ms->runDir          = runDir;
+
+    metrics_phase_begin(stream->metric, METRICS_PHASE_MINSORT_SUBLIST_INIT, 0);
+    init_MinSort_sublist(ms, &stream->es, stream->metric);
+    metrics_phase_end(stream->metric, &stream->es);
+    stream->source  = SORT_STREAM_MINSORT_SUBLIST;
+    ms->runDir      = NULL;         /* Only used by init. Freed when the sort returns. */
+    if (ms->index.min == NULL || ms->index.exhausted == NULL || ms->offset == NULL || (stream->es.codec != SORT_CODEC_NONE && ms->record == NULL))
+        return 8;
+    metrics_phase_begin(stream->metric, METRICS_PHASE_MINSORT_SUBLIST_OUTPUT, 0);
+    return 0;
+}
+
+/**
+ * Returns the next record of the single run or NULL if none are left.
+ */
+static char* streamNextRun(adaptive_sort_stream_t *stream)
+{
+    external_sort_t *es = &stream->es;
+
+    while (stream->recordIdx >= stream->numRecords)
+    {
+        if (stream->page >= stream->numPages)
+            return NULL;
+        /* Seek each page as the output of the stream may be written to the same file */
+        fseek(stream->file, (long) stream->page * es->page_size, SEEK_SET);
+        if (0 == fread(stream->buffer, (size_t)es->page_size, 1, stream->file))
+        {
+            stream->err = 10;
+            return NULL;
+        }
+        stream->metric->num_reads++;
+        stream->page++;
+        stream->recordIdx   = 0;
+        stream->numRecords  = *((int16_t *) (stream->buffer + BLOCK_COUNT_OFFSET));
+        sort_codec_rewind(&stream->cursor);
+    }
+    if (es->codec != SORT_CODEC_NONE)
+    {   /* Run pages are encoded, so records are decoded into the tuple buffer */
+        stream->recordIdx++;
+        sort_codec_read(es, stream->buffer, &stream->cursor, stream->tupleBuffer);
+        return (char*) stream->tupleBuffer;
+    }
+    return stream->buffer + es->headerSize + (stream->recordIdx++) * es->record_size;
+}
+
+/**
+ * Returns the next record of the final merge or NULL if none are left. Records are returned in place in the buffer,
+ * so the sublist of the previous record is advanced (reading its next block if needed) before the next smallest record is found.
+ */
+static char* streamNextMerge(adaptive_sort_stream_t *stream)
+{
+    merge_run_t     *mr = &stream->merge;
+    external_sort_t *es = &stream->es;
+    int16_t         blk = stream->lastBlock;
+
+    if (blk != -1 && es->codec != SORT_CODEC_NONE)
+    {   /* Records of encoded blocks are decoded one at a time (see mergeRunCodec()) */
+        if (mergeCodecNext(mr, blk) != 0)
+        {
+            stream->err = 10;
+            stream->lastBlock = -1;
+            return NULL;
+        }
+        mergeTreeUpdate(&mr->tree, blk, blk);
+        stream->lastBlock = -1;
+    }
+    else if (blk != -1)
+    {
+        mr->record1[blk] += es->record_size;
+        if (mr->record1[blk] >= blk * es->page_size + (*((int16_t *) (mr->buffer + blk * es->page_size + BLOCK_COUNT_OFFSET))) * es->record_size + es->headerSize)
+        {   /* Block is exhausted. Read next block of sublist if there is one. */
+            if (mr->sublsBlkPos[blk] != -1 && mr->sublsBlkPos[blk] < mr->blocksInSublist[blk] - 1)
+            {
+                mr->sublsBlkPos[blk]++;
+                mr->sublsFilePtr[blk] += es->page_size;
+                if (mergeReadBlock(mr, mr->sublsFilePtr[blk], mr->buffer + blk * es->page_size) != 0)
+                {
+                    stream->err = 10;
+                    stream->lastBlock = -1;
+                    return NULL;
+                }
+                stream->metric->num_reads++;
+                mr->record1[blk] = blk * es->page_size + es->headerSize;
+            }
+            else
+                mr->record1[blk] = -1;
+        }
+        mergeTreeUpdate(&mr->tree, blk, blk);
+        stream->lastBlock = -1;
+    }
+
+    if (mr->tree.node[1] == -1)
+        return NULL;
+    blk = mr->tree.node[1] / 2;
+    stream->lastBlock = blk;
+    return mr->tree.buffer + mr->record1[blk];
+}
+
+/**
+ * Returns the next record of the final merge or MinSort before aggregation or NULL if none are left.
+ */
+static char* streamNext(adaptive_sort_stream_t *stream)
+{
+    switch (stream->source)
+    {
+        case SORT_STREAM_RUN:
+            return streamNextRun(stream);
+        case SORT_STREAM_MERGE:
+            return streamNextMerge(stream);
+        case SORT_STREAM_MINSORT:
+            return next_MinSort(&stream->ms, &stream->es, stream->tupleBuffer, stream->metric);
+        case SORT_STREAM_MINSORT_SUBLIST:
+            return next_MinSort_sublist(&stream->mss, &stream->es, stream->tupleBuffer, stream->metric);
+    }
+    return NULL;
+}
+
+/**
+ * Returns the next record combining all records with its key or NULL if none are left. Records of a key are read until
+ * a record with a larger key is found, which is kept as the first record of the next call.
+ */
+static char* streamNextAggregate(adaptive_sort_stream_t *stream)
+{
+    external_sort_t *es = &stream->es;
+    char            *result, *pending, *record;
+
+    if (stream->aggRecords == NULL)
+    {
+        stream->aggRecords = (char*) malloc(2 * (size_t) es->record_size);
+        if (stream->aggRecords == NULL)
+        {
+            stream->err = 8;
+            return NULL;
+        }
+    }
+    result  = stream->aggRecords;
+    pending = stream->aggRecords + es->record_size;
+
+    if (stream->havePending)
+        memcpy(result, pending, es->record_size);
+    else if ((record = streamNext(stream)) != NULL)
+        memcpy(result, record, es->record_size);
+    else
+        return NULL;
+
+    stream->havePending = 0;
+    while ((record = streamNext(stream)) != NULL)
+    {
+        stream->metric->num_compar++;
+        if (es->compare_fcn(result, record) != 0)
+        {
+            memcpy(pending, record, es->record_size);
+            stream->havePending = 1;
+            break;
+        }
+        sort_aggregate_combine(es, result, record);
+    }
+    return result;
+}
+
+/**
+ * Writes page as block blockIndex of the output of a stream at file offset writePos and advances writePos.
+ * Returns 0 if success, 9 if write error.
+ */
+static int8_t streamWriteBlock(adaptive_sort_stream_t *stream, char *page, int32_t blockIndex, long *writePos)
+{
+    *((int32_t *) page) = blockIndex;
+    fseek(stream->file, *writePos, SEEK_SET);
+    if (0 == fwrite(page, (size_t)stream->es.page_size, 1, stream->file))
+        return 9;
+    stream->metric->num_writes++;
+    *writePos += stream->es.page_size;
+    return 0;
+}
+
+/**
+ * Writes the first limit records (all records if limit is 0) of a stream as blocks starting at file offset writePos.
+ * Block 1 of the sort buffer is the output block as MinSort and a single run stream do not use it. Variable length
+ * records are written to slotted pages (see sort_codec_output()), which are encoded in a page allocated by this call.
+ * Returns 0 if success, 8 if out of memory, 9 if write error, 10 if read error.
+ */
+static int8_t streamWrite(adaptive_sort_stream_t *stream, long writePos, int32_t limit)
+{
+    external_sort_t *es = &stream->es;
+    char            *outputBuffer = stream->buffer + es->page_size;
+    int16_t         tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+    int16_t         count = 0;
+    int32_t         blockIndex = 0;
+    int32_t         numRecords;
+    char            *record;
+    int8_t          err = 0;
+    sort_codec_writer_t writer;
+
+    writer.page = writer.first = NULL;
+    writer.count = 0;
+    if (sort_codec_output(es) != SORT_CODEC_NONE)
+    {
+        if (sort_codec_writer_init(&writer, es) != 0)
+            return 8;
+        sort_codec_reset(&writer, es, sort_codec_output(es));
+    }
+
+    for (numRecords = 0; (limit == 0 || numRecords < limit) && err == 0; numRecords++)
+    {
+        record = adaptive_sort_next(stream);
+        if (record == NULL)
+            break;
+        if (writer.page != NULL)
+        {
+            if (!sort_codec_add(&writer, es, record))
+            {   /* Write full page and start the next page with record */
+                err = streamWriteBlock(stream, writer.page, blockIndex++, &writePos);
+                sort_codec_reset(&writer, es, writer.codec);
+                sort_codec_add(&writer, es, record);
+            }
+        }
+        else
+        {
+            memcpy(outputBuffer + es->headerSize + count * es->record_size, record, (size_t)es->record_size);
+            count++;
+            if (count == tuplesPerPage)
+            {   /* Write block */
+                *((int16_t *) (outputBuffer + BLOCK_COUNT_OFFSET)) = count;
+                err = streamWriteBlock(stream, outputBuffer, blockIndex++, &writePos);
+                count = 0;
+            }
+        }
+    }
+
+    /* Write last block */
+    if (err == 0 && writer.count > 0)
+        err = streamWriteBlock(stream, writer.page, blockIndex, &writePos);
+    else if (err == 0 && count > 0)
+    {
+        *((int16_t *) (outputBuffer + BLOCK_COUNT_OFFSET)) = count;
+        err = streamWriteBlock(stream, outputBuffer, blockIndex, &writePos);
+    }
+    sort_codec_writer_free(&writer);
+    return err != 0 ? err : stream->err;
+}
+
+/**
+ * MinSort that writes its output through a stream so it stops after limit records (if not 0) and combines records with
+ * equal keys if es->aggregate is set. Output is written after the sorted input like flash_minsort() and flash_minsort_sublist().
+ * numSublist 0 uses regular MinSort, otherwise MinSort with sorted sublists. Returns 0 if success, 8 if out of memory,
+ * 9 if write error, 10 if read error.
+ */
+static int8_t minsortWrite(void *iteratorState, void *tupleBuffer, ION_FILE *outputFile, char *buffer, int bufferSizeInBytes, external_sort_t *esRuns,
+                long fileOffset, int32_t numSublist, run_directory_t *runDir, metrics_t *metric, int32_t limit)
+{
+    adaptive_sort_stream_t  stream;
+    int8_t                  err;
+
+    streamInit(&stream, esRuns, metric, outputFile, buffer, tupleBuffer);
+    if (numSublist == 0)
+        err = streamOpenMinSort(&stream, iteratorState, buffer, bufferSizeInBytes, esRuns);
+    else
+        err = streamOpenMinSortSublist(&stream, iteratorState, buffer, bufferSizeInBytes, esRuns, fileOffset, numSublist, runDir);
+    if (err == 0)
+        err = streamWrite(&stream, fileOffset + (long) esRuns->num_pages * esRuns->page_size, limit);
+    streamClose(&stream);
+    return err;
+}
+
+/**
+ * Writes the page of the run generation codec writer as block blockId of the current run and empties it. Runs with a
+ * first block are counted in runsWritten. pipeline is NULL if run writes are not pipelined. Returns 0 if success, 9 if write error.
+ */
+static int8_t runWriteCodecPage(sort_codec_writer_t *w, int32_t *blockId, int32_t *runsWritten, run_pipeline_t *pipeline, ION_FILE *outputFile,
+                run_directory_t *runDir, external_sort_t *es, metrics_t *metric)
+{
+    *((int32_t *) w->page) = *blockId;
+    if (pipeline != NULL ? run_pipeline_write(pipeline, w->page) != 0 : 0 == fwrite(w->page, es->page_size, 1, outputFile))
+        return 9;
+    run_directory_add_block(runDir, *blockId, w->count, w->first, es);
+    metric->num_writes++;
+    if (*blockId == 0)
+        (*runsWritten)++;
+    (*blockId)++;
+    sort_codec_reset(w, es, es->codec);
+    return 0;
+}
+
+/**
+ * Inserts a record into the replacement selection heap of heapSize records with root at heap.
+ * If heapPrefix is not NULL, it holds the key prefix of each heap entry so most comparisons are integer comparisons.
+ */
+static void runHeapInsert(char *heap, uint32_t *heapPrefix, void *tuple, int32_t heapSize, external_sort_t *es, metrics_t *metric)
+{
+    if (heapPrefix != NULL)
+        shiftUp_rev_prefix(heap, heapPrefix, tuple, sort_key_prefix(es, tuple), heapSize, es, metric);
+    else
+        shiftUp_rev(heap, tuple, heapSize, es, metric);
+}
+
+/**
+ * Replaces the root of the replacement selection heap with a record and restores the heap (see runHeapInsert()).
+ */
+static void runHeapReplace(char *heap, uint32_t *heapPrefix, void *tuple, int32_t heapSize, external_sort_t *es, metrics_t *metric)
+{
+    if (heapPrefix != NULL)
+        heapify_rev_prefix(heap, heapPrefix, tuple, sort_key_prefix(es, tuple), heapSize, es, metric);
+    else
+        heapify_rev(heap, tuple, heapSize, es, metric);
+}
+
+/**
+ * Reads records of the input of run generation into addr until maxPages pages of records are read or the input ends.
+ * pipeline is NULL if input reads are not pipelined. Returns the number of records read.
+ */
+static int32_t runFill(int (*iterator)(void *state, void* buffer, external_sort_t *es), void *iteratorState, run_pipeline_t *pipeline,
+                char *addr, int32_t maxPages, int16_t tuplesPerPage, external_sort_t *es)
+{
+    int32_t i, recordsRead = 0;
+    int16_t status;
+
+    if (pipeline != NULL)
+    {
+        for (i = 0; i < maxPages; i++)
+        {
+            status = run_pipeline_read(pipeline, addr);
+            recordsRead += status;
+            addr += status*es->record_size;
+            if (status < tuplesPerPage)
+                break;
+        }
+    }
+    else
+    {
+        for (i = 0; i < maxPages*tuplesPerPage; i++)
+        {
+            if (iterator(iteratorState, addr, es) == 0)
+                break;
+            recordsRead++;
+            addr += es->record_size;
+        }
+    }
+    return recordsRead;
+}
+
+/**
+ * Checks a page of count records for the natural run of run generation (see adaptiveSort()). Returns 1 if the page continues the
+ * natural run, which is if its records are ascending and the first is not less than lastOutputKey or lastOutputKey is NULL.
+ * A page that is not ascending ends the natural run even if sorting it would continue the run, as a large key out of place
+ * would end the natural run at the next page while replacement selection holds it in the heap until it can be output.
+ * Pages of the run pipeline are sorted, so are only checked to count distinct keys. numDistinct counts the distinct keys of
+ * the run up to 255 and is only updated if the page continues the run.
+ */
+static int8_t naturalRunPage(char *records, int16_t count, void *lastOutputKey, int8_t sorted, uint8_t *numDistinct,
+                external_sort_t *es, metrics_t *metric)
+{
+    uint8_t distinct = *numDistinct;
+    int8_t  c;
+    int16_t i;
+    char    *rec = records;
+
+    if (lastOutputKey != NULL)
+    {
+        metric->num_compar++;
+        c = es->compare_fcn(records, lastOutputKey);
+        if (c < 0)
+            return 0;
+        if (c > 0 && distinct < 255)
+            distinct++;
+    }
+    for (i = 1; i < count && (!sorted || distinct < 255); i++, rec += es->record_size)
+    {
+        metric->num_compar++;
+        c = es->compare_fcn(rec, rec + es->record_size);
+        if (c > 0)
+            return 0;
+        if (c < 0 && distinct < 255)
+            distinct++;
+    }
+    *numDistinct = distinct;
+    return 1;
+}
+
+/**
+ * Returns 1 if compare_fcn orders count consecutive records the same way as their keys described by key_type, key_size and
+ * key_offset, or the key type is not supported. MinSort, the radix sort, the heap key prefixes and the page codecs order
+ * records by the key descriptor and the rest of the sort by compare_fcn, so a sort where they disagree is not ordered.
+ * Records with equal keys may be in any order of compare_fcn.
+ */
+static int8_t keyOrderMatches(char *records, int32_t count, external_sort_t *es, metrics_t *metric)
+{
+    int32_t  i;
+    uint64_t a, b;
+    int8_t   c;
+
+    if (!sort_key_supported(es))
+        return 1;
+    for (i = 1; i < count; i++)
+    {
+        a = sort_key_normalize(es, records + (i-1)*es->record_size);
+        b = sort_key_normalize(es, records + i*es->record_size);
+        c = es->compare_fcn(records + (i-1)*es->record_size, records + i*es->record_size);
+        metric->num_compar++;
+        if ((a < b && c >= 0) || (a > b && c <= 0))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Estimates the number of distinct keys of the input from a sketch of the keys of up to OPTIMISTIC_SAMPLE_PAGES pages
+ * spread evenly over the input file. Pages are read into page and encoded records decoded into record. The file position
+ * is not restored. Returns 0 if the input is empty, a page cannot be read or the key descriptor and compare_fcn disagree
+ * on the order of the records of a page (see keyOrderMatches()).
+ */
+static uint32_t sampleDistinct(ION_FILE *file, char *page, char *record, external_sort_t *es, metrics_t *metric)
+{
+    uint32_t numSample = es->num_pages < OPTIMISTIC_SAMPLE_PAGES ? es->num_pages : OPTIMISTIC_SAMPLE_PAGES;
+    uint32_t i;
+    int16_t  j, count;
+    char     *rec;
+    sort_estimate_t distinct;
+    sort_codec_cursor_t cursor;
+
+    sort_estimate_clear(&distinct);
+    for (i = 0; i < numSample; i++)
+    {
+        fseek(file, (long) ((uint64_t) i * es->num_pages / numSample) * es->page_size, SEEK_SET);
+        if (0 == fread(page, es->page_size, 1, file))
+            return 0;
+        metric->num_reads++;
+
+        count = *((int16_t *) (page + BLOCK_COUNT_OFFSET));
+        if (es->codec == SORT_CODEC_NONE && !keyOrderMatches(page + es->headerSize, count, es, metric))
+            return 0;       /* Run generation reports the error */
+        sort_codec_rewind(&cursor);
+        for (j = 0; j < count; j++)
+        {
+            rec = page + es->headerSize + j * es->record_size;
+            if (es->codec != SORT_CODEC_NONE)
+            {
+                sort_codec_read(es, page, &cursor, record);
+                rec = record;
+            }
+            sort_estimate_add(&distinct, sort_key_normalize(es, rec));
+        }
+    }
+    return sort_estimate_count(&distinct);
+}
+
+/**
+ * MinSorts the input file directly, without run generation, if its keys are estimated to be few enough that MinSort reads
+ * cost less than writing runs and merging them. Costs are in tenths of a read of the input per input page. MinSort reads
+ * each page once for each distinct key of its region, which is at most the distinct keys of the input. Run generation and
+ * merging write runs and read and write them in each pass but the last. Reading the input and writing the output cost
+ * the same either way.
+ *
+ * The distinct keys are first estimated from a sample of input pages. If MinSort is chosen, the initial scan of MinSort
+ * counts the keys of every page. If the count shows that the sample missed too many keys, MinSort is abandoned before any
+ * output is written and the input is sorted with run generation, losing only the scan. If stream is not NULL, MinSort
+ * is set up in the stream rather than written. Returns 1 if the input was sorted or opened in the stream with *err set to
+ * 0 if success, 8 if out of memory, 9 if write error or 10 if read error. Returns 0 if run generation is to be used.
+ */
+static int8_t optimisticMinSort(void *iteratorState, void *tupleBuffer, ION_FILE *outputFile, char *buffer, int bufferSizeInBlocks,
+                external_sort_t *es, long *resultFilePtr, metrics_t *metric, int8_t writeToReadRatio, int8_t randomReadRatio,
+                int32_t limit, adaptive_sort_stream_t *stream, int8_t *err)
+{
+    file_iterator_state_t   *input = (file_iterator_state_t*) iteratorState;
+    external_sort_t         esInput = *es;
+    adaptive_sort_stream_t  direct;
+    adaptive_sort_stream_t  *s = stream != NULL ? stream : &direct;
+    int32_t                 numRuns, sortCost;
+    uint32_t                numDistinct;
+    long                    inputPos;
+
+    /* MinSort orders keys itself and needs input, output and index blocks. COUNT values are only set as records are written
+       to runs. Tags of adaptive_sort_tag() are not in a file. */
+    if (!sort_key_supported(es) || bufferSizeInBlocks < 3 || es->aggregate == SORT_AGGREGATE_COUNT || input->file == NULL)
+        return 0;
+
+    /* Replacement selection runs are about twice the size of the heap */
+    numRuns = (int32_t) (es->num_pages / (2 * (bufferSizeInBlocks - 1))) + 1;
+    if (numRuns <= 1)
+        return 0;
+    sortCost = (int32_t) ceil(log(numRuns) / log(bufferSizeInBlocks)) * (10 + writeToReadRatio);
+
+    /* Input pages are in the format of the output: standard blocks, or slotted pages of variable length records */
+    esInput.codec = sort_codec_output(es);
+    inputPos = ftell(input->file);
+    numDistinct = sampleDistinct(input->file, buffer, (char*) tupleBuffer, &esInput, metric);
+    fseek(input->file, inputPos, SEEK_SET);
+    printf("Optimistic MinSort. Sampled distinct keys: %lu  MinSort cost: %ld  Run generation and merge cost: %ld\n",
+            (unsigned long) numDistinct, (long) numDistinct * randomReadRatio, (long) sortCost);
+    if (numDistinct == 0 || (int32_t) numDistinct * randomReadRatio >= sortCost)
+        return 0;
+
+    if (stream == NULL)
+        streamInit(&direct, &esInput, metric, outputFile, buffer, tupleBuffer);
+    *err = streamOpenMinSort(s, iteratorState, buffer, bufferSizeInBlocks * es->page_size, &esInput);
+    if (*err == 0 && (int32_t) s->ms.numDistinct * randomReadRatio >= sortCost)
+    {
+        printf("Distinct keys: %u. Using run generation.\n", s->ms.numDistinct);
+        streamClose(s);
+        s->es = *es;
+        fseek(input->file, inputPos, SEEK_SET);
+        return 0;
+    }
+
+    printf("Performing MinSort Optimistic\n");
+    if (*err == 0 && stream == NULL)
+    {
+        *resultFilePtr = 0;
+        *err = streamWrite(s, 0, limit);
+    }
+    if (stream == NULL)
+        streamClose(&direct);
+    return 1;
+}
+
+/**
+@brief      Adaptive sort combining no output buffer sort and MinSort that dynamically determines best sorting
+                algorithm based on input distribution. Uses replacement selection.
+@param      iterator
+                Row iterator for reading input rows
+@param      iteratorState
+                Structure stores state of iterator (file info etc.)
+@param      tupleBuffer
+                Pre-allocated space to store one tuple (row) of input being sorted
+@param      outputFile
+                Already opened file to store sorting output (and in-progress temporary results)
+@param      buffer
+                Pre-allocated space used by algorithm during sorting
+@param      bufferSizeInBlocks
+                Size of buffer in blocks
+@param      es
+                Sorting state info (block size, record size, etc.)
+@param      resultFilePtr
+                Offset within output file of first output record
+@param      metric
+                Tracks algorithm metrics (I/Os, comparisons, memory swaps)
+@param      compareFn
+                Record comparison function for record ordering
+@param      runGenOnly
+                True if generate sorted runs but not whole merge process
+@param      writeToReadRatio
+                Write time divided by read time multiplied by 10. If ratio is 2.5 
+                (writes over twice as expensive) then value is 25. ADAPTIVE_SORT_DEVICE_PROFILE
+                uses the ratios of the calibrated device profile (see device_profile.h).
+@param      limit
+                If not 0, only the smallest limit records are sorted and output (see adaptive_sort_limit())
+@param      stream
+                If not NULL, the final merge or MinSort is set up in the stream rather than performed
+                (see adaptive_sort_open())
+*/
+static int adaptiveSort(
+    int     (*iterator)(void *state, void* buffer, external_sort_t *es),
+    void    *iteratorState,
+	void    *tupleBuffer,
+    ION_FILE *outputFile,		
+	char    *buffer,        
+	int     bufferSizeInBlocks,
+	external_sort_t *es,
+	long    *resultFilePtr,
+	metrics_t *metric,
+    int8_t  (*compareFn)(void *a, void *b),
+    int8_t  runGenOnly,
+    int8_t  writeToReadRatio,
+    int32_t limit,
+    adaptive_sort_stream_t *stream
+)
+{
+    printf("Adaptive sort with Replacement Selection for Run Generation\n");
+	unsigned long startMillis = millis();
+    
+    int16_t     tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;	
+	long        lastWritePos = 0;	
+    int32_t     i;
+    int16_t     status;
+	int32_t     numSublist=0;
+    run_directory_t runDir;                 /* Runs written by run generation (see run_directory.h) */
+	void        *addr;
+    int32_t     numShiftOutOutput = 0, numShiftIntoOutput = 0, numShiftOtherBlock = 0;     
+    int8_t      err = 0;
+
+    /* Distribution estimation variables */
+    int16_t avgDistinct = 0;                /* Average # of distinct values per run. Multiplied by 10 so can do integer rather than float operations. */
+                                            /* Note: Could be int8_t as larger than 255 is above cutoff for using MinSort. */
+    uint8_t  numDistinctInRun = 0;          /* Number of distinct values in current run */
+
+    /* Random read time divided by sequential read time multiplied by 10. MinSort reads are not sequential. */
+    int8_t   randomReadRatio = DEVICE_PROFILE_DEFAULT_RANDOM_RATIO;
+    if (writeToReadRatio < 0)
+    {
+        const device_profile_t *profile = device_profile_get_active();
+        writeToReadRatio = device_profile_write_ratio(profile, es->page_size);
+        randomReadRatio  = device_profile_random_ratio(profile, es->page_size);
+        printf("Device profile: %s  Write/read ratio: %d  Random/sequential read ratio: %d\n",
+                profile == NULL ? "default" : "calibrated", writeToReadRatio, randomReadRatio);
+    }
+
+    /* Keys the page codec cannot encode are sorted in unencoded pages */
+    external_sort_t esPlain;
+    if (!sort_codec_supported(es))
+    {
+        esPlain         = *es;
+        esPlain.codec   = SORT_CODEC_NONE;
+        es              = &esPlain;
+        if (stream != NULL)
+            stream->es.codec = SORT_CODEC_NONE;
+    }
+
+    /* Few distinct keys may make MinSort of the input cheaper than writing runs (see optimisticMinSort()) */
+    int8_t optimistic = runGenOnly ? 0 : optimisticMinSort(iteratorState, tupleBuffer, outputFile, buffer, bufferSizeInBlocks, es,
+                            resultFilePtr, metric, writeToReadRatio, randomReadRatio, limit, stream, &err);
+    if (optimistic)
+        return err;
+
+    metrics_phase_begin(metric, METRICS_PHASE_RUN_GENERATION, 0);
+
+    /* Replacement selection runs are usually at least as long as the heap, so this is rarely exceeded */
+    run_directory_init(&runDir, runGenOnly ? 0 : es->num_pages / (bufferSizeInBlocks-1) + 2, es);
+
+    /* Scratch space for in-memory sort of each input block. Allocated once for all blocks.
+       Radix sort needs space for a block of records so falls back to introsort if it is not available. */
+    void *sortScratch = NULL;
+    int8_t useRadix = sort_key_supported(es) && tuplesPerPage >= IN_MEMORY_RADIX_MIN_VALUES;
+    if (useRadix)
+    {
+        sortScratch = malloc(IN_MEMORY_RADIX_SCRATCH_SIZE(tuplesPerPage, es->record_size));
+        useRadix = sortScratch != NULL;
+    }
+    if (!useRadix)
+        sortScratch = malloc(es->record_size);
+    if (sortScratch == NULL)
+    {
+        run_directory_free(&runDir);
+        return 8;
+    }
+
+    /* With a page codec, records of each output block are encoded into pages of the run (see sort_codec.h).
+       Encoded pages hold a different number of records than output blocks, so they have their own block ids. */
+    sort_codec_writer_t codecWriter;
+    int32_t codecBlock = 0;
+    codecWriter.page = codecWriter.first = NULL;
+    codecWriter.count = 0;
+    if (es->codec != SORT_CODEC_NONE)
+    {
+        if (sort_codec_writer_init(&codecWriter, es) != 0)
+        {
+            free(sortScratch);
+            run_directory_free(&runDir);
+            return 8;
+        }
+        sort_codec_reset(&codecWriter, es, es->codec);
+    }
+
+    /* With a limit, only the first limit records of each run can be in the result, so later pages of a run are not written.
+       The last of the first limit records of a run bounds the result. Pages starting after the smallest bound are not written either. */
+    int32_t recordsInRun    = 0;
+    int32_t runsWritten     = 0;
+    int16_t writeCount;
+    int8_t  haveLimitKey    = 0;
+    char    *limitKey       = limit > 0 ? (char*) malloc(es->key_offset + es->key_size) : NULL;
+
+    /* Overlap input reads and run writes with replacement selection if supported (see run_pipeline.h).
+       Input pages arrive sorted. */
+    run_pipeline_t pipeline;
+    int8_t pipelined = run_pipeline_start(&pipeline, iterator, iteratorState, outputFile, es, useRadix, sortScratch) == 0;
+    if (pipelined)
+        printf("Pipelined run generation. Queue depth: %d pages\n", pipeline.depth);
+
+    /* Replacement selection variables */
+    int32_t recordsRead     = 0;    
+    int32_t heapSize        = 0;
+    int32_t heapStartOffset = bufferSizeInBlocks*es->page_size - es->record_size;
+    int32_t listSize        = 0; 
+
+    /* Key prefix of each heap entry. Heap compares records with compare_fcn if key type is not supported or memory is not available. */
+    uint32_t *heapPrefix    = sort_key_supported(es) ? (uint32_t*) malloc(sizeof(uint32_t) * (bufferSizeInBlocks-1) * tuplesPerPage) : NULL;
+
+    /* -----Replacement Selection----- */	
+    /* Fill all blocks other than first (input block) with tuples */
+    /* TODO: This algorithm may be improved for M=2 case by using merging and alternating output block rather than using a heap.
+            Unclear if any optimization for M=3 and above that is worth the added complexity.
+            Idea: Sort each block and then perform merge like merge code. Advanced the output block every output which would work great for sorted input.
+    */
+    /* Current algorithm sorts output block every time new input block is read. Merges with heap in the remaining blocks.
+    Uses a list for any records that would be in next sublist (since they are less than the maximum record key output so far).
+    This list starts in block 1. Output/input block is block 0. Heap is reverse heap with top of heap being end of buffer.
+    */ 
+    recordsRead = runFill(iterator, iteratorState, pipelined ? &pipeline : NULL, buffer+es->page_size, bufferSizeInBlocks-1, tuplesPerPage, es);
+
+    if (!keyOrderMatches(buffer+es->page_size, recordsRead < tuplesPerPage ? recordsRead : tuplesPerPage, es, metric))
+    {
+        printf("Error: Key type, size and offset do not order records as compare_fcn does.\n");
+        if (pipelined)
+            run_pipeline_finish(&pipeline);
+        free(limitKey);
+        free(heapPrefix);
+        free(sortScratch);
+        sort_codec_writer_free(&codecWriter);
+        run_directory_free(&runDir);
+        return 11;
+    }
+
+    metric->num_reads += bufferSizeInBlocks-1;
+    metric->num_runs++;
+
+    /* Natural run: if each page of the filled blocks is ascending and starts at or after the end of the page before it,
+       as for presorted input, the pages are output as they are and the heap is not built. Input pages that continue the
+       run are then output without sorting them or using the heap until one does not (see naturalRunPage()). Checking
+       stops at the first record out of order, so costs unsorted input only a few comparisons. */
+    int8_t  natural = recordsRead > 0;
+    char    *naturalNext = buffer+es->page_size;    /* Next record of the filled blocks output by the natural run */
+    int32_t naturalLeft;                            /* Records of the filled blocks not output by the natural run */
+    uint8_t naturalDistinct = 0;
+    for (naturalLeft = 0; naturalLeft < recordsRead && natural; naturalLeft += tuplesPerPage)
+    {
+        addr = naturalNext + naturalLeft*es->record_size;
+        status = (int16_t) (recordsRead - naturalLeft < tuplesPerPage ? recordsRead - naturalLeft : tuplesPerPage);
+        natural = naturalRunPage(addr, status, naturalLeft > 0 ? addr - es->record_size : NULL, pipelined, &naturalDistinct, es, metric);
+    }
+    addr = buffer+es->page_size + recordsRead*es->record_size;
+    naturalLeft = natural ? recordsRead : 0;
+    if (natural)
+        numDistinctInRun = naturalDistinct;
+
+    /* Build heap from tuples in filled blocks */
+    for(i = 0; i < recordsRead && !natural; i++)
+    {        
+        addr -= es->record_size;
+        memcpy(tupleBuffer, addr, es->record_size);
+        metric->num_memcpys++;
+        runHeapInsert(buffer + heapStartOffset, heapPrefix, tupleBuffer, heapSize, es, metric);
+        heapSize++;
+    }
+
+    void *lastOutputKey        = NULL;              /* Pointer to memory storing value of last key output */
+    int8_t haveOutputKey       = 0;
+    int32_t sublistSize        = 0;                 /* size in blocks */
+    int32_t outputCount        = 0;                 /* number of values in output block */
+    int32_t recordsLeft        = recordsRead;       /* number of records in buffer */
+    void *heapVal, *inputVal;
+
+    while (recordsLeft != 0 || natural)
+    {
+        /* Read next block and sort it. The natural run first outputs the filled blocks. */
+        recordsRead = 0;
+        addr = buffer+es->headerSize;
+        if (naturalLeft > 0)
+        {
+            recordsRead = naturalLeft < tuplesPerPage ? naturalLeft : tuplesPerPage;
+            memcpy(addr, naturalNext, (size_t) recordsRead*es->record_size);
+            metric->num_memcpys++;
+            naturalNext += recordsRead*es->record_size;
+            naturalLeft -= recordsRead;
+        }
+        else
+        {
+            if (pipelined)
+                recordsRead = run_pipeline_read(&pipeline, addr);
+            else
+            {
+                for(i = 0; i < tuplesPerPage; i++)
+                {
+                    status=iterator(iteratorState, addr, es);
+                    if (status == 0)
+                        break;
+                    recordsRead++;
+                    addr += es->record_size;
+                }
+            }
+            recordsLeft += recordsRead;
+            if (natural && recordsRead > 0)
+                metric->num_reads += 1;
+            if (natural && (recordsRead == 0 || !naturalRunPage(buffer+es->headerSize, (int16_t) recordsRead,
+                                haveOutputKey ? lastOutputKey : NULL, pipelined, &numDistinctInRun, es, metric)))
+            {
+                natural = 0;
+                if (recordsRead == 0)
+                    continue;
+
+                /* Page does not continue the natural run. It and the input records after it fill the blocks other than the first
+                   and the run continues with replacement selection. Records less than the last record output are in the list
+                   for the next run and the others are in the heap. Block 0 is free, so holds records being moved. */
+                int32_t j, n;
+                char    *move = buffer+es->headerSize;
+
+                memcpy(buffer+es->page_size, buffer+es->headerSize, (size_t) recordsRead*es->record_size);
+                n = recordsRead + runFill(iterator, iteratorState, pipelined ? &pipeline : NULL, buffer+es->page_size + recordsRead*es->record_size,
+                                bufferSizeInBlocks-2, tuplesPerPage, es);
+                metric->num_reads += bufferSizeInBlocks-2;
+                recordsLeft += n - recordsRead;
+                for (j = 0; j < n; j++)
+                {
+                    addr = buffer+es->page_size + j*es->record_size;
+                    metric->num_compar++;
+                    if (es->compare_fcn(addr, lastOutputKey) >= 0)
+                        continue;
+                    if (j != listSize)
+                    {
+                        memcpy(move, addr, es->record_size);
+                        memcpy(addr, buffer+es->page_size + listSize*es->record_size, es->record_size);
+                        memcpy(buffer+es->page_size + listSize*es->record_size, move, es->record_size);
+                        metric->num_memcpys += 3;
+                    }
+                    listSize++;
+                }
+                addr = buffer+es->page_size + n*es->record_size;
+                for (j = listSize; j < n; j++)
+                {
+                    addr -= es->record_size;
+                    memcpy(move, addr, es->record_size);
+                    metric->num_memcpys++;
+                    runHeapInsert(buffer + heapStartOffset, heapPrefix, move, heapSize, es, metric);
+                    heapSize++;
+                }
+                continue;
+            }
+        }
+
+        #ifdef DEBUG_HEAP 
+            print_heap(buffer, heapStartOffset, heapSize, listSize, es); 
+        #endif
+        if (natural)
+        {   /* Page continues the natural run. Output as it is. */
+            outputCount = recordsRead;
+            recordsLeft -= recordsRead;
+            haveOutputKey = 1;
+        }
+        else if (recordsRead > 1)
+        {
+            metric->num_reads += 1;        
+            if (!pipelined)     /* Pipeline reader sorts pages */
+            {
+                if (useRadix)
+                    in_memory_radix_sort(buffer + es->headerSize, (uint32_t)recordsRead, es, sortScratch);
+                else
+                    in_memory_sort(buffer + es->headerSize, (uint32_t)recordsRead, es->record_size, es->compare_fcn, IN_MEMORY_SORT_INTRO, sortScratch);
+            }
+        }       
+        else if (heapSize < tuplesPerPage)  /* May have enough records currently in heap to continue last block. TODO: Does this make sense? It will add to last run before starting new one.*/
+        {   /* If list is not empty (list values are smaller than lastOutputValue) then start new sublist, otherwise continue with previous one. 
+               Decided before moving the list as the last output key is stored in the tuple buffer. */
+            heapVal = buffer+heapStartOffset;
+            int8_t startNewSublist = haveOutputKey && (listSize > 0 || (heapSize > 0 && es->compare_fcn(heapVal, lastOutputKey) < 0));
+
+            /* Move everything in list in to heap */
+            for (listSize = listSize; listSize > 0; listSize--)
+            {   /* Copy list record out first as heap may grow into the space it occupies */
+                memcpy(tupleBuffer, buffer + es->page_size + (listSize-1)*es->record_size, es->record_size);
+                runHeapInsert(buffer + heapStartOffset, heapPrefix, tupleBuffer, heapSize, es, metric);
+                heapSize++;
+            }
+
+            if (startNewSublist)
+            {   /* Start new sublist */
+                numSublist++;
+
+                /* Track number of distinct values per sublist */                
+                avgDistinct = avgDistinct + (numDistinctInRun - avgDistinct/10)*10/numSublist;
+                #ifdef DEBUG
+                    printf("Number of distinct values in sublist: %d Running average: %d\n",  numDistinctInRun, avgDistinct/10);
+                #endif
+                numDistinctInRun = 1;
+
+                /* Restart building the sublist */
+                outputCount = 0;
+                haveOutputKey = 0;
+                sublistSize = 0;                
+                recordsInRun = 0;
+                metric->num_runs++;
+            }
+        }
+        
+        /* Input/output block is block 0. Swap output records into it from heap if smaller than records currently there. */
+        for(i = 0; i < tuplesPerPage && !natural; i++)
+        {
+            if (i >= recordsRead)
+            {   /* No input record in this slot (input is exhausted). Copy over from heap until it is empty. */
+                if (heapSize <= 0)
+                    break;
+                memcpy(buffer + es->headerSize + i*es->record_size, buffer+heapStartOffset, es->record_size);   /* Heap into input/output block */                
+                outputCount++;
+                recordsLeft--;
+
+                /* Restore heap */
+                heapSize--;
+                if(heapSize > 0)
+                    runHeapReplace(buffer+heapStartOffset, heapPrefix, buffer + heapStartOffset - heapSize*es->record_size, heapSize, es, metric);
+                continue;
+            }            
+
+            heapVal = buffer+heapStartOffset;
+            inputVal = buffer+es->headerSize + i*es->record_size;          
+
+            if (haveOutputKey && (es->compare_fcn(heapVal, lastOutputKey) < 0 || 0 >= heapSize) && es->compare_fcn(inputVal, lastOutputKey) < 0)
+            {
+                /* Start a new sublist (as cannot use heap value or input value) */
+                numSublist++;
+
+                /* Track number of distinct values per sublist */                
+                avgDistinct = avgDistinct + (numDistinctInRun - avgDistinct/10)*10/numSublist;
+                #ifdef DEBUG
+                    printf("Number of distinct values in sublist: %d Running average: %d\n",  numDistinctInRun, avgDistinct/10);
+                #endif
+                numDistinctInRun = 1;
+
+                /* Convert unsorted list into heap */
+                for (listSize = listSize; listSize > 0; listSize--)
+                {   /* Copy list record out first as heap may grow into the space it occupies */
+                    memcpy(tupleBuffer, buffer + es->page_size + (listSize-1)*es->record_size, es->record_size);
+                    runHeapInsert(buffer + heapStartOffset, heapPrefix, tupleBuffer, heapSize, es, metric);
+                    heapSize++;
+                }
+
+                /* Restart building the sublist */
+                outputCount = 0;
+                haveOutputKey = 0;
+                sublistSize = 0;
+                recordsInRun = 0;
+                recordsLeft += i;
+                i=-1;
+                metric->num_runs++;
+                continue;
+            }
+
+            if ((heapSize > 0 && es->compare_fcn(heapVal, inputVal) < 0 && (haveOutputKey==0 || es->compare_fcn(heapVal, lastOutputKey) >= 0))
+            || (haveOutputKey && es->compare_fcn(inputVal, lastOutputKey) < 0))
+            {
+                /* Use the heap value if heap value is less than input value AND heap value is not larger than last output key OR input value is invalid */
+                memcpy(tupleBuffer, buffer + es->headerSize + i*es->record_size, es->record_size);              /* Input tuple into buffer */
+                memcpy(buffer + es->headerSize + i*es->record_size, buffer+heapStartOffset, es->record_size);   /* Heap into input/output block */                
+                /* Determine if the value is different than the last one to estimate num. distinct values */
+                if (numDistinctInRun < 255 && haveOutputKey)
+                {   metric->num_compar++;
+                    if (es->compare_fcn(lastOutputKey, inputVal) < 0)
+                        numDistinctInRun++;
+                }
+                lastOutputKey = inputVal;             
+
+                /* Find somewhere to put the input value */
+                if(es->compare_fcn(tupleBuffer, lastOutputKey) < 0)
+                {
+                    /* Restore heap */
+                    heapSize--;
+                    if(heapSize > 0)
+                        runHeapReplace(buffer+heapStartOffset, heapPrefix, buffer + heapStartOffset - heapSize*es->record_size, heapSize, es, metric);
+
+                    /* val into list (unsorted) */
+                    memcpy(buffer+es->page_size + listSize*es->record_size, tupleBuffer, es->record_size);
+                    listSize++;
+                }
+                else
+                {
+                    /* val into heap */
+                    runHeapReplace(buffer + heapStartOffset, heapPrefix, tupleBuffer, heapSize, es, metric);
+                }
+            }
+            else
+            {
+                /* Determine if the value is different than the last one to estimate num. distinct values */
+                metric->num_compar++;
+                if (numDistinctInRun < 255 && haveOutputKey)
+                {   metric->num_compar++;
+                    if (es->compare_fcn(lastOutputKey, inputVal) < 0)
+                        numDistinctInRun++;
+                }              
+
+                /* Use the newly read value. don't move it, it's in proper place. */                
+                lastOutputKey = inputVal;       /* Update the last key output */                 
+            }
+            haveOutputKey = 1;
+            outputCount++;
+            recordsLeft--;
+            #ifdef DEBUG_HEAP 
+                print_heap(buffer, heapStartOffset, heapSize, listSize, es); 
+            #endif
+            if(recordsLeft == 0) break;
+        }
+
+        /* Setup header */
+        *((int32_t *) buffer) = sublistSize;
+        *((int16_t *) (buffer + BLOCK_COUNT_OFFSET)) = (int16_t)outputCount;        
+        memcpy(tupleBuffer, buffer+(outputCount-1)*es->record_size+es->headerSize, es->key_offset+es->key_size);
+        lastOutputKey = tupleBuffer;
+        /* Store the last key output temporarily in tuple buffer as once write out then read new block it would be gone */
+
+        writeCount = (int16_t) outputCount;
+        if (limit > 0)
+        {   /* Page records after the limit records of the run or all larger than the bound are not in the result */
+            if (recordsInRun >= limit || (haveLimitKey && es->compare_fcn(buffer + es->headerSize, limitKey) > 0))
+                writeCount = 0;
+            else if (recordsInRun + outputCount >= limit)
+            {
+                writeCount = (int16_t) (limit - recordsInRun);
+                addr = buffer + es->headerSize + (writeCount-1)*es->record_size;
+                if (limitKey != NULL && (!haveLimitKey || es->compare_fcn(addr, limitKey) < 0))
+                {
+                    memcpy(limitKey, addr, es->key_offset + es->key_size);
+                    haveLimitKey = 1;
+                }
+            }
+            *((int16_t *) (buffer + BLOCK_COUNT_OFFSET)) = writeCount;
+            recordsInRun += outputCount;
+        }
+
+        /* Records of runs are combined as they are merged, so COUNT starts each record with a count of 1 */
+        if (es->aggregate == SORT_AGGREGATE_COUNT)
+        {
+            for (i = 0; i < writeCount; i++)
+                sort_aggregate_init(es, buffer + es->headerSize + i*es->record_size);
+        }
+
+        /* Write the output block */
+        if (codecWriter.page != NULL)
+        {   /* Encode the records of the block. The last page of the previous run is written when a run starts. */
+            if (sublistSize == 0 && codecWriter.count > 0)
+                err = runWriteCodecPage(&codecWriter, &codecBlock, &runsWritten, pipelined ? &pipeline : NULL, outputFile, &runDir, es, metric);
+            if (sublistSize == 0)
+                codecBlock = 0;
+            for (i = 0; i < writeCount && err == 0; i++)
+            {
+                addr = buffer + es->headerSize + i*es->record_size;
+                if (sort_codec_add(&codecWriter, es, addr))
+                    continue;
+                err = runWriteCodecPage(&codecWriter, &codecBlock, &runsWritten, pipelined ? &pipeline : NULL, outputFile, &runDir, es, metric);
+                sort_codec_add(&codecWriter, es, addr);
+            }
+        }
+        else if (writeCount > 0 && (pipelined ? run_pipeline_write(&pipeline, buffer) != 0 : 0 == fwrite(buffer, es->page_size, 1, outputFile)))
+            err = 9;
+        if (err != 0)
+        {
+            if (pipelined)
+                run_pipeline_finish(&pipeline);
+            free(limitKey);
+            free(heapPrefix);
+            free(sortScratch);
+            sort_codec_writer_free(&codecWriter);
+            run_directory_free(&runDir);
+            return 9;
+        }
+        if (writeCount > 0 && codecWriter.page == NULL)
+        {
+            run_directory_add_block(&runDir, sublistSize, writeCount, buffer+es->headerSize, es);
+            metric->num_writes +=1;
+            if (sublistSize == 0)
+                runsWritten++;
+        }
+        #ifdef DEBUG_OUTPUT
+        printf("Wrote block. Sublist: %d ", numSublist);
+        printf(" Idx: %d\n", sublistSize);
+        printf("Offset: %lu\n",  ftell(outputFile)-es->page_size);
+        for (int k=0; k < tuplesPerPage; k++)
+        {
+            test_record_t *buf = (void*) (buffer+es->headerSize+k*es->record_size);
+            printf("%d: Output Record: %d\n", k, buf->key);
+        }
+        #endif         
+        
+        sublistSize++;
+        outputCount = 0;       
+    } /* while records left */
+
+    // free(lastOutputKey);
+    free(limitKey);
+    free(heapPrefix);
+    if (codecWriter.count > 0)
+        err = runWriteCodecPage(&codecWriter, &codecBlock, &runsWritten, pipelined ? &pipeline : NULL, outputFile, &runDir, es, metric);
+    sort_codec_writer_free(&codecWriter);
+    if ((pipelined && run_pipeline_finish(&pipeline) != 0) || err != 0)
+    {
+        free(sortScratch);
+        run_directory_free(&runDir);
+        return 9;
+    }
+    free(sortScratch);
+    numSublist = limit > 0 ? runsWritten : (int32_t) metric->num_runs;
+    unsigned long endMillis = millis();
+    metric->genTime = ((double) (endMillis - startMillis));
+    metrics_phase_end(metric, es);
+    printf("Gen time: %d\n", metric->genTime);
+
+    /* Track number of distinct values per sublist */       
+    avgDistinct = avgDistinct + (numDistinctInRun - avgDistinct/10)*10/numSublist;  
+    printf("Final number of distinct values in sublist: %d Average: %d\n",  numDistinctInRun, avgDistinct);
+    numDistinctInRun = 0;
+
+    if (numSublist == 1 || runGenOnly)
+        run_directory_free(&runDir);
+    if (numSublist == 1)
+	{	/* No merge phase necessary */
+		*resultFilePtr = 0;
+        if (stream != NULL)
+            streamOpenRun(stream, (int32_t) (ftell(outputFile) / es->page_size));
+        else if ((es->aggregate != SORT_AGGREGATE_NONE || es->codec != sort_codec_output(es)) && !runGenOnly)
+        {   /* Nothing has combined the records of the run or decoded its pages. Copy it combining records with equal keys.
+               Slotted pages of variable length records are also the output format, so they are only copied to aggregate. */
+            adaptive_sort_stream_t runStream;
+
+            *resultFilePtr = ftell(outputFile);
+            metrics_phase_begin(metric, METRICS_PHASE_MERGE_PASS, 1);
+            streamInit(&runStream, es, metric, outputFile, buffer, tupleBuffer);
+            streamOpenRun(&runStream, (int32_t) (*resultFilePtr / es->page_size));
+            err = streamWrite(&runStream, *resultFilePtr, 0);
+            streamClose(&runStream);
+        }
+		return err;
+	}
+    if (runGenOnly)
+        return 0;
+
+    lastWritePos = ftell(outputFile);
+
+    /* Make decision to use either no output buffer sort or MinSort */
+   // if (avgDistinct/10 < nobSortCost)    
+    int bufferSizeBytes = (bufferSizeInBlocks-1) * es->page_size;   /* One of the buffers is used for a read buffer */
+    int8_t sublistVersionPossible =  (numSublist <= bufferSizeBytes / MINSORT_SUBLIST_REGION_SIZE(es->key_size));  /* Each record has a key and file offset. */
+
+    if (sublistVersionPossible && avgDistinct > tuplesPerPage)
+        avgDistinct  = tuplesPerPage * 10;
+
+    printf("Adaptive calculation.\n");
+    int16_t numPasses = (int) ceil(log(numSublist)/log(bufferSizeInBlocks));
+    int32_t nobSortCost = numPasses *(10 + writeToReadRatio)/10;    
+    printf("NOB sort cost. # runs: %d", numSublist);
+    printf(" # passes: %d cost: %d\n", numPasses, nobSortCost);
+    int32_t minSortCost = (int32_t) avgDistinct * randomReadRatio / 100;
+    printf("MinSort cost. Num sublists: %d ", numSublist);
+    printf(" Avg. distinct/sublist: %d cost: %d\n", avgDistinct/10, minSortCost);
+
+    /* Regular MinSort needs input and output blocks plus space for the region index */
+    if (!sublistVersionPossible && bufferSizeInBlocks < 3)
+        minSortCost = nobSortCost;
+
+    /* MinSort orders keys itself so must support the key type */
+    if (!sort_key_supported(es))
+        minSortCost = nobSortCost;
+
+    /* Regular MinSort assumes full pages but runs end wherever their first limit records end */
+    if (limit > 0 && !sublistVersionPossible)
+        minSortCost = nobSortCost;
+
+    if (minSortCost < nobSortCost)        
+    // if (0)
+    {   /* MinSort */             
+        /* Sublists written by run generation may not fill every page, so use actual number of pages in file */
+        external_sort_t esRuns = *es;
+        esRuns.num_pages = lastWritePos / es->page_size;
+
+        if (sublistVersionPossible)         
+        {   /* If can buffer smallest value per sublist, can use a better performing version */
+            printf("Performing MinSort with sorted sublists\n");
+            ((file_iterator_state_t*) iteratorState)->file = outputFile;
+            *resultFilePtr = 0;
+            if (stream != NULL)
+                err = streamOpenMinSortSublist(stream, iteratorState, buffer, bufferSizeBytes, &esRuns, 0, numSublist, &runDir);
+            else if (limit > 0 || es->aggregate != SORT_AGGREGATE_NONE || sort_codec_output(es) != SORT_CODEC_NONE)
+                err = minsortWrite(iteratorState, tupleBuffer, outputFile, buffer, bufferSizeBytes, &esRuns, 0, numSublist, &runDir, metric, limit);
+            else
+                flash_minsort_sublist(iteratorState, tupleBuffer, outputFile, buffer, bufferSizeBytes, &esRuns, resultFilePtr, metric, compareFn, numSublist, &runDir);
+            *resultFilePtr = lastWritePos;
+        }
+        else
+        {   /* Do not have enough space to index a value per sublist, so use regular version (assumes data is not sorted in each region) */
+            printf("Performing MinSort\n");
+            ((file_iterator_state_t*) iteratorState)->file = outputFile;
+            if (stream != NULL)
+                err = streamOpenMinSort(stream, iteratorState, buffer, bufferSizeInBlocks*es->page_size, &esRuns);
+            else if (es->aggregate != SORT_AGGREGATE_NONE || sort_codec_output(es) != SORT_CODEC_NONE)
+                err = minsortWrite(iteratorState, tupleBuffer, outputFile, buffer, bufferSizeInBlocks*es->page_size, &esRuns, 0, 0, NULL, metric, 0);
+            else
+                err = flash_minsort(iteratorState, tupleBuffer, outputFile, buffer, bufferSizeInBlocks*es->page_size, &esRuns, resultFilePtr, metric, compareFn);
+            *resultFilePtr = lastWritePos;
+        }                    
+        run_directory_free(&runDir);
+    }
+    else
+    {   /* No output buffer sort merge */        
+        printf("Performing NOBSort\n");
+        /* ----- Merge phase: recursively combine M sublists ----- */
+        long	mergeSOW;                                                                           /* start of write */
+        long	lastMergeStart		    = 0;	                                                    /* start of read */
+        long	lastMergeEnd            = lastWritePos;
+        run_directory_t mergeDir;
+        run_directory_t *inDir          = &runDir;      /* Sublists read by this pass */
+        run_directory_t *outDir         = &mergeDir;    /* Sublists written by this pass. Swapped with inDir after each pass. */
+        run_directory_t *swapDir;
+        run_directory_init(outDir, (numSublist + bufferSizeInBlocks - 1) / bufferSizeInBlocks, es);
+        int16_t run                     = 0;
+        int8_t  passNumber              = 1;
+        int32_t numRuns;
+
+        /* Merges of a pass are independent. Worker 0 uses the sort buffer. Each other worker allocates its own buffer
+           so merges of a pass can run in parallel (see sort_parallel.h). */
+        merge_run_t workers[SORT_PARALLEL_MAX_WORKERS];
+        metrics_t   workerMetrics[SORT_PARALLEL_MAX_WORKERS];
+        merge_pass_t pass;
+        int16_t numWorkers = sort_parallel_get_workers();
+        int16_t w;
+        if (numWorkers > SORT_PARALLEL_MAX_WORKERS)
+            numWorkers = SORT_PARALLEL_MAX_WORKERS;
+        if (numWorkers > (numSublist + bufferSizeInBlocks - 1) / bufferSizeInBlocks)
+            numWorkers = (int16_t) ((numSublist + bufferSizeInBlocks - 1) / bufferSizeInBlocks);
+        /* Parallel runs are placed by their number of input records. Aggregated and encoded output is smaller by an unknown amount. */
+        if (es->aggregate != SORT_AGGREGATE_NONE || es->codec != SORT_CODEC_NONE)
+            numWorkers = 1;
+
+        if (mergeRunInit(&workers[0], buffer, tupleBuffer, bufferSizeInBlocks, outputFile, es, metric) != 0)
+        {   /* Verify all memory has been allocated successfully */
+            run_directory_free(inDir); run_directory_free(outDir);
+            return 8;
+        }
+
+        /* Sublists written by run generation and each pass are read from a mapping of the output file if mapping is enabled */
+        ion_file_map_t      map;
+        ion_file_map_open(&map, outputFile);
+
+        /* I/O threads shared by all workers. All merge I/O then uses positional reads and writes. */
+        ion_file_async_t    io;
+        ion_file_async_t    *ioPtr = NULL;
+        if (ion_file_async_get_threads() > 0 && ion_file_async_init(&io, ion_file_async_get_threads()) == 0)
+        {
+            if (mergeRunInitAsync(&workers[0], &io) == 0)
+            {
+                ioPtr = &io;
+                fflush(outputFile);
+                printf("Merge I/O threads: %d\n", io.numThreads);
+            }
+            else
+                ion_file_async_close(&io);
+        }
+
+        for (w = 1; w < numWorkers; w++)
+        {   /* Fewer workers if memory is not available */
+            if (mergeRunInit(&workers[w], NULL, NULL, bufferSizeInBlocks, outputFile, es, &workerMetrics[w]) != 0)
+                break;
+            if (ioPtr != NULL && mergeRunInitAsync(&workers[w], ioPtr) != 0)
+            {
+                mergeRunFree(&workers[w]);
+                break;
+            }
+        }
+        numWorkers = w;
+        for (w = 0; w < numWorkers; w++)
+        {
+            workers[w].map      = &map;
+            workers[w].limit    = limit;
+        }
+        if (numWorkers > 1)
+            printf("Parallel merge workers: %d\n", numWorkers);
+        pass.workers = workers;
+
+        int32_t other = 0;
+        while (numSublist > 1) 
+        {         
+                         
+            if (numSublist >= 32 && numSublist <= 64 && sort_key_supported(es))
+            {   // Switch to MinSort to finish off
+                printf("Finishing sort with MinSort with sorted sublists\n");
+                printf("Elapsed time: %lu\n", millis()-startMillis);
+                ((file_iterator_state_t*) iteratorState)->file = outputFile;    
+                // *resultFilePtr = lastMergeStart;   
+                fflush(outputFile);
+                *resultFilePtr = lastMergeStart;           
+                external_sort_t esRuns = *es;
+                esRuns.num_pages = (lastMergeEnd - lastMergeStart) / es->page_size;
+                if (stream != NULL)
+                    err = streamOpenMinSortSublist(stream, iteratorState, buffer, bufferSizeBytes, &esRuns, lastMergeStart, numSublist, inDir);
+                else if (limit > 0 || es->aggregate != SORT_AGGREGATE_NONE || sort_codec_output(es) != SORT_CODEC_NONE)
+                    err = minsortWrite(iteratorState, tupleBuffer, outputFile, buffer, bufferSizeBytes, &esRuns, lastMergeStart, numSublist, inDir, metric, limit);
+                else
+                    flash_minsort_sublist(iteratorState, tupleBuffer, outputFile, buffer, bufferSizeBytes, &esRuns, resultFilePtr, metric, compareFn, numSublist, inDir);
+                lastMergeStart = lastMergeEnd;
+                *resultFilePtr = lastMergeStart;               
+                printf("Elapsed time: %lu\n", millis()-startMillis);
+                break;
+            }
+
+            if (stream != NULL && numSublist <= bufferSizeInBlocks)
+            {   /* Last pass. Sublists are merged as records are requested from the stream. */
+                metrics_phase_begin(metric, METRICS_PHASE_MERGE_PASS, passNumber);
+                err = streamOpenMerge(stream, &workers[0], inDir, lastMergeStart, lastMergeEnd, numSublist);
+                break;
+            }
+
+            /* Encoded sublists may grow when merged and the last pass decodes them, so a pass may not fit before the sublists it reads */
+            if (passNumber % 3 == 0 && es->codec == SORT_CODEC_NONE)
+            { 
+                lastWritePos = 0;          /* Wrap-around in memory space/file after every 3rd pass */                
+            }
+
+            printf("Pass number: %u  Comparisons: %lu  MemCopies: %lu  TransferIn: %lu  TransferOut: %lu TransferOther: %lu Other: %lu\n", passNumber, metric->num_compar, metric->num_memcpys, numShiftIntoOutput, numShiftOutOutput, numShiftOtherBlock, other);
+            printf("Elapsed time: %lu\n", millis()-startMillis);
+            metrics_phase_begin(metric, METRICS_PHASE_MERGE_PASS, passNumber);
+            passNumber++;
+
+            /* perform a merge */
+            ion_file_map_refresh(&map);         /* Map blocks written by the previous pass */
+            mergeSOW = lastWritePos;
+            run_directory_reset(outDir, mergeSOW);
+
+            numRuns	= (numSublist + bufferSizeInBlocks -1)/bufferSizeInBlocks; /* Equivalent to CEIL(numSublist/bufferSizeInBlocks) */
+
+            /* perform runs */
+            long ptrLastBlock = lastMergeEnd;
+            int8_t  useDir = run_directory_matches(inDir, numSublist, lastMergeStart);
+            int32_t dirRun = numSublist;            /* Sublists are taken from the back of the previous pass output */
+            err = 0;
+
+            /* Runs can be merged in parallel if the directory has the records of every sublist to place each run's output */
+            pass.runs = NULL;
+            pass.keys = NULL;
+            if (SORT_PARALLEL_MAX_WORKERS > 1 && useDir && numWorkers > 1 && numRuns > 1)
+            {
+                pass.runs = (merge_pass_run_t*) malloc(sizeof(merge_pass_run_t) * numRuns);
+                pass.keys = (char*) malloc((size_t) numRuns * (es->key_offset + es->key_size));
+            }
+            if (pass.runs != NULL && pass.keys != NULL)
+            {
+                long writePos = mergeSOW;
+                for (run = 0; run < numRuns; run++) 
+                {
+                    merge_pass_run_t *r = &pass.runs[run];
+                    int32_t numRecords = 0;
+
+                    r->numSublists = numSublist < bufferSizeInBlocks ? numSublist : bufferSizeInBlocks;
+                    numSublist -= r->numSublists;
+                    r->dirRun = dirRun;
+                    r->ptrLastBlock = ptrLastBlock;
+                    r->writePos = writePos;
+                    for (i = 0; i < r->numSublists; i++)
+                    {
+                        dirRun--;
+                        ptrLastBlock -= run_directory_blocks(inDir, dirRun) * es->page_size;
+                        numRecords += run_directory_records(inDir, dirRun);
+                    }
+                    if (limit > 0 && numRecords > limit)
+                        numRecords = limit;
+                    /* Merge output blocks are full except the last */
+                    writePos += (long) ((numRecords + tuplesPerPage - 1) / tuplesPerPage) * es->page_size;
+                }
+
+                pass.inDir = inDir;
+                pass.lastMergeStart = lastMergeStart;
+                for (w = 0; w < numWorkers; w++)
+                {
+                    memset(&workerMetrics[w], 0, sizeof(metrics_t));
+                    workers[w].metric = &workerMetrics[w];
+                    workers[w].positional = 1;
+                }
+                fflush(outputFile);
+                err = sort_parallel_run(numRuns, numWorkers, mergePassTask, &pass);
+
+                for (w = 0; w < numWorkers; w++)
+                {
+                    metric->num_reads   += workerMetrics[w].num_reads;
+                    metric->num_writes  += workerMetrics[w].num_writes;
+                    metric->num_memcpys += workerMetrics[w].num_memcpys;
+                    metric->num_compar  += workerMetrics[w].num_compar;
+                    workers[w].metric = metric;
+                    workers[w].positional = 0;
+                }
+                for (run = 0; run < numRuns && err == 0; run++)
+                    run_directory_add_run(outDir, pass.runs[run].numBlocks, pass.runs[run].numRecords, pass.keys + run * (es->key_offset + es->key_size), es);
+                lastWritePos = writePos;
+            }
+            else
+            {
+                merge_run_t *mr = &workers[0];
+                for (run = 0; run < numRuns && err == 0; run++) 
+                {
+                    /* Set up the run */
+                    mr->numSublists = numSublist < bufferSizeInBlocks ? numSublist : bufferSizeInBlocks;
+                    numSublist -= mr->numSublists;
+                    mr->writePos = lastWritePos;
+
+                    err = mergeFindSublists(mr, inDir, useDir, &dirRun, &ptrLastBlock, lastMergeStart);
+                    if (err == 0)
+                        err = es->codec == SORT_CODEC_NONE ? mergeRun(mr) : mergeRunCodec(mr, numRuns == 1 ? sort_codec_output(es) : es->codec);
+                    if (err == 0)
+                    {
+                        lastWritePos = mr->writePos;
+                        run_directory_add_run(outDir, mr->blocksOut, mr->recordsOut, mr->firstKey, es);
+                    }
+                }	/* end of runs */
+            }
+            free(pass.runs);
+            free(pass.keys);
+
+            for (w = 0; w < numWorkers; w++)
+            {
+                numShiftIntoOutput += workers[w].numShiftIntoOutput;
+                numShiftOutOutput += workers[w].numShiftOutOutput;
+                numShiftOtherBlock += workers[w].numShiftOtherBlock;
+                workers[w].numShiftIntoOutput = workers[w].numShiftOutOutput = workers[w].numShiftOtherBlock = 0;
+            }
+
+            if (err != 0)
+            {
+                for (w = 0; w < numWorkers; w++)
+                    mergeRunFree(&workers[w]);
+                if (ioPtr != NULL)
+                    ion_file_async_close(ioPtr);
+                ion_file_map_close(&map);
+                run_directory_free(inDir); run_directory_free(outDir);
+                return err;
+            }
+
+            numSublist                  = numRuns;      /* each run produces 1 sublist */
+            lastMergeStart			    = mergeSOW;     /* next merge reads where this one started writing */
+            lastMergeEnd                = lastWritePos;            
+            swapDir                     = inDir;        /* output sublists are input of next pass */
+            inDir                       = outDir;
+            outDir                      = swapDir;
+            metrics_phase_end(metric, es);
+        }	/* end of merge */
         *resultFilePtr = lastMergeStart;
   
         printf("Complete. Comparisons: %u  MemCopies: %u  TransferIn: %u  TransferOut: %u TransferOther: %u Other: %d\n", metric->num_compar, metric->num_memcpys, numShiftIntoOutput, numShiftOutOutput, numShiftOtherBlock, other);
     
-        /* cleanup */
-        free(sublsFilePtr);
-        free(sublsBlkPos);
-        free(blocksInSublist);
-        free(record1);
-        free(record2);
+        /* cleanup. The stream owns the state of worker 0 if it merges the last pass. */
+        for (w = (stream != NULL && stream->source == SORT_STREAM_MERGE) ? 1 : 0; w < numWorkers; w++)
+            mergeRunFree(&workers[w]);
+        if (ioPtr != NULL)
+            ion_file_async_close(ioPtr);
+        ion_file_map_close(&map);
+        run_directory_free(inDir);
+        run_directory_free(outDir);
+    }
+
+	return err;
+}
+
+int adaptive_sort(
+    int     (*iterator)(void *state, void* buffer, external_sort_t *es),
+    void    *iteratorState,
+	void    *tupleBuffer,
+    ION_FILE *outputFile,		
+	char    *buffer,        
+	int     bufferSizeInBlocks,
+	external_sort_t *es,
+	long    *resultFilePtr,
+	metrics_t *metric,
+    int8_t  (*compareFn)(void *a, void *b),
+    int8_t  runGenOnly,
+    int8_t  writeToReadRatio
+)
+{
+    return adaptiveSort(iterator, iteratorState, tupleBuffer, outputFile, buffer, bufferSizeInBlocks, es, resultFilePtr, metric,
+                        compareFn, runGenOnly, writeToReadRatio, 0, NULL);
+}
+
+/**
+ * Keeps the limit smallest input records in a max-heap in blocks 1 and up of the buffer, so the largest kept record is replaced
+ * when a smaller record is read. The heap is then sorted in place and written through block 0. Variable length records are
+ * encoded into slotted pages (see sort_codec_output()). Returns 0 if success, 9 if write error.
+ */
+static int topKHeap(
+    int     (*iterator)(void *state, void* buffer, external_sort_t *es),
+    void    *iteratorState,
+    void    *tupleBuffer,
+    ION_FILE *outputFile,
+    char    *buffer,
+    external_sort_t *es,
+    long    *resultFilePtr,
+    metrics_t *metric,
+    int32_t limit
+)
+{
+    int16_t tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+    char    *heap = buffer + es->page_size;
+    int32_t heapSize = 0, numRead = 0, i;
+    int32_t blockIndex = 0;
+    int16_t count = 0;
+    sort_codec_writer_t writer;
+
+    metrics_phase_begin(metric, METRICS_PHASE_RUN_GENERATION, 0);
+    while (iterator(iteratorState, tupleBuffer, es) != 0)
+    {
+        numRead++;
+        if (heapSize < limit)
+        {
+            shiftUp_max(heap, tupleBuffer, heapSize, es, metric);
+            heapSize++;
+        }
+        else
+        {
+            metric->num_compar++;
+            if (es->compare_fcn(tupleBuffer, heap) < 0)
+                heapify_max(heap, tupleBuffer, heapSize, es, metric);     /* Replaces largest kept record */
+        }
+    }
+    metric->num_reads += (numRead + tuplesPerPage - 1) / tuplesPerPage;
+    metric->num_runs++;
+
+    /* Heap sort: move largest remaining record after the heap until all are in order */
+    for (i = heapSize - 1; i > 0; i--)
+    {
+        memcpy(tupleBuffer, heap + i * es->record_size, es->record_size);
+        memcpy(heap + i * es->record_size, heap, es->record_size);
+        metric->num_memcpys += 2;
+        heapify_max(heap, tupleBuffer, i, es, metric);
+    }
+
+    /* Slotted pages are encoded in block 0. The tuple buffer is no longer used, so it holds the first record of the page. */
+    writer.page  = buffer;
+    writer.first = (char*) tupleBuffer;
+    fseek(outputFile, 0, SEEK_SET);
+    for (i = 0; i < heapSize; )
+    {
+        if (sort_codec_output(es) != SORT_CODEC_NONE)
+        {
+            sort_codec_reset(&writer, es, sort_codec_output(es));
+            while (i < heapSize && sort_codec_add(&writer, es, heap + i * es->record_size))
+                i++;
+            count = writer.count;
+        }
+        else
+        {
+            count = heapSize - i < tuplesPerPage ? (int16_t) (heapSize - i) : tuplesPerPage;
+            memcpy(buffer + es->headerSize, heap + i * es->record_size, (size_t) count * es->record_size);
+            *((int16_t *) (buffer + BLOCK_COUNT_OFFSET)) = count;
+            i += count;
+        }
+        metric->num_memcpys += count;
+        *((int32_t *) buffer) = blockIndex++;
+        if (0 == fwrite(buffer, es->page_size, 1, outputFile))
+        {
+            metrics_phase_end(metric, es);
+            return 9;
+        }
+        metric->num_writes++;
+    }
+    metrics_phase_end(metric, es);
+    *resultFilePtr = 0;
+    return 0;
+}
+
+int adaptive_sort_limit(
+    int     (*iterator)(void *state, void* buffer, external_sort_t *es),
+    void    *iteratorState,
+    void    *tupleBuffer,
+    ION_FILE *outputFile,
+    char    *buffer,
+    int     bufferSizeInBlocks,
+    external_sort_t *es,
+    long    *resultFilePtr,
+    metrics_t *metric,
+    int8_t  (*compareFn)(void *a, void *b),
+    int8_t  writeToReadRatio,
+    int32_t limit
+)
+{
+    int16_t tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+    external_sort_t esLimit = *es;
+
+    /* Runs are cut after limit records, which may not hold all records of the first limit keys */
+    esLimit.aggregate = SORT_AGGREGATE_NONE;
+    if (!sort_codec_supported(&esLimit))
+        esLimit.codec = SORT_CODEC_NONE;
+    if (limit > 0 && limit <= (int32_t) (bufferSizeInBlocks - 1) * tuplesPerPage)
+    {
+        printf("Top-k heap. Limit: %ld\n", (long) limit);
+        return topKHeap(iterator, iteratorState, tupleBuffer, outputFile, buffer, &esLimit, resultFilePtr, metric, limit);
+    }
+    return adaptiveSort(iterator, iteratorState, tupleBuffer, outputFile, buffer, bufferSizeInBlocks, &esLimit, resultFilePtr, metric,
+                        compareFn, 0, writeToReadRatio, limit, NULL);
+}
+
+/**
+ * Iterator state of the tags sorted by adaptive_sort_tag(). The file state is first as the engines use the iterator state as
+ * a file_iterator_state_t when they MinSort runs.
+ */
+typedef struct {
+    file_iterator_state_t input;            /* Record count of the input. Tags are not in a file. */
+    int     (*iterator)(void *state, void* buffer, external_sort_t *es);
+    void    *iteratorState;
+    external_sort_t *es;                    /* Settings of the input records */
+    char    *record;                        /* Input record being tagged */
+    uint32_t id;                            /* Number of next input record */
+} tag_iterator_state_t;
+
+/**
+ * Returns the tag of the next input record: its bytes up to the end of its key followed by its number in the input.
+ */
+static int tagIterator(void *state, void *buffer, external_sort_t *esTag)
+{
+    tag_iterator_state_t *t = (tag_iterator_state_t*) state;
+    uint16_t prefix = (uint16_t) (esTag->record_size - sizeof(uint32_t));
+
+    if (t->iterator(t->iteratorState, t->record, t->es) == 0)
+        return 0;
+    memcpy(buffer, t->record, prefix);
+    memcpy((char*) buffer + prefix, &t->id, sizeof(uint32_t));
+    t->id++;
+    return 1;
+}
+
+/**
+ * Writes a page of gathered records at *writePos of the output file and advances *writePos. Returns 0 if success, 9 if write error.
+ */
+static int8_t tagWritePage(ION_FILE *outputFile, char *page, int32_t blockIndex, int16_t count, long *writePos, external_sort_t *es, metrics_t *metric)
+{
+    *((int32_t *) page) = blockIndex;
+    *((int16_t *) (page + BLOCK_COUNT_OFFSET)) = count;
+    fseek(outputFile, *writePos, SEEK_SET);
+    if (0 == fwrite(page, es->page_size, 1, outputFile))
+        return 9;
+    metric->num_writes++;
+    *writePos += es->page_size;
+    return 0;
+}
+
+/**
+ * Copies the input record of each of the numRecords sorted tags at tagFilePtr to the end of the output file. Block 0 of the
+ * buffer is the output page, block 1 the page of tags and the other blocks cache input pages. An input page is cached in the
+ * block given by its number modulo the number of cache blocks, and the block id of the cached copy is set to its number.
+ * Returns 0 if success, 9 if write error, 10 if read error.
+ */
+static int tagGather(ION_FILE *inputFile, long inputStart, ION_FILE *outputFile, char *buffer, int bufferSizeInBlocks,
+                        external_sort_t *es, external_sort_t *esTag, long tagFilePtr, uint32_t numRecords, long *resultFilePtr, metrics_t *metric)
+{
+    int16_t  tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+    int16_t  numCache = (int16_t) (bufferSizeInBlocks - 2);
+    uint16_t prefix = (uint16_t) (esTag->record_size - sizeof(uint32_t));
+    char     *output = buffer, *tags = buffer + es->page_size, *cache = buffer + 2 * es->page_size, *cached;
+    long     readPos = tagFilePtr, writePos;
+    uint32_t numGathered = 0, id;
+    int32_t  blockIndex = 0, page;
+    int16_t  count = 0, numTags, i;
+    int      err = 0;
+
+    for (i = 0; i < numCache; i++)
+        *((int32_t *) (cache + i * es->page_size)) = -1;
+
+    fseek(outputFile, 0, SEEK_END);
+    writePos = ftell(outputFile);
+    *resultFilePtr = writePos;
+
+    metrics_phase_begin(metric, METRICS_PHASE_TAG_GATHER, 0);
+    while (err == 0 && numGathered < numRecords)
+    {
+        fseek(outputFile, readPos, SEEK_SET);
+        if (0 == fread(tags, es->page_size, 1, outputFile))
+        {
+            err = 10;
+            break;
+        }
+        metric->num_reads++;
+        readPos += es->page_size;
+        numTags = *((int16_t *) (tags + BLOCK_COUNT_OFFSET));
+        if (numTags <= 0)
+        {
+            err = 10;
+            break;
+        }
+
+        for (i = 0; i < numTags; i++)
+        {
+            memcpy(&id, tags + esTag->headerSize + i * esTag->record_size + prefix, sizeof(uint32_t));
+            page   = (int32_t) (id / tuplesPerPage);
+            cached = cache + (page % numCache) * es->page_size;
+            if (*((int32_t *) cached) != page)
+            {
+                fseek(inputFile, inputStart + (long) page * es->page_size, SEEK_SET);
+                if (0 == fread(cached, es->page_size, 1, inputFile))
+                {
+                    err = 10;
+                    break;
+                }
+                metric->num_reads++;
+                *((int32_t *) cached) = page;
+            }
+            memcpy(output + es->headerSize + count * es->record_size, cached + es->headerSize + (id % tuplesPerPage) * es->record_size, es->record_size);
+            metric->num_memcpys++;
+            if (++count == tuplesPerPage)
+            {
+                err = tagWritePage(outputFile, output, blockIndex++, count, &writePos, es, metric);
+                if (err != 0)
+                    break;
+                count = 0;
+            }
+        }
+        numGathered += (uint32_t) numTags;
+    }
+    if (err == 0 && count > 0)
+        err = tagWritePage(outputFile, output, blockIndex, count, &writePos, es, metric);
+    metrics_phase_end(metric, es);
+    return err;
+}
+
+int adaptive_sort_tag(
+    int     (*iterator)(void *state, void* buffer, external_sort_t *es),
+    void    *iteratorState,
+    void    *tupleBuffer,
+    ION_FILE *outputFile,
+    char    *buffer,
+    int     bufferSizeInBlocks,
+    external_sort_t *es,
+    long    *resultFilePtr,
+    metrics_t *metric,
+    int8_t  (*compareFn)(void *a, void *b),
+    int8_t  writeToReadRatio,
+    int8_t  permutation
+)
+{
+    file_iterator_state_t *input = (file_iterator_state_t*) iteratorState;
+    external_sort_t esTag = *es;
+    tag_iterator_state_t tags;
+    void    *tagTuple;
+    int16_t tagsPerPage;
+    long    inputStart, tagFilePtr;
+    int     err;
+
+    esTag.aggregate = SORT_AGGREGATE_NONE;
+    esTag.record_size = (uint16_t) ADAPTIVE_SORT_TAG_SIZE(es);
+    if (es->codec == SORT_CODEC_SLOTTED
+        || (!permutation && (bufferSizeInBlocks < 3 || esTag.record_size >= es->record_size)))
+    {   /* Records are sorted whole. The record number of a variable length record does not locate its page. */
+        printf("Tag sort not used.\n");
+        esTag.record_size = es->record_size;
+        return adaptiveSort(iterator, iteratorState, tupleBuffer, outputFile, buffer, bufferSizeInBlocks, &esTag, resultFilePtr, metric,
+                            compareFn, 0, writeToReadRatio, 0, NULL);
+    }
+
+    tagsPerPage = (esTag.page_size - esTag.headerSize) / esTag.record_size;
+    esTag.value_size = esTag.record_size - esTag.key_size;
+    esTag.num_pages = (input->totalRecords + tagsPerPage - 1) / tagsPerPage;
+    esTag.num_values_last_page = (uint16_t) (input->totalRecords - (esTag.num_pages - 1) * tagsPerPage);
+    esTag.length_fcn = NULL;
+
+    tags.input              = *input;
+    tags.input.file         = NULL;
+    tags.input.recordSize   = esTag.record_size;
+    tags.iterator           = iterator;
+    tags.iteratorState      = iteratorState;
+    tags.es                 = es;
+    tags.id                 = 0;
+    tags.record             = (char*) malloc(es->record_size);
+    if (tags.record == NULL)
+        return 8;
+
+    /* Permutation tags may be larger than a record, so the record sized tuple buffer of the caller is not used */
+    tagTuple = tupleBuffer;
+    if (esTag.record_size > es->record_size)
+    {
+        tagTuple = malloc(esTag.record_size);
+        if (tagTuple == NULL)
+        {
+            free(tags.record);
+            return 8;
+        }
+    }
+
+    printf("Tag sort. Tag size: %d\n", esTag.record_size);
+    inputStart = ftell(input->file);
+    err = adaptiveSort(&tagIterator, &tags, tagTuple, outputFile, buffer, bufferSizeInBlocks, &esTag, &tagFilePtr, metric,
+                        compareFn, 0, writeToReadRatio, 0, NULL);
+    if (tagTuple != tupleBuffer)
+        free(tagTuple);
+    free(tags.record);
+    if (err != 0)
+        return err;
+    if (permutation)
+    {
+        *resultFilePtr = tagFilePtr;
+        return 0;
+    }
+    return tagGather(input->file, inputStart, outputFile, buffer, bufferSizeInBlocks, es, &esTag, tagFilePtr, tags.id, resultFilePtr, metric);
+}
+
+int8_t adaptive_sort_is_sorted(
+    int     (*iterator)(void *state, void* buffer, external_sort_t *es),
+    void    *iteratorState,
+    char    *buffer,
+    external_sort_t *es,
+    metrics_t *metric
+)
+{
+    int16_t tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+    int32_t count = 0;
+    char    *prev = buffer, *record = buffer + es->record_size, *tmp;
+    int8_t  sorted = 1;
+
+    /* Records alternate between the two records of the buffer, so the record before each is not copied */
+    while (iterator(iteratorState, record, es))
+    {
+        count++;
+        if (count > 1)
+        {
+            metric->num_compar++;
+            if (es->compare_fcn(prev, record) > 0)
+            {
+                sorted = 0;
+                break;
+            }
+        }
+        tmp     = prev;
+        prev    = record;
+        record  = tmp;
+    }
+    metric->num_reads += (count + tuplesPerPage - 1) / tuplesPerPage;
+    printf("Sorted input check. Records read: %d  Sorted: %d\n", count, sorted);
+    return sorted;
+}
+
+int adaptive_sort_open(
+    adaptive_sort_stream_t **stream,
+    int     (*iterator)(void *state, void* buffer, external_sort_t *es),
+    void    *iteratorState,
+    void    *tupleBuffer,
+    ION_FILE *outputFile,
+    char    *buffer,
+    int     bufferSizeInBlocks,
+    external_sort_t *es,
+    metrics_t *metric,
+    int8_t  (*compareFn)(void *a, void *b),
+    int8_t  writeToReadRatio
+)
+{
+    adaptive_sort_stream_t *s = (adaptive_sort_stream_t*) malloc(sizeof(adaptive_sort_stream_t));
+    long    resultFilePtr;
+    int     err;
+
+    *stream = NULL;
+    if (s == NULL)
+        return 8;
+    streamInit(s, es, metric, outputFile, buffer, tupleBuffer);
+
+    err = adaptiveSort(iterator, iteratorState, tupleBuffer, outputFile, buffer, bufferSizeInBlocks, es, &resultFilePtr, metric,
+                        compareFn, 0, writeToReadRatio, 0, s);
+    if (err != 0)
+    {
+        adaptive_sort_close(s);
+        return err;
+    }
+    *stream = s;
+    return 0;
+}
+
+char* adaptive_sort_next(adaptive_sort_stream_t *stream)
+{
+    if (stream->es.aggregate != SORT_AGGREGATE_NONE)
+        return streamNextAggregate(stream);
+    return streamNext(stream);
+}
+
+int16_t adaptive_sort_next_page(adaptive_sort_stream_t *stream, char *page)
+{
+    external_sort_t *es = &stream->es;
+    int16_t         tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+    int16_t         count = 0;
+    char            *record;
+
+    while (count < tuplesPerPage && (record = adaptive_sort_next(stream)) != NULL)
+    {
+        memcpy(page + es->headerSize + count * es->record_size, record, (size_t)es->record_size);
+        count++;
+    }
+    if (count > 0)
+    {
+        *((int32_t *) page) = stream->pagesOut++;
+        *((int16_t *) (page + BLOCK_COUNT_OFFSET)) = count;
     }
+    return count;
+}
+
+int adaptive_sort_close(adaptive_sort_stream_t *stream)
+{
+    int err;
 
-	return 0;
+    if (stream == NULL)
+        return 0;
+    streamClose(stream);
+    err = stream->err;
+    free(stream);
+    return err;
 }
@@ -11,6 +11,7 @@
 #include <stdio.h>
 
 #include "external_sort.h"
+#include "clock_c_iface.h"
 
 //block to use as output block. Breaks reading in new block code if changed.
 #define OUTPUT_BLOCK_ID 0
@@ -18,13 +19,20 @@
 #define BUFFER_OUTPUT_BLOCK_START_OFFSET  	        0
 #define BUFFER_OUTPUT_BLOCK_START_RECORD_OFFSET 	BLOCK_HEADER_SIZE
 
+/* writeToReadRatio value that uses the active device profile (see device_profile.h) */
+#define ADAPTIVE_SORT_DEVICE_PROFILE                -1
+
+/* Size of the tags sorted by adaptive_sort_tag(): the bytes of a record up to the end of its key and the uint32_t number of the record in the input */
+#define ADAPTIVE_SORT_TAG_SIZE(es)                  ((es)->key_offset + (es)->key_size + sizeof(uint32_t))
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
 /**
 @brief      Adaptive sort combining no output buffer sort and MinSort that dynamically determines best sorting
-                algorithm based on input distribution. Uses replacement selection.
+                algorithm based on input distribution. Uses replacement selection. If a sample of the input has few
+                enough distinct keys, the input file of iteratorState is sorted with MinSort without run generation.
 @param      iterator
                 Row iterator for reading input rows
 @param      iteratorState
@@ -38,7 +46,13 @@ extern "C" {
 @param      bufferSizeInBlocks
                 Size of buffer in blocks
 @param      es
-                Sorting state info (block size, record size, etc.)
+                Sorting state info (block size, record size, key type and offset, etc.). Must be initialized with
+                external_sort_init() before its fields are set. If es->key_type is set, es->compare_fcn must order
+                records by that key, as both are used. The records of the first input page are checked. If es->aggregate is set,
+                records with equal keys are combined as they are merged (see sort_aggregate.h), so each pass
+                writes at most one record per key of each run. If es->codec is set, keys of the pages of runs
+                and merge passes are encoded (see sort_codec.h). Output is not encoded, except that variable length
+                records (SORT_CODEC_SLOTTED with es->length_fcn) are in slotted pages throughout the sort and in the output.
 @param      resultFilePtr
                 Offset within output file of first output record
 @param      metric
@@ -49,7 +63,10 @@ extern "C" {
                 True if generate sorted runs but not whole merge process
 @param      writeToReadRatio
                 Write time divided by read time multiplied by 10. If ratio is 2.5 
-                (writes over twice as expensive) then value is 25.
+                (writes over twice as expensive) then value is 25. ADAPTIVE_SORT_DEVICE_PROFILE
+                uses the ratios of the calibrated device profile (see device_profile.h).
+@return     0 if success, 8 if out of memory, 9 if write error, 10 if read error, 11 if es->compare_fcn does not order
+                records by the key of es->key_type, es->key_size and es->key_offset
 */
 int adaptive_sort(
         int     (*iterator)(void *state, void* buffer, external_sort_t *es),
@@ -66,6 +83,129 @@ int adaptive_sort(
         int8_t  writeToReadRatio
 );
 
+/**
+@brief      Sorts only the smallest limit records of the input (top-k). Output is limit records (or all records if there
+                are fewer) in sorted order at resultFilePtr. If limit records fit in all but one block of the buffer, they
+                are kept in a bounded heap while the input is read and no runs are written. Otherwise pages of each run
+                after its first limit records (or after a key known to be larger than the result) are not written, and
+                each merge and the final MinSort stop after limit records. Parameters are as for adaptive_sort().
+                es->aggregate is not applied.
+@param      limit
+                Number of records to output. 0 sorts all records.
+*/
+int adaptive_sort_limit(
+        int     (*iterator)(void *state, void* buffer, external_sort_t *es),
+        void    *iteratorState,
+        void    *tupleBuffer,
+        ION_FILE *outputFile,
+        char    *buffer,
+        int     bufferSizeInBlocks,
+        external_sort_t *es,
+        long    *resultFilePtr,
+        metrics_t *metric,
+        int8_t  (*compareFn)(void *a, void *b),
+        int8_t  writeToReadRatio,
+        int32_t limit
+);
+
+/**
+@brief      Sorts tags of the records rather than the records (tag sort). Run generation and merge passes sort only the
+                bytes of each record up to the end of its key followed by the number of the record in the input (see
+                ADAPTIVE_SORT_TAG_SIZE()). A final gather pass then reads the records in tag order from the input file and
+                writes them to the end of the output file at resultFilePtr, so the other bytes of each record are written
+                once however many merge passes are performed. Gather caches input pages in all but two blocks of the buffer
+                and reads an input page whenever a record is not in a cached page. Parameters are as for adaptive_sort().
+                iteratorState must be a file_iterator_state_t at the start of the input, which is a file of pages in the
+                standard block format with all pages full except the last, read in order by the iterator. compareFn and
+                es->compare_fcn must only read bytes up to the end of the key. es->aggregate is not applied. Variable length
+                records, and fixed size records when tags are not smaller or the buffer has less than 3 blocks, are
+                sorted whole.
+@param      permutation
+                If true, gather is not performed and the sorted tags are output at resultFilePtr. The uint32_t at the
+                end of each tag is the number of a record in the input, so the tags give the sorted order of the input.
+*/
+int adaptive_sort_tag(
+        int     (*iterator)(void *state, void* buffer, external_sort_t *es),
+        void    *iteratorState,
+        void    *tupleBuffer,
+        ION_FILE *outputFile,
+        char    *buffer,
+        int     bufferSizeInBlocks,
+        external_sort_t *es,
+        long    *resultFilePtr,
+        metrics_t *metric,
+        int8_t  (*compareFn)(void *a, void *b),
+        int8_t  writeToReadRatio,
+        int8_t  permutation
+);
+
+/**
+@brief      Checks if the input is already sorted without writing anything. Records are read with the iterator until one
+                is less than the record before it, so unsorted input is usually rejected after few records and sorted input
+                is read once. Sorted input may be used as the sorted output rather than sorting it. Records with equal keys
+                are not combined by es->aggregate. The iterator must be restarted at the start of the input before sorting.
+@param      buffer
+                Buffer of at least two records
+@return     1 if the records are in sorted order, 0 otherwise
+*/
+int8_t adaptive_sort_is_sorted(
+        int     (*iterator)(void *state, void* buffer, external_sort_t *es),
+        void    *iteratorState,
+        char    *buffer,
+        external_sort_t *es,
+        metrics_t *metric
+);
+
+/**
+@brief      Sorted output stream opened by adaptive_sort_open(). Private to adaptive_sort.c.
+*/
+typedef struct adaptive_sort_stream adaptive_sort_stream_t;
+
+/**
+@brief      Sorts like adaptive_sort() but does not write the sorted output. Run generation and all merge
+                passes but the last are performed. The records of the final merge (or MinSort) are produced
+                one at a time by adaptive_sort_next() so a consumer can use them without the final pass
+                writing them and reading them back. The output file, buffer, tuple buffer, iterator state,
+                and metrics are used by the stream until adaptive_sort_close().
+@param      stream
+                Set to the opened stream or NULL if error
+@return     0 if success, 8 if out of memory, 9 if write error, 10 if read error, 11 if es->compare_fcn does not order
+                records by the key of es (see adaptive_sort())
+*/
+int adaptive_sort_open(
+        adaptive_sort_stream_t **stream,
+        int     (*iterator)(void *state, void* buffer, external_sort_t *es),
+        void    *iteratorState,
+        void    *tupleBuffer,
+        ION_FILE *outputFile,
+        char    *buffer,
+        int     bufferSizeInBlocks,
+        external_sort_t *es,
+        metrics_t *metric,
+        int8_t  (*compareFn)(void *a, void *b),
+        int8_t  writeToReadRatio
+);
+
+/**
+@brief      Returns the next record in sorted order or NULL if all records have been returned or a read
+                failed (see adaptive_sort_close()). The record is valid until the next call. If es->aggregate
+                is set, the record combines all records with its key.
+*/
+char* adaptive_sort_next(adaptive_sort_stream_t *stream);
+
+/**
+@brief      Copies the next records in sorted order into a page and sets its header. The block id is the
+                number of pages returned before it.
+@return     Number of records copied. Less than a page of records only for the last page. 0 if none are left.
+*/
+int16_t adaptive_sort_next_page(adaptive_sort_stream_t *stream, char *page);
+
+/**
+@brief      Frees the stream. Records need not all have been read.
+@return     0 if success, 8 if out of memory, 10 if a read by adaptive_sort_next() failed
+*/
+int adaptive_sort_close(adaptive_sort_stream_t *stream);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,284 @@
+#if !defined(ADAPTIVE_SORT_HPP)
+#define ADAPTIVE_SORT_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "adaptive_sort.h"
+
+/*
+ * Header-only, type-safe C++ front end of adaptive sort. A sorter is specialized by record type, key, key comparison and
+ * page size. The settings of the C engines (external_sort_t) are derived from the types at compile time and checked with
+ * static_assert, and the record comparison and input iterator passed to the engines are generated for each record type.
+ * The engines are the same C code as for C callers and call the comparison through the compare_fcn pointer, so sorting
+ * costs the same as from C. The C functions in adaptive_sort.h remain the interface used by C code.
+ *
+ * The engines write the output file from its current position, so each sort starts writing at the start of the output
+ * file. The output file may be reused by later sorts.
+ *
+ * Records must be copyable with memcpy. Records are not aligned in pages, so they are copied in and out rather than accessed in place.
+ */
+namespace adaptive {
+
+/**
+@brief      Key type used by MinSort, key radix sort and the run generation heap (see sort_key.h). Keys of other types
+            are ordered only by the record comparison.
+*/
+template <typename K> struct key_traits          { static const int8_t type = SORT_KEY_TYPE_NONE; };
+template <> struct key_traits<int8_t>            { static const int8_t type = SORT_KEY_TYPE_INT; };
+template <> struct key_traits<int16_t>           { static const int8_t type = SORT_KEY_TYPE_INT; };
+template <> struct key_traits<int32_t>           { static const int8_t type = SORT_KEY_TYPE_INT; };
+template <> struct key_traits<int64_t>           { static const int8_t type = SORT_KEY_TYPE_INT; };
+template <> struct key_traits<uint8_t>           { static const int8_t type = SORT_KEY_TYPE_UINT; };
+template <> struct key_traits<uint16_t>          { static const int8_t type = SORT_KEY_TYPE_UINT; };
+template <> struct key_traits<uint32_t>          { static const int8_t type = SORT_KEY_TYPE_UINT; };
+template <> struct key_traits<uint64_t>          { static const int8_t type = SORT_KEY_TYPE_UINT; };
+template <> struct key_traits<float>             { static const int8_t type = SORT_KEY_TYPE_FLOAT; };
+template <> struct key_traits<double>            { static const int8_t type = SORT_KEY_TYPE_FLOAT; };
+
+/**
+@brief      Key extractor for a field of type Key at byte Offset of a record. Use ADAPTIVE_SORT_KEY(Record, member).
+*/
+template <typename Key, uint16_t Offset>
+struct field_key {
+    typedef Key key_type;
+    static const uint16_t offset = Offset;
+
+    static Key get(const void *record)
+    {   /* Copy as record may not be aligned */
+        Key key;
+        memcpy(&key, (const char*) record + Offset, sizeof(Key));
+        return key;
+    }
+};
+
+#define ADAPTIVE_SORT_KEY(Record, member)   adaptive::field_key<decltype(((Record*) 0)->member), offsetof(Record, member)>
+
+/**
+@brief      Ascending key order. The only order MinSort and the key based paths of the engines produce.
+*/
+template <typename K>
+struct less {
+    bool operator()(const K &a, const K &b) const { return a < b; }
+};
+
+template <typename Compare, typename K> struct natural_order            { static const bool value = false; };
+template <typename K> struct natural_order<less<K>, K>                  { static const bool value = true; };
+
+/**
+@brief      Adaptive sort of records of type Record ordered by the key returned by KeyExtractor::get() under Compare.
+            Input is a file of PageSize pages in the block format of the engines (see external_sort.h).
+            With a comparison other than less, the engines order records only with the record comparison, so
+            MinSort and the key based paths are not used.
+*/
+template <typename Record, typename KeyExtractor, typename Compare = less<typename KeyExtractor::key_type>, uint16_t PageSize = 512>
+class sorter {
+public:
+    typedef typename KeyExtractor::key_type key_type;
+
+    static const uint16_t   header_size         = (BLOCK_HEADER_SIZE);
+    static const uint16_t   record_size         = sizeof(Record);
+    static const uint16_t   page_size           = PageSize;
+    static const int16_t    records_per_page    = (PageSize - (BLOCK_HEADER_SIZE)) / sizeof(Record);
+
+    static_assert(records_per_page > 0, "Page must hold at least one record");
+    static_assert(KeyExtractor::offset + sizeof(key_type) <= sizeof(Record), "Key must be within record");
+
+    sorter() : stream_(NULL)
+    {
+        external_sort_init(&es_);
+        es_.key_size            = sizeof(key_type);
+        es_.value_size          = record_size - sizeof(key_type);
+        es_.page_size           = PageSize;
+        es_.record_size         = record_size;
+        es_.compare_fcn         = &compare;
+        es_.key_type            = natural_order<Compare, key_type>::value ? key_traits<key_type>::type : SORT_KEY_TYPE_NONE;
+        es_.key_offset          = KeyExtractor::offset;
+        memset(&input_, 0, sizeof(input_));
+    }
+
+    ~sorter()
+    {
+        close();
+    }
+
+    /**
+    @brief      Record comparison passed to the engines as compare_fcn. Orders records by the key of KeyExtractor
+                with Compare.
+    */
+    static int8_t compare(void *a, void *b)
+    {
+        Compare     before;
+        key_type    ka = KeyExtractor::get(a), kb = KeyExtractor::get(b);
+
+        if (before(ka, kb))
+            return -1;
+        if (before(kb, ka))
+            return 1;
+        return 0;
+    }
+
+    /**
+    @brief      Input iterator passed to the engines. Returns the next record of the input file in buffer.
+    */
+    static int next_record(void *state, void *buffer, external_sort_t *es)
+    {
+        file_iterator_state_t *input = (file_iterator_state_t*) state;
+        char *page = (char*) input->readBuffer;
+
+        (void) es;
+        if (input->recordsRead >= input->totalRecords)
+            return 0;
+        if (input->recordsLeftInBlock == 0)
+        {
+            if (0 == fread(page, PageSize, 1, input->file))
+                return 0;
+            input->recordsLeftInBlock   = *((int16_t *) (page + BLOCK_COUNT_OFFSET));
+            input->currentRecord        = 0;
+        }
+        input->recordsRead++;
+        input->recordsLeftInBlock--;
+        memcpy(buffer, page + header_size + input->currentRecord * sizeof(Record), sizeof(Record));
+        input->currentRecord++;
+        return 1;
+    }
+
+    /**
+    @brief      Settings passed to the engines. May be changed before sorting, e.g. to set an aggregate.
+    */
+    external_sort_t* settings()
+    {
+        return &es_;
+    }
+
+    /**
+    @brief      Combines records with equal keys during the sort (see sort_aggregate.h).
+    @param      value
+                    Byte offset of the int32_t value field of COUNT, SUM, MIN and MAX
+    */
+    void aggregate(int8_t op, uint16_t value)
+    {
+        es_.aggregate        = op;
+        es_.aggregate_offset = value;
+    }
+
+    /**
+    @brief      Sorts numRecords records of input. Parameters are as for adaptive_sort().
+    @return     0 if success, 8 if out of memory, 9 if write error, 10 if read error
+    */
+    int sort(ION_FILE *input, uint32_t numRecords, ION_FILE *output, char *buffer, int bufferSizeInBlocks, long *resultFilePtr,
+             metrics_t *metric, int8_t writeToReadRatio = ADAPTIVE_SORT_DEVICE_PROFILE)
+    {
+        setInput(input, numRecords);
+        fseek(output, 0, SEEK_SET);
+        return adaptive_sort(&next_record, &input_, tuple_, output, buffer, bufferSizeInBlocks, &es_, resultFilePtr, metric,
+                             &compare, 0, writeToReadRatio);
+    }
+
+    /**
+    @brief      Sorts only the smallest limit records of input (see adaptive_sort_limit()).
+    */
+    int sort_limit(ION_FILE *input, uint32_t numRecords, ION_FILE *output, char *buffer, int bufferSizeInBlocks, long *resultFilePtr,
+             metrics_t *metric, int32_t limit, int8_t writeToReadRatio = ADAPTIVE_SORT_DEVICE_PROFILE)
+    {
+        setInput(input, numRecords);
+        fseek(output, 0, SEEK_SET);
+        return adaptive_sort_limit(&next_record, &input_, tuple_, output, buffer, bufferSizeInBlocks, &es_, resultFilePtr, metric,
+                             &compare, writeToReadRatio, limit);
+    }
+
+    /**
+    @brief      Sorts tags of key and record number and then gathers the records of input in tag order (see adaptive_sort_tag()).
+                If permutation is true, the sorted tags are output rather than the records.
+    */
+    int sort_tag(ION_FILE *input, uint32_t numRecords, ION_FILE *output, char *buffer, int bufferSizeInBlocks, long *resultFilePtr,
+             metrics_t *metric, bool permutation = false, int8_t writeToReadRatio = ADAPTIVE_SORT_DEVICE_PROFILE)
+    {
+        setInput(input, numRecords);
+        fseek(output, 0, SEEK_SET);
+        return adaptive_sort_tag(&next_record, &input_, tuple_, output, buffer, bufferSizeInBlocks, &es_, resultFilePtr, metric,
+                             &compare, writeToReadRatio, permutation ? 1 : 0);
+    }
+
+    /**
+    @brief      Returns true if the numRecords records of input are already sorted (see adaptive_sort_is_sorted()).
+                The position of input is restored, so it can be sorted if not.
+    */
+    bool is_sorted(ION_FILE *input, uint32_t numRecords, char *buffer, metrics_t *metric)
+    {
+        long start = ftell(input);
+        bool sorted;
+
+        setInput(input, numRecords);
+        sorted = adaptive_sort_is_sorted(&next_record, &input_, buffer, &es_, metric) != 0;
+        fseek(input, start, SEEK_SET);
+        return sorted;
+    }
+
+    /**
+    @brief      Sorts input up to the final pass, which produces records as next() is called (see adaptive_sort_open()).
+                The sorter, files and buffer are used until close().
+    */
+    int open(ION_FILE *input, uint32_t numRecords, ION_FILE *output, char *buffer, int bufferSizeInBlocks,
+             metrics_t *metric, int8_t writeToReadRatio = ADAPTIVE_SORT_DEVICE_PROFILE)
+    {
+        close();
+        setInput(input, numRecords);
+        fseek(output, 0, SEEK_SET);
+        return adaptive_sort_open(&stream_, &next_record, &input_, tuple_, output, buffer, bufferSizeInBlocks, &es_, metric,
+                             &compare, writeToReadRatio);
+    }
+
+    /**
+    @brief      Copies the next record in sorted order to record. Returns false if none are left or a read failed.
+    */
+    bool next(Record &record)
+    {
+        char *next = stream_ == NULL ? NULL : adaptive_sort_next(stream_);
+
+        if (next == NULL)
+            return false;
+        memcpy(&record, next, sizeof(Record));
+        return true;
+    }
+
+    /**
+    @brief      Ends the sorted stream opened by open().
+    @return     0 if success or no stream is open, otherwise as for adaptive_sort_close()
+    */
+    int close()
+    {
+        int err = adaptive_sort_close(stream_);
+
+        stream_ = NULL;
+        return err;
+    }
+
+private:
+    void setInput(ION_FILE *input, uint32_t numRecords)
+    {
+        es_.num_pages               = (numRecords + records_per_page - 1) / records_per_page;
+        input_.file                 = input;
+        input_.recordsRead          = 0;
+        input_.totalRecords         = numRecords;
+        input_.recordSize           = record_size;
+        input_.currentRecord        = 0;
+        input_.recordsLeftInBlock   = 0;
+        input_.readBuffer           = readPage_;
+    }
+
+    /* Not copyable as the engines keep pointers to the settings, input state and buffers */
+    sorter(const sorter&);
+    sorter& operator=(const sorter&);
+
+    external_sort_t         es_;
+    file_iterator_state_t   input_;
+    adaptive_sort_stream_t  *stream_;
+    char                    tuple_[sizeof(Record)];
+    char                    readPage_[PageSize];
+};
+
+}
+
+#endif
@@ -0,0 +1,1099 @@
+/******************************************************************************/
+/**
+@file		bench_adaptive_sort.c
+@author		Ramon Lawrence
+@brief		Native (PC) benchmark driver for adaptive sort. Generates test data,
+			runs the selected algorithm and reports per-run metrics.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test_adaptive_sort.h"
+#include "device_profile.h"
+#include "sort_metrics.h"
+#include "sort_codec.h"
+#include "run_pipeline.h"
+#include "sort_parallel.h"
+#include "file/ion_file_async.h"
+#include "file/ion_file_map.h"
+
+#define BENCH_MAX_PHASES        64
+
+#define BENCH_ALG_ADAPTIVE      0
+#define BENCH_ALG_MINSORT       1
+#define BENCH_ALG_RUNGEN        2
+#define BENCH_ALG_STREAM        3
+#define BENCH_ALG_TAG           4
+#define BENCH_ALG_PERMUTATION   5
+
+/**
+ * Benchmark parameters. Set from command line flags.
+ */
+typedef struct {
+    int         memoryPages;
+    uint16_t    pageSize;
+    uint16_t    recordSize;
+    int32_t     numRecords;
+    int         distribution;       /* 0 - sorted, 1 - reverse sorted, 2 - random, 3 - percentage random */
+    int         percentRandom;
+    int         numDistinct;
+    int8_t      writeToReadRatio;
+    int         algorithm;
+    int         numRuns;
+    int         seed;
+    int8_t      csv;
+    int         calibrateTransfers; /* Transfers per size for device calibration. 0 if not calibrating. */
+    int8_t      ratioSet;
+    int         keyType;            /* Index into keyTypeNames */
+    uint16_t    keyOffset;
+    int         pipelineDepth;      /* Run generation queue depth in pages. -1 uses default. */
+    int         workers;            /* Parallel merge workers. 0 uses default. */
+    int         ioThreads;          /* Asynchronous I/O threads. -1 uses default. */
+    int         mapFiles;           /* 1 to read pages from memory-mapped files. -1 uses default. */
+    int32_t     limit;              /* Output only the smallest limit records. 0 sorts all records. */
+    int         aggregate;          /* One of SORT_AGGREGATE_* */
+    int         codec;              /* One of SORT_CODEC_* */
+    uint16_t    minRecordSize;      /* Variable length records of minRecordSize to recordSize bytes. 0 if records are fixed size. */
+    int8_t      checkSorted;        /* 1 to check if the input is sorted before sorting and not sort it if so */
+    const char  *inputFileName;
+    const char  *outputFileName;
+#if defined(SIM_FLASH)
+    sim_flash_config_t flash;       /* Simulated device. Page size 0 uses sort page size. */
+#endif
+} bench_config_t;
+
+static const char *algorithmNames[] = { "adaptive", "minsort", "rungen", "stream", "tag", "permutation" };
+static const char *distributionNames[] = { "sorted", "reverse", "random", "percent" };
+static const char *aggregateNames[] = { "none", "distinct", "count", "sum", "min", "max" };
+static const char *codecNames[] = { "none", "delta", "rle", "dict" };
+
+/* Record key formats. Test data keys are converted from int32 when key is not int32 at offset 0. */
+#define BENCH_NUM_KEY_TYPES     7
+static const char *keyTypeNames[] = { "int32", "uint32", "int16", "int64", "uint64", "float", "double" };
+static const int8_t keyTypes[] = { SORT_KEY_TYPE_INT, SORT_KEY_TYPE_UINT, SORT_KEY_TYPE_INT, SORT_KEY_TYPE_INT, SORT_KEY_TYPE_UINT, SORT_KEY_TYPE_FLOAT, SORT_KEY_TYPE_FLOAT };
+static const uint8_t keySizes[] = { 4, 4, 2, 8, 8, 4, 8 };
+
+/* Key of records being compared by compareKey() */
+static int      benchKeyType;
+static uint16_t benchKeyOffset;
+
+/* Offset of uint16_t length of variable length records. 0 if records are fixed size. */
+static uint16_t benchLengthOffset;
+
+/* Record comparison used by compareRecords() */
+static int8_t   (*benchCompareFcn)(void *a, void *b);
+
+/* Per-phase metrics of the current run */
+static metrics_phase_t runPhases[BENCH_MAX_PHASES];
+static metrics_phase_log_t runPhaseLog;
+
+#if defined(SIM_FLASH)
+static const char *overwriteNames[] = { "allow", "erase", "forbid" };
+
+/* Simulated device statistics for the sort (excludes test data generation and verification) */
+static sim_flash_stats_t runFlashStats;
+
+/* Parses read:program:erase latencies in microseconds. Returns 0 on success. */
+static int parseLatencies(const char *arg, sim_flash_config_t *flash)
+{
+    double r, p, e;
+    if (sscanf(arg, "%lf:%lf:%lf", &r, &p, &e) != 3 || r < 0 || p < 0 || e < 0)
+        return -1;
+    flash->read_latency_ns = (uint32_t) (r*1000);
+    flash->program_latency_ns = (uint32_t) (p*1000);
+    flash->erase_latency_ns = (uint32_t) (e*1000);
+    return 0;
+}
+#endif
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("  -m pages      Memory size in pages (default 2)\n");
+    printf("  -p bytes      Page size (default 512)\n");
+    printf("  -r bytes      Record size (default 16, minimum 4)\n");
+    printf("  -n count      Number of records (default 10000)\n");
+    printf("  -d dist       Distribution: sorted, reverse, random, percent (default random)\n");
+    printf("  -k count      Number of distinct keys for random data (default 256)\n");
+    printf("  -q percent    Percentage of random keys for percent distribution (default 10)\n");
+    printf("  -K type       Key type: int32, uint32, int16, int64, uint64, float, double (default int32)\n");
+    printf("  -f offset     Key offset in record (default 0)\n");
+    printf("  -T pages      Pipelined run generation queue depth, 0 disables (default %d)\n", run_pipeline_get_depth());
+    printf("  -W workers    Parallel merge workers, 1 disables (default %d)\n", sort_parallel_get_workers());
+    printf("  -A threads    Asynchronous merge I/O threads, 0 disables (default %d)\n", ion_file_async_get_threads());
+    printf("  -M 0|1        Read pages of temporary files from a memory mapping (default %d)\n", ion_file_map_get_enabled());
+    printf("  -w ratio      Write to read ratio x10 or 'profile' to use saved device profile (default 30)\n");
+    printf("  -a alg        Algorithm: adaptive, minsort, rungen, stream, tag, permutation (default adaptive)\n");
+    printf("  -l count      Output only the smallest count records with adaptive sort (default 0 sorts all)\n");
+    printf("  -g agg        Combine records with equal keys: none, distinct, count, sum, min, max (default none)\n");
+    printf("  -e codec      Encode keys of run and merge pages: none, delta, rle, dict (default none)\n");
+    printf("  -v bytes      Variable length records of bytes to record size bytes in slotted pages (default 0 is fixed size)\n");
+    printf("  -S            Check if input is already sorted and do not sort it if so\n");
+    printf("  -t runs       Number of runs (default 3)\n");
+    printf("  -s seed       Random seed (default 2020)\n");
+    printf("  -i file       Input data file (default bench_in.bin)\n");
+    printf("  -o file       Output/temporary file (default bench_out.bin)\n");
+    printf("  -c            Print one CSV line per run\n");
+    printf("  -C transfers  Calibrate device, save profile and use it for sorting (unless -w given)\n");
+#if defined(SIM_FLASH)
+    printf("  -L r:p:e      Simulated flash read, program, erase latency in us (default 25:200:1500)\n");
+    printf("  -B pages      Pages per erase block (default 64)\n");
+    printf("  -P bytes      Device page size (default sort page size)\n");
+    printf("  -O policy     Overwrite policy: allow, erase, forbid (default erase)\n");
+    printf("                If -w is not given, write to read ratio is program/read latency\n");
+#endif
+}
+
+/* Returns offset of the int32 value field combined by an aggregate. First 4 bytes of record not used by key. */
+static uint16_t aggregateOffset(bench_config_t *cfg)
+{
+    return cfg->keyOffset >= sizeof(int32_t) ? 0 : (uint16_t) (cfg->keyOffset + keySizes[cfg->keyType]);
+}
+
+/* Returns offset of the uint16 length of variable length records. Follows the key and aggregate value field. */
+static uint16_t lengthOffset(bench_config_t *cfg)
+{
+    uint16_t keyEnd = (uint16_t) (cfg->keyOffset + keySizes[cfg->keyType]);
+    uint16_t valueEnd = (uint16_t) (aggregateOffset(cfg) + sizeof(int32_t));
+
+    return keyEnd > valueEnd ? keyEnd : valueEnd;
+}
+
+/* Returns index of name in list or value if numeric. -1 if not found. */
+static int lookupName(const char *name, const char **names, int count)
+{
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    }
+    if (name[0] >= '0' && name[0] <= '9')
+    {
+        i = atoi(name);
+        if (i < count)
+            return i;
+    }
+    return -1;
+}
+
+static int parseArgs(int argc, char **argv, bench_config_t *cfg)
+{
+    int opt;
+
+    cfg->memoryPages        = 2;
+    cfg->pageSize           = 512;
+    cfg->recordSize         = 16;
+    cfg->numRecords         = 10000;
+    cfg->distribution       = 2;
+    cfg->percentRandom      = 10;
+    cfg->numDistinct        = 256;
+    cfg->writeToReadRatio   = 30;
+    cfg->algorithm          = BENCH_ALG_ADAPTIVE;
+    cfg->numRuns            = 3;
+    cfg->seed               = 2020;
+    cfg->csv                = 0;
+    cfg->calibrateTransfers = 0;
+    cfg->ratioSet           = 0;
+    cfg->keyType            = 0;
+    cfg->keyOffset          = 0;
+    cfg->pipelineDepth      = -1;
+    cfg->workers            = 0;
+    cfg->ioThreads          = -1;
+    cfg->mapFiles           = -1;
+    cfg->limit              = 0;
+    cfg->aggregate          = SORT_AGGREGATE_NONE;
+    cfg->codec              = SORT_CODEC_NONE;
+    cfg->minRecordSize      = 0;
+    cfg->checkSorted        = 0;
+    cfg->inputFileName      = "bench_in.bin";
+    cfg->outputFileName     = "bench_out.bin";
+#if defined(SIM_FLASH)
+    sim_flash_get_config(&cfg->flash);
+    cfg->flash.page_size    = 0;
+#define BENCH_OPTIONS "m:p:r:n:d:k:q:K:f:T:W:A:M:w:a:l:g:e:v:St:s:i:o:cC:hL:B:P:O:"
+#else
+#define BENCH_OPTIONS "m:p:r:n:d:k:q:K:f:T:W:A:M:w:a:l:g:e:v:St:s:i:o:cC:h"
+#endif
+
+    while ((opt = getopt(argc, argv, BENCH_OPTIONS)) != -1)
+    {
+        switch (opt)
+        {
+            case 'm': cfg->memoryPages = atoi(optarg); break;
+            case 'p': cfg->pageSize = (uint16_t) atoi(optarg); break;
+            case 'r': cfg->recordSize = (uint16_t) atoi(optarg); break;
+            case 'n': cfg->numRecords = atol(optarg); break;
+            case 'd': cfg->distribution = lookupName(optarg, distributionNames, 4); break;
+            case 'k': cfg->numDistinct = atoi(optarg); break;
+            case 'q': cfg->percentRandom = atoi(optarg); break;
+            case 'K': cfg->keyType = lookupName(optarg, keyTypeNames, BENCH_NUM_KEY_TYPES); break;
+            case 'f': cfg->keyOffset = (uint16_t) atoi(optarg); break;
+            case 'T': cfg->pipelineDepth = atoi(optarg); break;
+            case 'W': cfg->workers = atoi(optarg); break;
+            case 'A': cfg->ioThreads = atoi(optarg); break;
+            case 'M': cfg->mapFiles = atoi(optarg); break;
+            case 'w': cfg->writeToReadRatio = strcmp(optarg, "profile") == 0 ? ADAPTIVE_SORT_DEVICE_PROFILE : (int8_t) atoi(optarg);
+                cfg->ratioSet = 1;
+                break;
+            case 'a': cfg->algorithm = lookupName(optarg, algorithmNames, 6); break;
+            case 'l': cfg->limit = atol(optarg); break;
+            case 'g': cfg->aggregate = lookupName(optarg, aggregateNames, 6); break;
+            case 'e': cfg->codec = lookupName(optarg, codecNames, 4); break;
+            case 'v': cfg->minRecordSize = (uint16_t) atoi(optarg); break;
+            case 'S': cfg->checkSorted = 1; break;
+            case 't': cfg->numRuns = atoi(optarg); break;
+            case 's': cfg->seed = atoi(optarg); break;
+            case 'i': cfg->inputFileName = optarg; break;
+            case 'o': cfg->outputFileName = optarg; break;
+            case 'c': cfg->csv = 1; break;
+            case 'C': cfg->calibrateTransfers = atoi(optarg); break;
+#if defined(SIM_FLASH)
+            case 'L':
+                if (parseLatencies(optarg, &cfg->flash) != 0)
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'B': cfg->flash.pages_per_block = (uint32_t) atoi(optarg); break;
+            case 'P': cfg->flash.page_size = (uint32_t) atoi(optarg); break;
+            case 'O': cfg->flash.overwrite_policy = (int8_t) lookupName(optarg, overwriteNames, 3); break;
+#endif
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (cfg->memoryPages < 2 || cfg->recordSize < sizeof(int32_t) || cfg->numRecords < 1 || cfg->numRuns < 1
+        || cfg->pageSize < BLOCK_HEADER_SIZE + cfg->recordSize || cfg->numDistinct < 1
+        || cfg->distribution < 0 || cfg->algorithm < 0 || cfg->limit < 0 || (cfg->limit > 0 && cfg->algorithm != BENCH_ALG_ADAPTIVE)
+        || cfg->keyType < 0 || cfg->keyOffset + keySizes[cfg->keyType] > cfg->recordSize
+        || cfg->aggregate < 0 || (cfg->aggregate != SORT_AGGREGATE_NONE && (cfg->limit > 0
+            || (cfg->algorithm != BENCH_ALG_ADAPTIVE && cfg->algorithm != BENCH_ALG_STREAM)
+            || aggregateOffset(cfg) + sizeof(int32_t) > cfg->recordSize))
+        || cfg->codec < 0 || (cfg->codec != SORT_CODEC_NONE && cfg->algorithm == BENCH_ALG_MINSORT)
+        || (cfg->minRecordSize > 0 && (cfg->minRecordSize < lengthOffset(cfg) + sizeof(uint16_t) || cfg->minRecordSize > cfg->recordSize
+            || cfg->codec != SORT_CODEC_NONE || cfg->algorithm == BENCH_ALG_MINSORT || cfg->algorithm == BENCH_ALG_PERMUTATION
+            || cfg->pageSize < SORT_CODEC_HEADER_SIZE + sizeof(int16_t) + cfg->recordSize))
+        || (cfg->checkSorted && (cfg->limit > 0 || cfg->aggregate != SORT_AGGREGATE_NONE
+            || (cfg->algorithm != BENCH_ALG_ADAPTIVE && cfg->algorithm != BENCH_ALG_STREAM))))
+    {
+        printf("Invalid arguments.\n");
+        usage(argv[0]);
+        return -1;
+    }
+    if (cfg->calibrateTransfers < 0)
+    {
+        printf("Invalid number of calibration transfers.\n");
+        return -1;
+    }
+    if (cfg->algorithm == BENCH_ALG_MINSORT && cfg->memoryPages < 3)
+    {
+        printf("MinSort requires at least 3 pages of memory.\n");
+        return -1;
+    }
+#if defined(SIM_FLASH)
+    if (cfg->flash.page_size == 0)
+        cfg->flash.page_size = cfg->pageSize;
+    if (!cfg->ratioSet && cfg->calibrateTransfers == 0 && cfg->flash.read_latency_ns > 0)
+    {   /* Device profile determines write to read ratio used by adaptive sort */
+        uint32_t ratio = (uint32_t) ((uint64_t) cfg->flash.program_latency_ns * 10 / cfg->flash.read_latency_ns);
+        cfg->writeToReadRatio = (int8_t) (ratio > 127 ? 127 : ratio);
+    }
+    if (sim_flash_init(&cfg->flash) != 0)
+    {
+        printf("Invalid simulated flash configuration.\n");
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+/**
+ * Profiles the storage device, saves the profile and makes it active. Returns 0 on success.
+ */
+static int calibrateDevice(bench_config_t *cfg)
+{
+    char buffer[2048];
+    device_profile_t profile;
+
+    ION_FILE *fp = fopen("bench_cal.bin", "w+b");
+    if (NULL == fp)
+    {
+        printf("Error: Can't open calibration file!\n");
+        return 10;
+    }
+    int err = device_profile_calibrate(fp, buffer, sizeof(buffer), (uint16_t) cfg->calibrateTransfers, &profile);
+    fclose(fp);
+    fremove("bench_cal.bin");
+    if (err != 0)
+    {
+        printf("Calibration error: %d\n", err);
+        return err;
+    }
+
+    device_profile_print(&profile);
+    if (device_profile_save(&profile, DEVICE_PROFILE_FILE_NAME) != 0)
+        printf("Error: Can't save device profile!\n");
+    device_profile_set_active(&profile);
+
+    if (!cfg->ratioSet)
+        cfg->writeToReadRatio = ADAPTIVE_SORT_DEVICE_PROFILE;
+    printf("Write/read ratio for page size %d: %d\n\n", cfg->pageSize, device_profile_write_ratio(&profile, cfg->pageSize));
+    return 0;
+}
+
+/* Compares keys of type benchKeyType at benchKeyOffset */
+static int8_t compareKey(void *a, void *b)
+{
+    char *ka = (char*) a + benchKeyOffset, *kb = (char*) b + benchKeyOffset;
+
+    #define BENCH_COMPARE(type) { type x, y; memcpy(&x, ka, sizeof(type)); memcpy(&y, kb, sizeof(type)); return x < y ? -1 : (x > y ? 1 : 0); }
+    switch (benchKeyType)
+    {
+        case 0:  BENCH_COMPARE(int32_t)
+        case 1:  BENCH_COMPARE(uint32_t)
+        case 2:  BENCH_COMPARE(int16_t)
+        case 3:  BENCH_COMPARE(int64_t)
+        case 4:  BENCH_COMPARE(uint64_t)
+        case 5:  BENCH_COMPARE(float)
+        default: BENCH_COMPARE(double)
+    }
+    #undef BENCH_COMPARE
+}
+
+/**
+ * Rewrites int32 test data keys at offset 0 as keys of the configured type and offset.
+ * Signed keys are centered on 0 so half are negative. Returns 0 on success.
+ */
+static int convertTestData(ION_FILE *fp, char *buffer, external_sort_t *es, bench_config_t *cfg)
+{
+    uint32_t i;
+    int32_t  k, center = cfg->numRecords / 2;
+    int16_t  j, count;
+    char     *rec;
+
+    for (i = 0; i < es->num_pages; i++)
+    {
+        fseek(fp, (long) i * es->page_size, SEEK_SET);
+        if (0 == fread(buffer, es->page_size, 1, fp))
+            return 10;
+
+        count = *((int16_t*) (buffer + BLOCK_COUNT_OFFSET));
+        for (j = 0; j < count; j++)
+        {
+            rec = buffer + es->headerSize + j*es->record_size;
+            memcpy(&k, rec, sizeof(int32_t));
+            memset(rec, 0, sizeof(int32_t));
+
+            #define BENCH_SET_KEY(type, value) { type v = (type) (value); memcpy(rec + cfg->keyOffset, &v, sizeof(type)); break; }
+            switch (cfg->keyType)
+            {
+                case 0:  BENCH_SET_KEY(int32_t, k - center)
+                case 1:  BENCH_SET_KEY(uint32_t, k)
+                case 2:  BENCH_SET_KEY(int16_t, (k - center) % 32768)
+                case 3:  BENCH_SET_KEY(int64_t, (int64_t) (k - center) * 4294967311LL)
+                case 4:  BENCH_SET_KEY(uint64_t, (uint64_t) k * 4294967311ULL)
+                case 5:  BENCH_SET_KEY(float, (k - center) / 4.0f)
+                default: BENCH_SET_KEY(double, (k - center) * 0.001)
+            }
+            #undef BENCH_SET_KEY
+        }
+
+        fseek(fp, (long) i * es->page_size, SEEK_SET);
+        if (0 == fwrite(buffer, es->page_size, 1, fp))
+            return 9;
+    }
+    fflush(fp);
+    return 0;
+}
+
+/* Length of a variable length record */
+static uint16_t recordLength(void *record)
+{
+    uint16_t len;
+
+    memcpy(&len, (char*) record + benchLengthOffset, sizeof(uint16_t));
+    return len;
+}
+
+/* Returns 1 if the bytes of a variable length record after its length are those set by slotTestData() */
+static int checkLength(external_sort_t *es, char *rec)
+{
+    uint16_t len = recordLength(rec), j;
+
+    if (len < benchLengthOffset + sizeof(uint16_t) || len > es->record_size)
+        return 0;
+    for (j = benchLengthOffset + sizeof(uint16_t); j < len; j++)
+    {
+        if ((uint8_t) rec[j] != (uint8_t) (len + j))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Gives each test data record a random length from the minimum record size to the record size and rewrites the
+ * records in slotted pages. The bytes after the length are set from the length so the records can be checked.
+ * The number of pages is updated. Returns 0 on success.
+ */
+static int slotTestData(ION_FILE *fp, char *buffer, external_sort_t *es, bench_config_t *cfg)
+{
+    char     *records = (char*) malloc((size_t) cfg->numRecords * es->record_size);
+    char     *rec;
+    uint32_t i;
+    int32_t  n = 0;
+    int16_t  j, count;
+    uint16_t len, b;
+    sort_codec_writer_t writer;
+
+    if (records == NULL)
+        return 8;
+    fseek(fp, 0, SEEK_SET);
+    for (i = 0; i < es->num_pages; i++)
+    {
+        if (0 == fread(buffer, es->page_size, 1, fp))
+        {
+            free(records);
+            return 10;
+        }
+        count = *((int16_t*) (buffer + BLOCK_COUNT_OFFSET));
+        for (j = 0; j < count; j++)
+        {
+            rec = records + (size_t) n++ * es->record_size;
+            memcpy(rec, buffer + es->headerSize + j*es->record_size, es->record_size);
+            len = (uint16_t) (cfg->minRecordSize + rand() % (cfg->recordSize - cfg->minRecordSize + 1));
+            memcpy(rec + benchLengthOffset, &len, sizeof(uint16_t));
+            for (b = benchLengthOffset + sizeof(uint16_t); b < len; b++)
+                rec[b] = (char) (len + b);
+        }
+    }
+
+    if (sort_codec_writer_init(&writer, es) != 0)
+    {
+        free(records);
+        return 8;
+    }
+    sort_codec_reset(&writer, es, SORT_CODEC_SLOTTED);
+    fseek(fp, 0, SEEK_SET);
+    es->num_pages = 0;
+    for (i = 0; i < (uint32_t) n || writer.count > 0; )
+    {
+        if (i < (uint32_t) n && sort_codec_add(&writer, es, records + (size_t) i * es->record_size))
+            i++;
+        else
+        {   /* Write full page or last page */
+            *((int32_t*) writer.page) = (int32_t) es->num_pages++;
+            if (0 == fwrite(writer.page, es->page_size, 1, fp))
+            {
+                sort_codec_writer_free(&writer);
+                free(records);
+                return 9;
+            }
+            sort_codec_reset(&writer, es, SORT_CODEC_SLOTTED);
+        }
+    }
+    fflush(fp);
+    sort_codec_writer_free(&writer);
+    free(records);
+    return 0;
+}
+
+/* qsort() comparison of records with benchCompareFcn */
+static int compareRecords(const void *a, const void *b)
+{
+    return benchCompareFcn((void*) a, (void*) b);
+}
+
+/**
+ * Sets the aggregated value field of the test data to random values and computes the expected result of aggregating it.
+ * The number of keys and the sum of the aggregates of all keys are returned. Returns 0 on success.
+ */
+static int aggregateTestData(ION_FILE *fp, char *buffer, external_sort_t *es, bench_config_t *cfg, int32_t *numKeys, int64_t *total)
+{
+    char     *records = (char*) malloc((size_t) cfg->numRecords * es->record_size);
+    char     *rec, *first;
+    uint32_t i;
+    int32_t  n = 0, v, x;
+    int16_t  j, count;
+
+    if (records == NULL)
+        return 8;
+    for (i = 0; i < es->num_pages; i++)
+    {
+        fseek(fp, (long) i * es->page_size, SEEK_SET);
+        if (0 == fread(buffer, es->page_size, 1, fp))
+        {
+            free(records);
+            return 10;
+        }
+
+        count = *((int16_t*) (buffer + BLOCK_COUNT_OFFSET));
+        for (j = 0; j < count; j++)
+        {
+            rec = buffer + es->headerSize + j*es->record_size;
+            v = rand() % 2001 - 1000;
+            memcpy(rec + es->aggregate_offset, &v, sizeof(int32_t));
+            memcpy(records + (size_t) n++ * es->record_size, rec, es->record_size);
+        }
+
+        fseek(fp, (long) i * es->page_size, SEEK_SET);
+        if (0 == fwrite(buffer, es->page_size, 1, fp))
+        {
+            free(records);
+            return 9;
+        }
+    }
+    fflush(fp);
+
+    benchCompareFcn = es->compare_fcn;
+    qsort(records, (size_t) n, es->record_size, compareRecords);
+
+    *numKeys = 0;
+    *total   = 0;
+    for (first = records; first < records + (size_t) n * es->record_size; first = rec)
+    {   /* Aggregate records with the key of first */
+        memcpy(&x, first + es->aggregate_offset, sizeof(int32_t));
+        if (es->aggregate == SORT_AGGREGATE_COUNT)
+            x = 0;
+        for (rec = first; rec < records + (size_t) n * es->record_size && es->compare_fcn(first, rec) == 0; rec += es->record_size)
+        {
+            memcpy(&v, rec + es->aggregate_offset, sizeof(int32_t));
+            switch (es->aggregate)
+            {
+                case SORT_AGGREGATE_COUNT:  x++; break;
+                case SORT_AGGREGATE_SUM:    x = rec == first ? v : (int32_t) ((uint32_t) x + (uint32_t) v); break;
+                case SORT_AGGREGATE_MIN:    x = v < x ? v : x; break;
+                case SORT_AGGREGATE_MAX:    x = v > x ? v : x; break;
+            }
+        }
+        (*numKeys)++;
+        if (es->aggregate != SORT_AGGREGATE_DISTINCT)
+            *total += x;
+    }
+    free(records);
+    return 0;
+}
+
+/**
+ * Checks a record of the output follows the last record. With an aggregate, keys must be unique and
+ * the aggregated values are summed. Variable length records must be intact. Returns 1 if record is in order.
+ */
+static int checkRecord(external_sort_t *es, char *lastRecord, char *rec, int32_t numvals, int64_t *total)
+{
+    int32_t v;
+
+    if (es->codec == SORT_CODEC_SLOTTED && !checkLength(es, rec))
+    {
+        printf("VERIFICATION ERROR Record: %d  Variable length record is not intact\n", numvals);
+        return 0;
+    }
+
+    if (es->aggregate != SORT_AGGREGATE_NONE && es->aggregate != SORT_AGGREGATE_DISTINCT)
+    {
+        memcpy(&v, rec + es->aggregate_offset, sizeof(int32_t));
+        *total += v;
+    }
+    if (numvals == 0)
+        return 1;
+    if (es->aggregate != SORT_AGGREGATE_NONE)
+        return es->compare_fcn(lastRecord, rec) < 0;
+    return es->compare_fcn(lastRecord, rec) <= 0;
+}
+
+/**
+ * Returns a hash of the bytes of a record. Variable length records are hashed up to their length. Hashes of records are
+ * summed, so the sum is the same for the same records in any order.
+ */
+static uint64_t recordHash(external_sort_t *es, char *rec)
+{
+    uint16_t len = es->length_fcn != NULL ? es->length_fcn(rec) : es->record_size;
+    uint64_t h = 14695981039346656037ULL;
+    uint16_t b;
+
+    for (b = 0; b < len; b++)
+        h = (h ^ (uint8_t) rec[b]) * 1099511628211ULL;
+    return h ^ (h >> 29);
+}
+
+/**
+ * Verifies output file is sorted and contains all records. With an aggregate, numRecords is the number of keys and
+ * aggregateTotal the sum of their aggregates. If recordsHash is not NULL, the output must hold the same records as the
+ * input, which is checked by comparing the sum of record hashes with it. Variable length records are output in slotted
+ * pages, which may not be the same number of pages as the input. Returns 1 if sorted.
+ */
+static int verifySorted(ION_FILE *fp, long resultFilePtr, char *buffer, external_sort_t *es, int32_t numRecords, int64_t aggregateTotal,
+                const uint64_t *recordsHash)
+{
+    uint32_t i;
+    int32_t  numvals = 0, numerrors = 0;
+    char     lastRecord[es->record_size];
+    char     slotRecord[es->record_size];
+    int      sorted = 1;
+    int64_t  total = 0;
+    uint64_t hash = 0;
+    sort_codec_cursor_t cursor;
+
+    fseek(fp, resultFilePtr, SEEK_SET);
+
+    for (i = 0; (i < es->num_pages || es->codec == SORT_CODEC_SLOTTED) && numvals < numRecords; i++)
+    {
+        if (0 == fread(buffer, es->page_size, 1, fp))
+        {   printf("Failed to read block.\n");
+            return 0;
+        }
+
+        int count = *((int16_t*) (buffer + BLOCK_COUNT_OFFSET));
+        sort_codec_rewind(&cursor);
+        for (int j = 0; j < count; j++)
+        {
+            char *rec = buffer + es->headerSize + j*es->record_size;
+            if (es->codec == SORT_CODEC_SLOTTED)
+            {
+                sort_codec_read(es, buffer, &cursor, slotRecord);
+                rec = slotRecord;
+            }
+            if (!checkRecord(es, lastRecord, rec, numvals, &total))
+            {
+                numerrors++;
+                if (numerrors < 10)
+                    printf("VERIFICATION ERROR Record: %d  Key not less than previous key\n", numvals);
+            }
+            hash += recordHash(es, rec);
+            memcpy(lastRecord, rec, es->record_size);
+            numvals++;
+        }
+    }
+
+    if (numvals != numRecords)
+    {
+        printf("ERROR: Missing values: %d\n", numRecords - numvals);
+        sorted = 0;
+    }
+    else if (recordsHash != NULL && hash != *recordsHash)
+    {
+        printf("ERROR: Output records are not the input records\n");
+        sorted = 0;
+    }
+    if (total != aggregateTotal)
+    {
+        printf("ERROR: Aggregate total: %lld Expected: %lld\n", (long long) total, (long long) aggregateTotal);
+        sorted = 0;
+    }
+    if (numerrors > 0)
+        sorted = 0;
+    return sorted;
+}
+
+/**
+ * Verifies the tags output by a tag sort without gather are sorted and number each input record once. Returns 1 if sorted.
+ */
+static int verifyPermutation(ION_FILE *fp, long resultFilePtr, char *buffer, external_sort_t *es, int32_t numRecords)
+{
+    uint16_t tagSize = (uint16_t) ADAPTIVE_SORT_TAG_SIZE(es);
+    uint16_t prefix  = (uint16_t) (tagSize - sizeof(uint32_t));
+    uint8_t  *seen   = (uint8_t*) calloc((size_t) (numRecords + 7) / 8, 1);
+    int32_t  numvals = 0, numerrors = 0;
+    char     lastTag[tagSize];
+    uint32_t id;
+
+    if (seen == NULL)
+        return 0;
+    fseek(fp, resultFilePtr, SEEK_SET);
+    while (numvals < numRecords && 1 == fread(buffer, es->page_size, 1, fp))
+    {
+        int count = *((int16_t*) (buffer + BLOCK_COUNT_OFFSET));
+        if (count <= 0)
+            break;
+        for (int j = 0; j < count; j++)
+        {
+            char *tag = buffer + es->headerSize + j*tagSize;
+
+            memcpy(&id, tag + prefix, sizeof(uint32_t));
+            if ((numvals > 0 && es->compare_fcn(lastTag, tag) > 0) || id >= (uint32_t) numRecords || (seen[id / 8] & (1 << (id % 8))))
+            {
+                numerrors++;
+                if (numerrors < 10)
+                    printf("VERIFICATION ERROR Tag: %d  Key not less than previous key or record number not valid\n", numvals);
+            }
+            else
+                seen[id / 8] |= (uint8_t) (1 << (id % 8));
+            memcpy(lastTag, tag, tagSize);
+            numvals++;
+        }
+    }
+    free(seen);
+    if (numvals != numRecords)
+        printf("ERROR: Missing values: %d\n", numRecords - numvals);
+    return numvals == numRecords && numerrors == 0;
+}
+
+/**
+ * Sorts with a sorted stream and verifies the records it returns are sorted and complete. Returns 0 on success.
+ */
+static int streamSorted(file_iterator_state_t *iteratorState, void *tupleBuffer, ION_FILE *outFilePtr, char *buffer, int memoryPages,
+                external_sort_t *es, metrics_t *metric, int8_t writeToReadRatio, int32_t numRecords, int64_t aggregateTotal,
+                const uint64_t *recordsHash, int *sorted)
+{
+    adaptive_sort_stream_t *stream;
+    int32_t numvals = 0, numerrors = 0;
+    int64_t total = 0;
+    uint64_t hash = 0;
+    char    lastRecord[es->record_size];
+    char    *rec;
+    int     err;
+
+    err = adaptive_sort_open(&stream, &fileRecordIterator, iteratorState, tupleBuffer, outFilePtr, buffer, memoryPages, es, metric,
+                            es->compare_fcn, writeToReadRatio);
+    if (err != 0)
+        return err;
+
+    while ((rec = adaptive_sort_next(stream)) != NULL)
+    {
+        if (!checkRecord(es, lastRecord, rec, numvals, &total))
+        {
+            numerrors++;
+            if (numerrors < 10)
+                printf("VERIFICATION ERROR Record: %d  Key not less than previous key\n", numvals);
+        }
+        hash += recordHash(es, rec);
+        memcpy(lastRecord, rec, es->record_size);
+        numvals++;
+    }
+    err = adaptive_sort_close(stream);
+
+    if (numvals != numRecords)
+        printf("ERROR: Missing values: %d\n", numRecords - numvals);
+    else if (recordsHash != NULL && hash != *recordsHash)
+    {
+        printf("ERROR: Output records are not the input records\n");
+        numerrors++;
+    }
+    if (total != aggregateTotal)
+        printf("ERROR: Aggregate total: %lld Expected: %lld\n", (long long) total, (long long) aggregateTotal);
+    *sorted = numvals == numRecords && total == aggregateTotal && numerrors == 0;
+    return err;
+}
+
+/**
+ * Performs one benchmark run. Returns 0 on success.
+ */
+static int runOnce(bench_config_t *cfg, metrics_t *metric, int *sorted)
+{
+    external_sort_t es;
+    int err;
+
+    *sorted = 0;
+    metrics_phase_log_init(&runPhaseLog, runPhases, BENCH_MAX_PHASES);
+    metrics_init(metric, &runPhaseLog);
+
+    external_sort_init(&es);
+    es.key_size     = keySizes[cfg->keyType];
+    es.key_type     = keyTypes[cfg->keyType];
+    es.key_offset   = cfg->keyOffset;
+    es.aggregate    = (int8_t) cfg->aggregate;
+    es.aggregate_offset = aggregateOffset(cfg);
+    es.codec        = (int8_t) (cfg->minRecordSize > 0 ? SORT_CODEC_SLOTTED : cfg->codec);
+    es.length_fcn   = cfg->minRecordSize > 0 ? recordLength : NULL;
+    es.value_size   = cfg->recordSize - es.key_size;
+    es.record_size  = cfg->recordSize;
+    es.page_size    = cfg->pageSize;
+
+    int32_t values_per_page = (es.page_size - es.headerSize) / es.record_size;
+    es.num_pages    = (uint32_t) (cfg->numRecords + values_per_page - 1) / values_per_page;
+    es.compare_fcn  = merge_sort_int32_comparator;
+    benchKeyType    = cfg->keyType;
+    benchKeyOffset  = cfg->keyOffset;
+    benchLengthOffset = lengthOffset(cfg);
+    if (cfg->keyType != 0 || cfg->keyOffset != 0)
+        es.compare_fcn = compareKey;
+
+    /* Buffers and file offsets used by sorting algorithm */
+    long result_file_ptr = 0;
+    char *buffer = (char*) malloc((size_t) cfg->memoryPages * es.page_size + es.record_size);
+    if (NULL == buffer)
+    {
+        printf("Error: Out of memory!\n");
+        return 8;
+    }
+    char *tuple_buffer = buffer + es.page_size * cfg->memoryPages;
+
+    /* Create the file and fill it with test data */
+    ION_FILE *fp = fopen(cfg->inputFileName, "w+b");
+    if (NULL == fp)
+    {
+        printf("Error: Can't open file!\n");
+        free(buffer);
+        return 10;
+    }
+
+    external_sort_write_test_data(fp, cfg->numRecords, es.record_size, cfg->distribution, &es, cfg->percentRandom, cfg->numDistinct);
+    fflush(fp);
+    if (es.compare_fcn == compareKey && convertTestData(fp, buffer, &es, cfg) != 0)
+    {
+        printf("Error: Can't convert test data keys!\n");
+        fclose(fp);
+        free(buffer);
+        return 10;
+    }
+
+    /* With an aggregate, output has one record per key */
+    int32_t numOutput = cfg->limit > 0 && cfg->limit < cfg->numRecords ? cfg->limit : cfg->numRecords;
+    int64_t aggregateTotal = 0;
+    if (es.aggregate != SORT_AGGREGATE_NONE && aggregateTestData(fp, buffer, &es, cfg, &numOutput, &aggregateTotal) != 0)
+    {
+        printf("Error: Can't set test data values!\n");
+        fclose(fp);
+        free(buffer);
+        return 10;
+    }
+    if (es.codec == SORT_CODEC_SLOTTED && slotTestData(fp, buffer, &es, cfg) != 0)
+    {
+        printf("Error: Can't write variable length test data!\n");
+        fclose(fp);
+        free(buffer);
+        return 10;
+    }
+    fseek(fp, 0, SEEK_SET);
+
+    file_iterator_state_t iteratorState;
+    iteratorState.file = fp;
+    iteratorState.recordsRead = 0;
+    iteratorState.totalRecords = cfg->numRecords;
+    iteratorState.recordSize = es.record_size;
+    iteratorState.readBuffer = malloc(es.page_size);
+    iteratorState.recordsLeftInBlock = 0;
+    iteratorState.currentRecord = 0;
+
+    ION_FILE *outFilePtr = fopen(cfg->outputFileName, "w+b");
+    if (NULL == outFilePtr || NULL == iteratorState.readBuffer)
+    {
+        printf("Error: Can't open output file!\n");
+        fclose(fp);
+        free(iteratorState.readBuffer);
+        free(buffer);
+        return 10;
+    }
+
+    /* Without an aggregate or limit, the output holds the input records. Sum of their hashes is compared when verifying. */
+    uint64_t inputHash = 0;
+    uint64_t *recordsHash = NULL;
+    if (es.aggregate == SORT_AGGREGATE_NONE && numOutput == cfg->numRecords)
+    {
+        while (fileRecordIterator(&iteratorState, tuple_buffer, &es) != 0)
+            inputHash += recordHash(&es, tuple_buffer);
+        fseek(fp, 0, SEEK_SET);
+        iteratorState.recordsRead = 0;
+        iteratorState.recordsLeftInBlock = 0;
+        iteratorState.currentRecord = 0;
+        recordsHash = &inputHash;
+    }
+
+#if defined(SIM_FLASH)
+    sim_flash_reset_stats();
+#endif
+    unsigned long start = millis();
+
+    /* Sorted input is the sorted output */
+    int8_t inputSorted = 0;
+    if (cfg->checkSorted)
+    {
+        inputSorted = adaptive_sort_is_sorted(&fileRecordIterator, &iteratorState, buffer, &es, metric);
+        fseek(fp, 0, SEEK_SET);
+        iteratorState.recordsRead = 0;
+        iteratorState.recordsLeftInBlock = 0;
+        iteratorState.currentRecord = 0;
+    }
+
+    if (inputSorted)
+        err = 0;
+    else if (cfg->algorithm == BENCH_ALG_STREAM)
+        err = streamSorted(&iteratorState, tuple_buffer, outFilePtr, buffer, cfg->memoryPages, &es, metric, cfg->writeToReadRatio, numOutput, aggregateTotal,
+                            recordsHash, sorted);
+    else if (cfg->limit > 0)
+        err = adaptive_sort_limit(&fileRecordIterator, &iteratorState, tuple_buffer, outFilePtr, buffer, cfg->memoryPages, &es, &result_file_ptr, metric,
+                            es.compare_fcn, cfg->writeToReadRatio, cfg->limit);
+    else if (cfg->algorithm == BENCH_ALG_TAG || cfg->algorithm == BENCH_ALG_PERMUTATION)
+        err = adaptive_sort_tag(&fileRecordIterator, &iteratorState, tuple_buffer, outFilePtr, buffer, cfg->memoryPages, &es, &result_file_ptr, metric,
+                            es.compare_fcn, cfg->writeToReadRatio, cfg->algorithm == BENCH_ALG_PERMUTATION);
+    else if (cfg->algorithm == BENCH_ALG_MINSORT)
+        err = flash_minsort(&iteratorState, tuple_buffer, outFilePtr, buffer, cfg->memoryPages * es.page_size, &es, &result_file_ptr, metric, es.compare_fcn);
+    else
+        err = adaptive_sort(&fileRecordIterator, &iteratorState, tuple_buffer, outFilePtr, buffer, cfg->memoryPages, &es, &result_file_ptr, metric,
+                            es.compare_fcn, cfg->algorithm == BENCH_ALG_RUNGEN, cfg->writeToReadRatio);
+
+    metric->time = millis() - start;
+    fflush(outFilePtr);
+#if defined(SIM_FLASH)
+    sim_flash_get_stats(&runFlashStats);
+#endif
+
+    if (err == 0 && inputSorted)
+        *sorted = verifySorted(fp, 0, buffer, &es, numOutput, aggregateTotal, recordsHash);
+    else if (err == 0 && cfg->algorithm == BENCH_ALG_PERMUTATION)
+        *sorted = verifyPermutation(outFilePtr, result_file_ptr, buffer, &es, cfg->numRecords);
+    else if (err == 0 && cfg->algorithm != BENCH_ALG_RUNGEN && cfg->algorithm != BENCH_ALG_STREAM)
+        *sorted = verifySorted(outFilePtr, result_file_ptr, buffer, &es, numOutput, aggregateTotal, recordsHash);
+    else if (err == 0)
+        *sorted = 1;     /* Run generation only does not produce a single sorted output */
+
+    fclose(fp);
+    fclose(outFilePtr);
+#if defined(SIM_FLASH)
+    fremove(cfg->inputFileName);
+    fremove(cfg->outputFileName);
+#endif
+    free(iteratorState.readBuffer);
+    free(buffer);
+    return err;
+}
+
+int main(int argc, char **argv)
+{
+    bench_config_t cfg;
+    int r, sorted, failures = 0;
+
+    if (parseArgs(argc, argv, &cfg) != 0)
+        return 1;
+
+    metrics_t *metric = (metrics_t*) malloc(sizeof(metrics_t) * cfg.numRuns);
+    if (NULL == metric)
+        return 1;
+
+    if (cfg.calibrateTransfers > 0 && calibrateDevice(&cfg) != 0)
+        return 1;
+
+    if (cfg.pipelineDepth >= 0)
+        run_pipeline_set_depth((int16_t) cfg.pipelineDepth);
+    if (cfg.workers > 0)
+        sort_parallel_set_workers((int16_t) cfg.workers);
+    if (cfg.ioThreads >= 0)
+        ion_file_async_set_threads((int16_t) cfg.ioThreads);
+    if (cfg.mapFiles >= 0)
+        ion_file_map_set_enabled((int8_t) cfg.mapFiles);
+
+    srand(cfg.seed);
+    printf("Benchmark. Algorithm: %s  M: %d  Page size: %d  Record size: %d  Records: %d  Distribution: %s  Distinct: %d  Write/read ratio: %d  Key: %s at %d\n",
+            algorithmNames[cfg.algorithm], cfg.memoryPages, cfg.pageSize, cfg.recordSize, cfg.numRecords,
+            distributionNames[cfg.distribution], cfg.numDistinct, cfg.writeToReadRatio, keyTypeNames[cfg.keyType], cfg.keyOffset);
+#if defined(SIM_FLASH)
+    printf("Simulated flash. Page size: %lu  Pages per block: %lu  Read: %.2f us  Program: %.2f us  Erase: %.2f us  Overwrite: %s\n",
+            (unsigned long) cfg.flash.page_size, (unsigned long) cfg.flash.pages_per_block, cfg.flash.read_latency_ns / 1000.0,
+            cfg.flash.program_latency_ns / 1000.0, cfg.flash.erase_latency_ns / 1000.0, overwriteNames[cfg.flash.overwrite_policy]);
+    double flashTime = 0;
+#endif
+
+    for (r = 0; r < cfg.numRuns; r++)
+    {
+        printf("--- Run Number %d ---\n", (r+1));
+        int err = runOnce(&cfg, &metric[r], &sorted);
+        if (err != 0 || !sorted)
+        {
+            printf("FAILURE. Error code: %d  Sorted: %d\n", err, sorted);
+            failures++;
+        }
+
+        double secs = metric[r].time / 1000.0;
+        double throughput = secs > 0 ? cfg.numRecords / secs : 0;
+        if (cfg.csv)
+        {
+            printf("CSV,%s,%d,%d,%d,%d,%s,%d,%d,%d,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.0f,%d\n",
+                algorithmNames[cfg.algorithm], cfg.memoryPages, cfg.pageSize, cfg.recordSize, cfg.numRecords,
+                distributionNames[cfg.distribution], cfg.numDistinct, cfg.writeToReadRatio, r+1,
+                (unsigned long) metric[r].time, (unsigned long) metric[r].genTime,
+                (unsigned long) metric[r].num_reads, (unsigned long) metric[r].num_writes,
+                (unsigned long) metric[r].num_compar, (unsigned long) metric[r].num_memcpys,
+                (unsigned long) metric[r].num_runs, throughput, sorted);
+            for (int p = 0; p < runPhaseLog.num_phases; p++)
+            {
+                metrics_phase_t *ph = &runPhaseLog.phases[p];
+                printf("CSVPHASE,%d,%s,%d,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", r+1, metrics_phase_name(ph->type), ph->number,
+                    (unsigned long) ph->time_us, (unsigned long) ph->num_reads, (unsigned long) ph->num_writes,
+                    (unsigned long) ph->bytes_read, (unsigned long) ph->bytes_written, (unsigned long) ph->num_compar,
+                    (unsigned long) ph->num_memcpys, (unsigned long) ph->bytes_copied);
+            }
+#if defined(SIM_FLASH)
+            printf("CSVFLASH,%d,%lu,%lu,%lu,%lu,%lu,%.3f\n", r+1, (unsigned long) runFlashStats.page_reads,
+                (unsigned long) runFlashStats.page_programs, (unsigned long) runFlashStats.block_erases,
+                (unsigned long) runFlashStats.overwrites, (unsigned long) runFlashStats.rejected_writes,
+                runFlashStats.virtual_time_ns / 1e6);
+#endif
+        }
+        else
+        {
+            printf("Sorted: %d\n", sorted);
+            printf("Time: %lu ms  Gen time: %lu ms  Throughput: %.0f records/s\n",
+                (unsigned long) metric[r].time, (unsigned long) metric[r].genTime, throughput);
+            printf("Reads: %lu  Writes: %lu  I/Os: %lu\n", (unsigned long) metric[r].num_reads, (unsigned long) metric[r].num_writes,
+                (unsigned long) (metric[r].num_reads + metric[r].num_writes));
+            printf("Comparisons: %lu  Memcpys: %lu  Runs: %lu\n", (unsigned long) metric[r].num_compar,
+                (unsigned long) metric[r].num_memcpys, (unsigned long) metric[r].num_runs);
+            metrics_print_phases(&runPhaseLog);
+            printf("\n");
+#if defined(SIM_FLASH)
+            printf("Flash page reads: %lu  Page programs: %lu  Block erases: %lu  Overwrites: %lu  Rejected writes: %lu  Virtual time: %.3f ms\n\n",
+                (unsigned long) runFlashStats.page_reads, (unsigned long) runFlashStats.page_programs,
+                (unsigned long) runFlashStats.block_erases, (unsigned long) runFlashStats.overwrites,
+                (unsigned long) runFlashStats.rejected_writes, runFlashStats.virtual_time_ns / 1e6);
+#endif
+        }
+#if defined(SIM_FLASH)
+        flashTime += runFlashStats.virtual_time_ns / 1e6;
+#endif
+    }
+
+    /* Print average results */
+    double time = 0, genTime = 0, reads = 0, writes = 0, compar = 0, memcpys = 0;
+    for (r = 0; r < cfg.numRuns; r++)
+    {
+        time    += metric[r].time;
+        genTime += metric[r].genTime;
+        reads   += metric[r].num_reads;
+        writes  += metric[r].num_writes;
+        compar  += metric[r].num_compar;
+        memcpys += metric[r].num_memcpys;
+    }
+    printf("Average over %d runs. Time: %.1f ms  Gen time: %.1f ms  Reads: %.0f  Writes: %.0f  Comparisons: %.0f  Memcpys: %.0f\n",
+            cfg.numRuns, time/cfg.numRuns, genTime/cfg.numRuns, reads/cfg.numRuns, writes/cfg.numRuns, compar/cfg.numRuns, memcpys/cfg.numRuns);
+#if defined(SIM_FLASH)
+    printf("Average flash virtual time: %.3f ms\n", flashTime/cfg.numRuns);
+#endif
+
+    free(metric);
+    return failures == 0 ? 0 : 2;
+}
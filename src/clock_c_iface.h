@@ -0,0 +1,74 @@
+/******************************************************************************/
+/**
+@file		clock_c_iface.h
+@author		Ramon Lawrence
+@brief		Portable millisecond/microsecond clock. Uses the Arduino core timers on
+			device and a monotonic clock on PC builds.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#if !defined(CLOCK_C_IFACE_H_)
+#define CLOCK_C_IFACE_H_
+
+#if defined(ARDUINO)
+
+#include <Arduino.h>
+
+#else /* Clause ARDUINO */
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief		Milliseconds elapsed since an arbitrary fixed point (process start).
+@details	Matches the Arduino millis() signature so timing code is shared.
+*/
+unsigned long
+millis(
+	void
+);
+
+/**
+@brief		Microseconds elapsed since an arbitrary fixed point (process start).
+*/
+unsigned long
+micros(
+	void
+);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* Clause ARDUINO */
+
+#endif /* CLOCK_C_IFACE_H_ */
@@ -0,0 +1,308 @@
+/******************************************************************************/
+/**
+@file		device_profile.c
+@author		Ramon Lawrence
+@brief		Storage device calibration. Measures read, write and random read
+            costs and derives the write to read ratio used by adaptive sort.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "device_profile.h"
+#include "clock_c_iface.h"
+
+static device_profile_t activeProfile;
+static int8_t           activeState = 0;        /* 0 - not checked, 1 - loaded from file, 2 - set by caller, -1 - not available */
+
+/* Bytes of a saved profile: magic, version and size count, then transfer size and three times per size */
+#define PROFILE_HEADER_BYTES    8
+#define PROFILE_COST_BYTES      14
+
+/* Clock for calibration in microseconds. Simulated device reports its virtual time. */
+static unsigned long profileClock(void)
+{
+#if defined(SIM_FLASH)
+    sim_flash_stats_t stats;
+    sim_flash_get_stats(&stats);
+    return (unsigned long) (stats.virtual_time_ns / 1000);
+#else
+    return micros();
+#endif
+}
+
+int8_t device_profile_calibrate(ION_FILE *file, char *buffer, uint16_t bufferSize, uint16_t numTransfers, device_profile_t *profile)
+{
+    uint16_t        size;
+    uint16_t        i;
+    long            regionStart = 0;
+    uint32_t        rnd = 2020;                 /* Local generator so caller's rand() sequence is not changed */
+    unsigned long   start;
+
+    memset(profile, 0, sizeof(device_profile_t));
+    profile->magic = DEVICE_PROFILE_MAGIC;
+    profile->version = DEVICE_PROFILE_VERSION;
+
+    if (numTransfers == 0)
+        numTransfers = 1;
+
+    for (i = 0; i < bufferSize; i++)
+        buffer[i] = (char) i;
+
+    for (size = DEVICE_PROFILE_MIN_TRANSFER; size <= bufferSize && profile->numSizes < DEVICE_PROFILE_MAX_SIZES; size *= 2)
+    {
+        device_transfer_cost_t *cost = &profile->cost[profile->numSizes];
+        cost->transferSize = size;
+
+        /* Sequential writes */
+        fseek(file, regionStart, SEEK_SET);
+        start = profileClock();
+        for (i = 0; i < numTransfers; i++)
+        {
+            if (0 == fwrite(buffer, size, 1, file))
+                return 9;
+        }
+        fflush(file);
+        cost->writeTime = (uint32_t) ((uint64_t) (profileClock() - start) * 1000 / numTransfers);
+
+        /* Sequential reads */
+        fseek(file, regionStart, SEEK_SET);
+        start = profileClock();
+        for (i = 0; i < numTransfers; i++)
+        {
+            if (0 == fread(buffer, size, 1, file))
+                return 10;
+        }
+        cost->readTime = (uint32_t) ((uint64_t) (profileClock() - start) * 1000 / numTransfers);
+
+        /* Random reads */
+        start = profileClock();
+        for (i = 0; i < numTransfers; i++)
+        {
+            rnd = rnd * 1103515245 + 12345;
+            fseek(file, regionStart + (long) ((rnd >> 8) % numTransfers) * size, SEEK_SET);
+            if (0 == fread(buffer, size, 1, file))
+                return 10;
+        }
+        cost->randomReadTime = (uint32_t) ((uint64_t) (profileClock() - start) * 1000 / numTransfers);
+
+        regionStart += (long) numTransfers * size;
+        profile->numSizes++;
+
+        if (size > UINT16_MAX / 2)
+            break;
+    }
+    return 0;
+}
+
+/* Returns cost of transfer size interpolated between profiled sizes. Field is offset of time in device_transfer_cost_t. */
+static uint32_t interpolateCost(const device_profile_t *profile, uint16_t transferSize, size_t field)
+{
+    uint16_t i;
+    const device_transfer_cost_t *lo, *hi;
+
+    #define COST_FIELD(c) (*((const uint32_t*) (((const char*) (c)) + field)))
+    if (transferSize <= profile->cost[0].transferSize)
+        return COST_FIELD(&profile->cost[0]);
+
+    for (i = 1; i < profile->numSizes; i++)
+    {
+        if (transferSize <= profile->cost[i].transferSize)
+        {
+            lo = &profile->cost[i-1];
+            hi = &profile->cost[i];
+            return (uint32_t) (COST_FIELD(lo) + ((int64_t) COST_FIELD(hi) - COST_FIELD(lo)) * (transferSize - lo->transferSize)
+                                / (hi->transferSize - lo->transferSize));
+        }
+    }
+    /* Larger than any profiled size. Ratios are assumed to stay the same. */
+    return COST_FIELD(&profile->cost[profile->numSizes-1]);
+    #undef COST_FIELD
+}
+
+/* Returns cost ratio (x10) clamped to range of int8_t. Uses default if profile has no measurements. */
+static int8_t costRatio(const device_profile_t *profile, uint16_t transferSize, size_t field, int8_t defaultRatio)
+{
+    uint32_t readTime, ratio;
+
+    if (profile == NULL || profile->numSizes == 0)
+        return defaultRatio;
+
+    readTime = interpolateCost(profile, transferSize, offsetof(device_transfer_cost_t, readTime));
+    if (readTime == 0)
+        return defaultRatio;
+
+    ratio = (uint32_t) ((uint64_t) interpolateCost(profile, transferSize, field) * 10 / readTime);
+    if (ratio < 1)
+        ratio = 1;
+    return (int8_t) (ratio > INT8_MAX ? INT8_MAX : ratio);
+}
+
+int8_t device_profile_write_ratio(const device_profile_t *profile, uint16_t transferSize)
+{
+    return costRatio(profile, transferSize, offsetof(device_transfer_cost_t, writeTime), DEVICE_PROFILE_DEFAULT_WRITE_RATIO);
+}
+
+int8_t device_profile_random_ratio(const device_profile_t *profile, uint16_t transferSize)
+{
+    return costRatio(profile, transferSize, offsetof(device_transfer_cost_t, randomReadTime), DEVICE_PROFILE_DEFAULT_RANDOM_RATIO);
+}
+
+/* Stores value in bytes of buf least significant byte first, so saved profiles do not depend on the host byte order or struct layout */
+static char* putField(char *buf, uint32_t value, uint8_t bytes)
+{
+    uint8_t i;
+    for (i = 0; i < bytes; i++)
+        *buf++ = (char) ((value >> (8*i)) & 0xFF);
+    return buf;
+}
+
+static const char* getField(const char *buf, uint32_t *value, uint8_t bytes)
+{
+    uint8_t i;
+    *value = 0;
+    for (i = 0; i < bytes; i++)
+        *value |= (uint32_t) (uint8_t) *buf++ << (8*i);
+    return buf;
+}
+
+int8_t device_profile_save(const device_profile_t *profile, char *fileName)
+{
+    char        data[PROFILE_HEADER_BYTES + DEVICE_PROFILE_MAX_SIZES*PROFILE_COST_BYTES];
+    char        *pos = data;
+    uint16_t    i, numSizes = profile->numSizes > DEVICE_PROFILE_MAX_SIZES ? DEVICE_PROFILE_MAX_SIZES : profile->numSizes;
+
+    pos = putField(pos, DEVICE_PROFILE_MAGIC, 4);
+    pos = putField(pos, DEVICE_PROFILE_VERSION, 2);
+    pos = putField(pos, numSizes, 2);
+    for (i = 0; i < numSizes; i++)
+    {
+        pos = putField(pos, profile->cost[i].transferSize, 2);
+        pos = putField(pos, profile->cost[i].readTime, 4);
+        pos = putField(pos, profile->cost[i].writeTime, 4);
+        pos = putField(pos, profile->cost[i].randomReadTime, 4);
+    }
+
+    ION_FILE *fp = fopen(fileName, "w+b");
+    if (NULL == fp)
+        return 9;
+
+    int8_t err = 0;
+    if (0 == fwrite(data, (size_t) (pos - data), 1, fp))
+        err = 9;
+    fflush(fp);
+    fclose(fp);
+
+    /* Profile loaded or found missing before is stale. A profile set by the caller stays active. */
+    if (err == 0 && activeState != 2 && strcmp(fileName, DEVICE_PROFILE_FILE_NAME) == 0)
+        activeState = 0;
+    return err;
+}
+
+int8_t device_profile_load(device_profile_t *profile, char *fileName)
+{
+    char        data[PROFILE_HEADER_BYTES + DEVICE_PROFILE_MAX_SIZES*PROFILE_COST_BYTES];
+    const char  *pos = data;
+    uint32_t    magic, version, numSizes, value;
+    uint16_t    i;
+
+    ION_FILE *fp = fopen(fileName, "rb");
+    if (NULL == fp)
+        return 10;
+
+    int8_t err = 0;
+    if (0 == fread(data, PROFILE_HEADER_BYTES, 1, fp))
+        err = 10;
+    else
+    {
+        pos = getField(pos, &magic, 4);
+        pos = getField(pos, &version, 2);
+        pos = getField(pos, &numSizes, 2);
+        if (magic != DEVICE_PROFILE_MAGIC || version != DEVICE_PROFILE_VERSION || numSizes == 0 || numSizes > DEVICE_PROFILE_MAX_SIZES
+                || 0 == fread(data + PROFILE_HEADER_BYTES, (size_t) numSizes*PROFILE_COST_BYTES, 1, fp))
+            err = 10;
+    }
+    fclose(fp);
+    if (err != 0)
+        return err;
+
+    memset(profile, 0, sizeof(device_profile_t));
+    profile->magic      = magic;
+    profile->version    = (uint16_t) version;
+    profile->numSizes   = (uint16_t) numSizes;
+    for (i = 0; i < profile->numSizes; i++)
+    {
+        pos = getField(pos, &value, 2);
+        profile->cost[i].transferSize = (uint16_t) value;
+        pos = getField(pos, &profile->cost[i].readTime, 4);
+        pos = getField(pos, &profile->cost[i].writeTime, 4);
+        pos = getField(pos, &profile->cost[i].randomReadTime, 4);
+    }
+    return 0;
+}
+
+void device_profile_set_active(const device_profile_t *profile)
+{
+    if (profile == NULL)
+    {
+        activeState = 0;
+        return;
+    }
+    activeProfile = *profile;
+    activeState = 2;
+}
+
+const device_profile_t* device_profile_get_active(void)
+{
+    if (activeState == 0)
+        activeState = device_profile_load(&activeProfile, DEVICE_PROFILE_FILE_NAME) == 0 ? 1 : -1;
+
+    return activeState > 0 ? &activeProfile : NULL;
+}
+
+void device_profile_print(const device_profile_t *profile)
+{
+    uint16_t i;
+
+    printf("Device profile. Times in ns per transfer.\n");
+    printf("Size\tRead\tWrite\tRandom\tW/R x10\tRand/R x10\n");
+    for (i = 0; i < profile->numSizes; i++)
+    {
+        const device_transfer_cost_t *c = &profile->cost[i];
+        printf("%u\t%lu\t%lu\t%lu\t%d\t%d\n", c->transferSize, (unsigned long) c->readTime, (unsigned long) c->writeTime,
+                (unsigned long) c->randomReadTime, device_profile_write_ratio(profile, c->transferSize),
+                device_profile_random_ratio(profile, c->transferSize));
+    }
+}
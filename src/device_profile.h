@@ -0,0 +1,118 @@
+#if !defined(DEVICE_PROFILE_H)
+#define DEVICE_PROFILE_H
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+#include <stdint.h>
+
+#include "external_sort.h"
+
+#define DEVICE_PROFILE_MAGIC            0x46525044      /* "DPRF" */
+#define DEVICE_PROFILE_VERSION          2
+#define DEVICE_PROFILE_MAX_SIZES        6
+#define DEVICE_PROFILE_MIN_TRANSFER     64
+#define DEVICE_PROFILE_FILE_NAME        "devprof.bin"
+
+/* Ratios (x10) used when no device profile is available */
+#define DEVICE_PROFILE_DEFAULT_WRITE_RATIO  30
+#define DEVICE_PROFILE_DEFAULT_RANDOM_RATIO 10
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief      Measured cost of one transfer of a given size. Times are in nanoseconds
+            per transfer (averaged over all transfers of the calibration).
+*/
+typedef struct {
+    uint16_t    transferSize;
+    uint32_t    readTime;           /* Sequential read */
+    uint32_t    writeTime;          /* Sequential write */
+    uint32_t    randomReadTime;     /* Read at random transfer-aligned offset */
+} device_transfer_cost_t;
+
+/**
+@brief      Storage device profile produced by calibration. Saved to a file field by field in little endian byte order
+            (see device_profile_save()), so a file is only read by a build with the same DEVICE_PROFILE_VERSION.
+*/
+typedef struct {
+    uint32_t                magic;
+    uint16_t                version;
+    uint16_t                numSizes;       /* Entries in cost sorted by increasing transfer size */
+    device_transfer_cost_t  cost[DEVICE_PROFILE_MAX_SIZES];
+} device_profile_t;
+
+/**
+@brief      Profiles a storage device by timing sequential writes, sequential reads and random reads
+            for transfer sizes of DEVICE_PROFILE_MIN_TRANSFER doubling up to bufferSize bytes.
+            Each transfer size uses a new region of the file so no data is overwritten.
+            Times are of the file interface as seen by the sort. On a PC, writes go to the stdio buffer and the
+            operating system page cache and reads of data just written are served from the cache, so the times
+            are those of buffered I/O rather than of the storage device.
+@param      file
+                Already opened file used for the calibration. Contents are overwritten.
+@param      buffer
+                Pre-allocated space used for transfers
+@param      bufferSize
+                Size of buffer in bytes. Largest transfer size profiled.
+@param      numTransfers
+                Number of transfers of each type and size
+@param      profile
+                Profile filled in with measured costs
+@return     0 if success, 9 if write error, 10 if read error
+*/
+int8_t device_profile_calibrate(ION_FILE *file, char *buffer, uint16_t bufferSize, uint16_t numTransfers, device_profile_t *profile);
+
+/**
+@brief      Returns write time divided by sequential read time multiplied by 10 for a transfer size.
+            Costs are linearly interpolated between profiled sizes. This is the writeToReadRatio
+            argument of adaptive_sort().
+*/
+int8_t device_profile_write_ratio(const device_profile_t *profile, uint16_t transferSize);
+
+/**
+@brief      Returns random read time divided by sequential read time multiplied by 10 for a transfer size.
+*/
+int8_t device_profile_random_ratio(const device_profile_t *profile, uint16_t transferSize);
+
+/**
+@brief      Writes profile to a file. Saving to DEVICE_PROFILE_FILE_NAME makes device_profile_get_active()
+            load it again unless a profile was set with device_profile_set_active().
+@return     0 if success, 9 if write error
+*/
+int8_t device_profile_save(const device_profile_t *profile, char *fileName);
+
+/**
+@brief      Reads profile from a file written by device_profile_save().
+@return     0 if success, 10 if file missing, unreadable or not a profile
+*/
+int8_t device_profile_load(device_profile_t *profile, char *fileName);
+
+/**
+@brief      Sets the profile used by adaptive_sort() when called with ADAPTIVE_SORT_DEVICE_PROFILE.
+            NULL clears the active profile.
+*/
+void device_profile_set_active(const device_profile_t *profile);
+
+/**
+@brief      Returns the active profile. If none has been set, loads it from DEVICE_PROFILE_FILE_NAME.
+            Returns NULL if no profile is available. A missing profile is not looked for again until one is
+            saved to DEVICE_PROFILE_FILE_NAME or the active profile is cleared.
+*/
+const device_profile_t* device_profile_get_active(void);
+
+/**
+@brief      Prints the measured costs and ratios of a profile.
+*/
+void device_profile_print(const device_profile_t *profile);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -42,6 +42,8 @@ ion_fexists(
 ) {
 #if defined(ARDUINO)
 	return (ion_boolean_t) SD_File_Exists(name);
+#elif defined(SIM_FLASH)
+	return (ion_boolean_t) sim_fexists(name);
 #else
 	return -1 != access(name, F_OK);
 #endif
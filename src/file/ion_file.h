@@ -65,8 +65,9 @@ typedef struct file_handle {
 
 #include "stdio.h"
 #include "unistd.h"
+#include "kv_stdio_intercept.h"
 
-typedef FILE *ion_file_handle_t;
+typedef ION_FILE *ion_file_handle_t;
 
 #define ION_NOFILE ((ion_file_handle_t) (NULL))
 
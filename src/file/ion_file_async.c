@@ -0,0 +1,367 @@
+/******************************************************************************/
+/**
+@file		ion_file_async.c
+@author		Ramon Lawrence
+@brief		Asynchronous page reads and writes on ION_FILE files.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include "ion_file_async.h"
+
+#if defined(ION_FILE_ASYNC_SUPPORTED)
+#include <unistd.h>
+
+/* Number of I/O threads set by ion_file_async_set_threads(). -1 if not set. */
+static int16_t async_threads = -1;
+#endif
+
+void
+ion_file_async_set_threads(
+	int16_t threads
+) {
+#if defined(ION_FILE_ASYNC_SUPPORTED)
+	if (threads < 0) {
+		threads = 0;
+	}
+
+	async_threads = threads > ION_FILE_ASYNC_MAX_THREADS ? ION_FILE_ASYNC_MAX_THREADS : threads;
+#else
+	(void) threads;
+#endif
+}
+
+int16_t
+ion_file_async_get_threads(
+	void
+) {
+#if defined(ION_FILE_ASYNC_SUPPORTED)
+
+	if (async_threads >= 0) {
+		return async_threads;
+	}
+
+	/* Extra threads only slow down a single processor */
+	return sysconf(_SC_NPROCESSORS_ONLN) > 1 ? ION_FILE_ASYNC_DEFAULT_THREADS : 0;
+#else
+	return 0;
+#endif
+}
+
+/**
+@brief		Performs the transfer of a request.
+@returns	@c 0 on success, 9 if write error, 10 if read error.
+*/
+static int8_t
+ion_file_async_transfer(
+	ion_file_request_t *request
+) {
+#if defined(ION_FILE_ASYNC_SUPPORTED)
+
+	if (request->write) {
+		if (pwrite(fileno(request->file), request->buffer, request->size, request->offset) != (ssize_t) request->size) {
+			return 9;
+		}
+	}
+	else if (pread(fileno(request->file), request->buffer, request->size, request->offset) != (ssize_t) request->size) {
+		return 10;
+	}
+
+#else
+	fseek(request->file, request->offset, SEEK_SET);
+
+	if (request->write) {
+		if (0 == fwrite(request->buffer, request->size, 1, request->file)) {
+			return 9;
+		}
+	}
+	else if (0 == fread(request->buffer, request->size, 1, request->file)) {
+		return 10;
+	}
+
+#endif
+	return 0;
+}
+
+#if defined(ION_FILE_ASYNC_SUPPORTED)
+
+/**
+@brief		I/O thread. Performs queued requests until the pool stops and
+			the queue is empty.
+*/
+static void *
+ion_file_async_thread(
+	void *arg
+) {
+	ion_file_async_t	*io = (ion_file_async_t *) arg;
+	ion_file_request_t	*request;
+	int8_t				status;
+
+	pthread_mutex_lock(&io->lock);
+
+	while (1) {
+		while (NULL == io->head && !io->stop) {
+			pthread_cond_wait(&io->submitted, &io->lock);
+		}
+
+		if (NULL == io->head) {
+			break;
+		}
+
+		request		= io->head;
+		io->head	= request->next;
+
+		if (NULL == io->head) {
+			io->tail = NULL;
+		}
+
+		pthread_mutex_unlock(&io->lock);
+
+		status = ion_file_async_transfer(request);
+
+		if (NULL != request->callback) {
+			request->callback(request, status);
+		}
+
+		pthread_mutex_lock(&io->lock);
+		request->status = status;
+
+		if ((0 != status) && (0 == io->err)) {
+			io->err = status;
+		}
+
+		io->pending--;
+		pthread_cond_broadcast(&io->completed);
+	}
+
+	pthread_mutex_unlock(&io->lock);
+	return NULL;
+}
+
+#endif
+
+int8_t
+ion_file_async_init(
+	ion_file_async_t	*io,
+	int16_t				numThreads
+) {
+	io->head		= NULL;
+	io->tail		= NULL;
+	io->pending		= 0;
+	io->numThreads	= 0;
+	io->stop		= 0;
+	io->err			= 0;
+
+	if (numThreads <= 0) {
+		return 0;
+	}
+
+#if defined(ION_FILE_ASYNC_SUPPORTED)
+
+	if (numThreads > ION_FILE_ASYNC_MAX_THREADS) {
+		numThreads = ION_FILE_ASYNC_MAX_THREADS;
+	}
+
+	pthread_mutex_init(&io->lock, NULL);
+	pthread_cond_init(&io->submitted, NULL);
+	pthread_cond_init(&io->completed, NULL);
+
+	/* Fewer threads if some cannot be started */
+	while (io->numThreads < numThreads && 0 == pthread_create(&io->threads[io->numThreads], NULL, ion_file_async_thread, io)) {
+		io->numThreads++;
+	}
+
+	if (io->numThreads > 0) {
+		return 0;
+	}
+
+	pthread_cond_destroy(&io->completed);
+	pthread_cond_destroy(&io->submitted);
+	pthread_mutex_destroy(&io->lock);
+#endif
+	return 8;
+}
+
+void
+ion_file_async_submit(
+	ion_file_async_t	*io,
+	ion_file_request_t	*requests,
+	int16_t				count
+) {
+	int16_t i;
+
+	if (0 == io->numThreads) {
+		for (i = 0; i < count; i++) {
+			int8_t status = ion_file_async_transfer(&requests[i]);
+
+			if (NULL != requests[i].callback) {
+				requests[i].callback(&requests[i], status);
+			}
+
+			requests[i].status = status;
+
+			if ((0 != status) && (0 == io->err)) {
+				io->err = status;
+			}
+		}
+
+		return;
+	}
+
+#if defined(ION_FILE_ASYNC_SUPPORTED)
+	pthread_mutex_lock(&io->lock);
+
+	for (i = 0; i < count; i++) {
+		requests[i].status	= ION_FILE_ASYNC_PENDING;
+		requests[i].next	= NULL;
+
+		if (NULL == io->tail) {
+			io->head = &requests[i];
+		}
+		else {
+			io->tail->next = &requests[i];
+		}
+
+		io->tail = &requests[i];
+	}
+
+	io->pending += count;
+	pthread_cond_broadcast(&io->submitted);
+	pthread_mutex_unlock(&io->lock);
+#endif
+}
+
+int8_t
+ion_file_async_wait(
+	ion_file_async_t	*io,
+	ion_file_request_t	*request
+) {
+	int8_t status;
+
+	if (0 == io->numThreads) {
+		return request->status;
+	}
+
+#if defined(ION_FILE_ASYNC_SUPPORTED)
+	pthread_mutex_lock(&io->lock);
+
+	while (ION_FILE_ASYNC_PENDING == request->status) {
+		pthread_cond_wait(&io->completed, &io->lock);
+	}
+
+	status = request->status;
+	pthread_mutex_unlock(&io->lock);
+#else
+	status = request->status;
+#endif
+	return status;
+}
+
+int8_t
+ion_file_async_drain(
+	ion_file_async_t *io
+) {
+	int8_t err;
+
+#if defined(ION_FILE_ASYNC_SUPPORTED)
+
+	if (io->numThreads > 0) {
+		pthread_mutex_lock(&io->lock);
+
+		while (io->pending > 0) {
+			pthread_cond_wait(&io->completed, &io->lock);
+		}
+
+		err		= io->err;
+		io->err = 0;
+		pthread_mutex_unlock(&io->lock);
+		return err;
+	}
+
+#endif
+	err		= io->err;
+	io->err = 0;
+	return err;
+}
+
+int8_t
+ion_file_async_read(
+	ion_file_async_t	*io,
+	ION_FILE			*file,
+	long				offset,
+	void				*buffer,
+	uint16_t			size
+) {
+	(void) io;
+#if defined(ION_FILE_ASYNC_SUPPORTED)
+
+	if (pread(fileno(file), buffer, size, offset) != (ssize_t) size) {
+		return 10;
+	}
+
+#else
+	fseek(file, offset, SEEK_SET);
+
+	if (0 == fread(buffer, size, 1, file)) {
+		return 10;
+	}
+
+#endif
+	return 0;
+}
+
+void
+ion_file_async_close(
+	ion_file_async_t *io
+) {
+#if defined(ION_FILE_ASYNC_SUPPORTED)
+	int16_t i;
+
+	if (0 == io->numThreads) {
+		return;
+	}
+
+	pthread_mutex_lock(&io->lock);
+	io->stop = 1;
+	pthread_cond_broadcast(&io->submitted);
+	pthread_mutex_unlock(&io->lock);
+
+	for (i = 0; i < io->numThreads; i++) {
+		pthread_join(io->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&io->completed);
+	pthread_cond_destroy(&io->submitted);
+	pthread_mutex_destroy(&io->lock);
+	io->numThreads = 0;
+#else
+	(void) io;
+#endif
+}
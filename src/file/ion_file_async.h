@@ -0,0 +1,219 @@
+/******************************************************************************/
+/**
+@file		ion_file_async.h
+@author		Ramon Lawrence
+@brief		Asynchronous page reads and writes on ION_FILE files.
+@details	Requests are queued in batches and performed by a pool of I/O
+			threads with positional reads and writes, so several I/Os are in
+			flight while the caller keeps sorting. Each request may have a
+			completion callback. Compile with -DION_FILE_ASYNC on a POSIX
+			host to enable the thread pool. Otherwise requests are performed
+			synchronously when submitted.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#if !defined(ION_FILE_ASYNC_H_)
+#define ION_FILE_ASYNC_H_
+
+#if defined(ARDUINO)
+#include "sd_stdio_c_iface.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "kv_stdio_intercept.h"
+
+/* The thread pool needs POSIX threads and positional I/O. The simulated flash device is not thread safe. */
+#if defined(ION_FILE_ASYNC) && !defined(ARDUINO) && !defined(SIM_FLASH)
+#define ION_FILE_ASYNC_SUPPORTED		1
+#include <pthread.h>
+#endif
+
+/**
+@brief		Largest number of I/O threads in a pool.
+*/
+#define ION_FILE_ASYNC_MAX_THREADS		8
+
+/**
+@brief		I/O threads used unless changed with ion_file_async_set_threads().
+			Used only if more than one processor is online.
+*/
+#define ION_FILE_ASYNC_DEFAULT_THREADS	2
+
+/**
+@brief		Status of a request that has been submitted and not completed.
+*/
+#define ION_FILE_ASYNC_PENDING			-1
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct ion_file_request ion_file_request_t;
+
+/**
+@brief		A page read or write. The buffer must not be used by the caller
+			until the request completes.
+*/
+struct ion_file_request {
+	ION_FILE			*file;
+	long				offset;			/**< File offset of first byte. */
+	void				*buffer;
+	uint16_t			size;			/**< Bytes to read or write. */
+	int8_t				write;			/**< 1 to write buffer, 0 to read into buffer. */
+	int8_t				status;			/**< ION_FILE_ASYNC_PENDING, 0 if success, 9 if write error, 10 if read error. */
+	void				(*callback)(ion_file_request_t *request, int8_t status);	/**< Called by the I/O thread with the transfer status before the request is complete. May be NULL. */
+	void				*arg;			/**< Caller data for the callback. */
+	ion_file_request_t	*next;			/**< Queue link. Used by the pool. */
+};
+
+/**
+@brief		Pool of I/O threads shared by all files of a sort. A pool with no
+			threads performs requests when they are submitted.
+*/
+typedef struct {
+#if defined(ION_FILE_ASYNC_SUPPORTED)
+	pthread_t			threads[ION_FILE_ASYNC_MAX_THREADS];
+	pthread_mutex_t		lock;
+	pthread_cond_t		submitted;		/**< Signaled when requests are queued or the pool stops. */
+	pthread_cond_t		completed;		/**< Broadcast when a request completes. */
+#endif
+	ion_file_request_t	*head;			/**< Queued requests not yet started. */
+	ion_file_request_t	*tail;
+	int32_t				pending;		/**< Requests submitted and not completed. */
+	int16_t				numThreads;
+	int8_t				stop;
+	int8_t				err;			/**< First error since last ion_file_async_drain(). */
+} ion_file_async_t;
+
+/**
+@brief		Sets number of I/O threads used by later sorts. 0 disables
+			asynchronous I/O.
+*/
+void
+ion_file_async_set_threads(
+	int16_t threads
+);
+
+/**
+@brief		Returns number of I/O threads. 0 if asynchronous I/O is disabled
+			or not supported. If not set, the default on a multi-processor
+			host and 0 otherwise.
+*/
+int16_t
+ion_file_async_get_threads(
+	void
+);
+
+/**
+@brief		Starts a pool of I/O threads. Files used with the pool must have
+			their stdio buffers flushed before requests are submitted.
+@param		io
+				Pool to start.
+@param		numThreads
+				Number of I/O threads. 0 performs requests synchronously.
+@returns	@c 0 on success, 8 if threads are not supported or could not
+			be started. The pool then performs requests synchronously.
+*/
+int8_t
+ion_file_async_init(
+	ion_file_async_t	*io,
+	int16_t				numThreads
+);
+
+/**
+@brief		Queues a batch of requests. Requests are started in order but
+			may complete in any order. Thread safe.
+@param		io
+				Pool performing the requests.
+@param		requests
+				Array of count requests with file, offset, buffer, size,
+				write, callback and arg set.
+@param		count
+				Number of requests.
+*/
+void
+ion_file_async_submit(
+	ion_file_async_t	*io,
+	ion_file_request_t	*requests,
+	int16_t				count
+);
+
+/**
+@brief		Waits until a request completes. Returns at once if the request
+			has completed. A request that was never submitted must have
+			status 0.
+@returns	Status of the request.
+*/
+int8_t
+ion_file_async_wait(
+	ion_file_async_t	*io,
+	ion_file_request_t	*request
+);
+
+/**
+@brief		Waits until all submitted requests complete.
+@returns	@c 0 if all requests since the last drain succeeded, otherwise
+			status of the first failed request.
+*/
+int8_t
+ion_file_async_drain(
+	ion_file_async_t	*io
+);
+
+/**
+@brief		Reads a page at an offset in the calling thread. Unlike fseek()
+			and fread() it is safe while writes to the file are in flight.
+@returns	@c 0 on success, 10 if read error.
+*/
+int8_t
+ion_file_async_read(
+	ion_file_async_t	*io,
+	ION_FILE			*file,
+	long				offset,
+	void				*buffer,
+	uint16_t			size
+);
+
+/**
+@brief		Waits for all requests and stops the I/O threads.
+*/
+void
+ion_file_async_close(
+	ion_file_async_t	*io
+);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* ION_FILE_ASYNC_H_ */
@@ -0,0 +1,178 @@
+/******************************************************************************/
+/**
+@file		ion_file_map.c
+@author		Ramon Lawrence
+@brief		Read-only memory mapping of ION_FILE files.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include "ion_file_map.h"
+
+#if defined(ION_FILE_MAP_SUPPORTED)
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* 0 if disabled with ion_file_map_set_enabled() */
+static int8_t map_enabled = 1;
+
+/**
+@brief		Applies the access pattern hint of a mapping.
+*/
+static void
+ion_file_map_apply_advice(
+	ion_file_map_t *map
+) {
+	int advice = MADV_NORMAL;
+
+	if (ION_FILE_MAP_SEQUENTIAL == map->advice) {
+		advice = MADV_SEQUENTIAL;
+	}
+	else if (ION_FILE_MAP_RANDOM == map->advice) {
+		advice = MADV_RANDOM;
+	}
+
+	madvise(map->base, (size_t) map->length, advice);
+}
+
+#endif
+
+void
+ion_file_map_set_enabled(
+	int8_t enabled
+) {
+#if defined(ION_FILE_MAP_SUPPORTED)
+	map_enabled = enabled ? 1 : 0;
+#else
+	(void) enabled;
+#endif
+}
+
+int8_t
+ion_file_map_get_enabled(
+	void
+) {
+#if defined(ION_FILE_MAP_SUPPORTED)
+	return map_enabled;
+#else
+	return 0;
+#endif
+}
+
+int8_t
+ion_file_map_open(
+	ion_file_map_t	*map,
+	ION_FILE		*file
+) {
+	map->file	= file;
+	map->base	= NULL;
+	map->length = 0;
+	map->advice = ION_FILE_MAP_NORMAL;
+
+	if (!ion_file_map_get_enabled()) {
+		return 10;
+	}
+
+	return ion_file_map_refresh(map);
+}
+
+int8_t
+ion_file_map_refresh(
+	ion_file_map_t *map
+) {
+#if defined(ION_FILE_MAP_SUPPORTED)
+	struct stat st;
+	void		*base;
+
+	if (!map_enabled || (NULL == map->file)) {
+		return 10;
+	}
+
+	fflush(map->file);
+
+	if (0 != fstat(fileno(map->file), &st)) {
+		return 10;
+	}
+
+	if ((NULL != map->base) && (st.st_size == map->length)) {
+		return 0;
+	}
+
+	ion_file_map_close(map);
+
+	if (0 == st.st_size) {
+		return 10;
+	}
+
+	base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fileno(map->file), 0);
+
+	if (MAP_FAILED == base) {
+		return 10;
+	}
+
+	map->base	= (char *) base;
+	map->length = (long) st.st_size;
+	ion_file_map_apply_advice(map);
+	return 0;
+#else
+	(void) map;
+	return 10;
+#endif
+}
+
+void
+ion_file_map_advise(
+	ion_file_map_t	*map,
+	int8_t			advice
+) {
+	map->advice = advice;
+#if defined(ION_FILE_MAP_SUPPORTED)
+
+	if (NULL != map->base) {
+		ion_file_map_apply_advice(map);
+	}
+
+#endif
+}
+
+void
+ion_file_map_close(
+	ion_file_map_t *map
+) {
+#if defined(ION_FILE_MAP_SUPPORTED)
+
+	if (NULL != map->base) {
+		munmap(map->base, (size_t) map->length);
+	}
+
+#endif
+	map->base	= NULL;
+	map->length = 0;
+}
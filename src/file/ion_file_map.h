@@ -0,0 +1,166 @@
+/******************************************************************************/
+/**
+@file		ion_file_map.h
+@author		Ramon Lawrence
+@brief		Read-only memory mapping of ION_FILE files.
+@details	Sort engines borrow pointers to pages of a mapped file instead
+			of copying pages into their buffer. Writes still use the file.
+			Compile with -DION_FILE_MMAP on a POSIX host to enable mapping.
+			Otherwise no file is mapped and callers read pages as usual.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#if !defined(ION_FILE_MAP_H_)
+#define ION_FILE_MAP_H_
+
+#if defined(ARDUINO)
+#include "sd_stdio_c_iface.h"
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "kv_stdio_intercept.h"
+
+/* Mapping needs mmap() on the file descriptor of a stdio file. Simulated flash files cannot be mapped. */
+#if defined(ION_FILE_MMAP) && !defined(ARDUINO) && !defined(SIM_FLASH)
+#define ION_FILE_MAP_SUPPORTED		1
+#endif
+
+/**
+@brief		Access pattern hints for ion_file_map_advise().
+*/
+#define ION_FILE_MAP_NORMAL			0
+#define ION_FILE_MAP_SEQUENTIAL		1
+#define ION_FILE_MAP_RANDOM			2
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief		A read-only mapping of the whole file. Pages written after the
+			file was mapped are visible once they are flushed. The mapping
+			grows with the file when it is refreshed.
+*/
+typedef struct {
+	ION_FILE	*file;
+	char		*base;			/**< Start of mapping. NULL if the file is not mapped. */
+	long		length;			/**< Bytes mapped. */
+	int8_t		advice;			/**< Last ION_FILE_MAP_* hint. Applied again when the file is remapped. */
+} ion_file_map_t;
+
+/**
+@brief		Enables or disables mapping for later sorts. Enabled by default
+			if supported.
+*/
+void
+ion_file_map_set_enabled(
+	int8_t enabled
+);
+
+/**
+@brief		Returns 1 if files are mapped, 0 if mapping is disabled or not
+			supported.
+*/
+int8_t
+ion_file_map_get_enabled(
+	void
+);
+
+/**
+@brief		Flushes the file and maps its current contents.
+@param		map
+				Mapping to initialize. Always initialized so it can be
+				passed to ion_file_map_page() and ion_file_map_close().
+@param		file
+				Already opened file.
+@returns	@c 0 on success, 10 if mapping is disabled, not supported or
+			failed. ion_file_map_page() then returns NULL.
+*/
+int8_t
+ion_file_map_open(
+	ion_file_map_t	*map,
+	ION_FILE		*file
+);
+
+/**
+@brief		Flushes the file and remaps it if its length changed.
+@returns	@c 0 on success, 10 if the file is not mapped.
+*/
+int8_t
+ion_file_map_refresh(
+	ion_file_map_t *map
+);
+
+/**
+@brief		Tells the kernel how the mapping will be read.
+@param		advice
+				One of ION_FILE_MAP_NORMAL, ION_FILE_MAP_SEQUENTIAL or
+				ION_FILE_MAP_RANDOM.
+*/
+void
+ion_file_map_advise(
+	ion_file_map_t	*map,
+	int8_t			advice
+);
+
+/**
+@brief		Unmaps the file. The file is not closed.
+*/
+void
+ion_file_map_close(
+	ion_file_map_t *map
+);
+
+/**
+@brief		Returns a pointer to size bytes at offset in the mapping, or
+			NULL if the file is not mapped or the bytes are past the end
+			of the mapping. The page must not be modified.
+*/
+static inline char *
+ion_file_map_page(
+	ion_file_map_t	*map,
+	long			offset,
+	uint16_t		size
+) {
+	if ((NULL == map->base) || (offset < 0) || (offset + size > map->length)) {
+		return NULL;
+	}
+
+	return map->base + offset;
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* ION_FILE_MAP_H_ */
@@ -11,6 +11,9 @@
 
 			Flags:  -DIntercept
 
+			On PC, compiling with -DSIM_FLASH routes the file functions to
+			the simulated flash device in sim_flash_c_iface.h.
+
 			Compiling with the -DIntercept flag will override stdio.h functions.
 			Leaving the flag (and thus the functions) out will allow for
 			regular use.
@@ -72,6 +75,31 @@ extern "C" {
 }
 #endif
 
+#elif defined(SIM_FLASH) /* Clause ARDUINO */
+
+#include <stdio.h>
+#include "sim_flash_c_iface.h"
+
+/* On PC with -DSIM_FLASH files are stored on a simulated flash device */
+#define  ION_FILE SIM_FILE
+#define  fopen(x, y)		sim_fopen(x, y)
+#define  fclose(x)			sim_fclose(x)
+#define  fwrite(w, x, y, z) sim_fwrite(w, x, y, z)
+#define  fflush(x)			sim_fflush(x)
+#define  fseek(x, y, z)		sim_fseek(x, y, z)
+#define  fread(w, x, y, z)	sim_fread(w, x, y, z)
+#define  ftell(x)			sim_ftell(x)
+#define  fremove(x)			sim_remove(x)
+#define  frewind(x)			sim_rewind(x)
+#define  fdeleteall()		sim_flash_delete_all()
+
+#else /* Clause ARDUINO */
+
+#include <stdio.h>
+
+/* On PC the standard C library file functions are used directly */
+#define  ION_FILE FILE
+
 #endif /* Clause ARDUINO */
 
 #endif /* KV_STDIO_INTERCEPT_H_ */
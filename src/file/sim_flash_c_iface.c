@@ -0,0 +1,478 @@
+/******************************************************************************/
+/**
+@file		sim_flash_c_iface.c
+@author		Ramon Lawrence
+@brief		Simulated flash device with stdio.h style file functions.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#if !defined(ARDUINO)
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim_flash_c_iface.h"
+
+#define SIM_FLASH_MAX_NAME	32
+
+/**
+@brief		A file stored on the simulated device. Each file starts on an
+			erase block boundary and its storage grows in erase blocks.
+*/
+struct _SIM_File {
+	char		name[SIM_FLASH_MAX_NAME];	/**< File name. Empty if slot is unused. */
+	uint8_t		*data;						/**< File contents. Erased bytes are 0xFF. */
+	uint32_t	*fill;						/**< Bytes programmed from start of each page. */
+	long		size;						/**< Logical end of file. */
+	long		capacity;					/**< Allocated bytes (multiple of erase block size). */
+	long		position;					/**< Current file position. */
+};
+
+static sim_flash_config_t	sim_config = { 512, 64, 25000, 200000, 1500000, SIM_FLASH_OVERWRITE_ERASE };
+static sim_flash_stats_t	sim_stats;
+static SIM_FILE				sim_files[SIM_FLASH_MAX_FILES];
+
+static void
+sim_charge_reads(
+	uint32_t count
+) {
+	sim_stats.page_reads		+= count;
+	sim_stats.virtual_time_ns	+= (uint64_t) count * sim_config.read_latency_ns;
+}
+
+static void
+sim_charge_programs(
+	uint32_t count
+) {
+	sim_stats.page_programs		+= count;
+	sim_stats.virtual_time_ns	+= (uint64_t) count * sim_config.program_latency_ns;
+}
+
+static void
+sim_charge_erases(
+	uint32_t count
+) {
+	sim_stats.block_erases		+= count;
+	sim_stats.virtual_time_ns	+= (uint64_t) count * sim_config.erase_latency_ns;
+}
+
+/* Grows file storage to hold at least size bytes. Returns 0 on success. */
+static int
+sim_reserve(
+	SIM_FILE	*stream,
+	long		size
+) {
+	long		block_bytes = (long) sim_config.page_size * sim_config.pages_per_block;
+	long		capacity;
+	uint8_t		*data;
+	uint32_t	*fill;
+
+	if (size <= stream->capacity) {
+		return 0;
+	}
+
+	capacity	= (size + block_bytes - 1) / block_bytes * block_bytes;
+	data		= (uint8_t *) realloc(stream->data, capacity);
+
+	if (NULL == data) {
+		return 1;
+	}
+
+	stream->data	= data;
+	fill			= (uint32_t *) realloc(stream->fill, capacity / sim_config.page_size * sizeof(uint32_t));
+
+	if (NULL == fill) {
+		return 1;
+	}
+
+	stream->fill = fill;
+	memset(data + stream->capacity, 0xFF, capacity - stream->capacity);
+	memset(fill + stream->capacity / sim_config.page_size, 0, (capacity - stream->capacity) / sim_config.page_size * sizeof(uint32_t));
+	stream->capacity = capacity;
+	return 0;
+}
+
+/* Erases block of file using read-modify-write of pages that are still in use. */
+static void
+sim_rewrite_block(
+	SIM_FILE	*stream,
+	long		block,
+	long		first_page,
+	long		last_page
+) {
+	long	page	= block * sim_config.pages_per_block;
+	long	end		= page + sim_config.pages_per_block;
+
+	sim_charge_erases(1);
+
+	for (; page < end; page++) {
+		if (0 == stream->fill[page]) {
+			continue;
+		}
+
+		/* Pages being written are programmed by the write itself */
+		sim_charge_reads(1);
+
+		if ((page < first_page) || (page > last_page)) {
+			sim_charge_programs(1);
+		}
+	}
+}
+
+int
+sim_flash_init(
+	sim_flash_config_t *config
+) {
+	int i;
+
+	if ((NULL == config) || (0 == config->page_size) || (0 == config->pages_per_block) || (config->overwrite_policy < SIM_FLASH_OVERWRITE_ALLOW) || (config->overwrite_policy > SIM_FLASH_OVERWRITE_FORBID)) {
+		return 1;
+	}
+
+	for (i = 0; i < SIM_FLASH_MAX_FILES; i++) {
+		if ('\0' != sim_files[i].name[0]) {
+			return 1;
+		}
+	}
+
+	sim_config = *config;
+	sim_flash_reset_stats();
+	return 0;
+}
+
+void
+sim_flash_get_config(
+	sim_flash_config_t *config
+) {
+	*config = sim_config;
+}
+
+void
+sim_flash_get_stats(
+	sim_flash_stats_t *stats
+) {
+	*stats = sim_stats;
+}
+
+void
+sim_flash_reset_stats(
+) {
+	memset(&sim_stats, 0, sizeof(sim_flash_stats_t));
+}
+
+int
+sim_flash_erase(
+	SIM_FILE	*stream,
+	long		offset,
+	long		length
+) {
+	long	block_bytes = (long) sim_config.page_size * sim_config.pages_per_block;
+	long	block, last;
+
+	if ((NULL == stream) || (offset < 0) || (length <= 0) || (0 != sim_reserve(stream, offset + length))) {
+		return 1;
+	}
+
+	last = (offset + length - 1) / block_bytes;
+
+	for (block = offset / block_bytes; block <= last; block++) {
+		memset(stream->data + block * block_bytes, 0xFF, block_bytes);
+		memset(stream->fill + block * sim_config.pages_per_block, 0, sim_config.pages_per_block * sizeof(uint32_t));
+		sim_charge_erases(1);
+	}
+
+	return 0;
+}
+
+int
+sim_flash_delete_all(
+) {
+	int i;
+
+	for (i = 0; i < SIM_FLASH_MAX_FILES; i++) {
+		if ('\0' != sim_files[i].name[0]) {
+			sim_remove(sim_files[i].name);
+		}
+	}
+
+	return 1;
+}
+
+static SIM_FILE *
+sim_find(
+	const char *filename
+) {
+	int i;
+
+	for (i = 0; i < SIM_FLASH_MAX_FILES; i++) {
+		if (('\0' != sim_files[i].name[0]) && (0 == strncmp(sim_files[i].name, filename, SIM_FLASH_MAX_NAME - 1))) {
+			return &sim_files[i];
+		}
+	}
+
+	return NULL;
+}
+
+int
+sim_fexists(
+	const char *filename
+) {
+	return NULL != sim_find(filename);
+}
+
+SIM_FILE *
+sim_fopen(
+	const char	*filename,
+	const char	*mode
+) {
+	SIM_FILE	*stream = sim_find(filename);
+	int			i;
+
+	if (NULL == stream) {
+		if ((NULL != strchr(mode, 'r')) && (NULL == strchr(mode, '+'))) {
+			return NULL;
+		}
+
+		for (i = 0; i < SIM_FLASH_MAX_FILES && NULL == stream; i++) {
+			if ('\0' == sim_files[i].name[0]) {
+				stream = &sim_files[i];
+			}
+		}
+
+		if ((NULL == stream) || ('\0' == filename[0])) {
+			return NULL;
+		}
+
+		memset(stream, 0, sizeof(SIM_FILE));
+		strncpy(stream->name, filename, SIM_FLASH_MAX_NAME - 1);
+	}
+	else if (NULL != strchr(mode, 'r') && NULL != strchr(mode, '+') && NULL == strchr(mode, 'w')) {
+		/* Existing file opened for update keeps its contents */
+	}
+	else if (NULL != strchr(mode, 'w')) {
+		/* Truncated file is given freshly erased blocks */
+		if (stream->capacity > 0) {
+			memset(stream->data, 0xFF, stream->capacity);
+			memset(stream->fill, 0, stream->capacity / sim_config.page_size * sizeof(uint32_t));
+		}
+
+		stream->size = 0;
+	}
+
+	stream->position = (NULL != strchr(mode, 'a')) ? stream->size : 0;
+	return stream;
+}
+
+int
+sim_fclose(
+	SIM_FILE *stream
+) {
+	(void) stream;
+	return 0;
+}
+
+size_t
+sim_fread(
+	void		*ptr,
+	size_t		size,
+	size_t		nmemb,
+	SIM_FILE	*stream
+) {
+	long	available, bytes;
+
+	if ((NULL == stream) || (0 == size) || (stream->position >= stream->size)) {
+		return 0;
+	}
+
+	available	= stream->size - stream->position;
+
+	if ((long) (size * nmemb) > available) {
+		nmemb = available / size;
+	}
+
+	bytes		= (long) (size * nmemb);
+
+	if (0 == bytes) {
+		return 0;
+	}
+
+	memcpy(ptr, stream->data + stream->position, bytes);
+	sim_charge_reads((stream->position + bytes - 1) / sim_config.page_size - stream->position / sim_config.page_size + 1);
+	stream->position += bytes;
+	return nmemb;
+}
+
+size_t
+sim_fwrite(
+	void		*ptr,
+	size_t		size,
+	size_t		nmemb,
+	SIM_FILE	*stream
+) {
+	long		bytes = (long) (size * nmemb);
+	long		end, first_page, last_page, page, last_block;
+	uint32_t	start_in_page, end_in_page;
+
+	if ((NULL == stream) || (0 == bytes)) {
+		return 0;
+	}
+
+	end = stream->position + bytes;
+
+	if (0 != sim_reserve(stream, end)) {
+		return 0;
+	}
+
+	first_page	= stream->position / sim_config.page_size;
+	last_page	= (end - 1) / sim_config.page_size;
+	last_block	= -1;
+
+	/* Check for writes over programmed bytes before changing any data */
+	for (page = first_page; page <= last_page; page++) {
+		start_in_page = (page == first_page) ? (uint32_t) (stream->position % sim_config.page_size) : 0;
+
+		if (start_in_page >= stream->fill[page]) {
+			continue;
+		}
+
+		if (SIM_FLASH_OVERWRITE_FORBID == sim_config.overwrite_policy) {
+			sim_stats.rejected_writes++;
+			return 0;
+		}
+
+		sim_stats.overwrites++;
+
+		if ((SIM_FLASH_OVERWRITE_ERASE == sim_config.overwrite_policy) && (page / (long) sim_config.pages_per_block != last_block)) {
+			last_block = page / sim_config.pages_per_block;
+			sim_rewrite_block(stream, last_block, first_page, last_page);
+		}
+	}
+
+	memcpy(stream->data + stream->position, ptr, bytes);
+
+	for (page = first_page; page <= last_page; page++) {
+		end_in_page = (page == last_page) ? (uint32_t) (end - page * (long) sim_config.page_size) : sim_config.page_size;
+
+		if (end_in_page > stream->fill[page]) {
+			stream->fill[page] = end_in_page;
+		}
+	}
+
+	sim_charge_programs(last_page - first_page + 1);
+	stream->position = end;
+
+	if (end > stream->size) {
+		stream->size = end;
+	}
+
+	return nmemb;
+}
+
+int
+sim_fseek(
+	SIM_FILE	*stream,
+	long		offset,
+	int			whence
+) {
+	long position;
+
+	if (NULL == stream) {
+		return 1;
+	}
+
+	switch (whence) {
+		case SEEK_SET:
+			position = offset;
+			break;
+
+		case SEEK_CUR:
+			position = stream->position + offset;
+			break;
+
+		case SEEK_END:
+			position = stream->size + offset;
+			break;
+
+		default:
+			return 1;
+	}
+
+	if (position < 0) {
+		return 1;
+	}
+
+	stream->position = position;
+	return 0;
+}
+
+long int
+sim_ftell(
+	SIM_FILE *stream
+) {
+	if (NULL == stream) {
+		return -1L;
+	}
+
+	return stream->position;
+}
+
+int
+sim_fflush(
+	SIM_FILE *stream
+) {
+	(void) stream;
+	return 0;
+}
+
+void
+sim_rewind(
+	SIM_FILE *stream
+) {
+	sim_fseek(stream, 0, SEEK_SET);
+}
+
+int
+sim_remove(
+	const char *filename
+) {
+	SIM_FILE *stream = sim_find(filename);
+
+	if (NULL == stream) {
+		return 1;
+	}
+
+	free(stream->data);
+	free(stream->fill);
+	memset(stream, 0, sizeof(SIM_FILE));
+	return 0;
+}
+
+#endif /* Clause ARDUINO */
@@ -0,0 +1,292 @@
+/******************************************************************************/
+/**
+@file		sim_flash_c_iface.h
+@author		Ramon Lawrence
+@brief		Simulated flash device with stdio.h style file functions.
+@details	Files are stored in memory and divided into device pages and
+			erase blocks. Each page read, page program and block erase is
+			counted and charged a configurable latency so that a device can
+			be modeled on a PC. Compile with -DSIM_FLASH to route ION_FILE
+			through the simulated device (see kv_stdio_intercept.h).
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#if !defined(SIM_FLASH_C_IFACE_H_)
+#define SIM_FLASH_C_IFACE_H_
+
+#if !defined(ARDUINO)
+
+#include <stdio.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief		Overwrite of a programmed page is allowed at no extra cost
+			(device has a flash translation layer, e.g. SD card).
+*/
+#define SIM_FLASH_OVERWRITE_ALLOW	0
+
+/**
+@brief		Overwrite of a programmed page erases its erase block. Other
+			programmed pages in the block are read and programmed back.
+*/
+#define SIM_FLASH_OVERWRITE_ERASE	1
+
+/**
+@brief		Overwrite of a programmed page fails unless the page was erased
+			with sim_flash_erase() (raw NAND/NOR without translation layer).
+*/
+#define SIM_FLASH_OVERWRITE_FORBID	2
+
+/**
+@brief		Maximum number of files stored on the simulated device.
+*/
+#define SIM_FLASH_MAX_FILES			8
+
+/**
+@brief		Simulated device geometry and timing.
+*/
+typedef struct {
+	uint32_t	page_size;				/**< Device page (program unit) size in bytes. */
+	uint32_t	pages_per_block;		/**< Pages in an erase block. */
+	uint32_t	read_latency_ns;		/**< Time to read one page. */
+	uint32_t	program_latency_ns;		/**< Time to program one page. */
+	uint32_t	erase_latency_ns;		/**< Time to erase one erase block. */
+	int8_t		overwrite_policy;		/**< One of SIM_FLASH_OVERWRITE_*. */
+} sim_flash_config_t;
+
+/**
+@brief		Operation counts and virtual time accumulated by the device.
+*/
+typedef struct {
+	uint32_t	page_reads;
+	uint32_t	page_programs;
+	uint32_t	block_erases;
+	uint32_t	overwrites;				/**< Writes to already programmed bytes. */
+	uint32_t	rejected_writes;		/**< Writes failed by SIM_FLASH_OVERWRITE_FORBID. */
+	uint64_t	virtual_time_ns;
+} sim_flash_stats_t;
+
+/**
+@brief		A file on the simulated device.
+*/
+typedef struct _SIM_File SIM_FILE;
+
+/**
+@brief		Sets the device geometry and timing and resets statistics.
+			Must be called before files are opened. If never called, the
+			device uses 512 byte pages, 64 page erase blocks, 25 us read,
+			200 us program, 1.5 ms erase and SIM_FLASH_OVERWRITE_ERASE.
+@param		config
+				Device configuration.
+@returns	@c 0 on success, a non-zero integer if the configuration is
+			invalid or files are open.
+*/
+int
+sim_flash_init(
+	sim_flash_config_t *config
+);
+
+/**
+@brief		Returns the current device configuration.
+@param		config
+				Structure to copy the configuration into.
+*/
+void
+sim_flash_get_config(
+	sim_flash_config_t *config
+);
+
+/**
+@brief		Copies the operation counts and virtual time since the last reset.
+@param		stats
+				Structure to copy the statistics into.
+*/
+void
+sim_flash_get_stats(
+	sim_flash_stats_t *stats
+);
+
+/**
+@brief		Resets operation counts and virtual time to zero.
+*/
+void
+sim_flash_reset_stats(
+);
+
+/**
+@brief		Erases all erase blocks overlapping a byte range of a file.
+			Erased bytes read as 0xFF and may be programmed again.
+@param		stream
+				The simulated file.
+@param		offset
+				Byte offset of the start of the range.
+@param		length
+				Number of bytes in the range.
+@returns	@c 0 on success, a non-zero integer otherwise.
+*/
+int
+sim_flash_erase(
+	SIM_FILE	*stream,
+	long		offset,
+	long		length
+);
+
+/**
+@brief		Deletes all files on the simulated device.
+@returns	@c 1, always.
+*/
+int
+sim_flash_delete_all(
+);
+
+/**
+@brief		Check to see if a simulated file exists.
+@param		filename
+				Name of the file.
+@returns	@c 1 if the file exists, @c 0 otherwise.
+*/
+int
+sim_fexists(
+	const char *filename
+);
+
+/**
+@brief		Opens a simulated file. Modes containing 'w' truncate the file,
+			modes containing 'r' (without '+' or 'w') require that it exists.
+@param		filename
+				Name of the file.
+@param		mode
+				Which mode to open the file under.
+@returns	A pointer to the file, or @c NULL if an error occurred.
+*/
+SIM_FILE *
+sim_fopen(
+	const char	*filename,
+	const char	*mode
+);
+
+/**
+@brief		Closes a simulated file. The file contents are kept on the
+			device until removed.
+@param		stream
+				The simulated file.
+@returns	@c 0, always.
+*/
+int
+sim_fclose(
+	SIM_FILE *stream
+);
+
+/**
+@brief		Reads @p size * @p nmemb bytes from the current position.
+			Each device page touched is charged one page read.
+@returns	The number of items that have been read.
+*/
+size_t
+sim_fread(
+	void		*ptr,
+	size_t		size,
+	size_t		nmemb,
+	SIM_FILE	*stream
+);
+
+/**
+@brief		Writes @p size * @p nmemb bytes at the current position.
+			Each device page touched is charged one page program. Writing
+			bytes that are already programmed is handled according to the
+			overwrite policy.
+@returns	The number of items successfully written.
+*/
+size_t
+sim_fwrite(
+	void		*ptr,
+	size_t		size,
+	size_t		nmemb,
+	SIM_FILE	*stream
+);
+
+/**
+@brief		Moves the file position. @p whence is SEEK_SET, SEEK_CUR or SEEK_END.
+@returns	@c 0 for success, a non-zero integer otherwise.
+*/
+int
+sim_fseek(
+	SIM_FILE	*stream,
+	long		offset,
+	int			whence
+);
+
+/**
+@brief		Reveals the file position of the given stream.
+@returns	The current position, or @c -1L if @p stream is invalid.
+*/
+long int
+sim_ftell(
+	SIM_FILE *stream
+);
+
+/**
+@brief		Flush is a no-op as writes go directly to the simulated device.
+@returns	@c 0, always.
+*/
+int
+sim_fflush(
+	SIM_FILE *stream
+);
+
+/**
+@brief		Set the file position to the beginning of the file.
+*/
+void
+sim_rewind(
+	SIM_FILE *stream
+);
+
+/**
+@brief		Removes a file from the simulated device.
+@returns	@c 0 if the file was removed successfully, @c 1 otherwise.
+*/
+int
+sim_remove(
+	const char *filename
+);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* Clause ARDUINO */
+
+#endif
@@ -46,6 +46,10 @@
 #include "flash_minsort.h"
 #include "in_memory_sort.h"
 #include "no_output_heap.h"
+#include "sort_metrics.h"
+#include "region_heap.h"
+#include "sort_parallel.h"
+#include "file/ion_file_async.h"
 /*
 #define DEBUG 1
 #define DEBUG_OUTPUT 1
@@ -56,38 +60,207 @@ void readPage(MinSortState *ms, int pageNum, external_sort_t *es, metrics_t *met
     file_iterator_state_t* is = (file_iterator_state_t*) ms->iteratorState;
     ION_FILE* fp = is->file;
     
-    /* Seek to page location in file */
-    fseek(fp, pageNum*es->page_size, SEEK_SET);
+    /* Borrow page from mapped file instead of copying it */
+    ms->page = ion_file_map_page(&ms->map, (long) pageNum*es->page_size, es->page_size);
+    if (ms->page == NULL)
+    {
+        /* Seek to page location in file */
+        fseek(fp, pageNum*es->page_size, SEEK_SET);
 
-    /* Read page into start of buffer */   
-    if (0 ==  fread(ms->buffer, es->page_size, 1, fp))
-    {	printf("Failed to read block: %d\n", pageNum);        
+        /* Read page into start of buffer */   
+        ms->page = ms->buffer;
+        if (0 ==  fread(ms->buffer, es->page_size, 1, fp))
+        {	printf("Failed to read block: %d\n", pageNum);        
+        }
     }
     
     metric->num_reads++;
     
     ms->blocksRead++;     
     ms->lastBlockIdx = pageNum;   
+    sort_codec_rewind(&ms->cursor);
     #ifdef DEBUG_READ
         printf("Reading block: %d\r\n",pageNum);        
         for (int k = 0; k < 31; k++)
         {
-            test_record_t *buf = (void *)(ms->buffer + es->headerSize + k * es->record_size);
+            test_record_t *buf = (void *)(ms->page + es->headerSize + k * es->record_size);
             printf("%d: Record: %d\n", k, buf->key);
         }
     #endif
 }
 
-/* Returns a value of a tuple given a record number in a block (that has been previously buffered) */
-int32_t getValue(MinSortState* ms, int recordNum, external_sort_t *es)
+/* Returns a record given its record number in a block (that has been previously buffered). Records of an encoded block
+   are decoded into ms->record (see sort_codec_read_at()). The record decoded last is not decoded again. */
+static inline char* getRecord(MinSortState* ms, int recordNum, external_sort_t *es)
+{
+    if (ms->record == NULL)
+        return ms->page+es->headerSize+recordNum*es->record_size;
+
+    if (ms->cursor.idx != recordNum + 1)
+        sort_codec_read_at(es, ms->page, &ms->cursor, (int16_t) recordNum, ms->record);
+    return ms->record;
+}
+
+/* Returns the normalized key of a tuple given a record number in a block (that has been previously buffered) */
+uint64_t getValue(MinSortState* ms, int recordNum, external_sort_t *es)
 {      
-    test_record_t *buf = (test_record_t*) (ms->buffer+es->headerSize+recordNum*es->record_size);
-    return buf->key;	    
+    return sort_key_normalize(es, getRecord(ms, recordNum, es));
+}
+
+/**
+ * Number of records of block blockIdx buffered in page. Blocks of unencoded input are full except the last.
+ * Encoded blocks hold any number of records, so their count is read from the block header.
+ */
+static unsigned int pageRecords(MinSortState *ms, char *page, unsigned int blockIdx)
+{
+    unsigned long first = (unsigned long) blockIdx * ms->records_per_block;
+    int16_t count;
+
+    if (ms->record != NULL)
+    {
+        memcpy(&count, page + BLOCK_COUNT_OFFSET, sizeof(int16_t));
+        return (unsigned int) count;
+    }
+    if (first >= ms->num_records)
+        return 0;
+    return ms->num_records - first < ms->records_per_block ? (unsigned int) (ms->num_records - first) : ms->records_per_block;
+}
+
+/**
+ * Updates the minimum of the region of block blockIdx with the records of the block buffered in page.
+ * Records of an encoded block are decoded in order into ms->record.
+ */
+static void scanPage(MinSortState *ms, external_sort_t *es, char *page, unsigned int blockIdx, sort_estimate_t *distinct, metrics_t *metric)
+{
+    unsigned int j, n = pageRecords(ms, page, blockIdx), regionIdx = blockIdx / ms->blocks_per_region;
+    uint64_t val;
+    sort_codec_cursor_t cursor;
+
+    sort_codec_rewind(&cursor);
+    for (j=0; j < n; j++)
+    {
+        if (ms->record != NULL)
+        {
+            sort_codec_read(es, page, &cursor, ms->record);
+            val = sort_key_normalize(es, ms->record);
+        }
+        else
+            val = sort_key_normalize(es, page + es->headerSize + j * es->record_size);
+
+        sort_estimate_add(distinct, val);
+        metric->num_compar++;
+
+        if (region_index_is_exhausted(&ms->index, regionIdx) || val < region_index_min(&ms->index, regionIdx))
+            region_index_set_min(&ms->index, regionIdx, val);
+    }
+}
+
+/**
+ * Scans regions firstRegion to endRegion-1, sets the minimum of each region and adds the keys to distinct. Pages are read
+ * into page. If positional, pages are read without moving the file position so several scans can share the input file.
+ */
+static void scanRegions(MinSortState *ms, external_sort_t *es, char *page, int8_t positional, unsigned int firstRegion,
+                unsigned int endRegion, sort_estimate_t *distinct, metrics_t *metric)
+{
+    file_iterator_state_t* is = (file_iterator_state_t*) ms->iteratorState;
+    unsigned int i;
+    unsigned int endBlock = endRegion * ms->blocks_per_region;
+
+    if (endBlock > ms->numBlocks)
+        endBlock = ms->numBlocks;
+
+    for (i = firstRegion * ms->blocks_per_region; i < endBlock; i++)
+    {
+        if (positional)
+        {
+            char *mapped = ion_file_map_page(&ms->map, (long) i * es->page_size, es->page_size);
+
+            if (mapped != NULL)
+                scanPage(ms, es, mapped, i, distinct, metric);
+            else
+            {
+                if (sort_parallel_read(is->file, (long) i * es->page_size, page, es->page_size) != 0)
+                    printf("Failed to read block: %d\n", i);
+                scanPage(ms, es, page, i, distinct, metric);
+            }
+            metric->num_reads++;
+        }
+        else
+        {
+            readPage(ms, i, es, metric);
+            scanPage(ms, es, ms->page, i, distinct, metric);
+        }
+    }
+}
+
+/**
+ * Scans all regions reading the next page with an I/O thread while the current page is scanned.
+ * Pages alternate between the MinSort input page and nextPage.
+ */
+static void scanRegionsReadAhead(MinSortState *ms, external_sort_t *es, ion_file_async_t *io, char *nextPage, metrics_t *metric)
+{
+    file_iterator_state_t* is = (file_iterator_state_t*) ms->iteratorState;
+    char *pages[2] = { ms->buffer, nextPage };
+    ion_file_request_t request;
+    unsigned int i;
+
+    request.file        = is->file;
+    request.size        = es->page_size;
+    request.write       = 0;
+    request.callback    = NULL;
+    request.status      = 0;
+    fflush(is->file);
+
+    for (i = 0; i < ms->numBlocks; i++)
+    {
+        if (i == 0)
+        {
+            request.offset = 0;
+            request.buffer = pages[0];
+            ion_file_async_submit(io, &request, 1);
+        }
+        if (ion_file_async_wait(io, &request) != 0)
+            printf("Failed to read block: %d\n", i);
+        metric->num_reads++;
+
+        if (i + 1 < ms->numBlocks)
+        {   /* Read next page while this one is scanned */
+            request.offset = (long) (i + 1) * es->page_size;
+            request.buffer = pages[(i + 1) & 1];
+            ion_file_async_submit(io, &request, 1);
+        }
+        scanPage(ms, es, pages[i & 1], i, &ms->distinct, metric);
+    }
+    ms->blocksRead += ms->numBlocks;
+}
+
+/**
+ * Region scan shared by scan workers. Each task is a slice of regionsPerTask regions. Slices are a multiple
+ * of 8 regions so workers never update the same byte of the exhausted flags.
+ */
+typedef struct {
+    MinSortState    *ms;
+    external_sort_t *es;
+    char            *pages;             /* Page buffer of each worker after worker 0 */
+    metrics_t       *metrics;           /* Metrics of each worker */
+    sort_estimate_t *distinct;          /* Distinct keys seen by each worker */
+    unsigned int    regionsPerTask;
+} minsort_scan_t;
+
+static int8_t scanRegionsTask(void *arg, int16_t worker, int32_t task)
+{
+    minsort_scan_t *scan = (minsort_scan_t*) arg;
+    char *page = worker == 0 ? scan->ms->buffer : scan->pages + (worker - 1) * scan->es->page_size;
+
+    scanRegions(scan->ms, scan->es, page, 1, (unsigned int) task * scan->regionsPerTask,
+                (unsigned int) (task + 1) * scan->regionsPerTask, &scan->distinct[worker], &scan->metrics[worker]);
+    return 0;
 }
 
 void init_MinSort(MinSortState* ms, external_sort_t *es, metrics_t *metric)
 {
-     unsigned int i = 0, j = 0, val, regionIdx;    
+     unsigned int i = 0, j = 0;
+     int32_t avail;
 
     /* Operator statistics */        
 
@@ -99,93 +272,147 @@ void init_MinSort(MinSortState* ms, external_sort_t *es, metrics_t *metric)
     ms->record_size       = es->record_size;    
     ms->numBlocks         = es->num_pages;
     ms->records_per_block =  (es->page_size - es->headerSize) / es->record_size;
-    j = (ms->memoryAvailable - 2 * SORT_KEY_SIZE - INT_SIZE) / SORT_KEY_SIZE;  
+
+    /* Encoded pages have fewer than page_size - SORT_CODEC_HEADER_SIZE records (see sort_codec_add()), which is used
+       as the stride of record numbers in a region */
+    if (es->codec != SORT_CODEC_NONE)
+        ms->records_per_block = es->page_size - SORT_CODEC_HEADER_SIZE;
+    /* Blocks 0 and 1 are input and output buffers. Remaining memory stores the minimum index (key and exhausted bit per region). */
+    avail = ms->memoryAvailable - 2 * es->page_size - 2 * SORT_KEY_SIZE - INT_SIZE;
+    j = (unsigned int) (avail * 8 / (8 * es->key_size + 1));  
     printf("Memory overhead: %d  Max regions: %d\r\n",  2 * SORT_KEY_SIZE + INT_SIZE, j);
     ms->blocks_per_region = (unsigned int) ceil((float) ms->numBlocks / j );                      
     ms->numRegions        = (unsigned int) ceil((float) ms->numBlocks / ms->blocks_per_region);    
     
     // Memory allocation    
     // Allocate minimum index after block 2 (block 0 is input buffer, block 1 is output buffer)
-    ms->min = (unsigned int*) ms->buffer+es->page_size*2;
+    ms->index.min = ms->buffer+es->page_size*2;
+    ms->index.numRegions = ms->numRegions;
+    ms->index.keyWidth = (uint8_t) es->key_size;
+
+    /* Region heap finds the smallest region in O(log regions) rather than scanning every minimum.
+       Only used if it fits after the minimum index as larger regions would cost more reads per output value. 
+       Heap starts on a 2 byte boundary after the keys and exhausted flags follow it. */
+    j = (unsigned int) ((avail - 1) * 8 / (8 * es->key_size + 8 * REGION_HEAP_ENTRY_SIZE + 1));
+    ms->index.heap = NULL;
+    ms->index.exhausted = (uint8_t*) (ms->index.min + ms->numRegions * es->key_size);
+    if (ms->numRegions <= j && ms->numRegions <= REGION_HEAP_MAX_REGIONS)
+    {
+        ms->index.heap = (uint16_t*) (ms->index.min + ((ms->numRegions * es->key_size + 1) & ~1u));
+        ms->index.exhausted = (uint8_t*) (ms->index.heap + ms->numRegions);
+    }
+    printf("Region heap: %s  Bytes per region: %d (%d with heap)\r\n", ms->index.heap == NULL ? "no" : "yes", 
+                es->key_size, es->key_size + REGION_HEAP_ENTRY_SIZE);
       
     printf("Page size: %d, Memory size: %d Record size: %d, Number of records: %lu, Number of blocks: %d, Blocks per region: %d  Regions: %d\r\n", 
                    es->page_size, ms->memoryAvailable, ms->record_size, ms->num_records, ms->numBlocks, ms->blocks_per_region, ms->numRegions);
                     
-    for (i=0; i < ms->numRegions; i++)
-        ms->min[i] = INT_MAX; 
+    region_index_clear(&ms->index);
+    sort_estimate_clear(&ms->distinct);
+    ms->numDistinct = 0;
+
+    /* Pages of a mapped input file are read in place. The scan reads every page in order and output reads regions in any order. */
+    ms->page = ms->buffer;
+    ion_file_map_open(&ms->map, ((file_iterator_state_t*) ms->iteratorState)->file);
+    ion_file_map_advise(&ms->map, ION_FILE_MAP_SEQUENTIAL);
+    ms->record = es->codec == SORT_CODEC_NONE ? NULL : (char*) malloc(es->record_size);
+    if (es->codec != SORT_CODEC_NONE && ms->record == NULL)
+        return;
            	
-    long n = 0;
-    /* Scan data to populate the minimum in each region */
-    for (i=0; i < ms->numBlocks; i++)
-    {                                                                                         
-        readPage(ms, i, es, metric);                
-        regionIdx = i / ms->blocks_per_region;
-               
-        /* Process first record in block */    		      
-        for (j=0; j < ms->records_per_block; j++)
-        {      
-            if (((i * ms->records_per_block) + j) < ms->num_records)
-            {               
-                val = getValue(ms, j, es);     
-
-                // TODO: Use hash to estimate # distinct
-                /*
-                int bit = val % 32;
-                n |= 1UL << bit; 
-                */
-                metric->num_compar++;
-                             
-                if (val < ms->min[regionIdx])                
-                    ms->min[regionIdx] = val;                                    
-            }
-            else                         
-                break;            
+    /* Scan data to populate the minimum in each region. Slices of regions are scanned in parallel
+       if there are several workers (see sort_parallel.h). Each worker after the first needs its own page. */
+    int16_t  numWorkers = sort_parallel_get_workers();
+    uint32_t numGroups = (ms->numRegions + 7) / 8;
+    minsort_scan_t scan;
+    metrics_t workerMetrics[SORT_PARALLEL_MAX_WORKERS];
+    sort_estimate_t workerDistinct[SORT_PARALLEL_MAX_WORKERS];
+
+    if (numWorkers > SORT_PARALLEL_MAX_WORKERS)
+        numWorkers = SORT_PARALLEL_MAX_WORKERS;
+    if (numWorkers > (int32_t) numGroups)
+        numWorkers = (int16_t) numGroups;
+    scan.pages = NULL;
+    /* Encoded pages are decoded into ms->record, so they are scanned by one worker */
+    if (SORT_PARALLEL_MAX_WORKERS > 1 && numWorkers > 1 && ms->record == NULL)
+        scan.pages = (char*) malloc((size_t) (numWorkers - 1) * es->page_size);
+
+    if (scan.pages != NULL)
+    {
+        file_iterator_state_t* is = (file_iterator_state_t*) ms->iteratorState;
+        int32_t numTasks;
+
+        scan.ms = ms;
+        scan.es = es;
+        scan.metrics = workerMetrics;
+        scan.distinct = workerDistinct;
+        scan.regionsPerTask = (unsigned int) ((numGroups + numWorkers - 1) / numWorkers) * 8;
+        numTasks = (int32_t) ((ms->numRegions + scan.regionsPerTask - 1) / scan.regionsPerTask);
+        memset(workerMetrics, 0, sizeof(metrics_t) * numWorkers);
+        memset(workerDistinct, 0, sizeof(sort_estimate_t) * numWorkers);
+        printf("Parallel region scan workers: %d\r\n", numWorkers);
+
+        fflush(is->file);
+        sort_parallel_run(numTasks, numWorkers, scanRegionsTask, &scan);
+        for (i = 0; i < (unsigned int) numWorkers; i++)
+        {
+            metric->num_reads  += workerMetrics[i].num_reads;
+            metric->num_compar += workerMetrics[i].num_compar;
+            sort_estimate_merge(&ms->distinct, &workerDistinct[i]);
+        }
+        ms->blocksRead += ms->numBlocks;
+        free(scan.pages);
+    }
+    else
+    {   /* Read ahead one page with an I/O thread if asynchronous I/O is enabled (see ion_file_async.h) and the file is not mapped */
+        ion_file_async_t io;
+        char *nextPage = NULL;
+
+        if (ms->map.base == NULL && ion_file_async_get_threads() > 0 && ion_file_async_init(&io, 1) == 0)
+        {
+            nextPage = (char*) malloc(es->page_size);
+            if (nextPage == NULL)
+                ion_file_async_close(&io);
+        }
+        if (nextPage != NULL)
+        {
+            scanRegionsReadAhead(ms, es, &io, nextPage, metric);
+            ion_file_async_close(&io);
+            free(nextPage);
         }
+        else
+            scanRegions(ms, es, ms->buffer, 0, 0, ms->numRegions, &ms->distinct, metric);
     }
        
      #ifdef DEBUG   
         for (i=0; i < ms->numRegions; i++)
-            printf("Region: %d  Min: %d\r\n",i,ms->min[i]); 
+            printf("Region: %d  Min: %llu\r\n",i,(unsigned long long) region_index_min(&ms->index, i)); 
       #endif
-    /*
-    // TODO: Count # distinct bits
-    printf("N: %lu\n",n);
-    unsigned int count = 0; 
-    while (n) { 
-         n &= (n - 1); 
-         count++; 
-    }
-    ms->numDistinct  = count;
-    printf("Distiinct: %d", ms->numDistinct);
-      */  
-    ms->current = INT_MAX;
-    ms->next    = INT_MAX; 
+    region_heap_build(&ms->index, metric);
+    ion_file_map_advise(&ms->map, ION_FILE_MAP_RANDOM);
+    ms->numDistinct = sort_estimate_count(&ms->distinct);
+    printf("Estimated distinct keys: %u\r\n", ms->numDistinct);
+    ms->current = 0;
+    ms->next    = 0; 
+    ms->haveNext = 0;
     ms->nextIdx = 0;       
     ms->lastBlockIdx = INT_MAX;
 }
 
 char* next_MinSort(MinSortState* ms, external_sort_t *es, void *tupleBuffer, metrics_t *metric)
 {
-    unsigned int i, curBlk, startBlk, dataVal;                                                     
+    unsigned int i, n, curBlk, startBlk;
+    uint64_t dataVal;                                                     
     unsigned long int startIndex, k;
                  
     // Find the block with the minimum tuple value - otherwise continue on with last block            
     if (ms->nextIdx == 0)
     {    // Find new block as do not know location of next minimum tuple
-        ms->current = INT_MAX;
-        ms->regionIdx = INT_MAX; 
-        ms->next = INT_MAX; 
-        for (i=0; i < ms->numRegions; i++)
-        {
-             metric->num_compar++;
-
-            if (ms->min[i] < ms->current)
-            {   ms->current = ms->min[i];
-                ms->regionIdx = i;
-            }
-        }        
-        if (ms->regionIdx == INT_MAX)
+        int32_t region = region_index_smallest(&ms->index, metric);
+        ms->haveNext = 0; 
+        if (region < 0)
             return NULL;    // Join complete - no more tuples	            		
+        ms->regionIdx = (unsigned int) region;
+        ms->current = region_index_min(&ms->index, ms->regionIdx);
     }
      				
     // Search current region for tuple with current minimum value		        
@@ -195,22 +422,24 @@ char* next_MinSort(MinSortState* ms, external_sort_t *es, void *tupleBuffer, met
     for (k=startIndex/ms->records_per_block; k < ms->blocks_per_region; k++)
     {
        curBlk = startBlk + k;
+       if (curBlk >= ms->numBlocks)
+            break;
        if (curBlk != ms->lastBlockIdx)
        {    // Read block into buffer   
             readPage(ms, curBlk, es, metric);                       
        }                        
            
-       for (i=startIndex%ms->records_per_block; i < ms->records_per_block; i++)
-       {     if (curBlk*ms->records_per_block + i >= ms->num_records)
-                    break;
+       n = pageRecords(ms, ms->page, curBlk);
+       for (i=startIndex%ms->records_per_block; i < n; i++)
+       {
             dataVal = getValue(ms,i, es); 
             metric->num_compar++;    
                 
             if (dataVal == ms->current)                
-            {   memcpy(tupleBuffer, &(ms->buffer[ms->record_size * i+es->headerSize]), ms->record_size);
+            {   memcpy(tupleBuffer, getRecord(ms, i, es), ms->record_size);
                 metric->num_memcpys++;     
                 #ifdef DEBUG
-                    test_record_t *buf = (test_record_t*) (ms->buffer+es->headerSize+i*es->record_size);                    
+                    test_record_t *buf = (test_record_t*) (ms->page+es->headerSize+i*es->record_size);                    
                     buf = (test_record_t*) tupleBuffer;
                     printf("Returning tuple: %d\n", buf->key);                    
                 #endif
@@ -219,13 +448,15 @@ char* next_MinSort(MinSortState* ms, external_sort_t *es, void *tupleBuffer, met
                 goto done;	// Found the record we are looking for
             } 
             metric->num_compar++;    
-            if (dataVal > ms->current && dataVal < ms->next)
+            if (dataVal > ms->current && (!ms->haveNext || dataVal < ms->next))
             {
                 ms->next = dataVal;
+                ms->haveNext = 1;
                 ms->nextIdx = 0;
             }
        }
     }           
+    i = 0;      // Record not found in the region, so any block scanned below starts at its first record
 
 done:   
     // Now update minimum in block - Scan rest of region after what we found to see if can find a smaller record 
@@ -234,15 +465,17 @@ done:
     for ( ; k < ms->blocks_per_region; k++)
     {
            curBlk = startBlk + k;
+           if (curBlk >= ms->numBlocks)
+                break;
            if (curBlk != ms->lastBlockIdx)
            {    // Read block into buffer  
                 readPage(ms, curBlk, es, metric); 
                 i = 0;               
            }                        
            
-           for ( ; i < ms->records_per_block; i++)
-           {    if (curBlk*ms->records_per_block + i >= ms->num_records)
-                    break;
+           n = pageRecords(ms, ms->page, curBlk);
+           for ( ; i < n; i++)
+           {
                 dataVal = getValue(ms,i,es); 
                 metric->num_compar++;                    
                 if (dataVal == ms->current)                
@@ -253,9 +486,10 @@ done:
                     goto done2;
                 } 
                 metric->num_compar++; 
-                if (dataVal > ms->current && dataVal < ms->next)
+                if (dataVal > ms->current && (!ms->haveNext || dataVal < ms->next))
                 {
                     ms->next = dataVal;
+                    ms->haveNext = 1;
                     ms->nextIdx = 0;
                 }
            }
@@ -266,9 +500,13 @@ done2:
     if (ms->nextIdx == 0) 		  
     {	               				
         // Update minimum currently in block
-        ms->min[ms->regionIdx] = ms->next;	
+        if (ms->haveNext)
+            region_index_set_min(&ms->index, ms->regionIdx, ms->next);	
+        else
+            region_index_set_exhausted(&ms->index, ms->regionIdx);
+        region_heap_update(&ms->index, metric);
         #ifdef DEBUG	
-            printf("Updated minimum in block to: %d\r\n", ms->min[ms->regionIdx]);
+            printf("Updated minimum in block to: %llu\r\n", (unsigned long long) ms->next);
         #endif					
     }
     return tupleBuffer;		    
@@ -276,6 +514,9 @@ done2:
 
 void close_MinSort(MinSortState* ms, external_sort_t *es)
 {
+    ion_file_map_close(&ms->map);
+    free(ms->record);
+    ms->record = NULL;
     /*
     printf("Tuples out:  %lu\r\n", ms->op.tuples_out); 
     printf("Blocks read: %lu\r\n", ms->op.blocks_read);
@@ -319,13 +560,33 @@ int flash_minsort(
 {
     printf("*Flash Minsort*\n");    
   
+    if (!sort_key_supported(es))
+    {   /* MinSort orders keys itself rather than using compareFn */
+        printf("Key type not supported by MinSort.\n");
+        return 8;
+    }
+
+    if (bufferSizeInBytes < 2 * es->page_size + 2 * SORT_KEY_SIZE + INT_SIZE + es->key_size + 1)
+    {   /* Need an input and output block plus space for at least one region minimum */
+        printf("Not enough memory for MinSort.\n");
+        return 8;
+    }
+
     MinSortState ms;
     ms.buffer = buffer;
     ms.iteratorState = iteratorState;
     ms.memoryAvailable = bufferSizeInBytes;
     ms.num_records = ((file_iterator_state_t*) iteratorState)->totalRecords;
     
+    metrics_phase_begin(metric, METRICS_PHASE_MINSORT_INIT, 0);
     init_MinSort(&ms, es, metric);
+    metrics_phase_end(metric, es);
+    if (es->codec != SORT_CODEC_NONE && ms.record == NULL)
+    {
+        close_MinSort(&ms, es);
+        return 8;
+    }
+    metrics_phase_begin(metric, METRICS_PHASE_MINSORT_OUTPUT, 0);
     int16_t count = 0;  
     int32_t blockIndex = 0;
     int16_t values_per_page = (es->page_size - es->headerSize) / es->record_size;
@@ -345,7 +606,11 @@ int flash_minsort(
             // Force seek to end of file as outputFile is also inputFile and have been reading it
             fseek(outputFile, 0, SEEK_END);
             if (0 == fwrite(outputBuffer, es->page_size, 1, outputFile))
+            {
+                close_MinSort(&ms, es);
                 return 9;
+            }
+            metric->num_writes += 1;
 
         #ifdef DEBUG_OUTPUT
             printf("Wrote output block. Block index: %d\n", blockIndex);
@@ -363,15 +628,20 @@ int flash_minsort(
     {        
         // Write last block        
         fseek(outputFile, 0, SEEK_END);
-        *((int32_t *) buffer) = blockIndex;                             /* Block index */
-        *((int16_t *)(buffer + BLOCK_COUNT_OFFSET)) = count;            /* Block record count */
+        *((int32_t *) outputBuffer) = blockIndex;                             /* Block index */
+        *((int16_t *)(outputBuffer + BLOCK_COUNT_OFFSET)) = count;            /* Block record count */
         count=0;
         blockIndex++;
-        if (0 == fwrite(buffer, es->page_size, 1, outputFile))
+        if (0 == fwrite(outputBuffer, es->page_size, 1, outputFile))
+        {
+            close_MinSort(&ms, es);
             return 9;
+        }
+        metric->num_writes += 1;
     }
      
     close_MinSort(&ms, es);  
+    metrics_phase_end(metric, es);
     *resultFilePtr = 0;
     return 0;
 }
@@ -10,6 +10,10 @@
 #include <stdint.h>
 
 #include "external_sort.h"
+#include "region_heap.h"
+#include "sort_codec.h"
+#include "sort_estimate.h"
+#include "file/ion_file_map.h"
 
 // #define BUFFER_OUTPUT_BLOCK_START_OFFSET  		OUTPUT_BLOCK_ID * es->page_size
 // #define BUFFER_OUTPUT_BLOCK_START_RECORD_OFFSET  OUTPUT_BLOCK_ID * es->page_size + BLOCK_HEADER_SIZE
@@ -37,7 +41,7 @@ extern "C" {
 @param      bufferSizeInByes
                 Size of buffer in byes
 @param      es
-                Sorting state info (block size, record size, etc.)
+                Sorting state info (block size, record size, key type and offset, etc.)
 @param      resultFilePtr
                 Offset within output file of first output record
 @param      metric
@@ -74,11 +78,16 @@ typedef struct OpState
 typedef struct MinSortState
 {
     char* buffer;
-    unsigned int* min;
+    char* page;                     // current page. Start of buffer or a page borrowed from the mapped input file.
+    ion_file_map_t map;             // input file mapping (see ion_file_map.h). Not mapped if base is NULL.
+    region_index_t index;           // minimum key of each region (see region_heap.h)
     
-    unsigned int current;           // current smallest value
-    unsigned int next;              // keep track of next smallest value for next iteration
+    uint64_t current;               // current smallest value (normalized key)
+    uint64_t next;                  // keep track of next smallest value for next iteration
+    int8_t   haveNext;              // 1 if next has been found
     unsigned long int nextIdx; 
+    sort_codec_cursor_t cursor;     // decoding position in current page if pages are encoded
+    char* record;                   // last record decoded from current page. NULL if pages are not encoded.
                        
     unsigned int record_size;
     unsigned long int num_records;
@@ -89,7 +98,8 @@ typedef struct MinSortState
     unsigned int numRegions;          
     unsigned int regionIdx;
     unsigned int lastBlockIdx;    
-    unsigned int numDistinct;
+    unsigned int numDistinct;      // estimated number of distinct keys of the input. Set by init_MinSort().
+    sort_estimate_t distinct;       // sketch of the keys read by the scan of init_MinSort()
 
     void    *iteratorState;
 
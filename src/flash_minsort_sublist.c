@@ -45,6 +45,7 @@
 
 #include "flash_minsort_sublist.h"
 #include "in_memory_sort.h"
+#include "sort_metrics.h"
 
 /*
 #define DEBUG 1
@@ -60,47 +61,72 @@ void readPage_sublist(MinSortStateSublist *ms, int pageNum, external_sort_t *es,
     unsigned long int offset = ms->fileOffset;
     offset += pageNum*es->page_size;
 
-    /* Seek to page location in file */
-    fseek(fp, offset, SEEK_SET);
+    /* Borrow page from mapped file instead of copying it */
+    ms->page = ion_file_map_page(&ms->map, (long) offset, es->page_size);
+    if (ms->page == NULL)
+    {
+        /* Seek to page location in file */
+        fseek(fp, offset, SEEK_SET);
 
-    /* Read page into start of buffer */   
-    if (0 ==  fread(ms->buffer, es->page_size, 1, fp))
-    {	printf("Failed to read block: %d Offset: %lu\n", pageNum, offset);        
+        /* Read page into start of buffer */   
+        ms->page = ms->buffer;
+        if (0 ==  fread(ms->buffer, es->page_size, 1, fp))
+        {	printf("Failed to read block: %d Offset: %lu\n", pageNum, offset);        
+        }
     }
     
     metric->num_reads++;    
     ms->blocksRead++;     
     ms->lastBlockIdx = pageNum;   
+    sort_codec_rewind(&ms->cursor);
     #ifdef DEBUG_READ
         printf("Reading block: %d Offset: %lu\n",pageNum, offset);        
         for (int k = 0; k < 31; k++)
         {
-            test_record_t *buf = (void *)(ms->buffer + es->headerSize + k * es->record_size);
+            test_record_t *buf = (void *)(ms->page + es->headerSize + k * es->record_size);
             printf("%d: Record: %d\n", k, buf->key);
         }
     #endif
 }
 
-inline int32_t getBlockId(MinSortStateSublist *ms)
+static inline int32_t getBlockId(MinSortStateSublist *ms)
+{
+    return *((int32_t *) (ms->page));    
+}
+
+static inline int16_t getNumRecordsBlock(MinSortStateSublist *ms)
 {
-    return *((int32_t *) (ms->buffer));    
+    return *((int16_t *) (ms->page + BLOCK_COUNT_OFFSET));    
 }
 
-inline int16_t getNumRecordsBlock(MinSortStateSublist *ms)
+/* Returns a record given its record number in a block (that has been previously buffered). Records of an encoded block
+   are decoded into ms->record (see sort_codec_read_at()). The record decoded last is not decoded again. */
+static inline char* getRecord_sublist(MinSortStateSublist* ms, int recordNum, external_sort_t *es)
 {
-    return *((int16_t *) (ms->buffer + BLOCK_COUNT_OFFSET));    
+    if (ms->record == NULL)
+        return ms->page+es->headerSize+recordNum*es->record_size;
+
+    if (ms->cursor.idx != recordNum + 1)
+        sort_codec_read_at(es, ms->page, &ms->cursor, (int16_t) recordNum, ms->record);
+    return ms->record;
 }
 
-/* Returns a value of a tuple given a record number in a block (that has been previously buffered) */
-inline int32_t getValue_sublist(MinSortStateSublist* ms, int recordNum, external_sort_t *es)
+/* Returns the normalized key of a tuple given a record number in a block (that has been previously buffered) */
+static inline uint64_t getValue_sublist(MinSortStateSublist* ms, int recordNum, external_sort_t *es)
 {      
-    test_record_t *buf = (test_record_t*) (ms->buffer+es->headerSize+recordNum*es->record_size);
-    return buf->key;	    
+    return sort_key_normalize(es, getRecord_sublist(ms, recordNum, es));
+}
+
+/* Offset of a record from the start of its block. Records of encoded blocks are located by record number. */
+static inline unsigned long recordOffset_sublist(MinSortStateSublist* ms, int recordNum, external_sort_t *es)
+{
+    return ms->record == NULL ? (unsigned long) es->headerSize+recordNum*es->record_size : (unsigned long) recordNum;
 }
 
 void init_MinSort_sublist(MinSortStateSublist* ms, external_sort_t *es, metrics_t *metric)
 {
-     unsigned int i = 0, j = 0, val, regionIdx=0;    
+     unsigned int j = 0, regionIdx=0;    
+     uint64_t val;
 
     /* Operator statistics */    
     ms->blocksRead    = 0;
@@ -111,6 +137,11 @@ void init_MinSort_sublist(MinSortStateSublist* ms, external_sort_t *es, metrics_
     ms->record_size       = es->record_size;    
     ms->numBlocks         = es->num_pages;
 
+    /* Pages of the mapped sublist file are read in place. Sublists are read in any order. */
+    ms->page = ms->buffer;
+    ion_file_map_open(&ms->map, ((file_iterator_state_t*) ms->iteratorState)->file);
+    ion_file_map_advise(&ms->map, ION_FILE_MAP_RANDOM);
+
     // Ignoring small variable overhead
     // j = (ms->memoryAvailable - 2 * SORT_KEY_SIZE - INT_SIZE) / SORT_KEY_SIZE;  
     j = (ms->memoryAvailable) / SORT_KEY_SIZE;  
@@ -121,47 +152,71 @@ void init_MinSort_sublist(MinSortStateSublist* ms, external_sort_t *es, metrics_
     // Block 1 as output buffer is not being counted in this case,
     // TODO: Challenge with this as if given only 2 buffers then have no room for minimum index. Creating separate allocated arrays for now.
     // Note: Assuming MinSort does need actually count the output buffer for its use as it can produce records in iterator format and does not need an output buffer for this.
-    ms->min = malloc(ms->numRegions*sizeof(int));
+    ms->index.numRegions = ms->numRegions;
+    ms->index.keyWidth = (uint8_t) es->key_size;
+    ms->index.min = malloc(ms->numRegions*es->key_size);
+    ms->index.exhausted = malloc((ms->numRegions+7)/8);
     ms->offset = malloc(ms->numRegions*sizeof(long));     
+    ms->record = es->codec == SORT_CODEC_NONE ? NULL : malloc(es->record_size);
+    /* Region heap finds the smallest sublist in O(log regions) rather than scanning every minimum. Only used if memory budget allows. */
+    ms->index.heap = NULL;
+    if (ms->numRegions * (MINSORT_SUBLIST_REGION_SIZE(es->key_size) + REGION_HEAP_ENTRY_SIZE) <= ms->memoryAvailable && ms->numRegions <= REGION_HEAP_MAX_REGIONS)
+        ms->index.heap = malloc(ms->numRegions*sizeof(uint16_t));
+    printf("Region heap: %s  Bytes per region: %d (%d with heap)\r\n", ms->index.heap == NULL ? "no" : "yes", 
+                MINSORT_SUBLIST_REGION_SIZE(es->key_size), MINSORT_SUBLIST_REGION_SIZE(es->key_size) + REGION_HEAP_ENTRY_SIZE);
+    if (ms->index.min == NULL || ms->index.exhausted == NULL || ms->offset == NULL || (es->codec != SORT_CODEC_NONE && ms->record == NULL))
+        return;
     printf("Page size: %d, Memory size: %d Record size: %d, Number of records: %lu, Number of blocks: %d, Regions: %d\r\n", 
                    es->page_size, ms->memoryAvailable, ms->record_size, ms->num_records, ms->numBlocks, ms->numRegions);
                     
-    for (i=0; i < ms->numRegions; i++)
-        ms->min[i] = INT_MAX; 
+    region_index_clear(&ms->index);
     regionIdx = ms->numRegions-1;
 
-    /* Scan data to populate the minimum in each region */
-    /* Read from back of output file to get start of each sublist (region) */
-
-    /* Read last block of sublist into buffer */
-    long lastBlock = ms->numBlocks-1;      
-    while (lastBlock >= 0)
-    {
-        readPage_sublist(ms, lastBlock, es, metric);     
-        int numBlocksSublist = *(int32_t*) &ms->buffer[0];       /* Retrieve block id (indexed from 0) to compute count of blocks in sublist */
-        #if DEBUG
-        printf("Read block: %d",lastBlock);
-        printf(" Num: %d\n", numBlocksSublist);
-          
-        for (int k = 0; k < 31; k++)
+    if (ms->runDir != NULL && run_directory_matches(ms->runDir, ms->numRegions, ms->fileOffset))
+    {   /* Sublist lengths and first keys are in the run directory so no I/O is needed */
+        long block = 0;
+        for (regionIdx = 0; regionIdx < ms->numRegions; regionIdx++)
         {
-            test_record_t *buf = (void *)(ms->buffer + es->headerSize + k * es->record_size);
-            printf("%d: Record: %d\n", k, buf->key);
+            region_index_set_min(&ms->index, regionIdx, sort_key_normalize(es, run_directory_key(ms->runDir, regionIdx)));
+            ms->offset[regionIdx] = block*es->page_size+recordOffset_sublist(ms, 0, es);     /* Offset is relative to fileOffset */
+            block += run_directory_blocks(ms->runDir, regionIdx);
         }
-        #endif
-        lastBlock = lastBlock - numBlocksSublist;
-        readPage_sublist(ms, lastBlock, es, metric);                         
+    }
+    else
+    {
+        /* Scan data to populate the minimum in each region */
+        /* Read from back of output file to get start of each sublist (region) */
+
+        /* Read last block of sublist into buffer */
+        long lastBlock = ms->numBlocks-1;      
+        while (lastBlock >= 0)
+        {
+            readPage_sublist(ms, lastBlock, es, metric);     
+            int numBlocksSublist = *(int32_t*) &ms->page[0];       /* Retrieve block id (indexed from 0) to compute count of blocks in sublist */
+            #if DEBUG
+            printf("Read block: %d",lastBlock);
+            printf(" Num: %d\n", numBlocksSublist);
+          
+            for (int k = 0; k < 31; k++)
+            {
+                test_record_t *buf = (void *)(ms->page + es->headerSize + k * es->record_size);
+                printf("%d: Record: %d\n", k, buf->key);
+            }
+            #endif
+            lastBlock = lastBlock - numBlocksSublist;
+            readPage_sublist(ms, lastBlock, es, metric);                         
         
-        val = getValue_sublist(ms, 0, es);    
-        ms->min[regionIdx] = val;
-        ms->offset[regionIdx] = lastBlock*es->page_size+es->headerSize+ms->fileOffset;
-        #if DEBUG
-        printf("New min. Index: %d", regionIdx);
-        printf(" Min: %u", ms->min[regionIdx]);
-        printf(" Offset: %lu\n", ms->offset[regionIdx]);
-        #endif
-        regionIdx--;
-        lastBlock--;
+            val = getValue_sublist(ms, 0, es);    
+            region_index_set_min(&ms->index, regionIdx, val);
+            ms->offset[regionIdx] = lastBlock*es->page_size+recordOffset_sublist(ms, 0, es); /* Offset is relative to fileOffset */
+            #if DEBUG
+            printf("New min. Index: %d", regionIdx);
+            printf(" Min: %llu", (unsigned long long) val);
+            printf(" Offset: %lu\n", ms->offset[regionIdx]);
+            #endif
+            regionIdx--;
+            lastBlock--;
+        }
     }
        
     #ifdef DEBUG   
@@ -169,14 +224,15 @@ void init_MinSort_sublist(MinSortStateSublist* ms, external_sort_t *es, metrics_
         for (i=0; i < ms->numRegions; i++)
         { 
             printf("Reg: %d",i); 
-            printf(" Min: %u", ms->min[i]);
+            printf(" Min: %llu", (unsigned long long) region_index_min(&ms->index, i));
             printf(" Offset: %lu\n", ms->offset[i]);
         }
            
     #endif
       
-    ms->current = INT_MAX;
-    ms->next    = INT_MAX; 
+    region_heap_build(&ms->index, metric);
+      
+    ms->current = 0;
     ms->nextIdx = 0;       
     ms->lastBlockIdx = INT_MAX;
 }
@@ -189,24 +245,15 @@ char* next_MinSort_sublist(MinSortStateSublist* ms, external_sort_t *es, void *t
     // Find the block with the minimum tuple value - otherwise continue on with last block            
     if (ms->nextIdx == 0)
     {    // Find new block as do not know location of next minimum tuple
-        ms->current = INT_MAX;
-        ms->regionIdx = INT_MAX; 
-        ms->next = INT_MAX; 
-        for (i=0; i < ms->numRegions; i++)
-        {
-             metric->num_compar++;
-
-            if (ms->min[i] < ms->current)
-            {   ms->current = ms->min[i];
-                ms->regionIdx = i;
-            }
-        }        
-        if (ms->regionIdx == INT_MAX)
+        int32_t region = region_index_smallest(&ms->index, metric);
+        if (region < 0)
             return NULL;    // Join complete - no more tuples	            		
+        ms->regionIdx = (unsigned int) region;
+        ms->current = region_index_min(&ms->index, ms->regionIdx);
             
         // Determine current block and record index for next smallest value based on file offset
         startIndex = ms->offset[ms->regionIdx]; 
-        i = (startIndex % es->page_size - es->headerSize) / ms->record_size;
+        i = ms->record == NULL ? (startIndex % es->page_size - es->headerSize) / ms->record_size : startIndex % es->page_size;
         curBlk = startIndex / es->page_size;
 
         // Smallest value is at current index
@@ -218,13 +265,14 @@ char* next_MinSort_sublist(MinSortStateSublist* ms, external_sort_t *es, void *t
     else
     {   // Use next record in current block
         i = ms->nextIdx;
+        curBlk = ms->lastBlockIdx;
     }    
 
-    memcpy(tupleBuffer, &(ms->buffer[ms->record_size * i+es->headerSize]), ms->record_size);
+    memcpy(tupleBuffer, getRecord_sublist(ms, i, es), ms->record_size);
     metric->num_memcpys++;                   
 
     #ifdef DEBUG
-        test_record_t *buf = (test_record_t*) (ms->buffer+es->headerSize+i*es->record_size);                    
+        test_record_t *buf = (test_record_t*) (ms->page+es->headerSize+i*es->record_size);                    
         buf = (test_record_t*) tupleBuffer;
         printf("Returning tuple: %d\n", buf->key);                    
     #endif
@@ -238,28 +286,32 @@ char* next_MinSort_sublist(MinSortStateSublist* ms, external_sort_t *es, void *t
         i = 0;
         int32_t currentBlockId = getBlockId(ms);
         curBlk++;
-        readPage_sublist(ms, curBlk, es, metric);   
-        if (currentBlockId >= getBlockId(ms))
+        if (curBlk < ms->numBlocks)
+            readPage_sublist(ms, curBlk, es, metric);   
+        if (curBlk >= ms->numBlocks || currentBlockId >= getBlockId(ms))
         {   // Transitioned to a block in a new sublist
             ms->offset[ms->regionIdx] = -1;
-            ms->min[ms->regionIdx] = INT_MAX;
+            region_index_set_exhausted(&ms->index, ms->regionIdx);
         }
         else
         {
-            ms->offset[ms->regionIdx] = curBlk*es->page_size+es->headerSize;
-            ms->min[ms->regionIdx] = getValue_sublist(ms,0,es);    
+            ms->offset[ms->regionIdx] = curBlk*es->page_size+recordOffset_sublist(ms, 0, es);
+            region_index_set_min(&ms->index, ms->regionIdx, getValue_sublist(ms,0,es));    
         }        
     }
     else
     {
-        ms->offset[ms->regionIdx] += es->record_size;
-        ms->min[ms->regionIdx] = getValue_sublist(ms,i,es); 
-        if (ms->min[ms->regionIdx]  == ms->current)                
+        uint64_t val = getValue_sublist(ms,i,es);
+        ms->offset[ms->regionIdx] = curBlk*es->page_size+recordOffset_sublist(ms, i, es);
+        region_index_set_min(&ms->index, ms->regionIdx, val); 
+        if (val == ms->current)                
             ms->nextIdx = i; 	
     }       
    
+    region_heap_update(&ms->index, metric);
+   
     #ifdef DEBUG	
-        printf("Updated minimum in block to: %d\r\n", ms->min[ms->regionIdx]);
+        printf("Updated minimum in block of region: %d\r\n", ms->regionIdx);
     #endif			
    
     return tupleBuffer;		    
@@ -267,6 +319,9 @@ char* next_MinSort_sublist(MinSortStateSublist* ms, external_sort_t *es, void *t
 
 void close_MinSort_sublist(MinSortStateSublist* ms, external_sort_t *es)
 {
+    ion_file_map_close(&ms->map);
+    free(ms->record);
+    ms->record = NULL;
     /*
     printf("Tuples out:  %lu\r\n", ms->op.tuples_out); 
     printf("Blocks read: %lu\r\n", ms->op.blocks_read);
@@ -308,7 +363,8 @@ int flash_minsort_sublist(
 		long    *resultFilePtr,
 		metrics_t *metric,
         int8_t  (*compareFn)(void *a, void *b),
-        long    numSubList
+        long    numSubList,
+        run_directory_t *runDir
 )
 {
     printf("*Flash Minsort (sorted sublist version)*\n");       
@@ -320,8 +376,18 @@ int flash_minsort_sublist(
     ms.num_records = ((file_iterator_state_t*) iteratorState)->totalRecords;
     ms.numRegions = numSubList;
     ms.fileOffset = *resultFilePtr;
+    ms.runDir = runDir;
 
+    metrics_phase_begin(metric, METRICS_PHASE_MINSORT_SUBLIST_INIT, 0);
     init_MinSort_sublist(&ms, es, metric);
+    metrics_phase_end(metric, es);
+    if (ms.index.min == NULL || ms.index.exhausted == NULL || ms.offset == NULL || (es->codec != SORT_CODEC_NONE && ms.record == NULL))
+    {
+        free(ms.index.min); free(ms.index.exhausted); free(ms.offset); free(ms.index.heap);
+        close_MinSort_sublist(&ms, es);
+        return 8;
+    }
+    metrics_phase_begin(metric, METRICS_PHASE_MINSORT_SUBLIST_OUTPUT, 0);
     int16_t count = 0;  
     int32_t blockIndex = 0;
     int16_t values_per_page = (es->page_size - es->headerSize) / es->record_size;
@@ -345,7 +411,11 @@ int flash_minsort_sublist(
             // fseek(outputFile, 0, SEEK_END);
 
             if (0 == fwrite(outputBuffer, es->page_size, 1, outputFile))
+            {
+                free(ms.index.min); free(ms.index.exhausted); free(ms.offset); free(ms.index.heap);
+                close_MinSort_sublist(&ms, es);
                 return 9;
+            }
             lastWritePos += es->page_size;
              metric->num_writes += 1;
 /*
@@ -370,19 +440,26 @@ printf("Loc2: %lu\n", ftell(outputFile));
         fseek(outputFile, lastWritePos, SEEK_SET);
         metric->num_writes += 1;
         // Write last block        
-        *((int32_t *) buffer) = blockIndex;                             /* Block index */
-        *((int16_t *)(buffer + BLOCK_COUNT_OFFSET)) = count;            /* Block record count */
+        *((int32_t *) outputBuffer) = blockIndex;                             /* Block index */
+        *((int16_t *)(outputBuffer + BLOCK_COUNT_OFFSET)) = count;            /* Block record count */
         count=0;
         blockIndex++;
-        if (0 == fwrite(buffer, es->page_size, 1, outputFile))
+        if (0 == fwrite(outputBuffer, es->page_size, 1, outputFile))
+        {
+            free(ms.index.min); free(ms.index.exhausted); free(ms.offset); free(ms.index.heap);
+            close_MinSort_sublist(&ms, es);
             return 9;
+        }
     }
      
     close_MinSort_sublist(&ms, es);   
+    metrics_phase_end(metric, es);
 
     *resultFilePtr = 0;
-    free(ms.min);
+    free(ms.index.min);
+    free(ms.index.exhausted);
     free(ms.offset);
+    free(ms.index.heap);
 
 //    printf("Complete. Comparisons: %d  MemCopies: %d  TransferIn: %d  TransferOut: %d TransferOther: %d\n", metric->num_compar, metric->num_memcpys, numShiftIntoOutput, numShiftOutOutput, numShiftOtherBlock);
 
@@ -10,10 +10,17 @@
 #include <stdint.h>
 
 #include "external_sort.h"
+#include "run_directory.h"
+#include "region_heap.h"
+#include "sort_codec.h"
+#include "file/ion_file_map.h"
 
 #define SORT_KEY_SIZE       4
 #define INT_SIZE            4
 
+/* Memory per sublist: minimum key and file offset. Region heap adds REGION_HEAP_ENTRY_SIZE if it fits. */
+#define MINSORT_SUBLIST_REGION_SIZE(keySize) ((keySize) + 4)
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -31,7 +38,7 @@ extern "C" {
 @param      bufferSizeInBytes
                 Size of buffer in bytes
 @param      es
-                Sorting state info (block size, record size, etc.)
+                Sorting state info (block size, record size, key type and offset, etc.)
 @param      resultFilePtr
                 Offset within output file of first output record
 @param      metric
@@ -40,6 +47,9 @@ extern "C" {
                 Record comparison function for record ordering
 @param      numSubList
                 Number of sublists
+@param      runDir
+                Directory of sublists (block count and first key). If NULL or it does not match the sublists,
+                the last and first block of each sublist are read instead.
 */
 int flash_minsort_sublist(
         void    *iteratorState,
@@ -51,17 +61,21 @@ int flash_minsort_sublist(
 		long    *resultFilePtr,
 		metrics_t *metric,
         int8_t  (*compareFn)(void *a, void *b),
-        long    numSubList
+        long    numSubList,
+        run_directory_t *runDir
 );
 
 typedef struct MinSortStateSublist
 {
     char* buffer;
-    unsigned int* min;
-    unsigned long* offset;
+    char* page;                     // current page. Start of buffer or a page borrowed from the mapped sublist file.
+    ion_file_map_t map;             // sublist file mapping (see ion_file_map.h). Not mapped if base is NULL.
+    region_index_t index;           // minimum key of each sublist (see region_heap.h)
+    unsigned long* offset;          // next record of each sublist. Block offset plus record index if pages are encoded (see sort_codec.h).
+    sort_codec_cursor_t cursor;     // decoding position in current page if pages are encoded
+    char* record;                   // last record decoded from current page. NULL if pages are not encoded.
 
-    unsigned int current;           // current smallest value
-    unsigned int next;              // keep track of next smallest value for next iteration
+    uint64_t current;               // current smallest value (normalized key)
     unsigned long int nextIdx; 
                        
     unsigned int record_size;
@@ -74,6 +88,7 @@ typedef struct MinSortStateSublist
     unsigned long fileOffset;
     
     void    *iteratorState;    
+    run_directory_t *runDir;
 
     /* Statistics */
     unsigned int blocksRead;
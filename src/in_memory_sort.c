@@ -2,7 +2,7 @@
 /**
 @file
 @author		Kris Wallperington
-@brief		Implementation of an in-place, recursive quicksort written by the author.
+@brief		Implementation of an in-place introsort (quick sort with insertion sort and heap sort fallbacks).
 @copyright	Copyright 2016
 				The University of British Columbia,
 				IonDB Project Contributors (see AUTHORS.md)
@@ -20,12 +20,10 @@
 			License.
 */
 /******************************************************************************/
-//TODO: quick sort throws a seg fault on pc when sorting large arrays (>20000). This may be due to the stack overflowing
-// from the recursive calls to in_memory_quick_sort_helper(...)
-
 #include <string.h>
 
 #include "in_memory_sort.h"
+#include "sort_key.h"
 
 int8_t
 merge_sort_int32_comparator(
@@ -38,7 +36,12 @@ merge_sort_int32_comparator(
     return 0;
 }
 
-void
+/* Partitions smaller than this are insertion sorted */
+#define IN_MEMORY_SORT_INSERTION_CUTOFF	16
+/* Partitions at least this size use the median of three medians (ninther) as pivot */
+#define IN_MEMORY_SORT_NINTHER_CUTOFF	128
+
+static void
 in_memory_swap(
 	void				*tmp_buffer,
 	int					value_size,
@@ -50,7 +53,102 @@ in_memory_swap(
 	memcpy(b, tmp_buffer, value_size);
 }
 
-void*
+/* Sorts values from low to high (inclusive) by insertion. Shifts larger values up in one move per value. */
+static void
+in_memory_insertion_sort(
+	void *tmp_buffer,
+	int value_size,
+	int8_t (*compare_fcn)(void* a, void* b),
+	char* low,
+	char* high
+) {
+	char *cur, *pos;
+
+	for (cur = low + value_size; cur <= high; cur += value_size) {
+		if (compare_fcn(cur - value_size, cur) <= 0) {
+			continue;
+		}
+
+		memcpy(tmp_buffer, cur, value_size);
+		pos = cur - value_size;
+		while (pos > low && compare_fcn(pos - value_size, tmp_buffer) > 0) {
+			pos -= value_size;
+		}
+		memmove(pos + value_size, pos, cur - pos);
+		memcpy(pos, tmp_buffer, value_size);
+	}
+}
+
+static void
+in_memory_heap_sift_down(
+	void *tmp_buffer,
+	int value_size,
+	int8_t (*compare_fcn)(void* a, void* b),
+	char* data,
+	uint32_t idx,
+	uint32_t num_values
+) {
+	uint32_t child;
+
+	while ((child = 2 * idx + 1) < num_values) {
+		if (child + 1 < num_values && compare_fcn(data + child * value_size, data + (child + 1) * value_size) < 0) {
+			child++;
+		}
+		if (compare_fcn(data + idx * value_size, data + child * value_size) >= 0) {
+			return;
+		}
+		in_memory_swap(tmp_buffer, value_size, data + idx * value_size, data + child * value_size);
+		idx = child;
+	}
+}
+
+/* Heap sort used when quick sort recursion is too deep (adversarial input). */
+static void
+in_memory_heap_sort(
+	void *tmp_buffer,
+	int value_size,
+	int8_t (*compare_fcn)(void* a, void* b),
+	char* low,
+	char* high
+) {
+	uint32_t num_values = (uint32_t) ((high - low) / value_size) + 1;
+	uint32_t i;
+
+	for (i = num_values / 2; i > 0; i--) {
+		in_memory_heap_sift_down(tmp_buffer, value_size, compare_fcn, low, i - 1, num_values);
+	}
+
+	for (i = num_values - 1; i > 0; i--) {
+		in_memory_swap(tmp_buffer, value_size, low, low + i * value_size);
+		in_memory_heap_sift_down(tmp_buffer, value_size, compare_fcn, low, 0, i);
+	}
+}
+
+/* Returns the median of three values */
+static char*
+in_memory_median3(
+	int8_t (*compare_fcn)(void* a, void* b),
+	char* a,
+	char* b,
+	char* c
+) {
+	if (compare_fcn(a, b) < 0) {
+		if (compare_fcn(b, c) < 0) {
+			return b;
+		}
+		return compare_fcn(a, c) < 0 ? c : a;
+	}
+	if (compare_fcn(a, c) < 0) {
+		return a;
+	}
+	return compare_fcn(b, c) < 0 ? c : b;
+}
+
+/**
+ * Partitions values from low to high (inclusive) around the value at low. Values equal to the pivot stop both scans
+ * so runs of duplicate keys split evenly. Returns the final location of the pivot.
+ */
+static char*
 in_memory_quick_sort_partition(
 	void *tmp_buffer,
 	int value_size,
@@ -58,61 +156,104 @@ in_memory_quick_sort_partition(
 	char* low,
 	char* high
 ) {
-	char* pivot	= low;
-	char* lower_bound	= low - value_size;
+	char* lower_bound	= low;
 	char* upper_bound	= high + value_size;
 
 	while (1) {
 		do {
-			upper_bound -= value_size;
-		} while (compare_fcn(upper_bound, pivot) > 0);
+			lower_bound += value_size;
+		} while (lower_bound < high && compare_fcn(lower_bound, low) < 0);
 
 		do {
-			lower_bound += value_size;
-		} while (compare_fcn(lower_bound, pivot) < 0);
+			upper_bound -= value_size;
+		} while (compare_fcn(upper_bound, low) > 0);
 
-		if (lower_bound < upper_bound) {
-			in_memory_swap(tmp_buffer, value_size, lower_bound, upper_bound);
-		}
-		else {
-			return upper_bound;
+		if (lower_bound >= upper_bound) {
+			break;
 		}
+		in_memory_swap(tmp_buffer, value_size, lower_bound, upper_bound);
 	}
+
+	in_memory_swap(tmp_buffer, value_size, low, upper_bound);
+	return upper_bound;
 }
 
-void
-in_memory_quick_sort_helper(
+/**
+ * Introsort: quick sort with median of three (ninther for large partitions) pivots, insertion sort for small partitions
+ * and heap sort once depth_limit partitions deep. Recurses on the smaller partition only so stack depth is O(log n).
+ */
+static void
+in_memory_intro_sort_helper(
 	void *tmp_buffer,
-	uint32_t num_values,
 	int value_size,
 	int8_t (*compare_fcn)(void* a, void* b),
 	char* low,
-	char* high
+	char* high,
+	int depth_limit
 ) {
-	if (low < high) {
-		char* pivot = in_memory_quick_sort_partition(tmp_buffer, value_size, compare_fcn, low, high);
+	uint32_t	num_values;
+	char		*pivot, *mid;
+
+	while (high > low) {
+		num_values = (uint32_t) ((high - low) / value_size) + 1;
+
+		if (num_values < IN_MEMORY_SORT_INSERTION_CUTOFF) {
+			in_memory_insertion_sort(tmp_buffer, value_size, compare_fcn, low, high);
+			return;
+		}
+		if (depth_limit-- == 0) {
+			in_memory_heap_sort(tmp_buffer, value_size, compare_fcn, low, high);
+			return;
+		}
+
+		mid = low + (num_values / 2) * value_size;
+		if (num_values >= IN_MEMORY_SORT_NINTHER_CUTOFF) {
+			uint32_t step = (num_values / 8) * value_size;
+			pivot = in_memory_median3(compare_fcn,
+						in_memory_median3(compare_fcn, low, low + step, low + 2 * step),
+						in_memory_median3(compare_fcn, mid - step, mid, mid + step),
+						in_memory_median3(compare_fcn, high - 2 * step, high - step, high));
+		}
+		else {
+			pivot = in_memory_median3(compare_fcn, low, mid, high);
+		}
+		if (pivot != low) {
+			in_memory_swap(tmp_buffer, value_size, low, pivot);
+		}
 
-		in_memory_quick_sort_helper(tmp_buffer, num_values, value_size, compare_fcn, low, pivot);
-		in_memory_quick_sort_helper(tmp_buffer, num_values, value_size, compare_fcn, pivot + value_size, high);
+		pivot = in_memory_quick_sort_partition(tmp_buffer, value_size, compare_fcn, low, high);
+
+		if (pivot - low < high - pivot) {
+			in_memory_intro_sort_helper(tmp_buffer, value_size, compare_fcn, low, pivot - value_size, depth_limit);
+			low = pivot + value_size;
+		}
+		else {
+			in_memory_intro_sort_helper(tmp_buffer, value_size, compare_fcn, pivot + value_size, high, depth_limit);
+			high = pivot - value_size;
+		}
 	}
 }
 
-int
-in_memory_quick_sort(
+static int
+in_memory_intro_sort(
 	void *data,
 	uint32_t num_values,
 	int value_size,
-	int8_t (*compare_fcn)(void* a, void* b)
+	int8_t (*compare_fcn)(void* a, void* b),
+	void *tmp_buffer
 ) {
-	void* tmp_buffer = malloc(value_size);
-	if(NULL == tmp_buffer) return 8;
+	int			depth_limit = 0;
+	uint32_t	n;
 
-	/*void* low = data*/
-	char* high = (char*)data + (num_values-1)*value_size;
-	in_memory_quick_sort_helper(tmp_buffer, num_values, value_size, compare_fcn, (char*)data, high);
+	if (num_values < 2) {
+		return 0;
+	}
 
-	free(tmp_buffer);
+	for (n = num_values; n > 1; n >>= 1) {
+		depth_limit += 2;
+	}
 
+	in_memory_intro_sort_helper(tmp_buffer, value_size, compare_fcn, (char*) data, (char*) data + (num_values - 1) * value_size, depth_limit);
 	return 0;
 }
 
@@ -122,15 +263,108 @@ in_memory_sort(
 	uint32_t num_values,
 	int value_size,
 	int8_t (*compare_fcn)(void* a, void* b),
-	int sort_algorithm
+	int sort_algorithm,
+	void *tmp_buffer
 ) {
 	int err = 0;
 	switch (sort_algorithm) {
-		case 1: {
-			err = in_memory_quick_sort(data, num_values, value_size, compare_fcn);
+		case IN_MEMORY_SORT_INTRO: {
+			err = in_memory_intro_sort(data, num_values, value_size, compare_fcn, tmp_buffer);
 			break;
 		}
 	}
 
 	return err;
 }
+
+/* Returns byte of a key in the normalized (unsigned, order preserving) key. Same conversion as sort_key_normalize()
+   but only reads the one byte so it is cheap enough to call for every record in every pass. */
+static inline uint8_t
+in_memory_radix_digit(
+	char *key,
+	uint16_t byte_index,
+	uint16_t sign_index,
+	uint8_t flip,
+	int8_t is_float
+) {
+	if (is_float && (key[sign_index] & 0x80)) {
+		return (uint8_t) ~key[byte_index];
+	}
+	return (uint8_t) key[byte_index] ^ flip;
+}
+
+int
+in_memory_radix_sort(
+	void *data,
+	uint32_t num_values,
+	external_sort_t *es,
+	void *tmp_buffer
+) {
+	int			value_size	= es->record_size;
+	uint32_t	*count		= (uint32_t*) tmp_buffer;
+	char		*src		= (char*) data;
+	char		*dst		= (char*) tmp_buffer + 256 * sizeof(uint32_t);
+	char		*swap;
+	uint64_t	key, key_and, key_or, varying;
+	uint32_t	i, total, digit_count;
+	uint16_t	byte_index, sign_index;
+	uint16_t	one			= 1;
+	int8_t		little		= *((char*) &one);
+	int8_t		is_float	= es->key_type == SORT_KEY_TYPE_FLOAT;
+	uint8_t		flip, digit, byte_num;
+
+	if (num_values < 2) {
+		return 0;
+	}
+
+	/* Find key bytes that differ between records. Only those need a pass. */
+	key_and = key_or = sort_key_normalize(es, src);
+	for (i = 1; i < num_values; i++) {
+		key		 = sort_key_normalize(es, src + i * value_size);
+		key_and &= key;
+		key_or	|= key;
+	}
+	varying = key_and ^ key_or;
+
+	sign_index = es->key_offset + (little ? es->key_size - 1 : 0);
+
+	/* Least significant byte first */
+	for (byte_num = 0; byte_num < es->key_size; byte_num++) {
+		if (((varying >> (byte_num * 8)) & 0xFF) == 0) {
+			continue;
+		}
+
+		byte_index	= es->key_offset + (little ? byte_num : es->key_size - 1 - byte_num);
+		flip		= (byte_num == es->key_size - 1 && es->key_type != SORT_KEY_TYPE_UINT) ? 0x80 : 0;
+
+		memset(count, 0, 256 * sizeof(uint32_t));
+		for (i = 0; i < num_values; i++) {
+			count[in_memory_radix_digit(src + i * value_size, byte_index, sign_index, flip, is_float)]++;
+		}
+
+		/* Convert counts to starting positions */
+		total = 0;
+		for (i = 0; i < 256; i++) {
+			digit_count	= count[i];
+			count[i]	= total;
+			total	   += digit_count;
+		}
+
+		for (i = 0; i < num_values; i++) {
+			digit = in_memory_radix_digit(src + i * value_size, byte_index, sign_index, flip, is_float);
+			memcpy(dst + count[digit] * value_size, src + i * value_size, value_size);
+			count[digit]++;
+		}
+
+		swap	= src;
+		src		= dst;
+		dst		= swap;
+	}
+
+	/* Odd number of passes leaves sorted records in scratch space */
+	if (src != (char*) data) {
+		memcpy(data, src, (size_t) num_values * value_size);
+	}
+
+	return 0;
+}
@@ -9,13 +9,45 @@ extern "C" {
 #include <stdint.h>
 // #include <alloca.h>
 
+#include "external_sort.h"
+
+/* Sort algorithms for in_memory_sort() */
+#define IN_MEMORY_SORT_INTRO	1	/* Introsort (quick sort with heap sort fallback). O(n log n) worst case and O(log n) stack. */
+
+/**
+ * Sorts num_values records of value_size bytes in place.
+ * tmp_buffer is caller provided scratch space of value_size bytes. No memory is allocated.
+ * Returns 0 if success.
+ */
 int
 in_memory_sort(
 	void *data,
 	uint32_t num_values,
 	int value_size,
 	int8_t (*compare_fcn)(void* a, void* b),
-	int sort_algorithm
+	int sort_algorithm,
+	void *tmp_buffer
+);
+
+/* Radix sort is used for blocks of at least this many records. Smaller blocks are faster with introsort. */
+#define IN_MEMORY_RADIX_MIN_VALUES	128
+
+/* Bytes of scratch space needed by in_memory_radix_sort() */
+#define IN_MEMORY_RADIX_SCRATCH_SIZE(num_values, value_size)	((size_t) (num_values) * (value_size) + 256 * sizeof(uint32_t))
+
+/**
+ * Sorts num_values records of es->record_size bytes in place with a least significant digit radix sort on the key
+ * described by es (key_type, key_size and key_offset). Key must be supported by sort_key_supported(). Stable.
+ * Key bytes that are the same in all records are skipped.
+ * tmp_buffer is caller provided scratch space of IN_MEMORY_RADIX_SCRATCH_SIZE(num_values, es->record_size) bytes.
+ * Returns 0 if success.
+ */
+int
+in_memory_radix_sort(
+	void *data,
+	uint32_t num_values,
+	external_sort_t *es,
+	void *tmp_buffer
 );
 
 /**
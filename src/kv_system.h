@@ -51,8 +51,8 @@ extern "C" {
 #include <alloca.h>
 #endif
 
-/* Only on PC */
-#if !defined(ARDUINO)
+/* Only on PC (simulated flash device defines its own in kv_stdio_intercept.h) */
+#if !defined(ARDUINO) && !defined(SIM_FLASH)
 #define fremove(x)	remove(x)
 #define frewind(x)	rewind(x)
 #define fdeleteall()
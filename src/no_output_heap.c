@@ -181,3 +181,149 @@ void shiftUp_rev(char* buffer,
 }
 
 
+/*
+ * Version of heapify_rev with the key prefix of each heap entry cached in prefix (entry i at prefix[i], root at prefix[0]).
+ * Records are compared with compare_fcn only if their prefixes are equal (see sort_key_prefix()).
+ */
+void heapify_rev_prefix(   char* buffer,
+                uint32_t* prefix,
+                void* input_tuple,
+                uint32_t input_prefix,
+                int32_t size,
+                external_sort_t* es,
+                metrics_t *metric
+) {
+    int32_t left, right, smallest;
+    int32_t i = 0;
+    while (1) {
+        left = 2 * i + 1;
+        right = left + 1;
+
+        if (left >= size)
+            break;
+
+        //find if left or right is smallest
+        metric->num_compar++;
+        if (right < size && (prefix[right] != prefix[left] ? prefix[right] < prefix[left]
+                                : es->compare_fcn(buffer - right*es->record_size, buffer - left*es->record_size) < 0))
+            smallest = right;
+        else
+            smallest = left;
+
+        //is input tuple the smallest
+        metric->num_compar++;
+        if (input_prefix != prefix[smallest] ? input_prefix < prefix[smallest]
+                                : es->compare_fcn(input_tuple, buffer - smallest*es->record_size) < 0)
+            break;
+
+        //Perform shift
+        metric->num_memcpys ++;
+        memcpy(buffer - i*es->record_size, buffer - smallest*es->record_size, (size_t)es->record_size);
+        prefix[i] = prefix[smallest];
+        i = smallest;
+    }
+    //insert the tuple
+    metric->num_memcpys ++;
+    memcpy(buffer - i*es->record_size, input_tuple, (size_t)es->record_size);
+    prefix[i] = input_prefix;
+}
+
+/*
+ * Version of shiftUp_rev with cached key prefixes (see heapify_rev_prefix()).
+ */
+void shiftUp_rev_prefix(char* buffer,
+             uint32_t* prefix,
+             void* input_tuple,
+             uint32_t input_prefix,
+             int32_t idx,
+             external_sort_t* es,
+             metrics_t *metric
+) {
+    int32_t parent;
+
+    while (idx > 0) {
+        parent = (idx - 1) / 2;
+
+        metric->num_compar++;
+        if (input_prefix != prefix[parent] ? input_prefix > prefix[parent]
+                                : es->compare_fcn(input_tuple, buffer - parent*es->record_size) >= 0) {
+            break;
+        }
+        metric->num_memcpys++;
+        memcpy(buffer - idx*es->record_size, buffer - parent*es->record_size, (size_t)es->record_size);
+        prefix[idx] = prefix[parent];
+        idx = parent;
+    }
+    metric->num_memcpys++;
+    memcpy(buffer - idx*es->record_size, input_tuple, (size_t)es->record_size);
+    prefix[idx] = input_prefix;
+}
+
+
+/*
+ * Max-heap version of heapify. Root is the largest record. Used to keep the smallest records seen so far (top-k) where the root is the record replaced next.
+ */
+void heapify_max(   char* buffer,
+                void* input_tuple,
+                int32_t size,
+                external_sort_t* es,
+                metrics_t *metric
+) {
+    int32_t left, right, largest;
+    int32_t i = 0;
+
+    while (1) {
+        left = 2 * i + 1;
+        right = left + 1;
+
+        if (left >= size)
+            break;
+
+        //find if left or right is largest
+        metric->num_compar++;
+        if (right < size && es->compare_fcn(buffer + right*es->record_size, buffer + left*es->record_size) > 0)
+            largest = right;
+        else
+            largest = left;
+
+        //is input tuple the largest
+        metric->num_compar++;
+        if (es->compare_fcn(input_tuple, buffer + largest*es->record_size) > 0)
+            break;
+
+        //Perform shift
+        metric->num_memcpys ++;
+        memcpy(buffer + i*es->record_size, buffer + largest*es->record_size, (size_t)es->record_size);
+        i = largest;
+    }
+
+    //insert the tuple
+    metric->num_memcpys ++;
+    memcpy(buffer + i*es->record_size, input_tuple, (size_t)es->record_size);
+}
+
+/*
+ * Max-heap version of shiftUp.
+ */
+void shiftUp_max(char* buffer,
+             void* input_tuple,
+             int32_t idx,
+             external_sort_t* es,
+             metrics_t *metric
+) {
+    int32_t parent;
+
+    while (idx > 0) {
+        parent = (idx - 1) / 2;
+
+        metric->num_compar++;
+        if (es->compare_fcn(input_tuple, buffer + parent*es->record_size) <= 0) {
+            break;
+        }
+        metric->num_memcpys++;
+        memcpy(buffer + idx*es->record_size, buffer + parent*es->record_size, (size_t)es->record_size);
+        idx = parent;
+    }
+    metric->num_memcpys++;
+    memcpy(buffer + idx*es->record_size, input_tuple, (size_t)es->record_size);
+}
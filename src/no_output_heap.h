@@ -42,6 +42,38 @@ void shiftUp_rev(char* buffer,
              metrics_t *metric
 );
 
+void heapify_rev_prefix(   char* buffer,
+                uint32_t* prefix,
+                void* input_tuple,
+                uint32_t input_prefix,
+                int32_t size,
+                external_sort_t* es,
+                metrics_t *metric
+);
+
+void shiftUp_rev_prefix(char* buffer,
+             uint32_t* prefix,
+             void* input_tuple,
+             uint32_t input_prefix,
+             int32_t idx,
+             external_sort_t* es,
+             metrics_t *metric
+);
+
+void heapify_max(   char* buffer,
+                void* input_tuple,
+                int32_t size,
+                external_sort_t* es,
+                metrics_t *metric
+);
+
+void shiftUp_max(char* buffer,
+             void* input_tuple,
+             int32_t idx,
+             external_sort_t* es,
+             metrics_t *metric
+);
+
 #if defined(__cplusplus)
 }
 #endif
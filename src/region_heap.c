@@ -0,0 +1,122 @@
+/******************************************************************************/
+/**
+@file		region_heap.c
+@author		Ramon Lawrence
+@brief		Minimum key index of MinSort regions with an optional heap ordered by region minimum.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <string.h>
+
+#include "region_heap.h"
+
+/* Returns 1 if region a is before region b. Exhausted regions are after all others. */
+static inline int8_t regionBefore(region_index_t *index, uint16_t a, uint16_t b, metrics_t *metric)
+{
+    int8_t doneA = region_index_is_exhausted(index, a), doneB = region_index_is_exhausted(index, b);
+    uint64_t minA, minB;
+
+    if (doneA || doneB)
+        return !doneA || (doneB && a < b);
+
+    metric->num_compar++;
+    minA = region_index_min(index, a);
+    minB = region_index_min(index, b);
+    return minA < minB || (minA == minB && a < b);
+}
+
+static void siftDown(region_index_t *index, uint16_t idx, metrics_t *metric)
+{
+    uint16_t *heap = index->heap;
+    uint16_t region = heap[idx];
+    uint32_t child;
+
+    while ((child = 2 * (uint32_t) idx + 1) < index->numRegions)
+    {
+        if (child + 1 < index->numRegions && regionBefore(index, heap[child+1], heap[child], metric))
+            child++;
+        if (!regionBefore(index, heap[child], region, metric))
+            break;
+        heap[idx] = heap[child];
+        idx = (uint16_t) child;
+    }
+    heap[idx] = region;
+}
+
+void region_index_clear(region_index_t *index)
+{
+    memset(index->exhausted, 0xFF, (index->numRegions + 7) / 8);
+}
+
+int32_t region_index_smallest(region_index_t *index, metrics_t *metric)
+{
+    uint32_t i;
+    int32_t  smallest = -1;
+    uint64_t key, smallestKey = 0;
+
+    if (index->heap != NULL)
+        return region_index_is_exhausted(index, index->heap[0]) ? -1 : index->heap[0];
+
+    for (i = 0; i < index->numRegions; i++)
+    {
+        if (region_index_is_exhausted(index, i))
+            continue;
+
+        metric->num_compar++;
+        key = region_index_min(index, i);
+        if (smallest == -1 || key < smallestKey)
+        {
+            smallest = (int32_t) i;
+            smallestKey = key;
+        }
+    }
+    return smallest;
+}
+
+void region_heap_build(region_index_t *index, metrics_t *metric)
+{
+    uint32_t i;
+
+    if (index->heap == NULL)
+        return;
+
+    for (i = 0; i < index->numRegions; i++)
+        index->heap[i] = (uint16_t) i;
+
+    for (i = index->numRegions / 2; i > 0; i--)
+        siftDown(index, (uint16_t) (i-1), metric);
+}
+
+void region_heap_update(region_index_t *index, metrics_t *metric)
+{
+    if (index->heap != NULL && index->numRegions > 1)
+        siftDown(index, 0, metric);
+}
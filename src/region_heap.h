@@ -0,0 +1,88 @@
+#if !defined(REGION_HEAP_H)
+#define REGION_HEAP_H
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#endif
+
+#include <stdint.h>
+
+#include "external_sort.h"
+#include "sort_key.h"
+
+/* Bytes of index per region in addition to the region minimum */
+#define REGION_HEAP_ENTRY_SIZE      2
+#define REGION_HEAP_MAX_REGIONS     UINT16_MAX
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief      Minimum key of each MinSort region. Keys are normalized (see sort_key.h) and stored in
+            keyWidth bytes. A region with no records left is flagged as exhausted rather than
+            holding a sentinel key, so every key value can be sorted.
+*/
+typedef struct {
+    char        *min;               /* numRegions keys of keyWidth bytes */
+    uint8_t     *exhausted;         /* Bit per region */
+    uint16_t    *heap;              /* Region indexes ordered by minimum. NULL if regions are scanned. */
+    uint32_t    numRegions;
+    uint8_t     keyWidth;
+} region_index_t;
+
+/* Bytes of memory for minimum keys and exhausted flags of numRegions regions */
+#define REGION_INDEX_SIZE(numRegions, keyWidth)     ((uint32_t) (numRegions) * (keyWidth) + ((numRegions) + 7) / 8)
+
+static inline uint64_t region_index_min(region_index_t *index, uint32_t region)
+{
+    return sort_key_get(index->min, region, index->keyWidth);
+}
+
+static inline int8_t region_index_is_exhausted(region_index_t *index, uint32_t region)
+{
+    return (index->exhausted[region >> 3] >> (region & 7)) & 1;
+}
+
+/**
+@brief      Sets minimum key of a region and clears its exhausted flag.
+*/
+static inline void region_index_set_min(region_index_t *index, uint32_t region, uint64_t key)
+{
+    sort_key_set(index->min, region, index->keyWidth, key);
+    index->exhausted[region >> 3] &= (uint8_t) ~(1 << (region & 7));
+}
+
+static inline void region_index_set_exhausted(region_index_t *index, uint32_t region)
+{
+    index->exhausted[region >> 3] |= (uint8_t) (1 << (region & 7));
+}
+
+/**
+@brief      Marks all regions exhausted. Regions become active when their minimum is set.
+*/
+void region_index_clear(region_index_t *index);
+
+/**
+@brief      Returns region with the smallest minimum (lowest region index if tied) or -1 if all
+            regions are exhausted. Uses the region heap if there is one, otherwise scans all regions.
+*/
+int32_t region_index_smallest(region_index_t *index, metrics_t *metric);
+
+/**
+@brief      Builds the region heap so the region with the smallest minimum is heap[0].
+            Finding the next region is then O(1) and updating it O(log regions).
+*/
+void region_heap_build(region_index_t *index, metrics_t *metric);
+
+/**
+@brief      Restores heap order after the minimum of the region at heap[0] has increased or the
+            region has been exhausted. Does nothing if there is no heap.
+*/
+void region_heap_update(region_index_t *index, metrics_t *metric);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,114 @@
+/******************************************************************************/
+/**
+@file		run_directory.c
+@author		Ramon Lawrence
+@brief		Directory of sorted runs (block count and first key) kept in memory
+            so merge passes and MinSort can locate sublists without reading block headers.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "run_directory.h"
+
+void run_directory_init(run_directory_t *dir, int32_t maxRuns, external_sort_t *es)
+{
+    dir->countOffset = (int16_t) ((es->key_offset + es->key_size + 3) & ~3);
+    dir->entrySize = (int16_t) ((dir->countOffset + 2*sizeof(int32_t) + 7) & ~7);
+    dir->entries   = NULL;
+    if (maxRuns > 0 && maxRuns <= RUN_DIRECTORY_MAX_RUNS)
+        dir->entries = (char*) malloc((size_t) maxRuns * dir->entrySize);
+    dir->maxRuns = dir->entries == NULL ? 0 : maxRuns;
+    run_directory_reset(dir, 0);
+}
+
+void run_directory_reset(run_directory_t *dir, long start)
+{
+    dir->start   = start;
+    dir->numRuns = 0;
+    dir->valid   = dir->entries != NULL;
+}
+
+void run_directory_add_block(run_directory_t *dir, int32_t blockId, int16_t numRecords, void *firstRecord, external_sort_t *es)
+{
+    int32_t *counts;
+
+    if (!dir->valid)
+        return;
+
+    if (blockId == 0)
+    {   /* Start of a new run */
+        run_directory_add_run(dir, 0, 0, firstRecord, es);
+        if (!dir->valid)
+            return;
+    }
+    else if (dir->numRuns == 0)
+    {   /* Run started before directory was reset */
+        dir->valid = 0;
+        return;
+    }
+    counts = (int32_t *) (dir->entries + (dir->numRuns-1) * dir->entrySize + dir->countOffset);
+    counts[0]++;
+    counts[1] += numRecords;
+}
+
+void run_directory_add_run(run_directory_t *dir, int32_t numBlocks, int32_t numRecords, void *firstRecord, external_sort_t *es)
+{
+    int32_t *counts;
+
+    if (!dir->valid)
+        return;
+
+    if (dir->numRuns >= dir->maxRuns)
+    {
+        dir->valid = 0;
+        return;
+    }
+    counts = (int32_t *) (dir->entries + dir->numRuns * dir->entrySize + dir->countOffset);
+    counts[0] = numBlocks;
+    counts[1] = numRecords;
+    memcpy(run_directory_key(dir, dir->numRuns), firstRecord, es->key_offset + es->key_size);
+    dir->numRuns++;
+}
+
+int8_t run_directory_matches(run_directory_t *dir, int32_t numRuns, long start)
+{
+    return dir->valid && dir->numRuns == numRuns && dir->start == start;
+}
+
+void run_directory_free(run_directory_t *dir)
+{
+    free(dir->entries);
+    dir->entries = NULL;
+    dir->maxRuns = 0;
+    dir->valid   = 0;
+}
@@ -0,0 +1,106 @@
+#if !defined(RUN_DIRECTORY_H)
+#define RUN_DIRECTORY_H
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+#include <stdint.h>
+
+#include "external_sort.h"
+
+/* Largest number of runs tracked. Sorts with more runs read block headers instead. */
+#if defined(ARDUINO)
+#define RUN_DIRECTORY_MAX_RUNS      64
+#else
+#define RUN_DIRECTORY_MAX_RUNS      32767
+#endif
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief      Compact in-memory directory of the sorted runs (sublists) written by run generation
+            or a merge pass. Runs are stored back to back starting at start, so only the number
+            of blocks and the first key of each run are kept. Each entry is the first key_offset+key_size
+            bytes of the first record of the run followed by an int32_t block count at countOffset
+            and an int32_t record count. Entries are padded to 8 bytes so keys and counts are aligned.
+*/
+typedef struct {
+    char        *entries;
+    long        start;          /* File offset of first block of first run */
+    int32_t     numRuns;
+    int32_t     maxRuns;
+    int16_t     entrySize;
+    int16_t     countOffset;
+    int8_t      valid;          /* 0 if not allocated or more than maxRuns runs were written */
+} run_directory_t;
+
+/**
+@brief      Allocates space for maxRuns runs. If maxRuns is larger than RUN_DIRECTORY_MAX_RUNS or
+            memory is not available the directory is left invalid and callers read block headers instead.
+*/
+void run_directory_init(run_directory_t *dir, int32_t maxRuns, external_sort_t *es);
+
+/**
+@brief      Empties directory for runs written starting at file offset start.
+*/
+void run_directory_reset(run_directory_t *dir, long start);
+
+/**
+@brief      Records a block written to the file. Block id 0 starts a new run.
+@param      blockId
+                Index of block in its run (block header id)
+@param      numRecords
+                Number of records in the block
+@param      firstRecord
+                First record of the block. Key is copied when it starts a run.
+*/
+void run_directory_add_block(run_directory_t *dir, int32_t blockId, int16_t numRecords, void *firstRecord, external_sort_t *es);
+
+/**
+@brief      Records a whole run written after the previous run.
+@param      firstRecord
+                First record (or key prefix of key_offset+key_size bytes) of the run
+*/
+void run_directory_add_run(run_directory_t *dir, int32_t numBlocks, int32_t numRecords, void *firstRecord, external_sort_t *es);
+
+/**
+@brief      Returns 1 if directory holds exactly numRuns runs written starting at file offset start.
+*/
+int8_t run_directory_matches(run_directory_t *dir, int32_t numRuns, long start);
+
+/**
+@brief      Returns number of blocks in a run.
+*/
+static inline int32_t run_directory_blocks(run_directory_t *dir, int32_t run)
+{
+    return *((int32_t *) (dir->entries + run * dir->entrySize + dir->countOffset));
+}
+
+/**
+@brief      Returns number of records in a run.
+*/
+static inline int32_t run_directory_records(run_directory_t *dir, int32_t run)
+{
+    return *((int32_t *) (dir->entries + run * dir->entrySize + dir->countOffset + sizeof(int32_t)));
+}
+
+/**
+@brief      Returns first key of a run as the start of a record. Only bytes up to the end of the key are valid.
+*/
+static inline char* run_directory_key(run_directory_t *dir, int32_t run)
+{
+    return dir->entries + run * dir->entrySize;
+}
+
+void run_directory_free(run_directory_t *dir);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,318 @@
+/******************************************************************************/
+/**
+@file		run_pipeline.c
+@author		Ramon Lawrence
+@brief		Pipelined run generation. Reader and writer threads overlap input reads and run writes.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "run_pipeline.h"
+#include "in_memory_sort.h"
+
+#if defined(RUN_PIPELINE_SUPPORTED)
+#include <unistd.h>
+
+/* Queue depth set by run_pipeline_set_depth(). -1 if not set. */
+static int16_t pipelineDepth = -1;
+#endif
+
+void run_pipeline_set_depth(int16_t depth)
+{
+#if defined(RUN_PIPELINE_SUPPORTED)
+    pipelineDepth = depth < 0 ? 0 : depth;
+#else
+    (void) depth;
+#endif
+}
+
+int16_t run_pipeline_get_depth(void)
+{
+#if defined(RUN_PIPELINE_SUPPORTED)
+    if (pipelineDepth >= 0)
+        return pipelineDepth;
+    /* On one processor the stages cannot overlap and hand-offs only add context switches */
+    return sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RUN_PIPELINE_DEFAULT_DEPTH : 0;
+#else
+    return 0;
+#endif
+}
+
+#if defined(RUN_PIPELINE_SUPPORTED)
+
+/**
+@brief      Reader stage. Fills free input pages from the iterator and sorts them until input is exhausted.
+*/
+static void* run_pipeline_reader(void *arg)
+{
+    run_pipeline_t  *pipe = (run_pipeline_t*) arg;
+    external_sort_t *es = pipe->es;
+    int16_t         tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+    int16_t         count;
+    char            *page, *addr;
+
+    while (1)
+    {
+        pthread_mutex_lock(&pipe->lock);
+        while (pipe->readCount == pipe->depth && !pipe->stop)
+            pthread_cond_wait(&pipe->changed, &pipe->lock);
+        if (pipe->stop)
+        {
+            pthread_mutex_unlock(&pipe->lock);
+            break;
+        }
+        page = pipe->readPages + ((pipe->readHead + pipe->readCount) % pipe->depth) * es->page_size;
+        pthread_mutex_unlock(&pipe->lock);
+
+        /* Page is not visible to the sort thread until queued so is filled without the lock */
+        addr = page + es->headerSize;
+        for (count = 0; count < tuplesPerPage; count++)
+        {
+            if (pipe->iterator(pipe->iteratorState, addr, es) == 0)
+                break;
+            addr += es->record_size;
+        }
+        if (count > 1)
+        {
+            if (pipe->useRadix)
+                in_memory_radix_sort(page + es->headerSize, (uint32_t) count, es, pipe->sortScratch);
+            else
+                in_memory_sort(page + es->headerSize, (uint32_t) count, es->record_size, es->compare_fcn, IN_MEMORY_SORT_INTRO, pipe->sortScratch);
+        }
+        *((int16_t *) (page + BLOCK_COUNT_OFFSET)) = count;
+
+        pthread_mutex_lock(&pipe->lock);
+        pipe->readCount++;
+        if (count < tuplesPerPage)
+            pipe->readDone = 1;
+        pthread_cond_broadcast(&pipe->changed);
+        pthread_mutex_unlock(&pipe->lock);
+
+        if (count < tuplesPerPage)
+            break;
+    }
+    return NULL;
+}
+
+/**
+@brief      Writer stage. Writes queued output pages until stopped and the queue is empty.
+*/
+static void* run_pipeline_writer(void *arg)
+{
+    run_pipeline_t  *pipe = (run_pipeline_t*) arg;
+    uint16_t        pageSize = pipe->es->page_size;
+    char            *page;
+    int8_t          failed = 0;
+
+    while (1)
+    {
+        pthread_mutex_lock(&pipe->lock);
+        while (pipe->writeCount == 0 && !pipe->stop)
+            pthread_cond_wait(&pipe->changed, &pipe->lock);
+        if (pipe->writeCount == 0)
+        {
+            pthread_mutex_unlock(&pipe->lock);
+            break;
+        }
+        page = pipe->writePages + pipe->writeHead * pageSize;
+        pthread_mutex_unlock(&pipe->lock);
+
+        /* After a failed write remaining pages are discarded */
+        if (!failed && 0 == fwrite(page, pageSize, 1, pipe->outputFile))
+            failed = 1;
+
+        pthread_mutex_lock(&pipe->lock);
+        pipe->writeHead = (pipe->writeHead + 1) % pipe->depth;
+        pipe->writeCount--;
+        pipe->writeError = failed;
+        pthread_cond_broadcast(&pipe->changed);
+        pthread_mutex_unlock(&pipe->lock);
+    }
+    return NULL;
+}
+
+int8_t run_pipeline_start(run_pipeline_t *pipe, int (*iterator)(void *state, void* buffer, external_sort_t *es),
+                void *iteratorState, ION_FILE *outputFile, external_sort_t *es, int8_t useRadix, void *sortScratch)
+{
+    pipe->depth = run_pipeline_get_depth();
+    if (pipe->depth == 0)
+        return 8;
+
+    pipe->readPages = malloc((size_t) 2 * pipe->depth * es->page_size);
+    if (pipe->readPages == NULL)
+        return 8;
+    pipe->writePages = pipe->readPages + pipe->depth * es->page_size;
+
+    pipe->readHead = pipe->readCount = 0;
+    pipe->writeHead = pipe->writeCount = 0;
+    pipe->readDone = pipe->stop = pipe->writeError = 0;
+    pipe->useRadix = useRadix;
+    pipe->sortScratch = sortScratch;
+    pipe->iterator = iterator;
+    pipe->iteratorState = iteratorState;
+    pipe->outputFile = outputFile;
+    pipe->es = es;
+
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->changed, NULL);
+    if (pthread_create(&pipe->reader, NULL, run_pipeline_reader, pipe) != 0)
+    {
+        pthread_cond_destroy(&pipe->changed);
+        pthread_mutex_destroy(&pipe->lock);
+        free(pipe->readPages);
+        return 8;
+    }
+    if (pthread_create(&pipe->writer, NULL, run_pipeline_writer, pipe) != 0)
+    {
+        pthread_mutex_lock(&pipe->lock);
+        pipe->stop = 1;
+        pthread_cond_broadcast(&pipe->changed);
+        pthread_mutex_unlock(&pipe->lock);
+        pthread_join(pipe->reader, NULL);
+        pthread_cond_destroy(&pipe->changed);
+        pthread_mutex_destroy(&pipe->lock);
+        free(pipe->readPages);
+        return 8;
+    }
+    return 0;
+}
+
+int16_t run_pipeline_read(run_pipeline_t *pipe, char *dest)
+{
+    external_sort_t *es = pipe->es;
+    char            *page;
+    int16_t         count;
+
+    pthread_mutex_lock(&pipe->lock);
+    while (pipe->readCount == 0 && !pipe->readDone)
+        pthread_cond_wait(&pipe->changed, &pipe->lock);
+    if (pipe->readCount == 0)
+    {
+        pthread_mutex_unlock(&pipe->lock);
+        return 0;
+    }
+    page = pipe->readPages + pipe->readHead * es->page_size;
+    pthread_mutex_unlock(&pipe->lock);
+
+    count = *((int16_t *) (page + BLOCK_COUNT_OFFSET));
+    memcpy(dest, page + es->headerSize, (size_t) count * es->record_size);
+
+    pthread_mutex_lock(&pipe->lock);
+    pipe->readHead = (pipe->readHead + 1) % pipe->depth;
+    pipe->readCount--;
+    pthread_cond_broadcast(&pipe->changed);
+    pthread_mutex_unlock(&pipe->lock);
+    return count;
+}
+
+int8_t run_pipeline_write(run_pipeline_t *pipe, char *page)
+{
+    uint16_t    pageSize = pipe->es->page_size;
+    char        *slot;
+
+    pthread_mutex_lock(&pipe->lock);
+    while (pipe->writeCount == pipe->depth && !pipe->writeError)
+        pthread_cond_wait(&pipe->changed, &pipe->lock);
+    if (pipe->writeError)
+    {
+        pthread_mutex_unlock(&pipe->lock);
+        return 9;
+    }
+    slot = pipe->writePages + ((pipe->writeHead + pipe->writeCount) % pipe->depth) * pageSize;
+    pthread_mutex_unlock(&pipe->lock);
+
+    memcpy(slot, page, pageSize);
+
+    pthread_mutex_lock(&pipe->lock);
+    pipe->writeCount++;
+    pthread_cond_broadcast(&pipe->changed);
+    pthread_mutex_unlock(&pipe->lock);
+    return 0;
+}
+
+int8_t run_pipeline_finish(run_pipeline_t *pipe)
+{
+    int8_t err;
+
+    pthread_mutex_lock(&pipe->lock);
+    pipe->stop = 1;
+    pthread_cond_broadcast(&pipe->changed);
+    pthread_mutex_unlock(&pipe->lock);
+
+    pthread_join(pipe->reader, NULL);
+    pthread_join(pipe->writer, NULL);
+
+    err = pipe->writeError ? 9 : 0;
+    pthread_cond_destroy(&pipe->changed);
+    pthread_mutex_destroy(&pipe->lock);
+    free(pipe->readPages);
+    pipe->readPages = pipe->writePages = NULL;
+    return err;
+}
+
+#else
+
+int8_t run_pipeline_start(run_pipeline_t *pipe, int (*iterator)(void *state, void* buffer, external_sort_t *es),
+                void *iteratorState, ION_FILE *outputFile, external_sort_t *es, int8_t useRadix, void *sortScratch)
+{
+    (void) pipe;
+    (void) iterator;
+    (void) iteratorState;
+    (void) outputFile;
+    (void) es;
+    (void) useRadix;
+    (void) sortScratch;
+    return 8;
+}
+
+int16_t run_pipeline_read(run_pipeline_t *pipe, char *dest)
+{
+    (void) pipe;
+    (void) dest;
+    return 0;
+}
+
+int8_t run_pipeline_write(run_pipeline_t *pipe, char *page)
+{
+    (void) pipe;
+    (void) page;
+    return 9;
+}
+
+int8_t run_pipeline_finish(run_pipeline_t *pipe)
+{
+    (void) pipe;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,105 @@
+#if !defined(RUN_PIPELINE_H)
+#define RUN_PIPELINE_H
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "external_sort.h"
+
+/* Pipelined run generation needs POSIX threads. The simulated flash device is not thread safe. */
+#if defined(ADAPTIVE_SORT_PIPELINE) && !defined(ARDUINO) && !defined(SIM_FLASH)
+#define RUN_PIPELINE_SUPPORTED          1
+#include <pthread.h>
+#endif
+
+/* Pages in each of the input and output queues unless changed with run_pipeline_set_depth().
+   Used only if more than one processor is online. */
+#define RUN_PIPELINE_DEFAULT_DEPTH      4
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief      Reader and writer stages that overlap input reads and run writes with replacement selection.
+            The reader thread calls the input iterator, sorts each page of input and queues it.
+            The writer thread writes queued output pages to the output file in order.
+            Each queue holds depth pages allocated in addition to the sort buffer.
+            The iterator must not read from the output file.
+*/
+typedef struct {
+#if defined(RUN_PIPELINE_SUPPORTED)
+    pthread_t       reader;
+    pthread_t       writer;
+    pthread_mutex_t lock;
+    pthread_cond_t  changed;            /* Broadcast on any change to queue state */
+#endif
+    char            *readPages;         /* Input queue. Page header count is number of records in page. */
+    char            *writePages;        /* Output queue */
+    int16_t         depth;
+    int16_t         readHead;
+    int16_t         readCount;
+    int16_t         writeHead;
+    int16_t         writeCount;
+    int8_t          readDone;           /* Input exhausted. No more pages will be queued. */
+    int8_t          stop;               /* Set by run_pipeline_finish() */
+    int8_t          writeError;
+    int8_t          useRadix;
+    void            *sortScratch;       /* Used by reader thread to sort input pages */
+    int             (*iterator)(void *state, void* buffer, external_sort_t *es);
+    void            *iteratorState;
+    ION_FILE        *outputFile;
+    external_sort_t *es;
+} run_pipeline_t;
+
+/**
+@brief      Sets number of pages in each queue used by later sorts. 0 disables the pipeline.
+*/
+void run_pipeline_set_depth(int16_t depth);
+
+/**
+@brief      Returns number of pages in each queue. 0 if pipelined run generation is disabled or not supported.
+            If not set, default depth on a multi-processor host and 0 otherwise.
+*/
+int16_t run_pipeline_get_depth(void);
+
+/**
+@brief      Allocates queues and starts reader and writer threads.
+@param      useRadix
+                1 if input pages are sorted with in_memory_radix_sort(), otherwise introsort
+@param      sortScratch
+                Scratch space for sorting input pages. Owned by reader thread until run_pipeline_finish().
+@return     0 if success, 8 if pipeline is disabled, not supported or memory or threads are not available
+*/
+int8_t run_pipeline_start(run_pipeline_t *pipe, int (*iterator)(void *state, void* buffer, external_sort_t *es),
+                void *iteratorState, ION_FILE *outputFile, external_sort_t *es, int8_t useRadix, void *sortScratch);
+
+/**
+@brief      Copies records of next sorted input page to dest. Waits for reader if no page is queued.
+@return     Number of records copied. Less than a page of records only for last page. 0 if input is exhausted.
+*/
+int16_t run_pipeline_read(run_pipeline_t *pipe, char *dest);
+
+/**
+@brief      Queues a copy of an output page to be written. Waits if the output queue is full.
+@return     0 if success, 9 if a previous write failed
+*/
+int8_t run_pipeline_write(run_pipeline_t *pipe, char *page);
+
+/**
+@brief      Waits until all queued pages are written, stops threads and frees queues.
+@return     0 if success, 9 if a write failed
+*/
+int8_t run_pipeline_finish(run_pipeline_t *pipe);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
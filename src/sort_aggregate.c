@@ -0,0 +1,94 @@
+/******************************************************************************/
+/**
+@file		sort_aggregate.c
+@author		Ramon Lawrence
+@brief		Duplicate elimination and aggregation of records with equal keys
+            as they are output by sort passes.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <string.h>
+
+#include "sort_aggregate.h"
+
+void sort_aggregate_init(external_sort_t *es, void *record)
+{
+    int32_t one = 1;
+
+    if (es->aggregate == SORT_AGGREGATE_COUNT)
+        memcpy((char*) record + es->aggregate_offset, &one, sizeof(int32_t));
+}
+
+void sort_aggregate_combine(external_sort_t *es, void *result, void *record)
+{
+    char    *a = (char*) result + es->aggregate_offset;
+    int32_t x, y;
+
+    if (es->aggregate == SORT_AGGREGATE_DISTINCT)
+        return;
+
+    /* Copy as value may not be aligned */
+    memcpy(&x, a, sizeof(int32_t));
+    memcpy(&y, (char*) record + es->aggregate_offset, sizeof(int32_t));
+    switch (es->aggregate)
+    {
+        case SORT_AGGREGATE_COUNT:
+        case SORT_AGGREGATE_SUM:
+            x = (int32_t) ((uint32_t) x + (uint32_t) y);
+            break;
+        case SORT_AGGREGATE_MIN:
+            if (y < x)
+                x = y;
+            break;
+        case SORT_AGGREGATE_MAX:
+            if (y > x)
+                x = y;
+            break;
+    }
+    memcpy(a, &x, sizeof(int32_t));
+}
+
+int8_t sort_aggregate_add(external_sort_t *es, char *page, int16_t *count, void *record)
+{
+    int16_t tuplesPerPage = (es->page_size - es->headerSize) / es->record_size;
+    char    *last = page + es->headerSize + (*count - 1) * es->record_size;
+
+    if (*count > 0 && es->compare_fcn(last, record) == 0)
+    {
+        sort_aggregate_combine(es, last, record);
+        return 1;
+    }
+    if (*count >= tuplesPerPage)
+        return 0;
+    memcpy(last + es->record_size, record, es->record_size);
+    (*count)++;
+    return 1;
+}
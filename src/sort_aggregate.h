@@ -0,0 +1,38 @@
+#if !defined(SORT_AGGREGATE_H)
+#define SORT_AGGREGATE_H
+
+#include <stdint.h>
+
+#include "external_sort.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief      Prepares a record read from input to be combined. COUNT sets the value field to 1.
+            Other aggregates use the record as is.
+*/
+void sort_aggregate_init(external_sort_t *es, void *record);
+
+/**
+@brief      Combines record into result. Both records have the same key and have been prepared by sort_aggregate_init().
+            DISTINCT keeps result. COUNT and SUM add the value fields and MIN and MAX keep the smaller or larger value.
+            Sums wrap on overflow.
+*/
+void sort_aggregate_combine(external_sort_t *es, void *result, void *record);
+
+/**
+@brief      Adds a record to the records of a page in key order. The record is combined with the last record
+            of the page if their keys are equal.
+@param      count
+                Number of records in page. Incremented if the record is appended.
+@return     1 if the record was combined or appended, 0 if it has a new key and the page is full
+*/
+int8_t sort_aggregate_add(external_sort_t *es, char *page, int16_t *count, void *record);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,320 @@
+/******************************************************************************/
+/**
+@file		sort_codec.c
+@author		Ramon Lawrence
+@brief		Delta, run length and dictionary encoding of the keys of temporary
+            run and merge pages and slotted pages of variable length records.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sort_codec.h"
+#include "sort_key.h"
+
+/**
+ * Number of bytes of a varint of value. Each byte stores 7 bits, least significant first, with the high bit set if more follow.
+ */
+static int8_t varintSize(uint64_t value)
+{
+    int8_t n = 1;
+
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static void putVarint(char *buf, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *buf++ = (char) ((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    *buf = (char) value;
+}
+
+static uint64_t getVarint(char *page, int16_t *pos)
+{
+    uint64_t value = 0;
+    uint8_t  b, shift = 0;
+
+    do
+    {
+        b = (uint8_t) page[(*pos)++];
+        value |= (uint64_t) (b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return value;
+}
+
+/**
+ * Copies the bytes of a record other than its key to buf.
+ */
+static void putRest(external_sort_t *es, char *buf, char *record)
+{
+    memcpy(buf, record, es->key_offset);
+    memcpy(buf + es->key_offset, record + es->key_offset + es->key_size, es->record_size - es->key_offset - es->key_size);
+}
+
+static void getRest(external_sort_t *es, char *buf, char *record)
+{
+    memcpy(record, buf, es->key_offset);
+    memcpy(record + es->key_offset + es->key_size, buf + es->key_offset, es->record_size - es->key_offset - es->key_size);
+}
+
+int8_t sort_codec_supported(external_sort_t *es)
+{
+    switch (es->codec)
+    {
+        case SORT_CODEC_NONE:
+            return 1;
+        case SORT_CODEC_DELTA:
+            return sort_key_supported(es);
+        case SORT_CODEC_RLE:
+        case SORT_CODEC_DICT:
+            return es->key_size > 0 && es->key_offset + es->key_size <= es->record_size;
+        case SORT_CODEC_SLOTTED:
+            return es->length_fcn != NULL && SORT_CODEC_HEADER_SIZE + sizeof(int16_t) + es->record_size <= es->page_size;
+        default:
+            return 0;
+    }
+}
+
+int8_t sort_codec_writer_init(sort_codec_writer_t *w, external_sort_t *es)
+{
+    w->page  = (char*) malloc(es->page_size);
+    w->first = (char*) malloc(es->record_size);
+    if (w->page == NULL || w->first == NULL)
+    {
+        sort_codec_writer_free(w);
+        return 8;
+    }
+    return 0;
+}
+
+void sort_codec_writer_free(sort_codec_writer_t *w)
+{
+    free(w->page);
+    free(w->first);
+    w->page  = NULL;
+    w->first = NULL;
+}
+
+void sort_codec_reset(sort_codec_writer_t *w, external_sort_t *es, int8_t codec)
+{
+    w->codec = codec;
+    w->count = 0;
+    w->end   = (int16_t) es->page_size;
+    w->run   = 0;
+    w->key   = 0;
+    if (codec == SORT_CODEC_NONE)
+        w->pos = es->headerSize;
+    else
+    {
+        int16_t id = codec;
+
+        w->pos = SORT_CODEC_HEADER_SIZE;
+        memcpy(w->page + SORT_CODEC_OFFSET, &id, sizeof(int16_t));
+    }
+    memcpy(w->page + BLOCK_COUNT_OFFSET, &w->count, sizeof(int16_t));
+}
+
+int8_t sort_codec_add(sort_codec_writer_t *w, external_sort_t *es, void *record)
+{
+    char    *rec = (char*) record;
+    char    *key = rec + es->key_offset;
+    int16_t rest = (int16_t) (es->record_size - es->key_size);
+    int16_t c;
+
+    /* Count is limited so that a record index is less than the page size (see flash_minsort_sublist.c) */
+    if (w->count >= (int16_t) (es->page_size - SORT_CODEC_HEADER_SIZE))
+        return 0;
+
+    switch (w->codec)
+    {
+        case SORT_CODEC_NONE:
+            if (w->pos + es->record_size > es->page_size)
+                return 0;
+            memcpy(w->page + w->pos, rec, es->record_size);
+            w->pos += es->record_size;
+            break;
+
+        case SORT_CODEC_DELTA:
+        {
+            uint64_t k = sort_key_normalize(es, rec);
+            uint64_t delta = w->count == 0 ? k : k - w->key;
+            int8_t   n = varintSize(delta);
+
+            if (w->pos + n + rest > es->page_size)
+                return 0;
+            putVarint(w->page + w->pos, delta);
+            putRest(es, w->page + w->pos + n, rec);
+            w->pos += n + rest;
+            w->key  = k;
+            break;
+        }
+
+        case SORT_CODEC_RLE:
+            if (w->count > 0 && (uint8_t) w->page[w->run] < SORT_CODEC_MAX_RUN
+                    && memcmp(w->page + w->run + 1, key, es->key_size) == 0)
+            {
+                if (w->pos + rest > es->page_size)
+                    return 0;
+                w->page[w->run]++;
+            }
+            else
+            {
+                if (w->pos + 1 + es->key_size + rest > es->page_size)
+                    return 0;
+                w->run = w->pos;
+                w->page[w->pos] = 1;
+                memcpy(w->page + w->pos + 1, key, es->key_size);
+                w->pos += 1 + es->key_size;
+            }
+            putRest(es, w->page + w->pos, rec);
+            w->pos += rest;
+            break;
+
+        case SORT_CODEC_DICT:
+        {
+            int16_t entries = (int16_t) ((es->page_size - w->end) / es->key_size);
+
+            /* Records are added in sorted order, so a key can only be equal to the most recently added key */
+            c = entries - 1;
+            if (c < 0 || memcmp(w->page + w->end, key, es->key_size) != 0)
+            {
+                if (entries >= SORT_CODEC_MAX_DICT || w->pos + 1 + rest > w->end - es->key_size)
+                    return 0;
+                w->end -= es->key_size;
+                memcpy(w->page + w->end, key, es->key_size);
+                c = entries;
+            }
+            else if (w->pos + 1 + rest > w->end)
+                return 0;
+            w->page[w->pos] = (char) c;
+            putRest(es, w->page + w->pos + 1, rec);
+            w->pos += 1 + rest;
+            break;
+        }
+
+        case SORT_CODEC_SLOTTED:
+        {
+            int16_t len = (int16_t) es->length_fcn(rec);
+
+            if (w->pos + (int16_t) sizeof(int16_t) + len > w->end)
+                return 0;
+            w->end -= len;
+            memcpy(w->page + w->end, rec, len);
+            memcpy(w->page + w->pos, &w->end, sizeof(int16_t));
+            w->pos += sizeof(int16_t);
+            break;
+        }
+    }
+
+    if (w->count == 0)
+        memcpy(w->first, rec, es->record_size);
+    w->count++;
+    memcpy(w->page + BLOCK_COUNT_OFFSET, &w->count, sizeof(int16_t));
+    return 1;
+}
+
+int8_t sort_codec_read(external_sort_t *es, char *page, sort_codec_cursor_t *c, void *record)
+{
+    char    *rec = (char*) record;
+    int16_t count, codec;
+
+    memcpy(&count, page + BLOCK_COUNT_OFFSET, sizeof(int16_t));
+    if (c->idx >= count)
+        return 0;
+
+    memcpy(&codec, page + SORT_CODEC_OFFSET, sizeof(int16_t));
+    if (codec == SORT_CODEC_SLOTTED)
+    {   /* Record ends where the record before it in the slot array starts */
+        int16_t start, end = (int16_t) es->page_size;
+
+        memcpy(&start, page + SORT_CODEC_HEADER_SIZE + c->idx * sizeof(int16_t), sizeof(int16_t));
+        if (c->idx > 0)
+            memcpy(&end, page + SORT_CODEC_HEADER_SIZE + (c->idx - 1) * sizeof(int16_t), sizeof(int16_t));
+        memcpy(rec, page + start, end - start);
+        c->idx++;
+        return 1;
+    }
+
+    switch (codec)
+    {
+        case SORT_CODEC_DELTA:
+            c->key += getVarint(page, &c->pos);
+            sort_key_denormalize(es, c->key, rec);
+            break;
+
+        case SORT_CODEC_RLE:
+            if (c->runLeft == 0)
+            {
+                c->runLeft = (uint8_t) page[c->pos];
+                c->runKey  = c->pos + 1;
+                c->pos    += 1 + es->key_size;
+            }
+            c->runLeft--;
+            memcpy(rec + es->key_offset, page + c->runKey, es->key_size);
+            break;
+
+        case SORT_CODEC_DICT:
+            memcpy(rec + es->key_offset, page + es->page_size - ((uint8_t) page[c->pos] + 1) * es->key_size, es->key_size);
+            c->pos++;
+            break;
+    }
+    getRest(es, page + c->pos, rec);
+    c->pos += es->record_size - es->key_size;
+    c->idx++;
+    return 1;
+}
+
+int8_t sort_codec_read_at(external_sort_t *es, char *page, sort_codec_cursor_t *c, int16_t idx, void *record)
+{
+    int16_t codec;
+
+    memcpy(&codec, page + SORT_CODEC_OFFSET, sizeof(int16_t));
+    if (codec == SORT_CODEC_SLOTTED)
+        c->idx = idx;
+    else if (c->idx > idx)
+        sort_codec_rewind(c);
+    while (c->idx < idx)
+    {
+        if (!sort_codec_read(es, page, c, record))
+            return 0;
+    }
+    return sort_codec_read(es, page, c, record);
+}
@@ -0,0 +1,113 @@
+#if !defined(SORT_CODEC_H)
+#define SORT_CODEC_H
+
+#include <stdint.h>
+
+#include "external_sort.h"
+
+/* Codec pages extend the block header with the codec used to encode the records of the page */
+#define SORT_CODEC_OFFSET           (BLOCK_HEADER_SIZE)
+#define SORT_CODEC_HEADER_SIZE      ((BLOCK_HEADER_SIZE) + sizeof(int16_t))
+
+/* Longest run of equal keys of an RLE page and most keys of a DICT page */
+#define SORT_CODEC_MAX_RUN          255
+#define SORT_CODEC_MAX_DICT         256
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief      Page being encoded. Each page is encoded independently so it can be decoded without the pages before it.
+            Only keys are encoded. The other bytes of each record follow its key code unchanged. SORT_CODEC_SLOTTED
+            stores the bytes of each record given by length_fcn at the end of the page and their offsets after the header.
+*/
+typedef struct {
+    char        *page;
+    char        *first;         /* Copy of first record of page */
+    int16_t     count;          /* Records in page */
+    int16_t     pos;            /* Offset of end of encoded records */
+    int16_t     end;            /* Offset of DICT dictionary or SLOTTED records, which grow down from end of page. Otherwise page size. */
+    int16_t     run;            /* Offset of length of last RLE run */
+    uint64_t    key;            /* Normalized key of last DELTA record */
+    int8_t      codec;          /* One of SORT_CODEC_*. SORT_CODEC_NONE writes pages in the standard block format. */
+} sort_codec_writer_t;
+
+/**
+@brief      Position of a reader in a codec page.
+*/
+typedef struct {
+    int16_t     idx;            /* Records decoded */
+    int16_t     pos;            /* Offset of next encoded record */
+    int16_t     runLeft;        /* Records left in current RLE run */
+    int16_t     runKey;         /* Offset of key of current RLE run */
+    uint64_t    key;            /* Normalized key of last DELTA record */
+} sort_codec_cursor_t;
+
+/**
+@brief      Returns 1 if es->codec can encode the keys of es. DELTA requires a key supported by sort_key_normalize().
+            RLE and DICT require the key to be within the record. SLOTTED requires es->length_fcn.
+*/
+int8_t sort_codec_supported(external_sort_t *es);
+
+/**
+@brief      Codec of the pages of the sorted output. Variable length records are output in slotted pages.
+            Output of the other codecs is in the standard block format.
+*/
+static inline int8_t sort_codec_output(external_sort_t *es)
+{
+    return es->codec == SORT_CODEC_SLOTTED ? SORT_CODEC_SLOTTED : SORT_CODEC_NONE;
+}
+
+/**
+@brief      Allocates the page of a writer. Call sort_codec_reset() before adding records.
+@return     0 if success, 8 if out of memory
+*/
+int8_t sort_codec_writer_init(sort_codec_writer_t *w, external_sort_t *es);
+
+/**
+@brief      Frees the page of a writer. The writer may have failed to initialize.
+*/
+void sort_codec_writer_free(sort_codec_writer_t *w);
+
+/**
+@brief      Empties the page of a writer and sets the codec used for the records added to it. Block id is not set.
+*/
+void sort_codec_reset(sort_codec_writer_t *w, external_sort_t *es, int8_t codec);
+
+/**
+@brief      Encodes a record at the end of the page and updates the record count of the page header.
+@return     1 if the record was added, 0 if the page is full
+*/
+int8_t sort_codec_add(sort_codec_writer_t *w, external_sort_t *es, void *record);
+
+/**
+@brief      Positions a cursor at the first record of a page.
+*/
+static inline void sort_codec_rewind(sort_codec_cursor_t *c)
+{
+    c->idx      = 0;
+    c->pos      = SORT_CODEC_HEADER_SIZE;
+    c->runLeft  = 0;
+    c->runKey   = 0;
+    c->key      = 0;
+}
+
+/**
+@brief      Decodes the record at the cursor of a codec page and advances the cursor.
+@return     1 if a record was decoded, 0 if all records of the page have been decoded
+*/
+int8_t sort_codec_read(external_sort_t *es, char *page, sort_codec_cursor_t *c, void *record);
+
+/**
+@brief      Decodes record idx of a codec page and positions the cursor after it. Records of a slotted page are located
+            by their offset. Other pages are decoded from the cursor, or from the first record if idx is before the cursor.
+@return     1 if a record was decoded, 0 if the page has idx records or less
+*/
+int8_t sort_codec_read_at(external_sort_t *es, char *page, sort_codec_cursor_t *c, int16_t idx, void *record);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
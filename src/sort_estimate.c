@@ -0,0 +1,103 @@
+/******************************************************************************/
+/**
+@file		sort_estimate.c
+@author		Ramon Lawrence
+@brief		Estimation of the number of distinct keys with a small HyperLogLog
+            sketch.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <math.h>
+#include <string.h>
+
+#include "sort_estimate.h"
+
+/**
+ * Mixes the bits of a key so that keys close together select unrelated registers (splitmix64 finalizer).
+ */
+static uint64_t hashKey(uint64_t key)
+{
+    key += 0x9E3779B97F4A7C15ULL;
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+    return key ^ (key >> 31);
+}
+
+void sort_estimate_clear(sort_estimate_t *e)
+{
+    memset(e->reg, 0, sizeof(e->reg));
+}
+
+void sort_estimate_add(sort_estimate_t *e, uint64_t key)
+{
+    uint64_t h = hashKey(key);
+    uint16_t i = (uint16_t) (h & (SORT_ESTIMATE_REGISTERS - 1));
+    uint8_t  rank = 1;
+
+    h >>= SORT_ESTIMATE_BITS;
+    while ((h & 1) == 0 && rank <= 64 - SORT_ESTIMATE_BITS)
+    {
+        rank++;
+        h >>= 1;
+    }
+    if (rank > e->reg[i])
+        e->reg[i] = rank;
+}
+
+void sort_estimate_merge(sort_estimate_t *dest, sort_estimate_t *src)
+{
+    uint16_t i;
+
+    for (i = 0; i < SORT_ESTIMATE_REGISTERS; i++)
+    {
+        if (src->reg[i] > dest->reg[i])
+            dest->reg[i] = src->reg[i];
+    }
+}
+
+uint32_t sort_estimate_count(sort_estimate_t *e)
+{
+    double   sum = 0, m = SORT_ESTIMATE_REGISTERS, estimate;
+    uint16_t i, empty = 0;
+
+    for (i = 0; i < SORT_ESTIMATE_REGISTERS; i++)
+    {
+        sum += ldexp(1.0, -e->reg[i]);
+        if (e->reg[i] == 0)
+            empty++;
+    }
+
+    /* HyperLogLog bias correction (0.709 for 64 registers) */
+    estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    if (estimate <= 2.5 * m && empty > 0)
+        estimate = m * log(m / empty);
+    return (uint32_t) (estimate + 0.5);
+}
@@ -0,0 +1,47 @@
+#if !defined(SORT_ESTIMATE_H)
+#define SORT_ESTIMATE_H
+
+#include <stdint.h>
+
+/* Registers of the sketch. The standard error of the estimate is about 1.04/sqrt(registers), 13% for 64 registers. */
+#define SORT_ESTIMATE_BITS          6
+#define SORT_ESTIMATE_REGISTERS     (1 << SORT_ESTIMATE_BITS)
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief      HyperLogLog sketch of the distinct keys added to it. Each register holds the longest run of trailing zero
+            bits (plus one) of the hashes of the keys that select it. Small counts are estimated from the number of
+            empty registers (linear counting), so they are close to exact.
+*/
+typedef struct {
+    uint8_t     reg[SORT_ESTIMATE_REGISTERS];
+} sort_estimate_t;
+
+/**
+@brief      Empties a sketch.
+*/
+void sort_estimate_clear(sort_estimate_t *e);
+
+/**
+@brief      Adds a normalized key (see sort_key_normalize()) to a sketch.
+*/
+void sort_estimate_add(sort_estimate_t *e, uint64_t key);
+
+/**
+@brief      Adds the keys of sketch src to sketch dest, e.g. to combine the sketches of scan workers.
+*/
+void sort_estimate_merge(sort_estimate_t *dest, sort_estimate_t *src);
+
+/**
+@brief      Returns the estimated number of distinct keys added to a sketch.
+*/
+uint32_t sort_estimate_count(sort_estimate_t *e);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,113 @@
+/******************************************************************************/
+/**
+@file		sort_key.c
+@author		Ramon Lawrence
+@brief		Order preserving conversion of typed record keys to unsigned integers
+            used by MinSort.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <string.h>
+
+#include "sort_key.h"
+
+int8_t sort_key_supported(external_sort_t *es)
+{
+    if (es->key_offset + es->key_size > es->record_size)
+        return 0;
+
+    switch (es->key_type)
+    {
+        case SORT_KEY_TYPE_INT:
+        case SORT_KEY_TYPE_UINT:
+            return es->key_size == 1 || es->key_size == 2 || es->key_size == 4 || es->key_size == 8;
+        case SORT_KEY_TYPE_FLOAT:
+            return es->key_size == sizeof(float) || es->key_size == sizeof(double);
+        default:
+            return 0;
+    }
+}
+
+uint64_t sort_key_normalize(external_sort_t *es, void *record)
+{
+    uint8_t  bits = (uint8_t) (es->key_size * 8);
+    uint64_t signBit = (uint64_t) 1 << (bits - 1);
+    uint64_t key;
+
+    /* Copy as key may not be aligned */
+    switch (es->key_size)
+    {
+        case 1:  { uint8_t  v; memcpy(&v, (char*) record + es->key_offset, 1); key = v; break; }
+        case 2:  { uint16_t v; memcpy(&v, (char*) record + es->key_offset, 2); key = v; break; }
+        case 4:  { uint32_t v; memcpy(&v, (char*) record + es->key_offset, 4); key = v; break; }
+        default: { uint64_t v; memcpy(&v, (char*) record + es->key_offset, 8); key = v; break; }
+    }
+
+    if (es->key_type == SORT_KEY_TYPE_INT)
+        key ^= signBit;
+    else if (es->key_type == SORT_KEY_TYPE_FLOAT)
+    {
+        if (key & signBit)
+            key = ~key & (signBit | (signBit - 1));
+        else
+            key |= signBit;
+    }
+    return key;
+}
+
+void sort_key_denormalize(external_sort_t *es, uint64_t key, void *record)
+{
+    uint8_t  bits = (uint8_t) (es->key_size * 8);
+    uint64_t signBit = (uint64_t) 1 << (bits - 1);
+
+    if (es->key_type == SORT_KEY_TYPE_INT)
+        key ^= signBit;
+    else if (es->key_type == SORT_KEY_TYPE_FLOAT)
+    {
+        if (key & signBit)
+            key &= ~signBit;
+        else
+            key = ~key & (signBit | (signBit - 1));
+    }
+
+    switch (es->key_size)
+    {
+        case 1:  { uint8_t  v = (uint8_t) key;  memcpy((char*) record + es->key_offset, &v, 1); break; }
+        case 2:  { uint16_t v = (uint16_t) key; memcpy((char*) record + es->key_offset, &v, 2); break; }
+        case 4:  { uint32_t v = (uint32_t) key; memcpy((char*) record + es->key_offset, &v, 4); break; }
+        default: memcpy((char*) record + es->key_offset, &key, 8); break;
+    }
+}
+
+uint32_t sort_key_prefix(external_sort_t *es, void *record)
+{
+    return (uint32_t) ((sort_key_normalize(es, record) << (64 - es->key_size * 8)) >> 32);
+}
@@ -0,0 +1,71 @@
+#if !defined(SORT_KEY_H)
+#define SORT_KEY_H
+
+#include <stdint.h>
+
+#include "external_sort.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief      Returns 1 if key type, size and offset of es are supported by sort_key_normalize().
+*/
+int8_t sort_key_supported(external_sort_t *es);
+
+/**
+@brief      Returns key of a record converted to an unsigned integer of key_size bytes with the same
+            ordering as the key. Signed integers have the sign bit flipped. Negative floats have all
+            bits flipped and positive floats have the sign bit set.
+@param      record
+                Record containing key at es->key_offset
+*/
+uint64_t sort_key_normalize(external_sort_t *es, void *record);
+
+/**
+@brief      Stores the key of a normalized key (see sort_key_normalize()) in a record.
+@param      record
+                Record with key at es->key_offset. Other bytes are unchanged.
+*/
+void sort_key_denormalize(external_sort_t *es, uint64_t key, void *record);
+
+/**
+@brief      Returns the first 32 bits of the normalized key of a record (see sort_key_normalize()). Shorter keys are
+            shifted left. Records with different prefixes are in prefix order. Equal prefixes need a full comparison.
+*/
+uint32_t sort_key_prefix(external_sort_t *es, void *record);
+
+/**
+@brief      Returns entry idx of an array of normalized keys of width bytes.
+*/
+static inline uint64_t sort_key_get(char *keys, uint32_t idx, uint8_t width)
+{
+    switch (width)
+    {
+        case 1:  return ((uint8_t *) keys)[idx];
+        case 2:  return ((uint16_t *) keys)[idx];
+        case 4:  return ((uint32_t *) keys)[idx];
+        default: return ((uint64_t *) keys)[idx];
+    }
+}
+
+/**
+@brief      Sets entry idx of an array of normalized keys of width bytes.
+*/
+static inline void sort_key_set(char *keys, uint32_t idx, uint8_t width, uint64_t key)
+{
+    switch (width)
+    {
+        case 1:  ((uint8_t *) keys)[idx] = (uint8_t) key; break;
+        case 2:  ((uint16_t *) keys)[idx] = (uint16_t) key; break;
+        case 4:  ((uint32_t *) keys)[idx] = (uint32_t) key; break;
+        default: ((uint64_t *) keys)[idx] = key; break;
+    }
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,139 @@
+/******************************************************************************/
+/**
+@file		sort_metrics.c
+@author		Ramon Lawrence
+@brief		Per-phase breakdown of sort metrics (run generation, merge passes
+            and MinSort stages).
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sort_metrics.h"
+#include "clock_c_iface.h"
+
+static const char *phaseNames[] = { "rungen", "merge", "minsort-init", "minsort-output", "sublist-init", "sublist-output", "gather" };
+
+/* Log given to the last metrics_init() with a log on this thread. Kept out of metrics_t so that callers that set up
+   metrics_t without metrics_init() do not have phase state the engines would use. */
+#if !defined(ARDUINO) && defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+static _Thread_local metrics_phase_log_t *activeLog = NULL;
+#else
+static metrics_phase_log_t *activeLog = NULL;
+#endif
+
+void metrics_phase_log_init(metrics_phase_log_t *log, metrics_phase_t *phases, uint16_t maxPhases)
+{
+    log->metric     = NULL;
+    log->phases     = phases;
+    log->max_phases = maxPhases;
+    log->num_phases = 0;
+    log->open       = 0;
+}
+
+void metrics_init(metrics_t *metric, metrics_phase_log_t *log)
+{
+    memset(metric, 0, sizeof(metrics_t));
+    if (log != NULL)
+    {
+        log->metric     = metric;
+        log->num_phases = 0;
+        log->open       = 0;
+        activeLog       = log;
+    }
+    else if (activeLog != NULL && activeLog->metric == metric)
+        activeLog = NULL;
+}
+
+void metrics_phase_begin(metrics_t *metric, int8_t type, int16_t number)
+{
+    metrics_phase_log_t *log = activeLog;
+    if (log == NULL || metric != log->metric)
+        return;
+
+    if (log->open)
+        metrics_phase_end(metric, NULL);
+
+    if (log->num_phases >= log->max_phases)
+        return;
+
+    /* Store counters at start of phase. Replaced by differences when phase ends. */
+    metrics_phase_t *p = &log->phases[log->num_phases];
+    p->type         = type;
+    p->number       = number;
+    p->num_reads    = metric->num_reads;
+    p->num_writes   = metric->num_writes;
+    p->num_memcpys  = metric->num_memcpys;
+    p->num_compar   = metric->num_compar;
+    p->time_us      = (uint32_t) micros();
+    log->open = 1;
+}
+
+void metrics_phase_end(metrics_t *metric, external_sort_t *es)
+{
+    metrics_phase_log_t *log = activeLog;
+    if (log == NULL || metric != log->metric || !log->open)
+        return;
+
+    metrics_phase_t *p = &log->phases[log->num_phases];
+    p->time_us      = (uint32_t) micros() - p->time_us;
+    p->num_reads    = metric->num_reads - p->num_reads;
+    p->num_writes   = metric->num_writes - p->num_writes;
+    p->num_memcpys  = metric->num_memcpys - p->num_memcpys;
+    p->num_compar   = metric->num_compar - p->num_compar;
+    p->bytes_read   = es == NULL ? 0 : p->num_reads * es->page_size;
+    p->bytes_written = es == NULL ? 0 : p->num_writes * es->page_size;
+    p->bytes_copied = es == NULL ? 0 : p->num_memcpys * es->record_size;
+    log->num_phases++;
+    log->open = 0;
+}
+
+const char* metrics_phase_name(int8_t type)
+{
+    if (type < 0 || type > METRICS_PHASE_TAG_GATHER)
+        return "unknown";
+    return phaseNames[type];
+}
+
+void metrics_print_phases(metrics_phase_log_t *log)
+{
+    uint16_t i;
+
+    for (i = 0; i < log->num_phases; i++)
+    {
+        metrics_phase_t *p = &log->phases[i];
+        printf("Phase: %s %d  Time: %lu us  Reads: %lu  Writes: %lu  Bytes read: %lu  Bytes written: %lu  Comparisons: %lu  Memcpys: %lu  Bytes copied: %lu\n",
+                metrics_phase_name(p->type), p->number, (unsigned long) p->time_us, (unsigned long) p->num_reads,
+                (unsigned long) p->num_writes, (unsigned long) p->bytes_read, (unsigned long) p->bytes_written,
+                (unsigned long) p->num_compar, (unsigned long) p->num_memcpys, (unsigned long) p->bytes_copied);
+    }
+}
@@ -0,0 +1,74 @@
+#if !defined(SORT_METRICS_H)
+#define SORT_METRICS_H
+
+#include <stdint.h>
+
+#include "external_sort.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Per-phase breakdown of a sort. Provided by the caller, so sorts with their own logs do not share phase state. */
+typedef struct {
+    metrics_t       *metric;        /* Metrics whose phases are recorded */
+    metrics_phase_t *phases;        /* Caller provided array of phases */
+    uint16_t        max_phases;     /* Number of entries in phases. Phases past this limit are not recorded. */
+    uint16_t        num_phases;     /* Completed phases */
+    int8_t          open;           /* 1 if phases[num_phases] holds the counters at the start of the current phase */
+} metrics_phase_log_t;
+
+/**
+@brief      Sets the storage of a phase log.
+@param      phases
+                Caller provided array of phases
+@param      maxPhases
+                Number of entries in phases
+*/
+void metrics_phase_log_init(metrics_phase_log_t *log, metrics_phase_t *phases, uint16_t maxPhases);
+
+/**
+@brief      Clears all counters and the phases of log, and records the phases of the sort that uses metric in log.
+            Phases are recorded for the metrics last initialized with a log on the calling thread, so sorts on different
+            threads record their own phases. Arduino builds and builds without C11 thread-local storage record the
+            phases of one sort at a time.
+            Metrics set up without metrics_init() do not record phases.
+@param      metric
+                Metrics to initialize
+@param      log
+                Log initialized with metrics_phase_log_init(). NULL if phases are not tracked.
+*/
+void metrics_init(metrics_t *metric, metrics_phase_log_t *log);
+
+/**
+@brief      Starts a phase. Ends the current phase if one is open. Called by the engines on the thread that called the sort.
+@param      type
+                One of METRICS_PHASE_*
+@param      number
+                Pass number for merge passes, otherwise 0
+*/
+void metrics_phase_begin(metrics_t *metric, int8_t type, int16_t number);
+
+/**
+@brief      Ends the current phase and records the counters, bytes and time since it began.
+@param      es
+                Sorting state info. Page and record size are used to derive bytes moved from the counts.
+*/
+void metrics_phase_end(metrics_t *metric, external_sort_t *es);
+
+
+/**
+@brief      Returns the name of a phase type.
+*/
+const char* metrics_phase_name(int8_t type);
+
+/**
+@brief      Prints one line per recorded phase of log.
+*/
+void metrics_print_phases(metrics_phase_log_t *log);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
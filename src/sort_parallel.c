@@ -0,0 +1,213 @@
+/******************************************************************************/
+/**
+@file		sort_parallel.c
+@author		Ramon Lawrence
+@brief		Worker threads and positional file I/O for sort phases that run in parallel.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <stdlib.h>
+
+#include "sort_parallel.h"
+
+#if defined(SORT_PARALLEL_SUPPORTED)
+#include <pthread.h>
+#include <unistd.h>
+
+/* Number of workers set by sort_parallel_set_workers(). -1 if not set. */
+static int16_t parallelWorkers = -1;
+#endif
+
+void sort_parallel_set_workers(int16_t workers)
+{
+#if defined(SORT_PARALLEL_SUPPORTED)
+    if (workers < 1)
+        workers = 1;
+    parallelWorkers = workers > SORT_PARALLEL_MAX_WORKERS ? SORT_PARALLEL_MAX_WORKERS : workers;
+#else
+    (void) workers;
+#endif
+}
+
+int16_t sort_parallel_get_workers(void)
+{
+#if defined(SORT_PARALLEL_SUPPORTED)
+    long processors;
+
+    if (parallelWorkers > 0)
+        return parallelWorkers;
+    processors = sysconf(_SC_NPROCESSORS_ONLN);
+    if (processors < 1)
+        return 1;
+    return processors > SORT_PARALLEL_MAX_WORKERS ? SORT_PARALLEL_MAX_WORKERS : (int16_t) processors;
+#else
+    return 1;
+#endif
+}
+
+/**
+@brief      Tasks shared by the workers of one call to sort_parallel_run()
+*/
+typedef struct {
+#if defined(SORT_PARALLEL_SUPPORTED)
+    pthread_mutex_t lock;
+#endif
+    int8_t          (*task)(void *arg, int16_t worker, int32_t taskIdx);
+    void            *arg;
+    int32_t         numTasks;
+    int32_t         nextTask;
+    int8_t          err;            /* Result of first failed task */
+} sort_parallel_tasks_t;
+
+/**
+@brief      Returns next task to run or -1 if all tasks are taken or a task failed.
+*/
+static int32_t sort_parallel_next(sort_parallel_tasks_t *tasks)
+{
+    int32_t taskIdx = -1;
+
+#if defined(SORT_PARALLEL_SUPPORTED)
+    pthread_mutex_lock(&tasks->lock);
+#endif
+    if (tasks->err == 0 && tasks->nextTask < tasks->numTasks)
+        taskIdx = tasks->nextTask++;
+#if defined(SORT_PARALLEL_SUPPORTED)
+    pthread_mutex_unlock(&tasks->lock);
+#endif
+    return taskIdx;
+}
+
+static void sort_parallel_work(sort_parallel_tasks_t *tasks, int16_t worker)
+{
+    int32_t taskIdx;
+    int8_t  err;
+
+    while ((taskIdx = sort_parallel_next(tasks)) != -1)
+    {
+        err = tasks->task(tasks->arg, worker, taskIdx);
+        if (err != 0)
+        {
+#if defined(SORT_PARALLEL_SUPPORTED)
+            pthread_mutex_lock(&tasks->lock);
+#endif
+            if (tasks->err == 0)
+                tasks->err = err;
+#if defined(SORT_PARALLEL_SUPPORTED)
+            pthread_mutex_unlock(&tasks->lock);
+#endif
+        }
+    }
+}
+
+#if defined(SORT_PARALLEL_SUPPORTED)
+/**
+@brief      Arguments of a worker thread
+*/
+typedef struct {
+    sort_parallel_tasks_t   *tasks;
+    int16_t                 worker;
+} sort_parallel_worker_t;
+
+static void* sort_parallel_thread(void *arg)
+{
+    sort_parallel_worker_t *w = (sort_parallel_worker_t*) arg;
+    sort_parallel_work(w->tasks, w->worker);
+    return NULL;
+}
+#endif
+
+int8_t sort_parallel_run(int32_t numTasks, int16_t numWorkers, int8_t (*task)(void *arg, int16_t worker, int32_t taskIdx), void *arg)
+{
+    sort_parallel_tasks_t tasks;
+
+    tasks.task      = task;
+    tasks.arg       = arg;
+    tasks.numTasks  = numTasks;
+    tasks.nextTask  = 0;
+    tasks.err       = 0;
+
+#if defined(SORT_PARALLEL_SUPPORTED)
+    pthread_t               threads[SORT_PARALLEL_MAX_WORKERS];
+    sort_parallel_worker_t  workers[SORT_PARALLEL_MAX_WORKERS];
+    int16_t                 started = 0, w;
+
+    if (numWorkers > SORT_PARALLEL_MAX_WORKERS)
+        numWorkers = SORT_PARALLEL_MAX_WORKERS;
+    if (numWorkers > numTasks)
+        numWorkers = (int16_t) numTasks;
+
+    pthread_mutex_init(&tasks.lock, NULL);
+    for (w = 1; w < numWorkers; w++)
+    {
+        workers[started].tasks = &tasks;
+        workers[started].worker = w;
+        if (pthread_create(&threads[started], NULL, sort_parallel_thread, &workers[started]) != 0)
+            break;
+        started++;
+    }
+
+    sort_parallel_work(&tasks, 0);
+
+    for (w = 0; w < started; w++)
+        pthread_join(threads[w], NULL);
+    pthread_mutex_destroy(&tasks.lock);
+#else
+    (void) numWorkers;
+    sort_parallel_work(&tasks, 0);
+#endif
+    return tasks.err;
+}
+
+int8_t sort_parallel_read(ION_FILE *file, long offset, void *dest, uint16_t size)
+{
+#if defined(SORT_PARALLEL_SUPPORTED)
+    if (pread(fileno(file), dest, size, offset) != (ssize_t) size)
+        return 10;
+#else
+    fseek(file, offset, SEEK_SET);
+    if (0 == fread(dest, size, 1, file))
+        return 10;
+#endif
+    return 0;
+}
+
+int8_t sort_parallel_write(ION_FILE *file, long offset, void *src, uint16_t size)
+{
+#if defined(SORT_PARALLEL_SUPPORTED)
+    if (pwrite(fileno(file), src, size, offset) != (ssize_t) size)
+        return 9;
+#else
+    fseek(file, offset, SEEK_SET);
+    if (0 == fwrite(src, size, 1, file))
+        return 9;
+#endif
+    return 0;
+}
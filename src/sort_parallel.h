@@ -0,0 +1,70 @@
+#if !defined(SORT_PARALLEL_H)
+#define SORT_PARALLEL_H
+
+#if defined(ARDUINO)
+#include "serial_c_iface.h"
+#include "file/kv_stdio_intercept.h"
+#include "file/sd_stdio_c_iface.h"
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "external_sort.h"
+
+/* Parallel sort phases need POSIX threads and positional file I/O. The simulated flash device is not thread safe. */
+#if defined(ADAPTIVE_SORT_PARALLEL) && !defined(ARDUINO) && !defined(SIM_FLASH)
+#define SORT_PARALLEL_SUPPORTED         1
+#endif
+
+/* Largest number of worker threads */
+#if defined(SORT_PARALLEL_SUPPORTED)
+#define SORT_PARALLEL_MAX_WORKERS       16
+#else
+#define SORT_PARALLEL_MAX_WORKERS       1
+#endif
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/**
+@brief      Sets number of workers used by later sorts. 1 runs every phase on the calling thread.
+*/
+void sort_parallel_set_workers(int16_t workers);
+
+/**
+@brief      Returns number of workers. If not set, number of online processors (at most SORT_PARALLEL_MAX_WORKERS).
+            1 if parallel sorting is not supported.
+*/
+int16_t sort_parallel_get_workers(void);
+
+/**
+@brief      Runs tasks 0 to numTasks-1 on up to numWorkers workers. The calling thread is worker 0.
+            Tasks are handed out in order as workers become free, so a worker may run several tasks.
+            If a worker thread cannot be started its tasks are run by the other workers.
+@param      task
+                Called with arg, the worker running the task (for per-worker resources) and the task index.
+                Returns 0 if success.
+@return     0 if all tasks succeeded, otherwise result of a failed task. No tasks are started after a failure.
+*/
+int8_t sort_parallel_run(int32_t numTasks, int16_t numWorkers, int8_t (*task)(void *arg, int16_t worker, int32_t taskIdx), void *arg);
+
+/**
+@brief      Reads size bytes at offset without using or changing the file position, so workers can share a file.
+            Buffered writes must be flushed before and the file repositioned with fseek() after.
+@return     0 if success, 10 if read error
+*/
+int8_t sort_parallel_read(ION_FILE *file, long offset, void *dest, uint16_t size);
+
+/**
+@brief      Writes size bytes at offset without using or changing the file position.
+@return     0 if success, 9 if write error
+*/
+int8_t sort_parallel_write(ION_FILE *file, long offset, void *src, uint16_t size);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
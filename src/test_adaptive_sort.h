@@ -41,6 +41,8 @@
 #include "flash_minsort.h"
 #include "in_memory_sort.h"
 #include "adaptive_sort.h"
+#include "device_profile.h"
+#include "sort_metrics.h"
 
 /* Used to validate each individual input data item in the sorted output */
 // #define DATA_COMPARE    1
@@ -55,6 +57,19 @@ int cmpfunc (const void * a, const void * b) {
 
 int seed;
 
+/**
+ * Writes bytes of padding at end of block using record buffer (may be smaller than padding).
+ */
+void writeBlockPadding(ION_FILE *file, char *buffer, uint16_t record_size, uint16_t bytes)
+{
+    while (bytes > 0)
+    {
+        uint16_t len = bytes < record_size ? bytes : record_size;
+        fwrite(buffer, len, 1, file);
+        bytes -= len;
+    }
+}
+
 /**
  * Generates test data records
  */
@@ -125,7 +140,7 @@ external_sort_write_test_data(
         blockIndex++;
 
         /* Write out remainder of block (should be zeros but not worrying about that currently) */
-        fwrite(buffer, bytesAtEndOfBlock, 1, unsorted_file);
+        writeBlockPadding(unsorted_file, buffer, record_size, bytesAtEndOfBlock);
     }
    
     /* Write out last page. Write out header. */
@@ -166,7 +181,7 @@ external_sort_write_test_data(
             return 10;        
     }    
     /* Write out remainder of block (should be zeros but not worrying about that currently) */
-    fwrite(buffer, bytesAtEndOfBlock, 1, unsorted_file);
+    writeBlockPadding(unsorted_file, buffer, record_size, bytesAtEndOfBlock);
 
     #ifdef DATA_COMPARE     
    	qsort(sampleData, (uint32_t) num_values, sizeof(uint32_t), cmpfunc);			    
@@ -210,62 +225,50 @@ int fileRecordIterator(void* state, void* buffer, external_sort_t *es)
     fileState->recordsRead++;
     fileState->recordsLeftInBlock--;
 
-    /* Copy record from read buffer into tuple buffer */
-    memcpy(buffer, fileState->readBuffer+es->headerSize+fileState->currentRecord*es->record_size, (size_t) es->record_size);
+    /* Copy record from read buffer into tuple buffer. Variable length records are read from slotted pages (see sort_codec.h). */
+    if (es->codec == SORT_CODEC_SLOTTED)
+    {
+        sort_codec_cursor_t cursor;
+        sort_codec_rewind(&cursor);
+        sort_codec_read_at(es, (char*) fileState->readBuffer, &cursor, (int16_t) fileState->currentRecord, buffer);
+    }
+    else
+        memcpy(buffer, fileState->readBuffer+es->headerSize+fileState->currentRecord*es->record_size, (size_t) es->record_size);
     fileState->currentRecord++;
     return 1;
 }
 
 
 void testRawPerformance()
-{   /* Tests storage raw read and write performance */
+{   /* Tests storage raw read and write performance and saves device profile used by adaptive sort */
     ION_FILE *fp;
     fp = fopen("tmpfilec.bin", "w+b");
-
-    char buffer[512];
-    // Test time to write 1000 blocks
-    unsigned long startMillis = millis();
-
-    for (int i=0; i < 1000; i++)
-    {
-        if (0 == fwrite(buffer, 512, 1, fp))
-        {   printf("Write error.\n");             
-        }
+    if (NULL == fp)
+    {   printf("Error: Can't open file!\n");
+        return;
     }
-    printf("Write time: %lu\n", millis()-startMillis);
-    fflush(fp);
 
-    // Time to read 1000 blocks
-    fseek(fp, 0, SEEK_SET);
-    startMillis = millis();
-    for (int i=0; i < 1000; i++)
-    {
-        
-        if (0 == fread(buffer, 512, 1, fp))
-        {   printf("Read error.\n");             
-        }
+    char buffer[512];
+    device_profile_t profile;
+    int8_t err = device_profile_calibrate(fp, buffer, sizeof(buffer), 1000, &profile);
+    fclose(fp);
+    if (err != 0)
+    {   printf("Calibration error: %d\n", err);
+        return;
     }
-    printf("Read time: %lu\n", millis()-startMillis);
 
-    fseek(fp, 0, SEEK_SET);
-    // Time to read 1000 blocks randomly    
-    startMillis = millis();
-    srand(1);
-    for (int i=0; i < 1000; i++)
-    {
-        unsigned long num = rand() % 1000;         
-         fseek(fp, num*512 , SEEK_SET);
-        if (0 == fread(buffer, 512, 1, fp))
-        {   printf("Read error.\n");             
-        }
-    }
-    printf("Random Read time: %lu\n", millis()-startMillis);
+    device_profile_print(&profile);
+    if (device_profile_save(&profile, DEVICE_PROFILE_FILE_NAME) != 0)
+        printf("Error: Can't save device profile!\n");
+    device_profile_set_active(&profile);
 }
 
 void runalltests_adaptive_sort()
 {
     int8_t          numRuns = 3;
     metrics_t       metric[numRuns];
+    metrics_phase_t phases[8];      /* Per-phase breakdown of current run */
+    metrics_phase_log_t phaseLog;
     external_sort_t es;
 
     testRawPerformance();
@@ -290,15 +293,13 @@ void runalltests_adaptive_sort()
                 printf("--- Run Number %d ---\n", (r+1));
                 int buffer_max_pages = mem;
                     
-                metric[r].num_reads = 0;
-                metric[r].num_writes = 0;
-                metric[r].num_compar = 0;
-                metric[r].num_memcpys = 0;
-                metric[r].num_runs = 0;
+                metrics_phase_log_init(&phaseLog, phases, sizeof(phases) / sizeof(metrics_phase_t));
+                metrics_init(&metric[r], &phaseLog);
 
+                external_sort_init(&es);
                 es.key_size = sizeof(int32_t); 
+                es.key_type = SORT_KEY_TYPE_INT;
                 es.value_size = 12;
-                es.headerSize = BLOCK_HEADER_SIZE ;
                 es.record_size = es.key_size + es.value_size;
                 es.page_size = 512;
 
@@ -366,7 +367,7 @@ void runalltests_adaptive_sort()
                 #endif                    
                 
                 int8_t runGenOnly = 0;
-                int8_t writeReadRatio = 30;
+                int8_t writeReadRatio = ADAPTIVE_SORT_DEVICE_PROFILE;
                 int err = adaptive_sort(&fileRecordIterator, &iteratorState, tuple_buffer, outFilePtr, buffer, buffer_max_pages, &es, &result_file_ptr, &metric[r], merge_sort_int32_comparator, runGenOnly, writeReadRatio);
 
                 /* Close input data file */
@@ -463,6 +464,7 @@ void runalltests_adaptive_sort()
                 printf("Num Comparisons:%li\n", metric[r].num_compar);
                 printf("Num Memcpys:%li\n", metric[r].num_memcpys);
                 printf("Num Runs:%li\n", metric[r].num_runs);
+                metrics_print_phases(&phaseLog);
 
                 /* Clean up and print final result*/
                 free(buffer);
@@ -0,0 +1,145 @@
+/******************************************************************************/
+/**
+@file		test_key_order.c
+@author		Ramon Lawrence
+@brief		Checks that sorts return an error if the key descriptor and the
+            comparison function order records differently.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "test_adaptive_sort.h"
+#include "sort_metrics.h"
+
+/**
+ * Compares records with an int32_t key at the start in descending order.
+ */
+static int8_t compareDescending(void *a, void *b)
+{
+    return merge_sort_int32_comparator(b, a);
+}
+
+/**
+ * Sorts numRecords random records with int32_t keys at the start with a buffer of memoryPages pages of 512 bytes and
+ * comparison compareFn. The key type is SORT_KEY_TYPE_INT if keyType is true, otherwise it is not set. If stream is true,
+ * the sort is opened as a stream. Returns 0 if the error code of the sort is expected.
+ */
+static int runTest(const char *name, int memoryPages, int32_t numRecords, int8_t keyType, int8_t (*compareFn)(void *a, void *b),
+                   int8_t stream, int expected)
+{
+    external_sort_t es;
+    metrics_t       metric;
+    long            resultFilePtr = 0;
+    adaptive_sort_stream_t *s;
+    int             err;
+
+    external_sort_init(&es);
+    es.key_size         = sizeof(int32_t);
+    es.key_type         = keyType ? SORT_KEY_TYPE_INT : SORT_KEY_TYPE_NONE;
+    es.value_size       = 12;
+    es.record_size      = 16;
+    es.page_size        = 512;
+    es.compare_fcn      = compareFn;
+
+    int32_t valuesPerPage = (es.page_size - es.headerSize) / es.record_size;
+    es.num_pages = (uint32_t) (numRecords + valuesPerPage - 1) / valuesPerPage;
+
+    char *buffer = (char*) malloc((size_t) memoryPages * es.page_size + es.record_size);
+    ION_FILE *fp = fopen("test_in.bin", "w+b");
+    ION_FILE *outFp = fopen("test_out.bin", "w+b");
+    file_iterator_state_t iteratorState;
+    iteratorState.readBuffer = malloc(es.page_size);
+    if (buffer == NULL || fp == NULL || outFp == NULL || iteratorState.readBuffer == NULL)
+    {
+        printf("%s: Error: Out of memory or can't open files!\n", name);
+        return 1;
+    }
+    char *tupleBuffer = buffer + (size_t) memoryPages * es.page_size;
+
+    external_sort_write_test_data(fp, numRecords, es.record_size, 2, &es, 0, 1000000);
+    fflush(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    iteratorState.file = fp;
+    iteratorState.recordsRead = 0;
+    iteratorState.totalRecords = numRecords;
+    iteratorState.recordSize = es.record_size;
+    iteratorState.recordsLeftInBlock = 0;
+    iteratorState.currentRecord = 0;
+
+    metrics_init(&metric, NULL);
+    if (stream)
+    {
+        err = adaptive_sort_open(&s, &fileRecordIterator, &iteratorState, tupleBuffer, outFp, buffer, memoryPages, &es, &metric,
+                                 compareFn, 30);
+        if (err == 0)
+            adaptive_sort_close(s);
+    }
+    else
+        err = adaptive_sort(&fileRecordIterator, &iteratorState, tupleBuffer, outFp, buffer, memoryPages, &es, &resultFilePtr, &metric,
+                            compareFn, 0, 30);
+
+    int failed = err != expected;
+    printf("%s: M: %d  Records: %d  Error: %d  Expected: %d  %s\n", name, memoryPages, numRecords, err, expected, failed ? "FAILED" : "passed");
+
+    fclose(fp);
+    fclose(outFp);
+    remove("test_in.bin");
+    remove("test_out.bin");
+    free(iteratorState.readBuffer);
+    free(buffer);
+    return failed;
+}
+
+int main(void)
+{
+    int failures = 0;
+
+    srand(2020);
+
+    /* Key type and comparison agree */
+    failures += runTest("ascending", 4, 20000, 1, merge_sort_int32_comparator, 0, 0);
+
+    /* Comparison orders records only by compare_fcn as the key type is not set */
+    failures += runTest("descending no key type", 4, 20000, 0, compareDescending, 0, 0);
+
+    /* Key type orders records ascending and comparison descending */
+    failures += runTest("descending", 4, 20000, 1, compareDescending, 0, 11);
+    failures += runTest("descending", 16, 20000, 1, compareDescending, 0, 11);
+    failures += runTest("descending stream", 4, 20000, 1, compareDescending, 1, 11);
+
+    printf("%s\n", failures == 0 ? "All tests passed." : "Tests FAILED.");
+    return failures != 0;
+}
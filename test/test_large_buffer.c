@@ -0,0 +1,176 @@
+/******************************************************************************/
+/**
+@file		test_large_buffer.c
+@author		Ramon Lawrence
+@brief		Sorts with buffers of hundreds or thousands of pages, where counts of
+            blocks, merge tree leaves and heap records exceed int8_t or int16_t.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "test_adaptive_sort.h"
+#include "sort_metrics.h"
+
+/**
+ * Returns an order independent hash of numRecords records read from the pages of a file starting at pos, so the input and
+ * the sorted output have equal hashes only if they hold the same records. Returns 0 if fewer records could be read.
+ * Pages are read into page. If last is not NULL, it holds the previous record while checking that records are in sorted
+ * order and *ordered is set to 1 if they are.
+ */
+static uint64_t hashRecords(ION_FILE *fp, long pos, int32_t numRecords, char *page, char *last, external_sort_t *es, int8_t *ordered)
+{
+    uint64_t sum = 0, h;
+    int32_t  n = 0;
+    int16_t  count, i;
+    uint16_t b;
+    char     *rec;
+
+    *ordered = 1;
+    fseek(fp, pos, SEEK_SET);
+    while (n < numRecords && 1 == fread(page, es->page_size, 1, fp))
+    {
+        count = *((int16_t *) (page + BLOCK_COUNT_OFFSET));
+        for (i = 0; i < count && n < numRecords; i++, n++)
+        {
+            rec = page + es->headerSize + i*es->record_size;
+            if (last != NULL)
+            {
+                if (n > 0 && es->compare_fcn(last, rec) > 0)
+                    *ordered = 0;
+                memcpy(last, rec, es->record_size);
+            }
+            for (b = 0, h = 14695981039346656037ULL; b < es->record_size; b++)
+                h = (h ^ (uint8_t) rec[b]) * 1099511628211ULL;
+            sum += h ^ (h >> 29);
+        }
+    }
+    return n == numRecords ? sum : 0;
+}
+
+/**
+ * Sorts numRecords records with a buffer of memoryPages pages and checks the output holds the input records in sorted order.
+ * The first sortedRecords records are sorted, which should be a multiple of the records per page. Of the others, percentRandom
+ * percent are random and the rest ascending. Returns 0 if the test passed.
+ */
+static int runTest(const char *name, int memoryPages, uint16_t pageSize, uint16_t recordSize, int32_t numRecords, int32_t sortedRecords,
+                   int percentRandom, int8_t writeToReadRatio)
+{
+    external_sort_t es;
+    metrics_t       metric;
+    long            resultFilePtr = 0;
+    int8_t          ordered;
+    int             err;
+
+    external_sort_init(&es);
+    es.key_size         = sizeof(int32_t);
+    es.key_type         = SORT_KEY_TYPE_INT;
+    es.value_size       = recordSize - es.key_size;
+    es.record_size      = recordSize;
+    es.page_size        = pageSize;
+    es.compare_fcn      = merge_sort_int32_comparator;
+
+    int32_t valuesPerPage = (es.page_size - es.headerSize) / es.record_size;
+
+    char *buffer = (char*) malloc((size_t) memoryPages * es.page_size + 2 * es.record_size);
+    ION_FILE *fp = fopen("test_in.bin", "w+b");
+    ION_FILE *outFp = fopen("test_out.bin", "w+b");
+    file_iterator_state_t iteratorState;
+    iteratorState.readBuffer = malloc(es.page_size);
+    if (buffer == NULL || fp == NULL || outFp == NULL || iteratorState.readBuffer == NULL)
+    {
+        printf("%s: Error: Out of memory or can't open files!\n", name);
+        return 1;
+    }
+    char *tupleBuffer = buffer + (size_t) memoryPages * es.page_size;
+
+    if (sortedRecords > 0)
+    {
+        es.num_pages = (uint32_t) (sortedRecords + valuesPerPage - 1) / valuesPerPage;
+        external_sort_write_test_data(fp, sortedRecords, es.record_size, 0, &es, 0, 1000000);
+    }
+    es.num_pages = (uint32_t) (numRecords - sortedRecords + valuesPerPage - 1) / valuesPerPage;
+    external_sort_write_test_data(fp, numRecords - sortedRecords, es.record_size, percentRandom < 100 ? 3 : 2, &es, percentRandom, 1000000);
+    es.num_pages = (uint32_t) (numRecords + valuesPerPage - 1) / valuesPerPage;
+    fflush(fp);
+    uint64_t inputHash = hashRecords(fp, 0, numRecords, buffer, NULL, &es, &ordered);
+    fseek(fp, 0, SEEK_SET);
+
+    iteratorState.file = fp;
+    iteratorState.recordsRead = 0;
+    iteratorState.totalRecords = numRecords;
+    iteratorState.recordSize = es.record_size;
+    iteratorState.recordsLeftInBlock = 0;
+    iteratorState.currentRecord = 0;
+
+    metrics_init(&metric, NULL);
+    err = adaptive_sort(&fileRecordIterator, &iteratorState, tupleBuffer, outFp, buffer, memoryPages, &es, &resultFilePtr, &metric,
+                        merge_sort_int32_comparator, 0, writeToReadRatio);
+    uint64_t outputHash = err != 0 ? 0 : hashRecords(outFp, resultFilePtr, numRecords, buffer, tupleBuffer + es.record_size, &es, &ordered);
+
+    int failed = err != 0 || outputHash != inputHash || !ordered;
+    printf("%s: M: %d  Page size: %d  Record size: %d  Records: %d  Error: %d  Sorted: %d  Same records: %d  %s\n", name, memoryPages,
+            pageSize, recordSize, numRecords, err, ordered, outputHash == inputHash, failed ? "FAILED" : "passed");
+
+    fclose(fp);
+    fclose(outFp);
+    remove("test_in.bin");
+    remove("test_out.bin");
+    free(iteratorState.readBuffer);
+    free(buffer);
+    return failed;
+}
+
+int main(void)
+{
+    int failures = 0;
+
+    srand(2020);
+
+    /* Merge tree has more than 32767 nodes */
+    failures += runTest("merge tree", 9000, 128, 64, 60000, 0, 100, 30);
+
+    /* Run generation heap and fill hold more than 32767 records */
+    failures += runTest("heap", 9000, 128, 16, 70000, 0, 100, 30);
+
+    /* Natural run ends after the fill, so the blocks are filled again and the heap built from more than 32767 records */
+    failures += runTest("natural run", 9000, 128, 16, 140000, 63000, 100, 30);
+
+    /* Merge moves output records to a block after block 127 for this input. Writes cost as much as reads, so the runs are merged. */
+    srand(2020);
+    failures += runTest("relocation", 400, 64, 16, 400000, 0, 70, 1);
+
+    printf("%s\n", failures == 0 ? "All tests passed." : "Tests FAILED.");
+    return failures != 0;
+}
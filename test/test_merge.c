@@ -0,0 +1,197 @@
+/******************************************************************************/
+/**
+@file		test_merge.c
+@author		Ramon Lawrence
+@brief		Sorts records and tags no larger than the block header, where
+            merge passes move records between blocks of the buffer.
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "test_adaptive_sort.h"
+#include "sort_metrics.h"
+
+/**
+ * Compares records with an int8_t key at the start.
+ */
+static int8_t compareInt8(void *a, void *b)
+{
+    int8_t x = *((int8_t *) a), y = *((int8_t *) b);
+    return (int8_t) ((x > y) - (x < y));
+}
+
+/**
+ * Compares records with an int16_t key at the start.
+ */
+static int8_t compareInt16(void *a, void *b)
+{
+    int16_t x, y;
+    memcpy(&x, a, sizeof(int16_t));
+    memcpy(&y, b, sizeof(int16_t));
+    return (int8_t) ((x > y) - (x < y));
+}
+
+/**
+ * Returns an order independent hash of numRecords records read from the pages of a file starting at pos, so the input and
+ * the sorted output have equal hashes only if they hold the same records. Returns 0 if fewer records could be read.
+ * Pages are read into page. If last is not NULL, it holds the previous record while checking that records are in sorted
+ * order and *ordered is set to 1 if they are.
+ */
+static uint64_t hashRecords(ION_FILE *fp, long pos, int32_t numRecords, char *page, char *last, external_sort_t *es, int8_t *ordered)
+{
+    uint64_t sum = 0, h;
+    int32_t  n = 0;
+    int16_t  count, i;
+    uint16_t b;
+    char     *rec;
+
+    *ordered = 1;
+    fseek(fp, pos, SEEK_SET);
+    while (n < numRecords && 1 == fread(page, es->page_size, 1, fp))
+    {
+        count = *((int16_t *) (page + BLOCK_COUNT_OFFSET));
+        for (i = 0; i < count && n < numRecords; i++, n++)
+        {
+            rec = page + es->headerSize + i*es->record_size;
+            if (last != NULL)
+            {
+                if (n > 0 && es->compare_fcn(last, rec) > 0)
+                    *ordered = 0;
+                memcpy(last, rec, es->record_size);
+            }
+            for (b = 0, h = 14695981039346656037ULL; b < es->record_size; b++)
+                h = (h ^ (uint8_t) rec[b]) * 1099511628211ULL;
+            sum += h ^ (h >> 29);
+        }
+    }
+    return n == numRecords ? sum : 0;
+}
+
+/**
+ * Sorts numRecords random records with a buffer of memoryPages pages of 512 bytes and checks the output holds the input
+ * records in sorted order. The key is a signed integer of keySize bytes at the start of the record. Keys are less than
+ * 100 so they fit in any key size. If tag is true, the records are sorted with adaptive_sort_tag().
+ * Returns 0 if the test passed.
+ */
+static int runTest(const char *name, int memoryPages, uint16_t recordSize, uint8_t keySize, int32_t numRecords, int8_t tag)
+{
+    external_sort_t es;
+    metrics_t       metric;
+    long            resultFilePtr = 0;
+    int8_t          ordered;
+    int             err;
+
+    external_sort_init(&es);
+    es.key_size         = keySize;
+    es.key_type         = SORT_KEY_TYPE_INT;
+    es.value_size       = recordSize - es.key_size;
+    es.record_size      = recordSize;
+    es.page_size        = 512;
+    es.compare_fcn      = keySize == 1 ? compareInt8 : keySize == 2 ? compareInt16 : merge_sort_int32_comparator;
+
+    int32_t valuesPerPage = (es.page_size - es.headerSize) / es.record_size;
+    es.num_pages = (uint32_t) (numRecords + valuesPerPage - 1) / valuesPerPage;
+
+    char *buffer = (char*) malloc((size_t) memoryPages * es.page_size + 2 * es.record_size);
+    ION_FILE *fp = fopen("test_in.bin", "w+b");
+    ION_FILE *outFp = fopen("test_out.bin", "w+b");
+    file_iterator_state_t iteratorState;
+    iteratorState.readBuffer = malloc(es.page_size);
+    if (buffer == NULL || fp == NULL || outFp == NULL || iteratorState.readBuffer == NULL)
+    {
+        printf("%s: Error: Out of memory or can't open files!\n", name);
+        return 1;
+    }
+    char *tupleBuffer = buffer + (size_t) memoryPages * es.page_size;
+
+    /* Keys are written as int32_t, so the low bytes read as a shorter key on a little endian host hold the same value */
+    external_sort_write_test_data(fp, numRecords, es.record_size, 2, &es, 0, 100);
+    fflush(fp);
+    uint64_t inputHash = hashRecords(fp, 0, numRecords, buffer, NULL, &es, &ordered);
+    fseek(fp, 0, SEEK_SET);
+
+    iteratorState.file = fp;
+    iteratorState.recordsRead = 0;
+    iteratorState.totalRecords = numRecords;
+    iteratorState.recordSize = es.record_size;
+    iteratorState.recordsLeftInBlock = 0;
+    iteratorState.currentRecord = 0;
+
+    metrics_init(&metric, NULL);
+    if (tag)
+        err = adaptive_sort_tag(&fileRecordIterator, &iteratorState, tupleBuffer, outFp, buffer, memoryPages, &es, &resultFilePtr,
+                                &metric, es.compare_fcn, 30, 0);
+    else
+        err = adaptive_sort(&fileRecordIterator, &iteratorState, tupleBuffer, outFp, buffer, memoryPages, &es, &resultFilePtr, &metric,
+                            es.compare_fcn, 0, 30);
+    uint64_t outputHash = err != 0 ? 0 : hashRecords(outFp, resultFilePtr, numRecords, buffer, tupleBuffer + es.record_size, &es, &ordered);
+
+    int failed = err != 0 || outputHash != inputHash || !ordered;
+    printf("%s: M: %d  Record size: %d  Key size: %d  Records: %d  Error: %d  Sorted: %d  Same records: %d  %s\n", name, memoryPages,
+            recordSize, keySize, numRecords, err, ordered, outputHash == inputHash, failed ? "FAILED" : "passed");
+
+    fclose(fp);
+    fclose(outFp);
+    remove("test_in.bin");
+    remove("test_out.bin");
+    free(iteratorState.readBuffer);
+    free(buffer);
+    return failed;
+}
+
+int main(void)
+{
+    int failures = 0;
+
+    srand(2020);
+
+    /* Tags of an int8_t key are 5 bytes and of an int16_t key 6 bytes, so no larger than the block header */
+    failures += runTest("tag int8", 4, 16, 1, 20000, 1);
+    failures += runTest("tag int8", 8, 16, 1, 20000, 1);
+    failures += runTest("tag int16", 4, 16, 2, 20000, 1);
+    failures += runTest("tag int16", 8, 16, 2, 20000, 1);
+
+    /* Records of 4 to 7 bytes are no larger than the block header */
+    failures += runTest("record 4", 4, 4, 4, 20000, 0);
+    failures += runTest("record 5", 4, 5, 4, 20000, 0);
+    failures += runTest("record 5", 8, 5, 4, 20000, 0);
+    failures += runTest("record 6", 4, 6, 4, 20000, 0);
+    failures += runTest("record 6", 8, 6, 4, 20000, 0);
+    failures += runTest("record 7", 4, 7, 4, 20000, 0);
+    failures += runTest("record 7", 8, 7, 4, 20000, 0);
+
+    printf("%s\n", failures == 0 ? "All tests passed." : "Tests FAILED.");
+    return failures != 0;
+}
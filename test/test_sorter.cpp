@@ -0,0 +1,255 @@
+/******************************************************************************/
+/**
+@file		test_sorter.cpp
+@author		Ramon Lawrence
+@brief		Tests the C++ front end of adaptive sort (adaptive_sort.hpp).
+@copyright	Copyright 2020
+			The University of British Columbia,
+			IonDB Project Contributors (see AUTHORS.md)
+@par Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+@par 1.Redistributions of source code must retain the above copyright notice,
+	this list of conditions and the following disclaimer.
+
+@par 2.Redistributions in binary form must reproduce the above copyright notice,
+	this list of conditions and the following  disclaimer in the documentation
+	and/or other materials provided with the distribution.
+
+@par 3.Neither the name of the copyright holder nor the names of its contributors
+	may be used to endorse or promote products derived from this software without
+	specific prior written permission.
+
+@par THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "adaptive_sort.hpp"
+#include "sort_metrics.h"
+
+#define TEST_PAGE_SIZE      512
+#define TEST_MEMORY_PAGES   8
+
+typedef struct {
+    uint32_t    id;                 /* Input record number */
+    int32_t     key;
+    char        value[8];
+} test_sorter_record_t;
+
+struct descending {
+    bool operator()(int32_t a, int32_t b) const { return a > b; }
+};
+
+typedef adaptive::sorter<test_sorter_record_t, ADAPTIVE_SORT_KEY(test_sorter_record_t, key)> ascending_sorter;
+typedef adaptive::sorter<test_sorter_record_t, ADAPTIVE_SORT_KEY(test_sorter_record_t, key), descending> descending_sorter;
+
+static int32_t  keys[20000];        /* Key of each input record by id */
+static uint8_t  seen[20000];
+static char     buffer[TEST_MEMORY_PAGES * TEST_PAGE_SIZE];
+
+/**
+ * Writes numRecords records with random keys to the pages of a file.
+ */
+template <class Sorter>
+static void writeInput(ION_FILE *fp, int32_t numRecords)
+{
+    char    page[TEST_PAGE_SIZE];
+    int32_t written = 0, blockIndex = 0;
+    int16_t count;
+
+    fseek(fp, 0, SEEK_SET);
+    while (written < numRecords)
+    {
+        count = numRecords - written < Sorter::records_per_page ? (int16_t) (numRecords - written) : Sorter::records_per_page;
+        memset(page, 0, TEST_PAGE_SIZE);
+        memcpy(page, &blockIndex, sizeof(int32_t));
+        memcpy(page + BLOCK_COUNT_OFFSET, &count, sizeof(int16_t));
+        for (int16_t i = 0; i < count; i++, written++)
+        {
+            test_sorter_record_t rec;
+            rec.id  = (uint32_t) written;
+            rec.key = keys[written] = rand() % 5000 - 2500;
+            memset(rec.value, (char) written, sizeof(rec.value));
+            memcpy(page + Sorter::header_size + i * sizeof(rec), &rec, sizeof(rec));
+        }
+        fwrite(page, TEST_PAGE_SIZE, 1, fp);
+        blockIndex++;
+    }
+    fflush(fp);
+    fseek(fp, 0, SEEK_SET);
+}
+
+/**
+ * Checks the next record of sorted output. Records must follow the order of Compare, be input records with their
+ * keys and values intact and not be output twice. Returns 1 if the record is correct.
+ */
+template <class Compare>
+static int checkRecord(const test_sorter_record_t *rec, const test_sorter_record_t *last, int32_t numInput)
+{
+    Compare before;
+    char    value[8];
+
+    if (rec->id >= (uint32_t) numInput || seen[rec->id] || rec->key != keys[rec->id])
+        return 0;
+    memset(value, (char) rec->id, sizeof(value));
+    if (memcmp(value, rec->value, sizeof(value)) != 0)
+        return 0;
+    if (last != NULL && before(rec->key, last->key))
+        return 0;
+    seen[rec->id] = 1;
+    return 1;
+}
+
+/**
+ * Reads the sorted output written at pos and checks that it holds numOutput records. Returns 1 if the output is correct.
+ */
+template <class Sorter, class Compare>
+static int checkOutput(ION_FILE *fp, long pos, int32_t numInput, int32_t numOutput)
+{
+    char                    page[TEST_PAGE_SIZE];
+    test_sorter_record_t    rec, last;
+    int32_t                 n = 0;
+    int16_t                 count;
+
+    memset(seen, 0, sizeof(seen));
+    fseek(fp, pos, SEEK_SET);
+    while (n < numOutput && 1 == fread(page, TEST_PAGE_SIZE, 1, fp))
+    {
+        memcpy(&count, page + BLOCK_COUNT_OFFSET, sizeof(int16_t));
+        for (int16_t i = 0; i < count && n < numOutput; i++, n++)
+        {
+            memcpy(&rec, page + Sorter::header_size + i * sizeof(rec), sizeof(rec));
+            if (!checkRecord<Compare>(&rec, n > 0 ? &last : NULL, numInput))
+                return 0;
+            last = rec;
+        }
+    }
+    return n == numOutput;
+}
+
+/**
+ * Returns the number of input records with a key less than key.
+ */
+static int32_t countLess(int32_t key, int32_t numInput)
+{
+    int32_t n = 0;
+    for (int32_t i = 0; i < numInput; i++)
+        n += keys[i] < key;
+    return n;
+}
+
+/**
+ * Sorts numRecords records with sort(), sort_tag() and open()/next()/close() of Sorter ordered by Compare and with
+ * sort_limit() if ordered by key. Returns the number of failed tests.
+ */
+template <class Sorter, class Compare>
+static int runTests(const char *name, int32_t numRecords, int32_t limit)
+{
+    static Sorter   sorter;
+    metrics_t       metric;
+    long            resultFilePtr;
+    int             failures = 0, ok;
+    ION_FILE        *fp = fopen("test_in.bin", "w+b");
+    ION_FILE        *outFp = fopen("test_out.bin", "w+b");
+
+    if (fp == NULL || outFp == NULL)
+    {
+        printf("%s: Error: Can't open files!\n", name);
+        return 1;
+    }
+
+    writeInput<Sorter>(fp, numRecords);
+    metrics_init(&metric, NULL);
+    ok = !sorter.is_sorted(fp, (uint32_t) numRecords, buffer, &metric) || numRecords < 2;
+    resultFilePtr = 0;
+    ok = ok && 0 == sorter.sort(fp, (uint32_t) numRecords, outFp, buffer, TEST_MEMORY_PAGES, &resultFilePtr, &metric)
+            && checkOutput<Sorter, Compare>(outFp, resultFilePtr, numRecords, numRecords);
+    printf("%s sort: Records: %d  %s\n", name, numRecords, ok ? "passed" : "FAILED");
+    failures += !ok;
+
+    fseek(fp, 0, SEEK_SET);
+    metrics_init(&metric, NULL);
+    resultFilePtr = 0;
+    ok = 0 == sorter.sort_tag(fp, (uint32_t) numRecords, outFp, buffer, TEST_MEMORY_PAGES, &resultFilePtr, &metric)
+            && checkOutput<Sorter, Compare>(outFp, resultFilePtr, numRecords, numRecords);
+    printf("%s sort_tag: Records: %d  %s\n", name, numRecords, ok ? "passed" : "FAILED");
+    failures += !ok;
+
+    /* Limit only applies to the key order, so the smallest limit records are checked against the input keys */
+    if (limit > 0)
+    {
+        test_sorter_record_t last;
+        char                 page[TEST_PAGE_SIZE];
+
+        fseek(fp, 0, SEEK_SET);
+        metrics_init(&metric, NULL);
+        resultFilePtr = 0;
+        ok = 0 == sorter.sort_limit(fp, (uint32_t) numRecords, outFp, buffer, TEST_MEMORY_PAGES, &resultFilePtr, &metric, limit)
+                && checkOutput<Sorter, Compare>(outFp, resultFilePtr, numRecords, limit);
+        if (ok)
+        {   /* Last record output has the largest key of the limit smallest records */
+            fseek(outFp, resultFilePtr + (long) ((limit - 1) / Sorter::records_per_page) * TEST_PAGE_SIZE, SEEK_SET);
+            ok = 1 == fread(page, TEST_PAGE_SIZE, 1, outFp);
+            memcpy(&last, page + Sorter::header_size + ((limit - 1) % Sorter::records_per_page) * sizeof(last), sizeof(last));
+            ok = ok && countLess(last.key, numRecords) < limit && countLess(last.key + 1, numRecords) >= limit;
+        }
+        printf("%s sort_limit: Records: %d  Limit: %d  %s\n", name, numRecords, limit, ok ? "passed" : "FAILED");
+        failures += !ok;
+    }
+
+    test_sorter_record_t rec, last;
+    int32_t n = 0;
+
+    fseek(fp, 0, SEEK_SET);
+    metrics_init(&metric, NULL);
+    memset(seen, 0, sizeof(seen));
+    ok = 0 == sorter.open(fp, (uint32_t) numRecords, outFp, buffer, TEST_MEMORY_PAGES, &metric);
+    while (ok && sorter.next(rec))
+    {
+        ok = checkRecord<Compare>(&rec, n > 0 ? &last : NULL, numRecords);
+        last = rec;
+        n++;
+    }
+    ok = 0 == sorter.close() && ok && n == numRecords;
+    printf("%s open/next/close: Records: %d  %s\n", name, numRecords, ok ? "passed" : "FAILED");
+    failures += !ok;
+
+    fclose(fp);
+    fclose(outFp);
+    remove("test_in.bin");
+    remove("test_out.bin");
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+
+    srand(2020);
+
+    failures += runTests<ascending_sorter, adaptive::less<int32_t> >("ascending", 1, 1);
+    failures += runTests<ascending_sorter, adaptive::less<int32_t> >("ascending", 1000, 100);
+    failures += runTests<ascending_sorter, adaptive::less<int32_t> >("ascending", 20000, 1500);
+
+    /* Other orders use only the record comparison */
+    failures += runTests<descending_sorter, descending>("descending", 1000, 0);
+    failures += runTests<descending_sorter, descending>("descending", 20000, 0);
+
+    printf("%s\n", failures == 0 ? "All tests passed." : "Tests FAILED.");
+    return failures != 0;
+}